@@ -0,0 +1,148 @@
+#pragma once
+
+// Std. Includes
+#include <iostream>
+#include <string>
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "ProgramCache.h"
+
+// A program whose compile and link are only submitted. Nothing queries GL_COMPILE_STATUS or
+// GL_LINK_STATUS until the program is first used, so the driver can build all programs in the
+// background (KHR/ARB_parallel_shader_compile) while models and textures load. The program name
+// is valid right away; GL calls on it before Finish() simply wait for the link.
+class AsyncProgram
+{
+public:
+	AsyncProgram() : program(0), vertex(0), fragment(0), pending(false)
+	{
+	}
+
+	GLuint Submit(const std::string &vertexCode, const std::string &fragmentCode, const std::string &defines = "", const std::string &label = "")
+	{
+		enableParallelCompile();
+		this->label = label;
+
+		// A cached binary is already linked, nothing left to wait for
+		ProgramCache &cache = ProgramCache::Get();
+		this->key = cache.MakeKey(vertexCode, fragmentCode, defines);
+		this->program = cache.Load(this->key);
+		if (this->program != 0)
+		{
+			this->pending = false;
+			return this->program;
+		}
+
+		this->vertex = submitStage(GL_VERTEX_SHADER, vertexCode);
+		this->fragment = submitStage(GL_FRAGMENT_SHADER, fragmentCode);
+		this->program = glCreateProgram();
+		glAttachShader(this->program, this->vertex);
+		glAttachShader(this->program, this->fragment);
+		cache.PrepareForRetrieval(this->program);
+		glLinkProgram(this->program);
+		this->pending = true;
+		return this->program;
+	}
+
+	// Non-blocking where the driver compiles in parallel; otherwise there's no way to ask, so true
+	bool IsReady() const
+	{
+		if (!this->pending || !parallelCompile())
+		{
+			return true;
+		}
+		GLint done = GL_FALSE;
+		glGetProgramiv(this->program, GL_COMPLETION_STATUS_KHR, &done);
+		return done == GL_TRUE;
+	}
+
+	// Waits for the link, reports errors and stores the binary. Cheap once done.
+	GLuint Finish()
+	{
+		if (!this->pending)
+		{
+			return this->program;
+		}
+		this->pending = false;
+
+		GLint success;
+		GLchar infoLog[512];
+		glGetShaderiv(this->vertex, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			glGetShaderInfoLog(this->vertex, 512, NULL, infoLog);
+			std::cerr << "ERROR::SHADER::VERTEX::COMPILATION_FAILED " << this->label << "\n" << infoLog << std::endl;
+		}
+		glGetShaderiv(this->fragment, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			glGetShaderInfoLog(this->fragment, 512, NULL, infoLog);
+			std::cerr << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED " << this->label << "\n" << infoLog << std::endl;
+		}
+		glGetProgramiv(this->program, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			glGetProgramInfoLog(this->program, 512, NULL, infoLog);
+			std::cerr << "ERROR::SHADER::PROGRAM::LINKING_FAILED " << this->label << "\n" << infoLog << std::endl;
+		}
+		else
+		{
+			ProgramCache::Get().Store(this->key, this->program);
+		}
+		// Linked into the program, no longer needed
+		glDeleteShader(this->vertex);
+		glDeleteShader(this->fragment);
+		this->vertex = this->fragment = 0;
+		return this->program;
+	}
+
+	void Use()
+	{
+		glUseProgram(this->Finish());
+	}
+
+	GLuint GetProgram() const
+	{
+		return this->program;
+	}
+
+private:
+	GLuint program, vertex, fragment;
+	bool pending;
+	std::string key, label;
+
+	static bool parallelCompile()
+	{
+		return GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+	}
+
+	// Let the driver use as many compiler threads as it likes (the default may be 0 or 1)
+	static void enableParallelCompile()
+	{
+		static bool done = false;
+		if (done)
+		{
+			return;
+		}
+		done = true;
+		if (GLEW_KHR_parallel_shader_compile)
+		{
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		}
+		else if (GLEW_ARB_parallel_shader_compile)
+		{
+			glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+		}
+	}
+
+	static GLuint submitStage(GLenum type, const std::string &code)
+	{
+		const GLchar *source = code.c_str();
+		GLuint shader = glCreateShader(type);
+		glShaderSource(shader, 1, &source, NULL);
+		glCompileShader(shader);
+		return shader;
+	}
+};
@@ -0,0 +1,484 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ATMOSPHERE_USE_SSE 1
+#endif
+
+#include "Parallel.h"
+
+// RGB radiance padded to four lanes so the scattering integrals run on SSE registers.
+// Falls back to glm::vec3 when SSE2 is not available.
+#ifdef ATMOSPHERE_USE_SSE
+struct Spectrum
+{
+	__m128 v;
+
+	Spectrum() : v(_mm_setzero_ps()) {}
+	explicit Spectrum(float s) : v(_mm_set1_ps(s)) {}
+	Spectrum(float r, float g, float b) : v(_mm_set_ps(0.0f, b, g, r)) {}
+	Spectrum(__m128 x) : v(x) {}
+
+	Spectrum operator+(const Spectrum &o) const { return _mm_add_ps(v, o.v); }
+	Spectrum operator-(const Spectrum &o) const { return _mm_sub_ps(v, o.v); }
+	Spectrum operator*(const Spectrum &o) const { return _mm_mul_ps(v, o.v); }
+	Spectrum operator/(const Spectrum &o) const { return _mm_div_ps(v, o.v); }
+	Spectrum operator*(float s) const { return _mm_mul_ps(v, _mm_set1_ps(s)); }
+	Spectrum &operator+=(const Spectrum &o) { v = _mm_add_ps(v, o.v); return *this; }
+	Spectrum &operator*=(const Spectrum &o) { v = _mm_mul_ps(v, o.v); return *this; }
+
+	glm::vec3 ToVec3() const
+	{
+		alignas(16) float f[4];
+		_mm_store_ps(f, v);
+		return glm::vec3(f[0], f[1], f[2]);
+	}
+};
+
+inline Spectrum SpectrumMax(const Spectrum &a, const Spectrum &b) { return _mm_max_ps(a.v, b.v); }
+
+inline Spectrum SpectrumExp(const Spectrum &s)
+{
+	alignas(16) float f[4];
+	_mm_store_ps(f, s.v);
+	return Spectrum(std::exp(f[0]), std::exp(f[1]), std::exp(f[2]));
+}
+#else
+struct Spectrum
+{
+	glm::vec3 v;
+
+	Spectrum() : v(0.0f) {}
+	explicit Spectrum(float s) : v(s) {}
+	Spectrum(float r, float g, float b) : v(r, g, b) {}
+	Spectrum(const glm::vec3 &x) : v(x) {}
+
+	Spectrum operator+(const Spectrum &o) const { return v + o.v; }
+	Spectrum operator-(const Spectrum &o) const { return v - o.v; }
+	Spectrum operator*(const Spectrum &o) const { return v * o.v; }
+	Spectrum operator/(const Spectrum &o) const { return v / o.v; }
+	Spectrum operator*(float s) const { return v * s; }
+	Spectrum &operator+=(const Spectrum &o) { v += o.v; return *this; }
+	Spectrum &operator*=(const Spectrum &o) { v *= o.v; return *this; }
+
+	glm::vec3 ToVec3() const { return v; }
+};
+
+inline Spectrum SpectrumMax(const Spectrum &a, const Spectrum &b) { return glm::max(a.v, b.v); }
+inline Spectrum SpectrumExp(const Spectrum &s) { return glm::exp(s.v); }
+#endif
+
+// Earth-like atmosphere (Hillaire 2020). Distances in km, sun illuminance = 1.
+// Precomputes the transmittance, multiple-scattering and sky-view lookup tables on the CPU
+// so the sky shader and the sun light colour only need a texture fetch / table lookup.
+class Atmosphere
+{
+public:
+	Atmosphere() : skyTexture(0) {}
+
+	// Loads the tables from cachePath if it matches the current layout, otherwise precomputes them and writes the cache
+	void Load(const std::string &cachePath)
+	{
+		if (!this->loadCache(cachePath))
+		{
+			this->precompute();
+			this->saveCache(cachePath);
+		}
+		this->upload();
+	}
+
+	// 3D sky-view table: x = view elevation, y = sun elevation, z = relative azimuth
+	GLuint GetSkyTexture() const
+	{
+		return this->skyTexture;
+	}
+
+	float GetExposure() const
+	{
+		return SKY_EXPOSURE;
+	}
+
+	// Sun colour reaching the ground, scaled so the noon sun is roughly 1
+	glm::vec3 GetSunLight(const glm::vec3 &sunDir) const
+	{
+		return this->transmittance(R_GROUND + VIEW_HEIGHT, glm::clamp(sunDir.y, -1.0f, 1.0f)).ToVec3() * SUN_LIGHT_SCALE;
+	}
+
+	// Cosine-weighted sky irradiance (already exposed) for the ambient term of the model shader
+	glm::vec3 GetSkyAmbient(const glm::vec3 &sunDir) const
+	{
+		float x = (glm::clamp(sunDir.y, -1.0f, 1.0f) * 0.5f + 0.5f) * (AMBIENT_SIZE - 1);
+		int i0 = std::min((int)x, AMBIENT_SIZE - 2);
+		float f = x - i0;
+		return glm::mix(this->ambientLut[i0], this->ambientLut[i0 + 1], f);
+	}
+
+private:
+	// Table layout
+	static const int TRANSMITTANCE_W = 256;
+	static const int TRANSMITTANCE_H = 64;
+	static const int MS_SIZE = 32;
+	static const int SKY_MU = 64;
+	static const int SKY_MUS = 64;
+	static const int SKY_PHI = 16;
+	static const int AMBIENT_SIZE = 64;
+	static const uint32_t CACHE_VERSION = 1;
+
+	// Planet and medium
+	static constexpr float R_GROUND = 6360.0f;
+	static constexpr float R_TOP = 6460.0f;
+	static constexpr float VIEW_HEIGHT = 0.2f;
+	static constexpr float RAYLEIGH_H = 8.0f;
+	static constexpr float MIE_H = 1.2f;
+	static constexpr float MIE_G = 0.8f;
+	static constexpr float GROUND_ALBEDO = 0.3f;
+	static constexpr float SKY_EXPOSURE = 24.0f;
+	static constexpr float SUN_LIGHT_SCALE = 1.15f;
+	static constexpr float AMBIENT_SCALE = 0.35f;
+	static constexpr float PI = 3.14159265359f;
+
+	GLuint skyTexture;
+	std::vector<glm::vec3> transmittanceLut;
+	std::vector<glm::vec3> multiScatterLut;
+	std::vector<glm::vec3> skyLut;
+	std::vector<glm::vec3> ambientLut;
+
+	static Spectrum rayleighScattering() { return Spectrum(5.802e-3f, 13.558e-3f, 33.1e-3f); }
+	static Spectrum ozoneAbsorption() { return Spectrum(0.650e-3f, 1.881e-3f, 0.085e-3f); }
+	static float mieScattering() { return 3.996e-3f; }
+	static float mieExtinction() { return 3.996e-3f + 4.40e-3f; }
+
+	struct Medium
+	{
+		Spectrum rayleigh;	// Rayleigh scattering
+		float mie;			// Mie scattering
+		Spectrum extinction;
+	};
+
+	static Medium sampleMedium(float r)
+	{
+		float h = std::max(r - R_GROUND, 0.0f);
+		float dR = std::exp(-h / RAYLEIGH_H);
+		float dM = std::exp(-h / MIE_H);
+		float dO = std::max(0.0f, 1.0f - std::abs(h - 25.0f) / 15.0f);
+
+		Medium m;
+		m.rayleigh = rayleighScattering() * dR;
+		m.mie = mieScattering() * dM;
+		m.extinction = m.rayleigh + Spectrum(mieExtinction() * dM) + ozoneAbsorption() * dO;
+		return m;
+	}
+
+	static float distanceToTop(float r, float mu)
+	{
+		float disc = r * r * (mu * mu - 1.0f) + R_TOP * R_TOP;
+		return std::max(0.0f, -r * mu + std::sqrt(std::max(disc, 0.0f)));
+	}
+
+	static bool hitsGround(float r, float mu)
+	{
+		return mu < 0.0f && r * r * (mu * mu - 1.0f) + R_GROUND * R_GROUND >= 0.0f;
+	}
+
+	static float distanceToGround(float r, float mu)
+	{
+		float disc = r * r * (mu * mu - 1.0f) + R_GROUND * R_GROUND;
+		return std::max(0.0f, -r * mu - std::sqrt(std::max(disc, 0.0f)));
+	}
+
+	// Sky-view parameterisation: more texels near the horizon
+	static float decodeViewMu(float u)
+	{
+		float s = 2.0f * u - 1.0f;
+		return s < 0.0f ? -s * s : s * s;
+	}
+
+	// Bilinear lookup in the transmittance table
+	Spectrum transmittance(float r, float mu) const
+	{
+		float x = (mu * 0.5f + 0.5f) * (TRANSMITTANCE_W - 1);
+		float y = glm::clamp((r - R_GROUND) / (R_TOP - R_GROUND), 0.0f, 1.0f) * (TRANSMITTANCE_H - 1);
+		return this->bilinear(this->transmittanceLut, TRANSMITTANCE_W, TRANSMITTANCE_H, x, y);
+	}
+
+	Spectrum multiScatter(float r, float mus) const
+	{
+		float x = glm::clamp((mus * 0.5f + 0.5f) * MS_SIZE - 0.5f, 0.0f, (float)(MS_SIZE - 1));
+		float y = glm::clamp((r - R_GROUND) / (R_TOP - R_GROUND) * MS_SIZE - 0.5f, 0.0f, (float)(MS_SIZE - 1));
+		return this->bilinear(this->multiScatterLut, MS_SIZE, MS_SIZE, x, y);
+	}
+
+	static Spectrum bilinear(const std::vector<glm::vec3> &lut, int w, int h, float x, float y)
+	{
+		x = glm::clamp(x, 0.0f, (float)(w - 1));
+		y = glm::clamp(y, 0.0f, (float)(h - 1));
+		int x0 = std::min((int)x, w - 2), y0 = std::min((int)y, h - 2);
+		float fx = x - x0, fy = y - y0;
+		glm::vec3 a = glm::mix(lut[y0 * w + x0], lut[y0 * w + x0 + 1], fx);
+		glm::vec3 b = glm::mix(lut[(y0 + 1) * w + x0], lut[(y0 + 1) * w + x0 + 1], fx);
+		glm::vec3 c = glm::mix(a, b, fy);
+		return Spectrum(c.r, c.g, c.b);
+	}
+
+	void precompute()
+	{
+		std::cerr << "Precomputing atmospheric scattering tables..." << std::endl;
+
+		// 1. Transmittance to the top of the atmosphere
+		this->transmittanceLut.assign(TRANSMITTANCE_W * TRANSMITTANCE_H, glm::vec3(0.0f));
+		ParallelFor(0, TRANSMITTANCE_H, [&](int j)
+		{
+			float r = R_GROUND + (R_TOP - R_GROUND) * j / (TRANSMITTANCE_H - 1);
+			for (int i = 0; i < TRANSMITTANCE_W; i++)
+			{
+				float mu = -1.0f + 2.0f * i / (TRANSMITTANCE_W - 1);
+				if (hitsGround(r, mu))
+				{
+					continue;
+				}
+				const int STEPS = 40;
+				float dt = distanceToTop(r, mu) / STEPS;
+				Spectrum depth;
+				for (int s = 0; s < STEPS; s++)
+				{
+					float t = (s + 0.5f) * dt;
+					float rs = std::sqrt(t * t + 2.0f * r * mu * t + r * r);
+					depth += sampleMedium(rs).extinction * dt;
+				}
+				this->transmittanceLut[j * TRANSMITTANCE_W + i] = SpectrumExp(depth * -1.0f).ToVec3();
+			}
+		});
+
+		// 2. Multiple-scattering contribution (isotropic, infinite orders in closed form)
+		this->multiScatterLut.assign(MS_SIZE * MS_SIZE, glm::vec3(0.0f));
+		ParallelFor(0, MS_SIZE, [&](int j)
+		{
+			float r = R_GROUND + (R_TOP - R_GROUND) * (j + 0.5f) / MS_SIZE;
+			for (int i = 0; i < MS_SIZE; i++)
+			{
+				float mus = -1.0f + 2.0f * (i + 0.5f) / MS_SIZE;
+				glm::vec3 sunDir(std::sqrt(std::max(0.0f, 1.0f - mus * mus)), mus, 0.0f);
+				this->multiScatterLut[j * MS_SIZE + i] = this->integrateMultiScatter(r, sunDir).ToVec3();
+			}
+		}, 2);
+
+		// 3. Sky-view radiance seen from the ground
+		this->skyLut.assign(SKY_MU * SKY_MUS * SKY_PHI, glm::vec3(0.0f));
+		ParallelFor(0, SKY_PHI * SKY_MUS, [&](int row)
+		{
+			int c = row / SKY_MUS, b = row % SKY_MUS;
+			float mus = -1.0f + 2.0f * b / (SKY_MUS - 1);
+			float phi = PI * c / (SKY_PHI - 1);
+			float sinS = std::sqrt(std::max(0.0f, 1.0f - mus * mus));
+			glm::vec3 sunDir(sinS * std::cos(phi), mus, sinS * std::sin(phi));
+			for (int a = 0; a < SKY_MU; a++)
+			{
+				float mu = decodeViewMu((float)a / (SKY_MU - 1));
+				glm::vec3 viewDir(std::sqrt(std::max(0.0f, 1.0f - mu * mu)), mu, 0.0f);
+				this->skyLut[row * SKY_MU + a] = this->integrateSky(viewDir, sunDir).ToVec3();
+			}
+		}, 4);
+
+		// 4. Ambient irradiance per sun elevation
+		this->ambientLut.assign(AMBIENT_SIZE, glm::vec3(0.0f));
+		ParallelFor(0, AMBIENT_SIZE, [&](int k)
+		{
+			float mus = -1.0f + 2.0f * k / (AMBIENT_SIZE - 1);
+			int b = std::min(SKY_MUS - 1, (int)std::round((mus * 0.5f + 0.5f) * (SKY_MUS - 1)));
+			const int N = 16;
+			glm::vec3 E(0.0f);
+			for (int i = 0; i < N; i++)
+			{
+				float mu = (i + 0.5f) / N;
+				int a = std::min(SKY_MU - 1, (int)std::round((0.5f + 0.5f * std::sqrt(mu)) * (SKY_MU - 1)));
+				for (int c = 0; c < SKY_PHI; c++)
+				{
+					E += this->skyLut[(c * SKY_MUS + b) * SKY_MU + a] * mu;
+				}
+			}
+			// dw = dmu * dphi, both azimuth halves are symmetric
+			E *= 2.0f * (1.0f / N) * (PI / SKY_PHI);
+			glm::vec3 L = E / PI * SKY_EXPOSURE;
+			this->ambientLut[k] = (glm::vec3(1.0f) - glm::exp(-L)) * AMBIENT_SCALE;
+		});
+	}
+
+	Spectrum integrateMultiScatter(float r, const glm::vec3 &sunDir) const
+	{
+		const int DIRS = 8;
+		const int STEPS = 20;
+		const float isotropic = 1.0f / (4.0f * PI);
+		glm::vec3 origin(0.0f, r, 0.0f);
+
+		Spectrum L2, fms;
+		for (int k = 0; k < DIRS * DIRS; k++)
+		{
+			float cosT = 1.0f - 2.0f * ((k / DIRS) + 0.5f) / DIRS;
+			float ph = 2.0f * PI * ((k % DIRS) + 0.5f) / DIRS;
+			float sinT = std::sqrt(std::max(0.0f, 1.0f - cosT * cosT));
+			glm::vec3 dir(sinT * std::cos(ph), cosT, sinT * std::sin(ph));
+
+			bool ground = hitsGround(r, dir.y);
+			float dist = ground ? distanceToGround(r, dir.y) : distanceToTop(r, dir.y);
+			float dt = dist / STEPS;
+
+			Spectrum T(1.0f), L, f;
+			for (int s = 0; s < STEPS; s++)
+			{
+				glm::vec3 p = origin + dir * ((s + 0.5f) * dt);
+				float rs = glm::length(p);
+				Medium m = sampleMedium(rs);
+				Spectrum scat = m.rayleigh + Spectrum(m.mie);
+				Spectrum ext = SpectrumMax(m.extinction, Spectrum(1e-7f));
+				Spectrum stepT = SpectrumExp(ext * -dt);
+				Spectrum integ = (Spectrum(1.0f) - stepT) / ext;
+
+				Spectrum sunT = this->transmittance(rs, glm::dot(p / rs, sunDir));
+				L += T * scat * sunT * isotropic * integ;
+				f += T * scat * integ;
+				T *= stepT;
+			}
+
+			if (ground)
+			{
+				glm::vec3 p = origin + dir * dist;
+				float mu = glm::dot(glm::normalize(p), sunDir);
+				L += T * this->transmittance(R_GROUND, mu) * (std::max(mu, 0.0f) * GROUND_ALBEDO / PI);
+			}
+
+			L2 += L;
+			fms += f;
+		}
+
+		float inv = 1.0f / (DIRS * DIRS);
+		L2 = L2 * inv;
+		fms = fms * (inv * 4.0f * PI * isotropic);
+		return L2 / SpectrumMax(Spectrum(1.0f) - fms, Spectrum(1e-3f));
+	}
+
+	Spectrum integrateSky(const glm::vec3 &viewDir, const glm::vec3 &sunDir) const
+	{
+		const int STEPS = 40;
+		float r = R_GROUND + VIEW_HEIGHT;
+		glm::vec3 origin(0.0f, r, 0.0f);
+
+		float nu = glm::dot(viewDir, sunDir);
+		float phaseR = 3.0f / (16.0f * PI) * (1.0f + nu * nu);
+		float g2 = MIE_G * MIE_G;
+		float phaseM = 3.0f / (8.0f * PI) * ((1.0f - g2) * (1.0f + nu * nu)) /
+			((2.0f + g2) * std::pow(1.0f + g2 - 2.0f * MIE_G * nu, 1.5f));
+
+		float dist = hitsGround(r, viewDir.y) ? distanceToGround(r, viewDir.y) : distanceToTop(r, viewDir.y);
+		float dt = dist / STEPS;
+
+		Spectrum T(1.0f), L;
+		for (int s = 0; s < STEPS; s++)
+		{
+			glm::vec3 p = origin + viewDir * ((s + 0.5f) * dt);
+			float rs = glm::length(p);
+			float mus = glm::dot(p / rs, sunDir);
+			Medium m = sampleMedium(rs);
+			Spectrum scat = m.rayleigh + Spectrum(m.mie);
+			Spectrum ext = SpectrumMax(m.extinction, Spectrum(1e-7f));
+			Spectrum stepT = SpectrumExp(ext * -dt);
+
+			Spectrum S = (m.rayleigh * phaseR + Spectrum(m.mie * phaseM)) * this->transmittance(rs, mus)
+				+ scat * this->multiScatter(rs, mus);
+			L += T * S * ((Spectrum(1.0f) - stepT) / ext);
+			T *= stepT;
+		}
+		return L;
+	}
+
+	struct CacheHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t dims[7];
+	};
+
+	static CacheHeader makeHeader()
+	{
+		CacheHeader h;
+		std::memcpy(h.magic, "ATMO", 4);
+		h.version = CACHE_VERSION;
+		uint32_t dims[7] = { TRANSMITTANCE_W, TRANSMITTANCE_H, MS_SIZE, SKY_MU, SKY_MUS, SKY_PHI, AMBIENT_SIZE };
+		std::memcpy(h.dims, dims, sizeof(dims));
+		return h;
+	}
+
+	bool loadCache(const std::string &path)
+	{
+		std::ifstream in(path, std::ios::binary);
+		if (!in)
+		{
+			return false;
+		}
+
+		CacheHeader expected = makeHeader(), h;
+		in.read((char *)&h, sizeof(h));
+		if (!in || std::memcmp(&h, &expected, sizeof(h)) != 0)
+		{
+			return false;
+		}
+
+		this->transmittanceLut.resize(TRANSMITTANCE_W * TRANSMITTANCE_H);
+		this->skyLut.resize(SKY_MU * SKY_MUS * SKY_PHI);
+		this->ambientLut.resize(AMBIENT_SIZE);
+		in.read((char *)this->transmittanceLut.data(), this->transmittanceLut.size() * sizeof(glm::vec3));
+		in.read((char *)this->skyLut.data(), this->skyLut.size() * sizeof(glm::vec3));
+		in.read((char *)this->ambientLut.data(), this->ambientLut.size() * sizeof(glm::vec3));
+		return (bool)in;
+	}
+
+	void saveCache(const std::string &path) const
+	{
+		std::error_code ec;
+		std::filesystem::path dir = std::filesystem::path(path).parent_path();
+		if (!dir.empty())
+		{
+			std::filesystem::create_directories(dir, ec);
+		}
+
+		std::ofstream out(path, std::ios::binary);
+		if (!out)
+		{
+			std::cerr << "ERROR::ATMOSPHERE::CANNOT_WRITE " << path << std::endl;
+			return;
+		}
+
+		CacheHeader h = makeHeader();
+		out.write((const char *)&h, sizeof(h));
+		out.write((const char *)this->transmittanceLut.data(), this->transmittanceLut.size() * sizeof(glm::vec3));
+		out.write((const char *)this->skyLut.data(), this->skyLut.size() * sizeof(glm::vec3));
+		out.write((const char *)this->ambientLut.data(), this->ambientLut.size() * sizeof(glm::vec3));
+	}
+
+	void upload()
+	{
+		glGenTextures(1, &this->skyTexture);
+		glBindTexture(GL_TEXTURE_3D, this->skyTexture);
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_RGB16F, SKY_MU, SKY_MUS, SKY_PHI, 0, GL_RGB, GL_FLOAT, this->skyLut.data());
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_3D, 0);
+	}
+};
@@ -0,0 +1,294 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// GL Includes
+#include <GL/glew.h>
+
+// Command line of the headless benchmark:
+//   --headless [--frames N] [--warmup N] [--size WxH] [--out file.json] [--deferred]
+// Combined with --replay/--flyover (CameraPath.h) the run stops early when the path ends.
+struct BenchmarkOptions
+{
+	bool headless = false;
+	int frames = 300;
+	int warmup = 30;
+	int width = 1920;
+	int height = 1080;
+	std::string output;		// JSON goes to stdout when empty
+	std::string scenario;	// Camera source (live input, replay or fly-over), set by the caller
+	bool deferred = false;	// Point lights through the G-buffer instead of per object (DeferredShading.h)
+};
+
+inline bool ParseBenchmarkOptions(int argc, char **argv, BenchmarkOptions &options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--headless")
+		{
+			options.headless = true;
+		}
+		else if (arg == "--frames" && hasValue)
+		{
+			options.frames = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--warmup" && hasValue)
+		{
+			options.warmup = std::max(0, std::atoi(argv[++i]));
+		}
+		else if (arg == "--size" && hasValue)
+		{
+			int w = 0, h = 0;
+			if (sscanf(argv[++i], "%dx%d", &w, &h) == 2 && w > 0 && h > 0)
+			{
+				options.width = w;
+				options.height = h;
+			}
+		}
+		else if (arg == "--out" && hasValue)
+		{
+			options.output = argv[++i];
+		}
+		else if (arg == "--deferred")
+		{
+			options.deferred = true;
+		}
+	}
+	return options.headless;
+}
+
+// What a frame submitted to the GL (counted by the renderer while it replays)
+struct RenderStats
+{
+	long long draws = 0;
+	long long triangles = 0;
+};
+
+// Color + depth framebuffer the headless frames are rendered into
+class RenderTarget
+{
+public:
+	RenderTarget() : fbo(0), color(0), depth(0), width(0), height(0)
+	{
+	}
+
+	~RenderTarget()
+	{
+		this->Destroy();
+	}
+
+	bool Create(int width, int height)
+	{
+		this->width = width;
+		this->height = height;
+
+		glGenRenderbuffers(1, &this->color);
+		glBindRenderbuffer(GL_RENDERBUFFER, this->color);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_SRGB8_ALPHA8, width, height);
+		glGenRenderbuffers(1, &this->depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, this->depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glGenFramebuffers(1, &this->fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->color);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->depth);
+		bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if (!complete)
+		{
+			std::cerr << "ERROR::RENDERTARGET::INCOMPLETE_FRAMEBUFFER" << std::endl;
+		}
+		return complete;
+	}
+
+	void Bind() const
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+		glViewport(0, 0, this->width, this->height);
+	}
+
+	void Destroy()
+	{
+		if (this->fbo)
+		{
+			glDeleteFramebuffers(1, &this->fbo);
+			glDeleteRenderbuffers(1, &this->color);
+			glDeleteRenderbuffers(1, &this->depth);
+			this->fbo = this->color = this->depth = 0;
+		}
+	}
+
+	GLuint GetFramebuffer() const
+	{
+		return this->fbo;
+	}
+
+private:
+	GLuint fbo, color, depth;
+	int width, height;
+};
+
+// GL_TIME_ELAPSED queries in a small ring so reading a result never waits on the frame just issued
+class GpuTimer
+{
+public:
+	static const int RING = 4;
+
+	GpuTimer() : issued(0), collected(0), created(false)
+	{
+	}
+
+	~GpuTimer()
+	{
+		if (this->created)
+		{
+			glDeleteQueries(RING, this->queries);
+		}
+	}
+
+	void Begin()
+	{
+		if (!this->created)
+		{
+			glGenQueries(RING, this->queries);
+			this->created = true;
+		}
+		// Ring full: the oldest result has to be read before its query object is reused
+		if (this->issued - this->collected == RING)
+		{
+			this->collectOne();
+		}
+		glBeginQuery(GL_TIME_ELAPSED, this->queries[this->issued % RING]);
+	}
+
+	void End()
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		this->issued++;
+	}
+
+	// Waits for every outstanding query
+	void Drain()
+	{
+		while (this->collected < this->issued)
+		{
+			this->collectOne();
+		}
+	}
+
+	// Milliseconds per timed frame, in issue order
+	const std::vector<double> &GetResults() const
+	{
+		return this->results;
+	}
+
+private:
+	GLuint queries[RING];
+	long long issued, collected;
+	bool created;
+	std::vector<double> results;
+
+	void collectOne()
+	{
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(this->queries[this->collected % RING], GL_QUERY_RESULT, &ns);
+		this->results.push_back(ns / 1.0e6);
+		this->collected++;
+	}
+};
+
+// Nearest-rank percentile of an unsorted sample
+inline double Percentile(std::vector<double> values, double p)
+{
+	if (values.empty())
+	{
+		return 0.0;
+	}
+	std::sort(values.begin(), values.end());
+	double rank = std::ceil(p / 100.0 * values.size()) - 1.0;
+	rank = std::max(0.0, std::min(rank, (double)values.size() - 1.0));
+	return values[(size_t)rank];
+}
+
+inline std::string TimingJson(const std::vector<double> &ms)
+{
+	double sum = 0.0, worst = 0.0;
+	for (double v : ms)
+	{
+		sum += v;
+		worst = std::max(worst, v);
+	}
+	std::ostringstream o;
+	o.precision(4);
+	o << std::fixed << "{ \"mean\": " << (ms.empty() ? 0.0 : sum / ms.size())
+		<< ", \"p50\": " << Percentile(ms, 50.0)
+		<< ", \"p90\": " << Percentile(ms, 90.0)
+		<< ", \"p95\": " << Percentile(ms, 95.0)
+		<< ", \"p99\": " << Percentile(ms, 99.0)
+		<< ", \"max\": " << worst << " }";
+	return o.str();
+}
+
+inline std::string JsonEscape(const std::string &s)
+{
+	std::string r;
+	for (char c : s)
+	{
+		if (c == '"' || c == '\\')
+		{
+			r += '\\';
+		}
+		r += c;
+	}
+	return r;
+}
+
+// Writes the report to the requested file, or else to stdout, which carries nothing else (logs go to stderr)
+inline void WriteBenchmarkReport(const BenchmarkOptions &options, const char *backend, const std::vector<double> &cpuMs,
+	const std::vector<double> &gpuMs, const RenderStats &total, int frames)
+{
+	const char *renderer = (const char *)glGetString(GL_RENDERER);
+	const char *version = (const char *)glGetString(GL_VERSION);
+
+	std::ostringstream o;
+	o << "{\n"
+		<< "  \"backend\": \"" << backend << "\",\n"
+		<< "  \"scenario\": \"" << JsonEscape(options.scenario) << "\",\n"
+		<< "  \"shading\": \"" << (options.deferred ? "deferred" : "forward") << "\",\n"
+		<< "  \"renderer\": \"" << JsonEscape(renderer ? renderer : "") << "\",\n"
+		<< "  \"version\": \"" << JsonEscape(version ? version : "") << "\",\n"
+		<< "  \"width\": " << options.width << ",\n"
+		<< "  \"height\": " << options.height << ",\n"
+		<< "  \"frames\": " << frames << ",\n"
+		<< "  \"warmup\": " << options.warmup << ",\n"
+		<< "  \"cpu_ms\": " << TimingJson(cpuMs) << ",\n"
+		<< "  \"gpu_ms\": " << TimingJson(gpuMs) << ",\n"
+		<< "  \"draws_per_frame\": " << (frames > 0 ? total.draws / frames : 0) << ",\n"
+		<< "  \"triangles_per_frame\": " << (frames > 0 ? total.triangles / frames : 0) << "\n"
+		<< "}\n";
+
+	if (options.output.empty())
+	{
+		std::cout << o.str();
+		return;
+	}
+	std::ofstream file(options.output);
+	file << o.str();
+	if (!file)
+	{
+		std::cerr << "ERROR::BENCHMARK::CANNOT_WRITE " << options.output << std::endl;
+	}
+}
@@ -56,6 +56,14 @@ public:
 		return glm::lookAt(this->position, this->position + this->front, this->up);
 	}
 
+	// Returns the view matrix for an externally supplied pose (e.g. interpolated between simulation steps)
+	glm::mat4 GetViewMatrix(const glm::vec3 &eye, GLfloat yaw, GLfloat pitch)
+	{
+		glm::vec3 front = frontFromAngles(yaw, pitch);
+		glm::vec3 right = glm::normalize(glm::cross(front, this->worldUp));
+		return glm::lookAt(eye, eye + front, glm::normalize(glm::cross(right, front)));
+	}
+
 	// Processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
 	void ProcessKeyboard(Camera_Movement direction, GLfloat deltaTime)
 	{
@@ -125,11 +133,34 @@ public:
 		return this->position;
 	}
 
+	void SetPosition(const glm::vec3 &position)
+	{
+		this->position = position;
+	}
+
 	glm::vec3 GetFront()
 	{
 		return this->front;
 	}
 
+	GLfloat GetYaw()
+	{
+		return this->yaw;
+	}
+
+	GLfloat GetPitch()
+	{
+		return this->pitch;
+	}
+
+	// Restores the Euler angles of a saved pose
+	void SetOrientation(GLfloat yaw, GLfloat pitch)
+	{
+		this->yaw = yaw;
+		this->pitch = pitch;
+		this->updateCameraVectors();
+	}
+
 private:
 	// Camera Attributes
 	glm::vec3 position;
@@ -147,15 +178,20 @@ private:
 	GLfloat mouseSensitivity;
 	GLfloat zoom;
 
+	static glm::vec3 frontFromAngles(GLfloat yaw, GLfloat pitch)
+	{
+		glm::vec3 front;
+		front.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
+		front.y = sin(glm::radians(pitch));
+		front.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
+		return glm::normalize(front);
+	}
+
 	// Calculates the front vector from the Camera's (updated) Eular Angles
 	void updateCameraVectors()
 	{
 		// Calculate the new Front vector
-		glm::vec3 front;
-		front.x = cos(glm::radians(this->yaw)) * cos(glm::radians(this->pitch));
-		front.y = sin(glm::radians(this->pitch));
-		front.z = sin(glm::radians(this->yaw)) * cos(glm::radians(this->pitch));
-		this->front = glm::normalize(front);
+		this->front = frontFromAngles(this->yaw, this->pitch);
 		// Also re-calculate the Right and Up vector
 		this->right = glm::normalize(glm::cross(this->front, this->worldUp));  // Normalize the vectors, because their length gets closer to 0 the more you look up or down which results in slower movement.
 		this->up = glm::normalize(glm::cross(this->right, this->front));
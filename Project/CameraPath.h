@@ -0,0 +1,268 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// GL Includes
+#include <glm/glm.hpp>
+
+// Command line of the camera paths (all of them run the simulation on the fixed clock):
+//   --record file.campath   records the input and camera pose of every simulation step
+//   --replay file.campath   replays a recording step by step
+//   --flyover name          scripted fly-over (names are registered by the scene)
+struct CameraPathOptions
+{
+	std::string record;
+	std::string replay;
+	std::string flyover;
+};
+
+inline void ParseCameraPathOptions(int argc, char **argv, CameraPathOptions &options)
+{
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--record")
+		{
+			options.record = argv[++i];
+		}
+		else if (arg == "--replay")
+		{
+			options.replay = argv[++i];
+		}
+		else if (arg == "--flyover")
+		{
+			options.flyover = argv[++i];
+		}
+	}
+}
+
+// Held buttons, sampled once per simulation step
+enum InputButton
+{
+	INPUT_FORWARD = 1 << 0,
+	INPUT_BACKWARD = 1 << 1,
+	INPUT_LEFT = 1 << 2,
+	INPUT_RIGHT = 1 << 3,
+	INPUT_WHEEL_FORWARD = 1 << 4,
+	INPUT_WHEEL_BACKWARD = 1 << 5
+};
+
+// Everything the user did between two simulation steps. The update reads input only from here,
+// so feeding the same sequence again reproduces the same states.
+struct TickInput
+{
+	uint32_t buttons = 0;		// InputButton bits
+	float mouseX = 0.0f;		// Accumulated cursor offsets in pixels
+	float mouseY = 0.0f;
+	uint32_t fireToggles = 0;	// Key presses, not states, so none is lost between steps
+};
+
+// Euler angles in degrees, as used by Camera
+struct CameraPose
+{
+	glm::vec3 position = glm::vec3(0.0f);
+	float yaw = -90.0f;
+	float pitch = 0.0f;
+};
+
+// One simulation step: when it happened, what came in and where the camera ended up
+struct RecordedTick
+{
+	double time = 0.0;
+	TickInput input;
+	CameraPose pose;
+};
+
+// Text file, one step per line, floats written with enough digits to round-trip exactly:
+//   campath 1 <step>
+//   <time> <buttons> <mouseX> <mouseY> <fireToggles> <x> <y> <z> <yaw> <pitch>
+class InputRecording
+{
+public:
+	InputRecording() : step(0.0)
+	{
+	}
+
+	void Clear(double step)
+	{
+		this->step = step;
+		this->ticks.clear();
+	}
+
+	void Append(const RecordedTick &tick)
+	{
+		this->ticks.push_back(tick);
+	}
+
+	bool Save(const std::string &path) const
+	{
+		FILE *file = fopen(path.c_str(), "w");
+		if (!file)
+		{
+			std::cerr << "ERROR::CAMPATH::CANNOT_WRITE " << path << std::endl;
+			return false;
+		}
+		fprintf(file, "campath 1 %.17g\n", this->step);
+		for (const RecordedTick &t : this->ticks)
+		{
+			fprintf(file, "%.17g %u %.9g %.9g %u %.9g %.9g %.9g %.9g %.9g\n", t.time, t.input.buttons, t.input.mouseX, t.input.mouseY,
+				t.input.fireToggles, t.pose.position.x, t.pose.position.y, t.pose.position.z, t.pose.yaw, t.pose.pitch);
+		}
+		fclose(file);
+		return true;
+	}
+
+	bool Load(const std::string &path)
+	{
+		std::ifstream file(path);
+		std::string magic;
+		int version = 0;
+		if (!(file >> magic >> version >> this->step) || magic != "campath" || version != 1)
+		{
+			std::cerr << "ERROR::CAMPATH::NOT_A_RECORDING " << path << std::endl;
+			return false;
+		}
+
+		this->ticks.clear();
+		RecordedTick t;
+		while (file >> t.time >> t.input.buttons >> t.input.mouseX >> t.input.mouseY >> t.input.fireToggles
+			>> t.pose.position.x >> t.pose.position.y >> t.pose.position.z >> t.pose.yaw >> t.pose.pitch)
+		{
+			this->ticks.push_back(t);
+		}
+		return true;
+	}
+
+	double GetStep() const
+	{
+		return this->step;
+	}
+
+	size_t Size() const
+	{
+		return this->ticks.size();
+	}
+
+	const RecordedTick &Get(size_t i) const
+	{
+		return this->ticks[i];
+	}
+
+private:
+	double step;
+	std::vector<RecordedTick> ticks;
+};
+
+// Scripted camera flight: eye and look-at target keyframes joined by Catmull-Rom splines,
+// evaluated from simulated time only
+class FlyOver
+{
+public:
+	void Clear()
+	{
+		this->keys.clear();
+	}
+
+	// Keys must be added in increasing time
+	void AddKey(double time, const glm::vec3 &eye, const glm::vec3 &target)
+	{
+		Key k;
+		k.time = time;
+		k.eye = eye;
+		k.target = target;
+		this->keys.push_back(k);
+	}
+
+	// Appends another flight after this one ('gap' seconds to travel between them)
+	void Append(const FlyOver &other, double gap)
+	{
+		double offset = this->keys.empty() ? 0.0 : this->keys.back().time + gap;
+		for (const Key &k : other.keys)
+		{
+			this->AddKey(offset + k.time - other.keys.front().time, k.eye, k.target);
+		}
+	}
+
+	double GetDuration() const
+	{
+		return this->keys.empty() ? 0.0 : this->keys.back().time;
+	}
+
+	bool Empty() const
+	{
+		return this->keys.empty();
+	}
+
+	CameraPose Evaluate(double time) const
+	{
+		CameraPose pose;
+		if (this->keys.empty())
+		{
+			return pose;
+		}
+
+		int last = (int)this->keys.size() - 1;
+		int i = 0;
+		while (i < last && this->keys[i + 1].time <= time)
+		{
+			i++;
+		}
+		float u = 0.0f;
+		if (i < last)
+		{
+			u = (float)((time - this->keys[i].time) / (this->keys[i + 1].time - this->keys[i].time));
+			u = std::max(0.0f, std::min(u, 1.0f));
+		}
+
+		// End keys are repeated so the curve still passes through them
+		const Key &k0 = this->keys[std::max(i - 1, 0)];
+		const Key &k1 = this->keys[i];
+		const Key &k2 = this->keys[std::min(i + 1, last)];
+		const Key &k3 = this->keys[std::min(i + 2, last)];
+
+		pose.position = catmullRom(k0.eye, k1.eye, k2.eye, k3.eye, u);
+		glm::vec3 target = catmullRom(k0.target, k1.target, k2.target, k3.target, u);
+
+		glm::vec3 dir = target - pose.position;
+		float len = glm::length(dir);
+		if (len > 1e-5f)
+		{
+			dir /= len;
+			pose.yaw = glm::degrees(atan2f(dir.z, dir.x));
+			pose.pitch = glm::degrees(asinf(std::max(-1.0f, std::min(dir.y, 1.0f))));
+		}
+		return pose;
+	}
+
+private:
+	struct Key
+	{
+		double time;
+		glm::vec3 eye;
+		glm::vec3 target;
+	};
+
+	std::vector<Key> keys;
+
+	static glm::vec3 catmullRom(const glm::vec3 &p0, const glm::vec3 &p1, const glm::vec3 &p2, const glm::vec3 &p3, float u)
+	{
+		float u2 = u * u, u3 = u2 * u;
+		return 0.5f * ((2.0f * p1) + (p2 - p0) * u + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * u2 + (3.0f * p1 - p0 - 3.0f * p2 + p3) * u3);
+	}
+};
+
+// Angle equal to 'angle' modulo 360 that is closest to 'reference', so interpolating yaw never spins the long way
+inline float UnwrapDegrees(float angle, float reference)
+{
+	return angle - 360.0f * std::floor((angle - reference) / 360.0f + 0.5f);
+}
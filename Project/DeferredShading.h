@@ -0,0 +1,194 @@
+#pragma once
+
+// Std. Includes
+#include <iostream>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Shader.h"
+
+// Deferred point lights. The geometry pass renders the scene as usual into attachment 0 (RGBA16F: sun,
+// sky, shadows; everything but the point lights) and additionally writes what the lights need:
+//   attachment 1  RGBA8    albedo, material id (uMode / 255) in alpha
+//   attachment 2  RGBA16F  world-space normal
+// Resolve() draws attachment 0 over the framebuffer that was bound before, then LightPass() adds
+// every light by drawing its bounding sphere, so the lighting cost is visible pixels x lights touching them.
+class DeferredShading
+{
+public:
+	DeferredShading() : fbo(0), color(0), albedo(0), normal(0), depth(0), triangle(0), previous(0), width(0), height(0)
+	{
+	}
+
+	~DeferredShading()
+	{
+		this->Destroy();
+	}
+
+	bool Create(int width, int height)
+	{
+		this->width = width;
+		this->height = height;
+
+		GLint bound = 0;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &bound);
+
+		this->color = createTexture(GL_RGBA16F, GL_RGBA, GL_FLOAT);		// Linear; 8 bits would band the night
+		this->albedo = createTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+		this->normal = createTexture(GL_RGBA16F, GL_RGBA, GL_FLOAT);
+		this->depth = createTexture(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_FLOAT);
+
+		glGenFramebuffers(1, &this->fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->color, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, this->albedo, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, this->normal, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, this->depth, 0);
+		const GLenum buffers[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+		glDrawBuffers(3, buffers);
+		bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		glBindFramebuffer(GL_FRAMEBUFFER, bound);
+		glGenVertexArrays(1, &this->triangle);
+		if (!complete)
+		{
+			std::cerr << "ERROR::DEFERRED::INCOMPLETE_FRAMEBUFFER" << std::endl;
+		}
+		return complete;
+	}
+
+	void Destroy()
+	{
+		if (this->fbo)
+		{
+			glDeleteFramebuffers(1, &this->fbo);
+			GLuint textures[4] = { this->color, this->albedo, this->normal, this->depth };
+			glDeleteTextures(4, textures);
+			glDeleteVertexArrays(1, &this->triangle);
+			this->fbo = this->color = this->albedo = this->normal = this->depth = this->triangle = 0;
+		}
+	}
+
+	bool IsCreated() const
+	{
+		return this->fbo != 0;
+	}
+
+	// Redirects the scene into the G-buffer. Attachment 0 gets the current clear color, the others zero.
+	void BeginGeometry()
+	{
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &this->previous);
+		glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		glClearBufferfv(GL_COLOR, 1, zero);
+		glClearBufferfv(GL_COLOR, 2, zero);
+		// Flames blend over attachment 0 only; alpha holds the material id in attachment 1
+		glDisablei(GL_BLEND, 1);
+		glDisablei(GL_BLEND, 2);
+	}
+
+	// Draws the unlit image over the framebuffer bound before BeginGeometry() and leaves that one bound.
+	// A fullscreen triangle rather than a blit: the window's framebuffer is multisampled and sRGB.
+	void Resolve(Shader &shader)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, this->previous);
+		GLboolean blend = glIsEnabled(GL_BLEND), depthTest = glIsEnabled(GL_DEPTH_TEST);
+		glDisable(GL_BLEND);
+		glDisable(GL_DEPTH_TEST);
+		glDepthMask(GL_FALSE);
+
+		shader.Use();
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, this->color);
+		glUniform1i(glGetUniformLocation(shader.Program, "uColor"), 0);
+		glBindVertexArray(this->triangle);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glBindVertexArray(0);
+
+		glDepthMask(GL_TRUE);
+		if (depthTest)
+		{
+			glEnable(GL_DEPTH_TEST);
+		}
+		if (blend)
+		{
+			glEnable(GL_BLEND);
+		}
+		glEnablei(GL_BLEND, 1);
+		glEnablei(GL_BLEND, 2);
+	}
+
+	// Adds 'lightCount' lights from a uLightData texture buffer (LightClusters.h) to the bound framebuffer.
+	// 'sphere' is a unit-diameter sphere centered on the origin.
+	void LightPass(Shader &shader, GLuint lightData, int lightCount, const glm::mat4 &view, const glm::mat4 &projection,
+		GLuint sphere, GLsizei sphereVerts)
+	{
+		if (lightCount <= 0)
+		{
+			return;
+		}
+		GLint blendSrc = 0, blendDst = 0;
+		glGetIntegerv(GL_BLEND_SRC_RGB, &blendSrc);
+		glGetIntegerv(GL_BLEND_DST_RGB, &blendDst);
+
+		shader.Use();
+		const GLuint textures[3] = { this->albedo, this->normal, this->depth };
+		const char *samplers[3] = { "uGAlbedo", "uGNormal", "uGDepth" };
+		for (int i = 0; i < 3; i++)
+		{
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(GL_TEXTURE_2D, textures[i]);
+			glUniform1i(glGetUniformLocation(shader.Program, samplers[i]), i);
+		}
+		glActiveTexture(GL_TEXTURE3);
+		glBindTexture(GL_TEXTURE_BUFFER, lightData);
+		glUniform1i(glGetUniformLocation(shader.Program, "uLightData"), 3);
+		glActiveTexture(GL_TEXTURE0);
+
+		glm::mat4 viewProjection = projection * view;
+		glUniformMatrix4fv(glGetUniformLocation(shader.Program, "viewProjection"), 1, GL_FALSE, glm::value_ptr(viewProjection));
+		glUniformMatrix4fv(glGetUniformLocation(shader.Program, "uInvViewProjection"), 1, GL_FALSE, glm::value_ptr(glm::inverse(viewProjection)));
+		glUniform2f(glGetUniformLocation(shader.Program, "uInvScreen"), 1.0f / this->width, 1.0f / this->height);
+
+		// Back faces only: each covered pixel is shaded once per light, also with the camera inside the sphere
+		glDisable(GL_DEPTH_TEST);
+		glDepthMask(GL_FALSE);
+		glEnable(GL_CULL_FACE);
+		glCullFace(GL_FRONT);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE);
+
+		glBindVertexArray(sphere);
+		glDrawArraysInstanced(GL_TRIANGLES, 0, sphereVerts, lightCount);
+		glBindVertexArray(0);
+
+		glBlendFunc(blendSrc, blendDst);
+		glCullFace(GL_BACK);
+		glDisable(GL_CULL_FACE);
+		glDepthMask(GL_TRUE);
+		glEnable(GL_DEPTH_TEST);
+	}
+
+private:
+	GLuint fbo, color, albedo, normal, depth;
+	GLuint triangle;					// Empty VAO for Resolve(); the vertex shader makes the corners
+	GLint previous;
+	int width, height;
+
+	GLuint createTexture(GLenum internalFormat, GLenum format, GLenum type) const
+	{
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, this->width, this->height, 0, format, type, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return texture;
+	}
+};
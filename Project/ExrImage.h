@@ -0,0 +1,1721 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define EXR_USE_SSE 1
+#endif
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+#include <immintrin.h>
+#define EXR_USE_F16C 1
+#endif
+
+#include "Parallel.h"
+
+// stb_image's zlib, compiled with the rest of stb_image inside SOIL2
+#include "SOIL2/stb_image.h"
+
+namespace ExrDetail
+{
+	enum Compression { NONE = 0, RLE = 1, ZIPS = 2, ZIP = 3, PIZ = 4, PXR24 = 5, B44 = 6, B44A = 7, DWAA = 8, DWAB = 9 };
+	enum PixelType { UINT = 0, HALF = 1, FLOAT = 2 };
+
+	struct ChannelInfo
+	{
+		std::string name;
+		int type;
+		bool pLinear;	// Stored perceptually linear; DWA skips its gamma curve for these
+	};
+
+	inline int sampleBytes(int type)
+	{
+		return type == HALF ? 2 : 4;
+	}
+
+	// Scanlines per compressed chunk
+	inline int linesPerChunk(int compression)
+	{
+		switch (compression)
+		{
+		case ZIP: return 16;
+		case PIZ: case DWAA: return 32;
+		case DWAB: return 256;
+		default: return 1;
+		}
+	}
+
+	template <typename T>
+	inline T read(const unsigned char *p)
+	{
+		T v;
+		std::memcpy(&v, p, sizeof(T));
+		return v;
+	}
+
+	// ------------------------------------------------------------------
+	// Half floats
+	// ------------------------------------------------------------------
+
+	inline float halfToFloat(uint16_t h)
+	{
+		uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+		uint32_t exponent = (h >> 10) & 0x1F;
+		uint32_t mantissa = h & 0x3FF;
+		uint32_t bits;
+		if (exponent == 0x1F)
+		{
+			bits = sign | 0x7F800000 | (mantissa << 13);	// Inf / NaN
+		}
+		else if (exponent != 0)
+		{
+			bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+		}
+		else if (mantissa == 0)
+		{
+			bits = sign;
+		}
+		else
+		{
+			// Subnormal: normalize the mantissa
+			exponent = 113;
+			while ((mantissa & 0x400) == 0)
+			{
+				mantissa <<= 1;
+				exponent--;
+			}
+			bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+		}
+		float f;
+		std::memcpy(&f, &bits, 4);
+		return f;
+	}
+
+	// Round to nearest even, like F16C; overflow goes to Inf and NaN stays NaN
+	inline uint16_t floatToHalf(float value)
+	{
+		uint32_t x;
+		std::memcpy(&x, &value, 4);
+		const uint32_t sign = x & 0x80000000u;
+		x ^= sign;
+		uint32_t h;
+		if (x >= 0x47800000u)
+		{
+			h = x > 0x7F800000u ? 0x7E00 : 0x7C00;
+		}
+		else if (x < 0x38800000u)
+		{
+			// Subnormal result: adding 0.5 lines the 10 mantissa bits up at the bottom and the FPU rounds
+			const uint32_t magicBits = 126u << 23;
+			float magic, f;
+			std::memcpy(&magic, &magicBits, 4);
+			std::memcpy(&f, &x, 4);
+			f += magic;
+			std::memcpy(&h, &f, 4);
+			h -= magicBits;
+		}
+		else
+		{
+			const uint32_t odd = (x >> 13) & 1;
+			h = (x + ((uint32_t)(15 - 127) << 23) + 0xFFF + odd) >> 13;
+		}
+		return (uint16_t)((sign >> 16) | h);
+	}
+
+#if defined(EXR_USE_SSE) && !defined(EXR_USE_F16C)
+	// 4 halves in the low 16 bits of each lane; exact for every input, subnormals included
+	inline __m128 halfToFloat4(__m128i h)
+	{
+		const __m128i expMant = _mm_and_si128(h, _mm_set1_epi32(0x7FFF));
+		const __m128 scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(expMant, 13)), _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23)));
+		const __m128i infNan = _mm_cmpgt_epi32(expMant, _mm_set1_epi32(0x7BFF));
+		const __m128i sign = _mm_slli_epi32(_mm_xor_si128(h, expMant), 16);
+		const __m128 special = _mm_and_ps(_mm_castsi128_ps(infNan), _mm_castsi128_ps(_mm_set1_epi32(255 << 23)));
+		return _mm_or_ps(scaled, _mm_or_ps(_mm_castsi128_ps(sign), special));
+	}
+
+	// The scalar floatToHalf on 4 lanes; results are sign-extended so _mm_packs_epi32 keeps them
+	inline __m128i floatToHalf4(__m128 f)
+	{
+		const __m128 signBit = _mm_castsi128_ps(_mm_set1_epi32((int)0x80000000u));
+		const __m128 sign = _mm_and_ps(f, signBit);
+		const __m128 absF = _mm_xor_ps(f, sign);
+		const __m128i absI = _mm_castps_si128(absF);
+		const __m128i isRegular = _mm_cmpgt_epi32(_mm_set1_epi32(0x47800000), absI);
+		const __m128i nanBit = _mm_and_si128(_mm_castps_si128(_mm_cmpunord_ps(absF, absF)), _mm_set1_epi32(0x200));
+		const __m128i special = _mm_or_si128(nanBit, _mm_set1_epi32(0x7C00));
+
+		const __m128i isSubnormal = _mm_cmpgt_epi32(_mm_set1_epi32(0x38800000), absI);
+		const __m128i magic = _mm_set1_epi32(126 << 23);
+		const __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absF, _mm_castsi128_ps(magic))), magic);
+
+		const __m128i odd = _mm_srai_epi32(_mm_slli_epi32(absI, 31 - 13), 31);
+		const __m128i rounded = _mm_sub_epi32(_mm_add_epi32(absI, _mm_set1_epi32(0xFFF - ((127 - 15) << 23))), odd);
+		const __m128i normal = _mm_srli_epi32(rounded, 13);
+
+		__m128i h = _mm_or_si128(_mm_and_si128(isSubnormal, subnormal), _mm_andnot_si128(isSubnormal, normal));
+		h = _mm_or_si128(_mm_and_si128(isRegular, h), _mm_andnot_si128(isRegular, special));
+		return _mm_or_si128(h, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+	}
+#endif
+
+	// n little-endian halves (any alignment) to floats
+	inline void halfToFloatRow(const unsigned char *src, float *dst, int n, bool simd = true)
+	{
+		int i = 0;
+		if (simd)
+		{
+#if defined(EXR_USE_F16C)
+			for (; i + 8 <= n; i += 8)
+			{
+				_mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + 2 * i))));
+			}
+#elif defined(EXR_USE_SSE)
+			const __m128i zero = _mm_setzero_si128();
+			for (; i + 8 <= n; i += 8)
+			{
+				const __m128i h = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+				_mm_storeu_ps(dst + i, halfToFloat4(_mm_unpacklo_epi16(h, zero)));
+				_mm_storeu_ps(dst + i + 4, halfToFloat4(_mm_unpackhi_epi16(h, zero)));
+			}
+#endif
+		}
+		for (; i < n; i++)
+		{
+			dst[i] = halfToFloat(read<uint16_t>(src + 2 * i));
+		}
+	}
+
+	inline void floatToHalfRow(const float *src, uint16_t *dst, int n, bool simd = true)
+	{
+		int i = 0;
+		if (simd)
+		{
+#if defined(EXR_USE_F16C)
+			for (; i + 8 <= n; i += 8)
+			{
+				_mm_storeu_si128((__m128i *)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+			}
+#elif defined(EXR_USE_SSE)
+			for (; i + 8 <= n; i += 8)
+			{
+				const __m128i lo = floatToHalf4(_mm_loadu_ps(src + i)), hi = floatToHalf4(_mm_loadu_ps(src + i + 4));
+				_mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(lo, hi));
+			}
+#endif
+		}
+		for (; i < n; i++)
+		{
+			dst[i] = floatToHalf(src[i]);
+		}
+	}
+
+	// Clamped to [0, 1] and scaled to 0..255 with rounding; NaN becomes 0
+	inline void floatToUNorm8Row(const float *src, unsigned char *dst, int n, bool simd = true)
+	{
+		int i = 0;
+#if defined(EXR_USE_SSE)
+		if (simd)
+		{
+			const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), scale = _mm_set1_ps(255.0f), half = _mm_set1_ps(0.5f);
+			auto quantize = [&](const float *p)
+			{
+				__m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(p), zero), one);
+				return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, scale), half));
+			};
+			for (; i + 16 <= n; i += 16)
+			{
+				const __m128i a = _mm_packs_epi32(quantize(src + i), quantize(src + i + 4));
+				const __m128i b = _mm_packs_epi32(quantize(src + i + 8), quantize(src + i + 12));
+				_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, b));
+			}
+		}
+#else
+		(void)simd;
+#endif
+		for (; i < n; i++)
+		{
+			float v = std::min(1.0f, std::max(0.0f, src[i]));
+			dst[i] = (unsigned char)(v * 255.0f + 0.5f);
+		}
+	}
+
+	// One row of a decompressed chunk to float
+	inline void sampleRowToFloat(int type, const unsigned char *src, float *dst, int n)
+	{
+		switch (type)
+		{
+		case HALF:
+			halfToFloatRow(src, dst, n);
+			break;
+		case FLOAT:
+			std::memcpy(dst, src, (size_t)n * 4);
+			break;
+		default:
+			for (int x = 0; x < n; x++)
+			{
+				dst[x] = (float)read<uint32_t>(src + 4 * x);
+			}
+			break;
+		}
+	}
+
+	// ------------------------------------------------------------------
+	// RLE / ZIP
+	// ------------------------------------------------------------------
+
+	// Signed count bytes: -n copies n literal bytes, n repeats the next byte n + 1 times
+	inline size_t unRle(const unsigned char *src, size_t size, unsigned char *out, size_t outSize)
+	{
+		size_t i = 0, o = 0;
+		while (i < size)
+		{
+			int count = (signed char)src[i++];
+			if (count < 0)
+			{
+				count = -count;
+				if (i + count > size || o + count > outSize)
+				{
+					return 0;
+				}
+				std::memcpy(out + o, src + i, count);
+				i += count;
+				o += count;
+			}
+			else
+			{
+				if (i >= size || o + count + 1 > outSize)
+				{
+					return 0;
+				}
+				std::memset(out + o, src[i++], count + 1);
+				o += count + 1;
+			}
+		}
+		return o;
+	}
+
+	// RLE and ZIP store bytes delta-coded and split in two halves (even bytes, then odd)
+	inline void unpredictAndInterleave(unsigned char *tmp, size_t size, unsigned char *out)
+	{
+		for (size_t i = 1; i < size; i++)
+		{
+			tmp[i] = (unsigned char)(tmp[i - 1] + tmp[i] - 128);
+		}
+		const unsigned char *a = tmp, *b = tmp + (size + 1) / 2;
+		for (size_t i = 0; i + 1 < size; i += 2)
+		{
+			out[i] = *a++;
+			out[i + 1] = *b++;
+		}
+		if (size & 1)
+		{
+			out[size - 1] = *a;
+		}
+	}
+
+	inline bool inflate(const unsigned char *src, size_t size, unsigned char *out, size_t outSize)
+	{
+		return stbi_zlib_decode_buffer((char *)out, (int)outSize, (const char *)src, (int)size) == (int)outSize;
+	}
+
+	inline bool inflateZip(const unsigned char *src, size_t size, unsigned char *out, size_t outSize)
+	{
+		std::vector<unsigned char> tmp(outSize);
+		if (!inflate(src, size, tmp.data(), outSize))
+		{
+			return false;
+		}
+		unpredictAndInterleave(tmp.data(), outSize, out);
+		return true;
+	}
+
+	// ------------------------------------------------------------------
+	// Huffman coding shared by PIZ and the DWA AC coefficients
+	// ------------------------------------------------------------------
+
+	// Canonical code lengths for the symbols in [im, iM] (6 bits each, runs of unused symbols packed),
+	// then the bit stream, MSB first. The largest symbol means "repeat the last value n times", n in
+	// the next 8 bits.
+	inline bool hufDecompress(const unsigned char *src, size_t size, uint16_t *out, size_t count)
+	{
+		enum { ENCSIZE = 65537, DECBITS = 14, DECSIZE = 1 << DECBITS, DECMASK = DECSIZE - 1 };
+		if (size == 0)
+		{
+			return count == 0;
+		}
+		if (size < 20)
+		{
+			return false;
+		}
+		const uint32_t im = read<uint32_t>(src), iM = read<uint32_t>(src + 4), nBits = read<uint32_t>(src + 12);
+		if (im >= ENCSIZE || iM >= ENCSIZE || im > iM)
+		{
+			return false;
+		}
+		const unsigned char *p = src + 20, *end = src + size;
+
+		// Lengths of the symbols in use; most of the 16-bit range usually isn't
+		struct Code
+		{
+			uint32_t symbol;
+			int len;
+			uint64_t code;
+		};
+		std::vector<Code> used;
+		uint64_t c = 0;
+		int lc = 0;
+		auto getBits = [&](int n, uint32_t &value)
+		{
+			while (lc < n)
+			{
+				if (p >= end)
+				{
+					return false;
+				}
+				c = (c << 8) | *p++;
+				lc += 8;
+			}
+			lc -= n;
+			value = (uint32_t)(c >> lc) & ((1u << n) - 1);
+			return true;
+		};
+		for (uint32_t i = im; i <= iM; i++)
+		{
+			uint32_t l;
+			if (!getBits(6, l))
+			{
+				return false;
+			}
+			if (l < 59)
+			{
+				if (l > 0)
+				{
+					used.push_back({ i, (int)l, 0 });
+				}
+				continue;
+			}
+			// Runs of unused symbols: 59..62 short, 63 long with an 8-bit length
+			uint32_t run = l - 59 + 2;
+			if (l == 63)
+			{
+				if (!getBits(8, run))
+				{
+					return false;
+				}
+				run += 6;
+			}
+			if (i + run > iM + 1)
+			{
+				return false;
+			}
+			i += run - 1;
+		}
+
+		// Canonical codes: longer codes take the lower values
+		uint64_t n[59] = {};
+		for (const Code &code : used)
+		{
+			n[code.len]++;
+		}
+		uint64_t next = 0;
+		for (int l = 58; l > 0; l--)
+		{
+			uint64_t nc = (next + n[l]) >> 1;
+			n[l] = next;
+			next = nc;
+		}
+		for (Code &code : used)
+		{
+			code.code = n[code.len]++;
+			if (code.code >> code.len)
+			{
+				return false;
+			}
+		}
+
+		// Table indexed by the next 14 bits: symbol << 8 | length for short codes; longer codes are
+		// listed under their 14-bit prefix
+		std::vector<uint32_t> table(DECSIZE, 0);
+		std::vector<uint32_t> longFirst, longCount;
+		std::vector<const Code *> longCodes;
+		for (const Code &code : used)
+		{
+			if (code.len <= DECBITS)
+			{
+				uint32_t *e = &table[code.code << (DECBITS - code.len)];
+				for (uint32_t k = 1u << (DECBITS - code.len); k > 0; k--, e++)
+				{
+					if (*e != 0)
+					{
+						return false;
+					}
+					*e = code.symbol << 8 | (uint32_t)code.len;
+				}
+			}
+			else
+			{
+				longCodes.push_back(&code);
+			}
+		}
+		if (!longCodes.empty())
+		{
+			// Grouped by prefix; the stable sort keeps symbol order within a prefix
+			longFirst.assign(DECSIZE, 0);
+			longCount.assign(DECSIZE, 0);
+			auto prefix = [](const Code *code) { return (uint32_t)(code->code >> (code->len - DECBITS)); };
+			std::stable_sort(longCodes.begin(), longCodes.end(), [&](const Code *a, const Code *b) { return prefix(a) < prefix(b); });
+			for (uint32_t k = 0; k < longCodes.size(); k++)
+			{
+				const uint32_t e = prefix(longCodes[k]);
+				if (table[e] != 0)
+				{
+					return false;
+				}
+				if (longCount[e]++ == 0)
+				{
+					longFirst[e] = k;
+				}
+			}
+		}
+
+		const uint32_t rlc = iM;
+		const unsigned char *ie = p + (nBits + 7) / 8;
+		if (ie > end)
+		{
+			return false;
+		}
+		uint16_t *o = out, *oe = out + count;
+		c = 0;
+		lc = 0;
+		auto emit = [&](uint32_t symbol)
+		{
+			if (symbol == rlc)
+			{
+				if (lc < 8)
+				{
+					if (p >= ie)
+					{
+						return false;
+					}
+					c = (c << 8) | *p++;
+					lc += 8;
+				}
+				lc -= 8;
+				const int repeat = (unsigned char)(c >> lc);
+				if (oe - o < repeat || o == out)
+				{
+					return false;
+				}
+				const uint16_t s = o[-1];
+				for (int k = 0; k < repeat; k++)
+				{
+					*o++ = s;
+				}
+			}
+			else
+			{
+				if (o >= oe)
+				{
+					return false;
+				}
+				*o++ = (uint16_t)symbol;
+			}
+			return true;
+		};
+		for (;;)
+		{
+			// Keep up to 64 bits buffered
+			while (lc <= 56 && p < ie)
+			{
+				c = (c << 8) | *p++;
+				lc += 8;
+			}
+			if (lc < DECBITS)
+			{
+				break;
+			}
+			const uint32_t prefix = (uint32_t)(c >> (lc - DECBITS)) & DECMASK;
+			const uint32_t e = table[prefix];
+			if (e != 0)
+			{
+				lc -= e & 0xFF;
+				if (!emit(e >> 8))
+				{
+					return false;
+				}
+				continue;
+			}
+			if (longCount.empty() || longCount[prefix] == 0)
+			{
+				return false;
+			}
+			uint32_t j = 0;
+			for (; j < longCount[prefix]; j++)
+			{
+				const Code &code = *longCodes[longFirst[prefix] + j];
+				if (lc >= code.len && code.code == ((c >> (lc - code.len)) & (((uint64_t)1 << code.len) - 1)))
+				{
+					lc -= code.len;
+					if (!emit(code.symbol))
+					{
+						return false;
+					}
+					break;
+				}
+			}
+			if (j == longCount[prefix])
+			{
+				return false;
+			}
+		}
+
+		// Drop the padding of the last byte and finish with the short codes left in the buffer
+		const int pad = (8 - nBits) & 7;
+		c >>= pad;
+		lc -= pad;
+		while (lc > 0)
+		{
+			const uint32_t e = table[(c << (DECBITS - lc)) & DECMASK];
+			if (e == 0 || (int)(e & 0xFF) > lc)
+			{
+				return false;
+			}
+			lc -= e & 0xFF;
+			if (!emit(e >> 8))
+			{
+				return false;
+			}
+		}
+		return o == oe;
+	}
+
+	// ------------------------------------------------------------------
+	// PIZ: value range reduction, 2D Haar wavelet per channel, Huffman
+	// ------------------------------------------------------------------
+
+	inline void wdec14(uint16_t l, uint16_t h, uint16_t &a, uint16_t &b)
+	{
+		const int hi = (short)h;
+		const int ai = (short)l + (hi & 1) + (hi >> 1);
+		a = (uint16_t)(short)ai;
+		b = (uint16_t)(short)(ai - hi);
+	}
+
+	inline void wdec16(uint16_t l, uint16_t h, uint16_t &a, uint16_t &b)
+	{
+		const int m = l, d = h;
+		const int bb = (m - (d >> 1)) & 0xFFFF;
+		const int aa = (d + bb - 32768) & 0xFFFF;
+		b = (uint16_t)bb;
+		a = (uint16_t)aa;
+	}
+
+	// Undoes the wavelet on an nx * ny grid whose samples are ox apart in a row and oy between rows
+	inline void wav2Decode(uint16_t *in, int nx, int ox, int ny, int oy, uint16_t mx)
+	{
+		const bool w14 = mx < (1 << 14);
+		auto dec = [w14](uint16_t l, uint16_t h, uint16_t &a, uint16_t &b)
+		{
+			if (w14)
+			{
+				wdec14(l, h, a, b);
+			}
+			else
+			{
+				wdec16(l, h, a, b);
+			}
+		};
+		const int n = std::min(nx, ny);
+		int p = 1;
+		while (p <= n)
+		{
+			p <<= 1;
+		}
+		p >>= 1;
+		int p2 = p;
+		p >>= 1;
+
+		while (p >= 1)
+		{
+			uint16_t *py = in;
+			uint16_t *ey = in + (ptrdiff_t)oy * (ny - p2);
+			const int oy1 = oy * p, oy2 = oy * p2, ox1 = ox * p, ox2 = ox * p2;
+			uint16_t i00, i01, i10, i11;
+			for (; py <= ey; py += oy2)
+			{
+				uint16_t *px = py;
+				uint16_t *ex = py + (ptrdiff_t)ox * (nx - p2);
+				for (; px <= ex; px += ox2)
+				{
+					uint16_t *p01 = px + ox1, *p10 = px + oy1, *p11 = p10 + ox1;
+					dec(*px, *p10, i00, i10);
+					dec(*p01, *p11, i01, i11);
+					dec(i00, i01, *px, *p01);
+					dec(i10, i11, *p10, *p11);
+				}
+				// Odd column
+				if (nx & p)
+				{
+					uint16_t *p10 = px + oy1;
+					dec(*px, *p10, i00, *p10);
+					*px = i00;
+				}
+			}
+			// Odd line
+			if (ny & p)
+			{
+				uint16_t *px = py;
+				uint16_t *ex = py + (ptrdiff_t)ox * (nx - p2);
+				for (; px <= ex; px += ox2)
+				{
+					uint16_t *p01 = px + ox1;
+					dec(*px, *p01, i00, *p01);
+					*px = i00;
+				}
+			}
+			p2 = p;
+			p >>= 1;
+		}
+	}
+
+	inline const char *unpiz(const unsigned char *src, size_t size, const std::vector<ChannelInfo> &channels, int width, int lines, unsigned char *out, size_t outSize)
+	{
+		const char *damaged = "damaged PIZ block";
+		const unsigned char *p = src, *end = src + size;
+		if (size < 4)
+		{
+			return damaged;
+		}
+		// Bitmap of the 16-bit values in use; the wavelet ran on their indices
+		const uint16_t minNonZero = read<uint16_t>(p), maxNonZero = read<uint16_t>(p + 2);
+		p += 4;
+		std::vector<unsigned char> bitmap(8192, 0);
+		if (maxNonZero >= 8192)
+		{
+			return damaged;
+		}
+		if (minNonZero <= maxNonZero)
+		{
+			const size_t bytes = maxNonZero - minNonZero + 1;
+			if ((size_t)(end - p) < bytes)
+			{
+				return damaged;
+			}
+			std::memcpy(&bitmap[minNonZero], p, bytes);
+			p += bytes;
+		}
+		std::vector<uint16_t> lut(65536, 0);
+		int k = 0;
+		for (int i = 0; i < 65536; i++)
+		{
+			if (i == 0 || (bitmap[i >> 3] & (1 << (i & 7))))
+			{
+				lut[k++] = (uint16_t)i;
+			}
+		}
+		const uint16_t maxValue = (uint16_t)(k - 1);
+
+		if (end - p < 4)
+		{
+			return damaged;
+		}
+		const int length = read<int>(p);
+		p += 4;
+		if (length < 0 || end - p < length)
+		{
+			return damaged;
+		}
+		std::vector<uint16_t> tmp(outSize / 2);
+		if (!hufDecompress(p, length, tmp.data(), tmp.size()))
+		{
+			return damaged;
+		}
+
+		// Channels are planar in tmp; 32-bit samples are two interleaved 16-bit wavelets
+		uint16_t *plane = tmp.data();
+		for (const ChannelInfo &ch : channels)
+		{
+			const int words = sampleBytes(ch.type) / 2;
+			for (int j = 0; j < words; j++)
+			{
+				wav2Decode(plane + j, width, words, lines, width * words, maxValue);
+			}
+			plane += (size_t)width * lines * words;
+		}
+		for (uint16_t &v : tmp)
+		{
+			v = lut[v];
+		}
+
+		// Back to a line at a time, every channel's row in turn
+		std::vector<const uint16_t *> cursor(channels.size());
+		plane = tmp.data();
+		for (size_t c = 0; c < channels.size(); c++)
+		{
+			cursor[c] = plane;
+			plane += (size_t)width * lines * (sampleBytes(channels[c].type) / 2);
+		}
+		unsigned char *dst = out;
+		for (int y = 0; y < lines; y++)
+		{
+			for (size_t c = 0; c < channels.size(); c++)
+			{
+				const size_t bytes = (size_t)width * sampleBytes(channels[c].type);
+				std::memcpy(dst, cursor[c], bytes);
+				cursor[c] += bytes / 2;
+				dst += bytes;
+			}
+		}
+		return nullptr;
+	}
+
+	// ------------------------------------------------------------------
+	// DWAA / DWAB: 8x8 DCT for color (after an RGB -> Y'CbCr rotation), RLE for alpha, zlib for the rest
+	// ------------------------------------------------------------------
+
+	// Half values in a DCT block are in a 2.2 gamma space; this table takes them back to linear
+	inline const uint16_t *dwaToLinear()
+	{
+		static const std::vector<uint16_t> table = []()
+		{
+			std::vector<uint16_t> t(65536, 0);
+			for (int i = 0; i < 65536; i++)
+			{
+				if ((i & 0x7C00) == 0x7C00)
+				{
+					continue;	// Inf / NaN
+				}
+				const float x = halfToFloat((uint16_t)i), ax = std::fabs(x), sign = x < 0.0f ? -1.0f : 1.0f;
+				const float y = ax <= 1.0f ? std::pow(ax, 2.2f) : (float)std::pow(2.7182818, 2.2 * (ax - 1.0));
+				t[i] = floatToHalf(sign * y);
+			}
+			return t;
+		}();
+		return table.data();
+	}
+
+	// Natural index of each zig-zag position
+	static const int dctZigZag[64] =
+	{
+		 0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+		12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+		35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+		58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+	};
+
+	inline float vmul(float a, float x) { return a * x; }
+	inline float vadd(float a, float b) { return a + b; }
+	inline float vsub(float a, float b) { return a - b; }
+#if defined(EXR_USE_SSE)
+	inline __m128 vmul(float a, __m128 x) { return _mm_mul_ps(_mm_set1_ps(a), x); }
+	inline __m128 vadd(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+	inline __m128 vsub(__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+#endif
+
+	// One 8-point inverse DCT, the same arithmetic for a float or 4 lanes at once
+	template <typename V>
+	inline void idct8(V *x)
+	{
+		const float a = 0.5f * std::cos(3.14159f / 4.0f);
+		const float b = 0.5f * std::cos(3.14159f / 16.0f);
+		const float c = 0.5f * std::cos(3.14159f / 8.0f);
+		const float d = 0.5f * std::cos(3.0f * 3.14159f / 16.0f);
+		const float e = 0.5f * std::cos(5.0f * 3.14159f / 16.0f);
+		const float f = 0.5f * std::cos(3.0f * 3.14159f / 8.0f);
+		const float g = 0.5f * std::cos(7.0f * 3.14159f / 16.0f);
+
+		const V alpha0 = vmul(c, x[2]), alpha1 = vmul(f, x[2]), alpha2 = vmul(c, x[6]), alpha3 = vmul(f, x[6]);
+		const V beta0 = vadd(vadd(vadd(vmul(b, x[1]), vmul(d, x[3])), vmul(e, x[5])), vmul(g, x[7]));
+		const V beta1 = vsub(vsub(vsub(vmul(d, x[1]), vmul(g, x[3])), vmul(b, x[5])), vmul(e, x[7]));
+		const V beta2 = vadd(vadd(vsub(vmul(e, x[1]), vmul(b, x[3])), vmul(g, x[5])), vmul(d, x[7]));
+		const V beta3 = vsub(vadd(vsub(vmul(g, x[1]), vmul(e, x[3])), vmul(d, x[5])), vmul(b, x[7]));
+		const V theta0 = vmul(a, vadd(x[0], x[4])), theta3 = vmul(a, vsub(x[0], x[4]));
+		const V theta1 = vadd(alpha0, alpha3), theta2 = vsub(alpha1, alpha2);
+		const V gamma0 = vadd(theta0, theta1), gamma1 = vadd(theta3, theta2);
+		const V gamma2 = vsub(theta3, theta2), gamma3 = vsub(theta0, theta1);
+		x[0] = vadd(gamma0, beta0);
+		x[1] = vadd(gamma1, beta1);
+		x[2] = vadd(gamma2, beta2);
+		x[3] = vadd(gamma3, beta3);
+		x[4] = vsub(gamma3, beta3);
+		x[5] = vsub(gamma2, beta2);
+		x[6] = vsub(gamma1, beta1);
+		x[7] = vsub(gamma0, beta0);
+	}
+
+#if defined(EXR_USE_SSE)
+	inline void transpose8x8(float *data)
+	{
+		__m128 r[16];
+		for (int i = 0; i < 16; i++)
+		{
+			r[i] = _mm_loadu_ps(data + 4 * i);
+		}
+		// Quadrants are rows {0, 2, 4, 6} + {0, 1} (top) and {8, 10, 12, 14} + {0, 1} (bottom)
+		_MM_TRANSPOSE4_PS(r[0], r[2], r[4], r[6]);
+		_MM_TRANSPOSE4_PS(r[1], r[3], r[5], r[7]);
+		_MM_TRANSPOSE4_PS(r[8], r[10], r[12], r[14]);
+		_MM_TRANSPOSE4_PS(r[9], r[11], r[13], r[15]);
+		for (int i = 0; i < 4; i++)
+		{
+			_mm_storeu_ps(data + 8 * i, r[2 * i]);
+			_mm_storeu_ps(data + 8 * i + 4, r[8 + 2 * i]);
+			_mm_storeu_ps(data + 8 * (i + 4), r[2 * i + 1]);
+			_mm_storeu_ps(data + 8 * (i + 4) + 4, r[9 + 2 * i]);
+		}
+	}
+#endif
+
+	// Rows, then columns
+	inline void inverseDct(float *data)
+	{
+#if defined(EXR_USE_SSE)
+		auto columns = [](float *block)
+		{
+			for (int half = 0; half < 8; half += 4)
+			{
+				__m128 x[8];
+				for (int k = 0; k < 8; k++)
+				{
+					x[k] = _mm_loadu_ps(block + 8 * k + half);
+				}
+				idct8(x);
+				for (int k = 0; k < 8; k++)
+				{
+					_mm_storeu_ps(block + 8 * k + half, x[k]);
+				}
+			}
+		};
+		transpose8x8(data);
+		columns(data);
+		transpose8x8(data);
+		columns(data);
+#else
+		float x[8];
+		for (int row = 0; row < 8; row++)
+		{
+			idct8(data + 8 * row);
+		}
+		for (int column = 0; column < 8; column++)
+		{
+			for (int k = 0; k < 8; k++)
+			{
+				x[k] = data[column + 8 * k];
+			}
+			idct8(x);
+			for (int k = 0; k < 8; k++)
+			{
+				data[column + 8 * k] = x[k];
+			}
+		}
+#endif
+	}
+
+	// Rec. 709 Y'CbCr back to R'G'B'
+	inline void csc709Inverse(float &c0, float &c1, float &c2)
+	{
+		const float y = c0, cb = c1, cr = c2;
+		c0 = y + 1.5747f * cr;
+		c1 = y - 0.1873f * cb - 0.4682f * cr;
+		c2 = y + 1.8556f * cb;
+	}
+
+	// 1 or 3 (Y'CbCr) channels of DCT blocks. row0[comp] is the component's first row in the chunk
+	// buffer, stride bytes per line. AC and DC values are consumed from the packed streams.
+	inline bool decodeDct(int numComp, unsigned char *const *row0, size_t stride, const int *types, const uint16_t *toLinear,
+		int width, int height, const uint16_t *&ac, const uint16_t *acEnd, const uint16_t *&dc, const uint16_t *dcEnd)
+	{
+		const int blocksX = (width + 7) / 8, blocksY = (height + 7) / 8;
+		const size_t blocks = (size_t)blocksX * blocksY;
+		if ((size_t)(dcEnd - dc) < blocks * numComp)
+		{
+			return false;
+		}
+		// DC values are grouped by component
+		const uint16_t *dcComp[3];
+		for (int comp = 0; comp < numComp; comp++)
+		{
+			dcComp[comp] = dc + comp * blocks;
+		}
+		dc += blocks * numComp;
+
+		std::vector<uint16_t> rowBlocks((size_t)numComp * blocksX * 64), line(width);
+		float dct[3][64], coefficients[64];
+		uint16_t zig[64];
+		for (int by = 0; by < blocksY; by++)
+		{
+			for (int bx = 0; bx < blocksX; bx++)
+			{
+				bool constant = true;
+				for (int comp = 0; comp < numComp; comp++)
+				{
+					// AC: 0xFF00 ends the block, 0xFFnn skips nn zeros
+					std::memset(zig, 0, sizeof(zig));
+					zig[0] = *dcComp[comp]++;
+					int last = 0;
+					for (int k = 1; k < 64;)
+					{
+						if (ac >= acEnd)
+						{
+							return false;
+						}
+						const uint16_t v = *ac++;
+						if (v == 0xFF00)
+						{
+							break;
+						}
+						if ((v >> 8) == 0xFF)
+						{
+							k += v & 0xFF;
+						}
+						else
+						{
+							zig[k] = v;
+							last = k++;
+						}
+					}
+
+					float *block = dct[comp];
+					if (last == 0)
+					{
+						const float value = halfToFloat(zig[0]) * 3.535536e-01f * 3.535536e-01f;
+						std::fill(block, block + 64, value);
+					}
+					else
+					{
+						constant = false;
+						halfToFloatRow((const unsigned char *)zig, coefficients, 64);
+						for (int k = 0; k < 64; k++)
+						{
+							block[dctZigZag[k]] = coefficients[k];
+						}
+						inverseDct(block);
+					}
+				}
+
+				if (numComp == 3)
+				{
+					for (int i = 0; i < (constant ? 1 : 64); i++)
+					{
+						csc709Inverse(dct[0][i], dct[1][i], dct[2][i]);
+					}
+				}
+				for (int comp = 0; comp < numComp; comp++)
+				{
+					uint16_t *dst = &rowBlocks[((size_t)comp * blocksX + bx) * 64];
+					if (constant)
+					{
+						std::fill(dst, dst + 64, floatToHalf(dct[comp][0]));
+					}
+					else
+					{
+						floatToHalfRow(dct[comp], dst, 64);
+					}
+				}
+			}
+
+			// Unblock this row of blocks into the chunk's lines
+			const int rows = std::min(8, height - 8 * by);
+			for (int comp = 0; comp < numComp; comp++)
+			{
+				const uint16_t *blocksRow = &rowBlocks[(size_t)comp * blocksX * 64];
+				for (int y = 0; y < rows; y++)
+				{
+					for (int x = 0; x < width; x++)
+					{
+						const uint16_t v = blocksRow[(x >> 3) * 64 + y * 8 + (x & 7)];
+						line[x] = toLinear != nullptr ? toLinear[v] : v;
+					}
+					std::memcpy(row0[comp] + (size_t)(8 * by + y) * stride, line.data(), (size_t)width * 2);
+				}
+			}
+		}
+
+		// FLOAT channels went through as halves
+		std::vector<float> floats(width);
+		for (int comp = 0; comp < numComp; comp++)
+		{
+			if (types[comp] != FLOAT)
+			{
+				continue;
+			}
+			for (int y = 0; y < height; y++)
+			{
+				unsigned char *row = row0[comp] + (size_t)y * stride;
+				halfToFloatRow(row, floats.data(), width);
+				std::memcpy(row, floats.data(), (size_t)width * 4);
+			}
+		}
+		return true;
+	}
+
+	inline const char *undwa(const unsigned char *src, size_t size, const std::vector<ChannelInfo> &channels, int width, int lines, unsigned char *out, size_t outSize)
+	{
+		const char *damaged = "damaged DWA block";
+		enum Scheme { UNKNOWN_SCHEME = 0, LOSSY_DCT = 1, RLE_SCHEME = 2 };
+		struct Rule
+		{
+			std::string suffix;
+			int scheme, csc, type;
+			bool caseInsensitive;
+		};
+
+		if (size < 88)
+		{
+			return damaged;
+		}
+		uint64_t h[11];
+		for (int i = 0; i < 11; i++)
+		{
+			h[i] = read<uint64_t>(src + 8 * i);
+		}
+		const uint64_t version = h[0], unknownRawSize = h[1], unknownSize = h[2], acSize = h[3], dcSize = h[4],
+			rleSize = h[5], rleUncompressedSize = h[6], rleRawSize = h[7], acCount = h[8], dcCount = h[9], acCompression = h[10];
+		const unsigned char *p = src + 88, *end = src + size;
+		if (version > 2)
+		{
+			return "unsupported DWA version";
+		}
+
+		// Version 2 carries the rules that sorted channels into schemes; older files used fixed ones
+		std::vector<Rule> rules;
+		if (version == 2)
+		{
+			if (end - p < 2)
+			{
+				return damaged;
+			}
+			const uint16_t ruleSize = read<uint16_t>(p);
+			if (ruleSize < 2 || end - p < ruleSize)
+			{
+				return damaged;
+			}
+			const unsigned char *r = p + 2, *rulesEnd = p + ruleSize;
+			while (r < rulesEnd)
+			{
+				const unsigned char *zero = (const unsigned char *)std::memchr(r, 0, rulesEnd - r);
+				if (zero == nullptr || rulesEnd - zero < 3)
+				{
+					return damaged;
+				}
+				Rule rule;
+				rule.suffix.assign((const char *)r, zero - r);
+				rule.csc = (zero[1] >> 4) - 1;
+				rule.scheme = (zero[1] >> 2) & 3;
+				rule.caseInsensitive = (zero[1] & 1) != 0;
+				rule.type = zero[2];
+				if (rule.csc >= 3 || rule.scheme > RLE_SCHEME || rule.type > FLOAT)
+				{
+					return damaged;
+				}
+				rules.push_back(rule);
+				r = zero + 3;
+			}
+			p = rulesEnd;
+		}
+		else
+		{
+			const char *names[] = { "r", "red", "g", "grn", "green", "b", "blu", "blue" };
+			const int csc[] = { 0, 0, 1, 1, 1, 2, 2, 2 };
+			for (int i = 0; i < 8; i++)
+			{
+				rules.push_back({ names[i], LOSSY_DCT, csc[i], HALF, false });
+			}
+			rules.push_back({ "y", LOSSY_DCT, -1, HALF, false });
+			for (int type = UINT; type <= FLOAT; type++)
+			{
+				rules.push_back({ "a", RLE_SCHEME, -1, type, false });
+			}
+		}
+		if (unknownSize > (uint64_t)(end - p) || acSize > (uint64_t)(end - p) - unknownSize
+			|| dcSize > (uint64_t)(end - p) - unknownSize - acSize || rleSize > (uint64_t)(end - p) - unknownSize - acSize - dcSize)
+		{
+			return damaged;
+		}
+
+		// Classify by the name after the last '.'; the last matching rule wins. R, G and B with a common
+		// prefix are decoded together.
+		auto lower = [](std::string s)
+		{
+			std::transform(s.begin(), s.end(), s.begin(), [](unsigned char ch) { return (char)std::tolower(ch); });
+			return s;
+		};
+		std::vector<int> scheme(channels.size(), UNKNOWN_SCHEME);
+		std::map<std::string, std::array<int, 3>> sets;
+		for (size_t c = 0; c < channels.size(); c++)
+		{
+			const std::string &name = channels[c].name;
+			const size_t dot = name.find_last_of('.');
+			const std::string prefix = dot == std::string::npos ? "" : name.substr(0, dot);
+			const std::string suffix = dot == std::string::npos ? name : name.substr(dot + 1);
+			for (const Rule &rule : rules)
+			{
+				const bool match = rule.type == channels[c].type
+					&& (rule.caseInsensitive ? lower(rule.suffix) == lower(suffix) : rule.suffix == suffix);
+				if (!match)
+				{
+					continue;
+				}
+				scheme[c] = rule.scheme;
+				if (rule.csc >= 0)
+				{
+					auto it = sets.emplace(prefix, std::array<int, 3>{ { -1, -1, -1 } }).first;
+					it->second[rule.csc] = (int)c;
+				}
+			}
+		}
+
+		// Planar sizes of the UNKNOWN and RLE sections
+		size_t unknownBytes = 0, rleBytes = 0;
+		for (size_t c = 0; c < channels.size(); c++)
+		{
+			const size_t bytes = (size_t)width * lines * sampleBytes(channels[c].type);
+			if (scheme[c] == UNKNOWN_SCHEME)
+			{
+				unknownBytes += bytes;
+			}
+			else if (scheme[c] == RLE_SCHEME)
+			{
+				rleBytes += bytes;
+			}
+		}
+
+		std::vector<unsigned char> unknown(unknownBytes), rle(rleBytes);
+		std::vector<uint16_t> acValues(acCount), dcValues(dcCount);
+		const unsigned char *section = p;
+		if (unknownSize > 0 && (unknownRawSize > unknownBytes || !inflate(section, unknownSize, unknown.data(), unknownRawSize)))
+		{
+			return damaged;
+		}
+		section += unknownSize;
+		if (acSize > 0)
+		{
+			const bool ok = acCompression == 0
+				? hufDecompress(section, acSize, acValues.data(), acValues.size())
+				: inflate(section, acSize, (unsigned char *)acValues.data(), acValues.size() * 2);
+			if (!ok)
+			{
+				return damaged;
+			}
+		}
+		section += acSize;
+		if (dcSize > 0 && !inflateZip(section, dcSize, (unsigned char *)dcValues.data(), dcValues.size() * 2))
+		{
+			return damaged;
+		}
+		section += dcSize;
+		if (rleRawSize > 0)
+		{
+			std::vector<unsigned char> packed(rleUncompressedSize);
+			if (rleRawSize > rleBytes || !inflate(section, rleSize, packed.data(), packed.size())
+				|| unRle(packed.data(), packed.size(), rle.data(), rleRawSize) != rleRawSize)
+			{
+				return damaged;
+			}
+		}
+
+		// Row 0 of each channel in the line-interleaved output
+		const size_t stride = outSize / lines;
+		std::vector<unsigned char *> row0(channels.size());
+		size_t offset = 0;
+		for (size_t c = 0; c < channels.size(); c++)
+		{
+			row0[c] = out + offset;
+			offset += (size_t)width * sampleBytes(channels[c].type);
+		}
+
+		const uint16_t *toLinear = dwaToLinear();
+		const uint16_t *ac = acValues.data(), *acEnd = ac + acValues.size();
+		const uint16_t *dc = dcValues.data(), *dcEnd = dc + dcValues.size();
+		std::vector<bool> done(channels.size(), false);
+		for (const auto &set : sets)
+		{
+			const std::array<int, 3> &idx = set.second;
+			if (idx[0] < 0 || idx[1] < 0 || idx[2] < 0)
+			{
+				continue;
+			}
+			unsigned char *rows[3] = { row0[idx[0]], row0[idx[1]], row0[idx[2]] };
+			const int types[3] = { channels[idx[0]].type, channels[idx[1]].type, channels[idx[2]].type };
+			if (!decodeDct(3, rows, stride, types, toLinear, width, lines, ac, acEnd, dc, dcEnd))
+			{
+				return damaged;
+			}
+			done[idx[0]] = done[idx[1]] = done[idx[2]] = true;
+		}
+
+		const unsigned char *unknownRead = unknown.data(), *rleRead = rle.data();
+		for (size_t c = 0; c < channels.size(); c++)
+		{
+			if (done[c])
+			{
+				continue;
+			}
+			const int bytes = sampleBytes(channels[c].type);
+			const size_t rowBytes = (size_t)width * bytes;
+			switch (scheme[c])
+			{
+			case LOSSY_DCT:
+				if (!decodeDct(1, &row0[c], stride, &channels[c].type, channels[c].pLinear ? nullptr : toLinear, width, lines, ac, acEnd, dc, dcEnd))
+				{
+					return damaged;
+				}
+				break;
+			case RLE_SCHEME:
+				// One plane per byte of the sample
+				for (int y = 0; y < lines; y++)
+				{
+					unsigned char *dst = row0[c] + (size_t)y * stride;
+					for (int x = 0; x < width; x++)
+					{
+						for (int b = 0; b < bytes; b++)
+						{
+							dst[x * bytes + b] = rleRead[(size_t)b * width * lines + (size_t)y * width + x];
+						}
+					}
+				}
+				rleRead += rowBytes * lines;
+				break;
+			default:
+				for (int y = 0; y < lines; y++)
+				{
+					std::memcpy(row0[c] + (size_t)y * stride, unknownRead, rowBytes);
+					unknownRead += rowBytes;
+				}
+				break;
+			}
+		}
+		return nullptr;
+	}
+
+	// ------------------------------------------------------------------
+
+	// Decompresses one chunk (a block of lines or a tile) to width * lines of every channel in turn
+	inline const char *decompress(int compression, const unsigned char *src, size_t size, const std::vector<ChannelInfo> &channels,
+		int width, int lines, unsigned char *out, size_t outSize)
+	{
+		switch (compression)
+		{
+		case RLE:
+		{
+			std::vector<unsigned char> tmp(outSize);
+			if (unRle(src, size, tmp.data(), outSize) != outSize)
+			{
+				return "damaged RLE block";
+			}
+			unpredictAndInterleave(tmp.data(), outSize, out);
+			return nullptr;
+		}
+		case ZIPS:
+		case ZIP:
+			return inflateZip(src, size, out, outSize) ? nullptr : "damaged ZIP block";
+		case PIZ:
+			return unpiz(src, size, channels, width, lines, out, outSize);
+		case DWAA:
+		case DWAB:
+			return undwa(src, size, channels, width, lines, out, outSize);
+		default:
+			return "unsupported compression";
+		}
+	}
+}
+
+// An OpenEXR image as one float plane per channel, channels in file (alphabetical) order. Reads
+// single-part scanline and tiled files (the full-resolution level of mipmapped ones) with HALF, FLOAT
+// or UINT channels, uncompressed or RLE, ZIPS, ZIP, PIZ, DWAA or DWAB compressed; PXR24 and B44
+// report an error. Chunks are decompressed on every core.
+struct ExrImage
+{
+	int width = 0, height = 0;
+	std::vector<std::string> channels;
+	std::vector<std::vector<float>> planes;
+
+	// The plane of a channel, or nullptr
+	const float *Channel(const std::string &name) const
+	{
+		for (size_t i = 0; i < this->channels.size(); i++)
+		{
+			if (this->channels[i] == name)
+			{
+				return this->planes[i].data();
+			}
+		}
+		return nullptr;
+	}
+
+	// The named channels interleaved as half floats, ready for a GL_R16F .. GL_RGBA16F upload. Missing
+	// channels read as 0, or 1 for "A".
+	std::vector<uint16_t> ToHalf(const std::vector<std::string> &names, bool simd = true) const
+	{
+		std::vector<uint16_t> out;
+		this->interleave(names, out, [simd](const float *src, uint16_t *dst, int n)
+		{
+			ExrDetail::floatToHalfRow(src, dst, n, simd);
+		}, ExrDetail::floatToHalf(0.0f), ExrDetail::floatToHalf(1.0f));
+		return out;
+	}
+
+	// The same as 8-bit unsigned normalized values, clamped to [0, 1]
+	std::vector<unsigned char> ToUNorm8(const std::vector<std::string> &names, bool simd = true) const
+	{
+		std::vector<unsigned char> out;
+		this->interleave(names, out, [simd](const float *src, unsigned char *dst, int n)
+		{
+			ExrDetail::floatToUNorm8Row(src, dst, n, simd);
+		}, (unsigned char)0, (unsigned char)255);
+		return out;
+	}
+
+private:
+	template <typename T, typename Convert>
+	void interleave(const std::vector<std::string> &names, std::vector<T> &out, Convert convert, T zero, T one) const
+	{
+		const int count = (int)names.size(), w = this->width;
+		out.resize((size_t)w * this->height * count);
+		std::vector<const float *> src(count);
+		for (int k = 0; k < count; k++)
+		{
+			src[k] = this->Channel(names[k]);
+		}
+		ParallelFor(0, this->height, [&](int y)
+		{
+			T *dst = out.data() + (size_t)y * w * count;
+			if (count == 1 && src[0] != nullptr)
+			{
+				convert(src[0] + (size_t)y * w, dst, w);
+				return;
+			}
+			std::vector<T> row(w);
+			for (int k = 0; k < count; k++)
+			{
+				if (src[k] != nullptr)
+				{
+					convert(src[k] + (size_t)y * w, row.data(), w);
+				}
+				else
+				{
+					std::fill(row.begin(), row.end(), names[k] == "A" ? one : zero);
+				}
+				for (int x = 0; x < w; x++)
+				{
+					dst[(size_t)x * count + k] = row[x];
+				}
+			}
+		}, 64);
+	}
+};
+
+inline bool LoadExr(const std::string &path, ExrImage &image, std::string *error = nullptr, bool parallel = true)
+{
+	using namespace ExrDetail;
+	auto fail = [error](const std::string &message)
+	{
+		if (error != nullptr)
+		{
+			*error = message;
+		}
+		return false;
+	};
+
+	std::ifstream in(path, std::ios::binary | std::ios::ate);
+	if (!in)
+	{
+		return fail("cannot open the file");
+	}
+	std::vector<unsigned char> file((size_t)in.tellg());
+	in.seekg(0);
+	in.read((char *)file.data(), (std::streamsize)file.size());
+	const unsigned char *p = file.data(), *end = file.data() + file.size();
+	if (!in || file.size() < 8 || read<uint32_t>(p) != 20000630)
+	{
+		return fail("not an EXR file");
+	}
+	// Bit 9 marks a tiled file; deep data and multi-part files are out
+	uint32_t version = read<uint32_t>(p + 4);
+	const bool tiled = (version & 0x200) != 0;
+	if ((version & 0xFF) != 2 || (version & 0x1800) != 0)
+	{
+		return fail("only single-part EXR files are read");
+	}
+	p += 8;
+
+	// Header: name\0 type\0 size value ..., closed by an empty name
+	std::vector<ChannelInfo> channels;
+	int compression = -1, xMin = 0, yMin = 0, xMax = -1, yMax = -1;
+	int tileWidth = 0, tileHeight = 0;
+	while (p < end && *p != 0)
+	{
+		const unsigned char *nameEnd = (const unsigned char *)std::memchr(p, 0, end - p);
+		const unsigned char *typeEnd = nameEnd != nullptr ? (const unsigned char *)std::memchr(nameEnd + 1, 0, end - nameEnd - 1) : nullptr;
+		if (typeEnd == nullptr || end - typeEnd < 5)
+		{
+			return fail("damaged header");
+		}
+		std::string name((const char *)p, nameEnd - p);
+		p = typeEnd + 1;
+		int size = read<int>(p);
+		p += 4;
+		if (size < 0 || end - p < size)
+		{
+			return fail("damaged header");
+		}
+		if (name == "channels")
+		{
+			// name\0 type pLinear reserved[3] xSampling ySampling, closed by an empty name
+			const unsigned char *c = p, *listEnd = p + size;
+			while (c < listEnd && *c != 0)
+			{
+				const unsigned char *zero = (const unsigned char *)std::memchr(c, 0, listEnd - c);
+				if (zero == nullptr || listEnd - zero < 17)
+				{
+					return fail("damaged header");
+				}
+				ChannelInfo ch;
+				ch.name.assign((const char *)c, zero - c);
+				ch.type = read<int>(zero + 1);
+				ch.pLinear = zero[5] != 0;
+				int xs = read<int>(zero + 9), ys = read<int>(zero + 13);
+				if (xs != 1 || ys != 1)
+				{
+					return fail("subsampled channels");
+				}
+				if (ch.type < UINT || ch.type > FLOAT)
+				{
+					return fail("unknown channel type");
+				}
+				c = zero + 17;
+				channels.push_back(ch);
+			}
+		}
+		else if (name == "compression" && size >= 1)
+		{
+			compression = *p;
+		}
+		else if (name == "dataWindow" && size >= 16)
+		{
+			xMin = read<int>(p);
+			yMin = read<int>(p + 4);
+			xMax = read<int>(p + 8);
+			yMax = read<int>(p + 12);
+		}
+		else if (name == "tiles" && size >= 9)
+		{
+			tileWidth = (int)read<uint32_t>(p);
+			tileHeight = (int)read<uint32_t>(p + 4);
+		}
+		p += size;
+	}
+	p++;
+
+	if (compression < NONE || compression > DWAB || compression == PXR24 || compression == B44 || compression == B44A)
+	{
+		return fail("unsupported compression " + std::to_string(compression));
+	}
+	if (channels.empty())
+	{
+		return fail("no channels");
+	}
+	const int64_t fullWidth = (int64_t)xMax - xMin + 1, fullHeight = (int64_t)yMax - yMin + 1;
+	if (fullWidth <= 0 || fullHeight <= 0)
+	{
+		return fail("empty data window");
+	}
+	if (fullWidth > 65536 || fullHeight > 65536)
+	{
+		return fail("image too large");
+	}
+	const int width = (int)fullWidth, height = (int)fullHeight;
+	if (tiled && (tileWidth <= 0 || tileHeight <= 0))
+	{
+		return fail("invalid tile size");
+	}
+
+	size_t pixelBytes = 0;
+	for (const ChannelInfo &ch : channels)
+	{
+		pixelBytes += sampleBytes(ch.type);
+	}
+	// Mipmapped files list the full-resolution tiles first
+	const int tilesX = tiled ? (width + tileWidth - 1) / tileWidth : 1, tilesY = tiled ? (height + tileHeight - 1) / tileHeight : 1;
+	const int linesPerBlock = linesPerChunk(compression);
+	const int chunks = tiled ? tilesX * tilesY : (height + linesPerBlock - 1) / linesPerBlock;
+	if ((size_t)(end - p) / 8 < (size_t)chunks)
+	{
+		return fail("truncated chunk offset table");
+	}
+
+	image.width = width;
+	image.height = height;
+	image.channels.clear();
+	image.planes.assign(channels.size(), std::vector<float>((size_t)width * height));
+	for (const ChannelInfo &ch : channels)
+	{
+		image.channels.push_back(ch.name);
+	}
+
+	// Chunks are independent; each one fills its own rectangle of the planes
+	std::vector<const char *> errors(chunks, nullptr);
+	auto decodeChunk = [&](int index)
+	{
+		const uint64_t offset = read<uint64_t>(p + (size_t)index * 8);
+		const size_t headerBytes = tiled ? 20 : 8;
+		if (offset > file.size() || file.size() - offset < headerBytes)
+		{
+			errors[index] = "chunk outside the file";
+			return;
+		}
+		const unsigned char *chunk = file.data() + offset;
+		int x0 = 0, y0, w = width, lines;
+		if (tiled)
+		{
+			const int tx = read<int>(chunk), ty = read<int>(chunk + 4);
+			if (read<int>(chunk + 8) != 0 || read<int>(chunk + 12) != 0 || tx < 0 || ty < 0 || tx >= tilesX || ty >= tilesY)
+			{
+				errors[index] = "damaged tile";
+				return;
+			}
+			x0 = tx * tileWidth;
+			y0 = ty * tileHeight;
+			w = std::min(tileWidth, width - x0);
+			lines = std::min(tileHeight, height - y0);
+		}
+		else
+		{
+			const int64_t y = (int64_t)read<int>(chunk) - yMin;
+			y0 = y >= 0 && y < height ? (int)y : -1;
+			lines = std::min(linesPerBlock, height - y0);
+		}
+		const int size = read<int>(chunk + headerBytes - 4);
+		if (y0 < 0 || lines <= 0 || size < 0 || file.size() - offset - headerBytes < (size_t)size)
+		{
+			errors[index] = "damaged chunk";
+			return;
+		}
+
+		const size_t expected = pixelBytes * w * lines;
+		const unsigned char *data = chunk + headerBytes;
+		std::vector<unsigned char> raw;
+		// A chunk that didn't shrink is stored raw
+		if ((size_t)size < expected)
+		{
+			raw.resize(expected);
+			errors[index] = decompress(compression, data, size, channels, w, lines, raw.data(), expected);
+			if (errors[index] != nullptr)
+			{
+				return;
+			}
+			data = raw.data();
+		}
+		else if ((size_t)size != expected)
+		{
+			errors[index] = "damaged chunk";
+			return;
+		}
+
+		// Each line holds every channel's row in turn
+		for (int l = 0; l < lines; l++)
+		{
+			for (size_t k = 0; k < channels.size(); k++)
+			{
+				float *dst = image.planes[k].data() + (size_t)(y0 + l) * width + x0;
+				sampleRowToFloat(channels[k].type, data, dst, w);
+				data += (size_t)w * sampleBytes(channels[k].type);
+			}
+		}
+	};
+	if (parallel)
+	{
+		ParallelFor(0, chunks, decodeChunk);
+	}
+	else
+	{
+		for (int c = 0; c < chunks; c++)
+		{
+			decodeChunk(c);
+		}
+	}
+	for (const char *message : errors)
+	{
+		if (message != nullptr)
+		{
+			return fail(message);
+		}
+	}
+	return true;
+}
+
+// Load time of an EXR on one thread and on every core, then the half / 8-bit conversions scalar
+// against SIMD
+inline void RunExrBenchmark(const std::string &path)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+	auto best = [](int reps, auto body)
+	{
+		double ms = 1e30;
+		for (int r = 0; r < reps; r++)
+		{
+			auto t0 = Clock::now();
+			body();
+			ms = std::min(ms, std::chrono::duration<double, std::milli>(Clock::now() - t0).count());
+		}
+		return ms;
+	};
+
+	ExrImage image;
+	std::string error;
+	if (!LoadExr(path, image, &error))
+	{
+		printf("%s: %s\n", path.c_str(), error.c_str());
+		return;
+	}
+	const double mpixels = (double)image.width * image.height * 1e-6;
+	printf("%s: %dx%d, %zu channels (best of 3, %u hardware threads)\n",
+		path.c_str(), image.width, image.height, image.channels.size(), std::thread::hardware_concurrency());
+
+	for (int parallel = 0; parallel < 2; parallel++)
+	{
+		ExrImage again;
+		double ms = best(3, [&]() { LoadExr(path, again, nullptr, parallel != 0); });
+		printf("  load %-12s %9.2f ms  %7.1f Mpixel/s\n", parallel ? "all threads" : "1 thread", ms, mpixels / ms * 1e3);
+	}
+
+	const std::vector<std::string> names(image.channels.begin(), image.channels.end());
+	std::vector<uint16_t> halves[2];
+	std::vector<unsigned char> bytes[2];
+	for (int simd = 0; simd < 2; simd++)
+	{
+		double ms = best(3, [&]() { halves[simd] = image.ToHalf(names, simd != 0); });
+		printf("  to half  %-8s %9.2f ms\n", simd ? "SIMD" : "scalar", ms);
+	}
+	for (int simd = 0; simd < 2; simd++)
+	{
+		double ms = best(3, [&]() { bytes[simd] = image.ToUNorm8(names, simd != 0); });
+		printf("  to 8-bit %-8s %9.2f ms\n", simd ? "SIMD" : "scalar", ms);
+	}
+
+	// Half back to float over the whole image
+	std::vector<float> floats(halves[0].size());
+	for (int simd = 0; simd < 2; simd++)
+	{
+		double ms = best(3, [&]() { ExrDetail::halfToFloatRow((const unsigned char *)halves[1].data(), floats.data(), (int)floats.size(), simd != 0); });
+		printf("  half to float %-8s %4.2f ms\n", simd ? "SIMD" : "scalar", ms);
+	}
+	if (halves[0] != halves[1] || bytes[0] != bytes[1])
+	{
+		printf("  (SIMD output differs from the scalar output)\n");
+	}
+}
@@ -0,0 +1,459 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "SOIL2/stb_image_write.h"
+
+// jo_jpeg is compiled as C inside SOIL2 and its header has no extern "C" block of its own
+extern "C" int jo_write_jpg(const char *filename, const void *data, int width, int height, int comp, int quality);
+
+enum class CaptureFormat
+{
+	Png,
+	Jpeg,
+	Raw		// One stream of packed top-down RGB24 frames, no header (ffmpeg -f rawvideo -pix_fmt rgb24)
+};
+
+// Command line of the frame capture:
+//   --capture dir|file.raw      numbered frames into dir, or every frame appended to one raw stream
+//   --capture-format png|jpg    format of the numbered frames (png by default)
+//   --capture-quality N         JPEG quality, 1 to 100
+//   --capture-ring N            readbacks in flight before the oldest has to be waited for, 2 to 8
+//   --capture-threads N         encoder threads (one per core but the GL thread's by default)
+struct CaptureOptions
+{
+	std::string path;
+	CaptureFormat format = CaptureFormat::Png;
+	int quality = 90;
+	int ring = 3;
+	int threads = 0;
+};
+
+inline void ParseCaptureOptions(int argc, char **argv, CaptureOptions &options)
+{
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--capture")
+		{
+			options.path = argv[++i];
+			const std::string ext = std::filesystem::path(options.path).extension().string();
+			if (ext == ".raw" || ext == ".rgb")
+			{
+				options.format = CaptureFormat::Raw;
+			}
+		}
+		else if (arg == "--capture-format")
+		{
+			std::string format = argv[++i];
+			if (options.format != CaptureFormat::Raw)
+			{
+				options.format = (format == "jpg" || format == "jpeg") ? CaptureFormat::Jpeg : CaptureFormat::Png;
+			}
+		}
+		else if (arg == "--capture-quality")
+		{
+			options.quality = std::min(std::max(std::atoi(argv[++i]), 1), 100);
+		}
+		else if (arg == "--capture-ring")
+		{
+			options.ring = std::min(std::max(std::atoi(argv[++i]), 2), 8);
+		}
+		else if (arg == "--capture-threads")
+		{
+			options.threads = std::max(0, std::atoi(argv[++i]));
+		}
+	}
+}
+
+// Records rendered frames without stalling the GL thread on them. Each Capture() only queues a
+// glReadPixels into the next pixel pack buffer of a small ring and fences it; the copy is mapped a
+// frame or more later, once the fence says the GPU is done with it, so the read never waits on the
+// frame just drawn. Mapped pixels are flipped into a recycled CPU buffer and handed to a pool of
+// encoder threads (stb_image_write for PNG, jo_jpeg for JPEG, a single ordered writer for the raw
+// stream), so compression runs beside the render loop instead of inside it.
+//
+// Nothing is dropped: when the ring is full the oldest copy is waited for, and when the encoders fall
+// behind by more than a few frames the GL thread waits for room. Both waits are timed so a run can
+// tell whether it kept up. stb_image_write's PNG takes around 100 ms for a 720p frame, so a sequence
+// at frame rate wants several encoder threads, JPEG (about a fifth of that) or the raw stream.
+class FrameCapture
+{
+public:
+	FrameCapture() : width(0), height(0), issued(0), collected(0), frames(0), written(0), failed(0),
+		ringWaits(0), encoderWaits(0), waitMs(0.0), maxQueued(0), stopping(false), active(false), stream(nullptr)
+	{
+	}
+
+	~FrameCapture()
+	{
+		this->Stop();
+	}
+
+	// Needs the GL context current. Frame numbers carry on across Stop()/Start(), and a raw stream that
+	// was already started is appended to.
+	bool Start(const CaptureOptions &options, int width, int height)
+	{
+		this->Stop();
+		this->options = options;
+		this->width = width;
+		this->height = height;
+		this->error.clear();
+
+		std::error_code ec;
+		if (options.format == CaptureFormat::Raw)
+		{
+			std::filesystem::path dir = std::filesystem::path(options.path).parent_path();
+			if (!dir.empty())
+			{
+				std::filesystem::create_directories(dir, ec);
+			}
+			this->stream = fopen(options.path.c_str(), this->frames == 0 ? "wb" : "ab");
+			if (this->stream == nullptr)
+			{
+				this->error = "can't open " + options.path;
+				std::cerr << "ERROR::FRAMECAPTURE::" << this->error << std::endl;
+				return false;
+			}
+		}
+		else
+		{
+			std::filesystem::create_directories(options.path, ec);
+			if (!std::filesystem::is_directory(options.path, ec))
+			{
+				this->error = "can't create " + options.path;
+				std::cerr << "ERROR::FRAMECAPTURE::" << this->error << std::endl;
+				return false;
+			}
+		}
+
+		this->slots.resize(std::min(std::max(options.ring, 2), 8));
+		for (Slot &s : this->slots)
+		{
+			glGenBuffers(1, &s.pbo);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+			glBufferData(GL_PIXEL_PACK_BUFFER, this->frameBytes(), nullptr, GL_STREAM_READ);
+			s.fence = nullptr;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		this->issued = this->collected = 0;
+
+		// The raw stream has to stay in frame order, so it gets exactly one writer
+		int threads = options.threads;
+		if (threads <= 0)
+		{
+			unsigned int hw = std::thread::hardware_concurrency();
+			threads = hw > 1 ? (int)hw - 1 : 1;
+		}
+		if (options.format == CaptureFormat::Raw)
+		{
+			threads = 1;
+		}
+		this->maxQueued = threads * 2 + 2;
+		this->stopping = false;
+		for (int i = 0; i < threads; i++)
+		{
+			this->workers.emplace_back(&FrameCapture::workerLoop, this);
+		}
+		this->active = true;
+		return true;
+	}
+
+	// GL thread, once the frame is complete and before the swap: queues the readback of 'framebuffer'
+	// (0 for the window's back buffer) and hands every earlier copy that has already landed to the
+	// encoders
+	void Capture(GLuint framebuffer)
+	{
+		if (!this->active)
+		{
+			return;
+		}
+		const long long ring = (long long)this->slots.size();
+		if (this->issued - this->collected == ring)
+		{
+			this->collect(true);
+		}
+
+		Slot &s = this->slots[this->issued % ring];
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+		glReadBuffer(framebuffer ? GL_COLOR_ATTACHMENT0 : GL_BACK);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+		glReadPixels(0, 0, this->width, this->height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		this->issued++;
+
+		// The copy just queued is never waited for here; older ones are taken only if already done
+		while (this->issued - this->collected > 1 && this->collect(false))
+		{
+		}
+	}
+
+	// Waits for the copies in flight and for the encoders, then frees the buffers and closes the stream
+	void Stop()
+	{
+		if (!this->active)
+		{
+			return;
+		}
+		while (this->collected < this->issued)
+		{
+			this->collect(true);
+		}
+		for (Slot &s : this->slots)
+		{
+			glDeleteBuffers(1, &s.pbo);
+		}
+		this->slots.clear();
+
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->stopping = true;
+		}
+		this->wake.notify_all();
+		for (std::thread &t : this->workers)
+		{
+			t.join();
+		}
+		this->workers.clear();
+		this->spare.clear();
+
+		if (this->stream != nullptr)
+		{
+			fclose(this->stream);
+			this->stream = nullptr;
+		}
+		this->active = false;
+		if (this->failed > 0)
+		{
+			this->error = std::to_string(this->failed) + " frames could not be written to " + this->options.path;
+			std::cerr << "ERROR::FRAMECAPTURE::" << this->error << std::endl;
+		}
+	}
+
+	bool IsActive() const
+	{
+		return this->active;
+	}
+
+	const CaptureOptions &GetOptions() const
+	{
+		return this->options;
+	}
+
+	// Frames handed to the encoders so far (across every Start())
+	long long GetFrameCount() const
+	{
+		return this->frames;
+	}
+
+	// Frames that reached the disk; only settled after Stop()
+	long long GetWrittenCount() const
+	{
+		return this->written;
+	}
+
+	// Times the GL thread had to wait because the ring was full or the encoders were behind
+	int GetRingWaits() const
+	{
+		return this->ringWaits;
+	}
+
+	int GetEncoderWaits() const
+	{
+		return this->encoderWaits;
+	}
+
+	double GetWaitMs() const
+	{
+		return this->waitMs;
+	}
+
+	const std::string &GetError() const
+	{
+		return this->error;
+	}
+
+private:
+	struct Slot
+	{
+		GLuint pbo = 0;
+		GLsync fence = nullptr;
+	};
+
+	struct Job
+	{
+		long long frame = 0;
+		std::vector<unsigned char> pixels;	// Top-down RGBA
+	};
+
+	typedef std::chrono::steady_clock Clock;
+
+	CaptureOptions options;
+	int width, height;
+	std::vector<Slot> slots;
+	long long issued, collected;	// Readbacks queued / mapped, GL thread only
+	long long frames;
+	long long written, failed;		// Guarded by mutex
+	int ringWaits, encoderWaits;
+	double waitMs;
+	size_t maxQueued;
+	bool stopping, active;
+	FILE *stream;
+	std::string error;
+
+	std::vector<std::thread> workers;
+	std::deque<Job> queue;
+	std::vector<std::vector<unsigned char>> spare;	// Recycled frame buffers
+	std::mutex mutex;
+	std::condition_variable wake;	// Workers: a job or the stop request arrived
+	std::condition_variable room;	// GL thread: a worker took a job off the queue
+
+	size_t frameBytes() const
+	{
+		return (size_t)this->width * this->height * 4;
+	}
+
+	// Maps the oldest readback into a job. Without 'wait' it gives up when the GPU isn't done yet.
+	bool collect(bool wait)
+	{
+		Slot &s = this->slots[this->collected % (long long)this->slots.size()];
+		GLenum status = glClientWaitSync(s.fence, 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED)
+		{
+			if (!wait)
+			{
+				return false;
+			}
+			Clock::time_point start = Clock::now();
+			do
+			{
+				status = glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000);
+			} while (status == GL_TIMEOUT_EXPIRED);
+			this->ringWaits++;
+			this->waitMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		}
+		glDeleteSync(s.fence);
+		s.fence = nullptr;
+
+		Job job;
+		job.frame = this->frames++;
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			if (this->queue.size() >= this->maxQueued)
+			{
+				Clock::time_point start = Clock::now();
+				this->room.wait(lock, [this] { return this->queue.size() < this->maxQueued; });
+				this->encoderWaits++;
+				this->waitMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			}
+			if (!this->spare.empty())
+			{
+				job.pixels.swap(this->spare.back());
+				this->spare.pop_back();
+			}
+		}
+		job.pixels.resize(this->frameBytes());
+
+		// GL rows come bottom-up; the flip costs nothing beyond the copy out of the mapping
+		const size_t row = (size_t)this->width * 4;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+		const unsigned char *src = (const unsigned char *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, this->frameBytes(), GL_MAP_READ_BIT);
+		if (src != nullptr)
+		{
+			for (int y = 0; y < this->height; y++)
+			{
+				std::memcpy(&job.pixels[(size_t)(this->height - 1 - y) * row], src + (size_t)y * row, row);
+			}
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		else
+		{
+			std::memset(job.pixels.data(), 0, job.pixels.size());
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		this->collected++;
+
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->queue.push_back(std::move(job));
+		}
+		this->wake.notify_one();
+		return true;
+	}
+
+	void workerLoop()
+	{
+		for (;;)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(this->mutex);
+				this->wake.wait(lock, [this] { return this->stopping || !this->queue.empty(); });
+				if (this->queue.empty())
+				{
+					return;
+				}
+				job = std::move(this->queue.front());
+				this->queue.pop_front();
+			}
+			this->room.notify_one();
+
+			const bool ok = this->encode(job);
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				(ok ? this->written : this->failed)++;
+				this->spare.push_back(std::move(job.pixels));
+			}
+		}
+	}
+
+	bool encode(Job &job)
+	{
+		const int w = this->width, h = this->height;
+		unsigned char *px = job.pixels.data();
+		if (this->options.format == CaptureFormat::Jpeg)
+		{
+			// jo_jpeg reads 4 components as RGBX, so the alpha left by blending is simply ignored
+			return jo_write_jpg(this->frameName(job.frame, "jpg").c_str(), px, w, h, 4, this->options.quality) != 0;
+		}
+
+		// Alpha isn't meaningful in the frame, so PNG and raw get packed RGB (in place, front to back)
+		const size_t count = (size_t)w * h;
+		for (size_t i = 0; i < count; i++)
+		{
+			px[i * 3 + 0] = px[i * 4 + 0];
+			px[i * 3 + 1] = px[i * 4 + 1];
+			px[i * 3 + 2] = px[i * 4 + 2];
+		}
+		if (this->options.format == CaptureFormat::Png)
+		{
+			return stbi_write_png(this->frameName(job.frame, "png").c_str(), w, h, 3, px, w * 3) != 0;
+		}
+		return fwrite(px, 1, count * 3, this->stream) == count * 3;
+	}
+
+	std::string frameName(long long frame, const char *ext) const
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "frame_%06lld.%s", frame, ext);
+		return (std::filesystem::path(this->options.path) / name).string();
+	}
+};
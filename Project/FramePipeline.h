@@ -0,0 +1,333 @@
+#pragma once
+
+// Std. Includes
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+class Model;
+class TextureArrayBatch;
+
+// Program a recorded draw is replayed with
+enum DrawProgram
+{
+	DRAW_PROCEDURAL,
+	DRAW_MODEL
+};
+
+// How a draw takes part in the sun's shadow maps (see ShadowCascades.h)
+enum ShadowCaster
+{
+	SHADOW_NONE,		// Doesn't cast (transparent, emissive)
+	SHADOW_STATIC,		// Cached in the static cascades
+	SHADOW_DYNAMIC		// Moves: drawn over the cached cascades every frame
+};
+
+// One draw plus its per-draw uniform payload, recorded by a worker and replayed on the GL thread
+struct DrawCmd
+{
+	glm::mat4 model;
+	Model *mesh;		// DRAW_MODEL
+	TextureArrayBatch *batch;	// DRAW_MODEL, several models merged into one draw per texture array
+	GLuint vao;			// DRAW_PROCEDURAL
+	GLsizei count;
+	int program;
+	int mode;			// uMode
+	float seed;			// uSeed
+	float flicker;		// uFlicker
+	int shadow;			// ShadowCaster
+};
+
+// Command list owned by a single job. Capacity survives Clear() so steady-state frames don't allocate.
+class DrawList
+{
+public:
+	void Clear()
+	{
+		this->cmds.clear();
+		this->caster = SHADOW_STATIC;
+	}
+
+	// Shadow class of the commands added from now on; Clear() goes back to SHADOW_STATIC
+	void SetShadowCaster(ShadowCaster caster)
+	{
+		this->caster = caster;
+	}
+
+	void AddModel(Model *mesh, const glm::mat4 &model)
+	{
+		DrawCmd c;
+		c.model = model;
+		c.mesh = mesh;
+		c.batch = nullptr;
+		c.vao = 0;
+		c.count = 0;
+		c.program = DRAW_MODEL;
+		c.mode = 0;
+		c.seed = 0.0f;
+		c.flicker = 1.0f;
+		c.shadow = this->caster;
+		this->cmds.push_back(c);
+	}
+
+	void AddBatch(TextureArrayBatch *batch, const glm::mat4 &model)
+	{
+		DrawCmd c;
+		c.model = model;
+		c.mesh = nullptr;
+		c.batch = batch;
+		c.vao = 0;
+		c.count = 0;
+		c.program = DRAW_MODEL;
+		c.mode = 0;
+		c.seed = 0.0f;
+		c.flicker = 1.0f;
+		c.shadow = this->caster;
+		this->cmds.push_back(c);
+	}
+
+	void AddProcedural(GLuint vao, GLsizei count, const glm::mat4 &model, int mode, float seed = 0.0f, float flicker = 1.0f)
+	{
+		DrawCmd c;
+		c.model = model;
+		c.mesh = nullptr;
+		c.batch = nullptr;
+		c.vao = vao;
+		c.count = count;
+		c.program = DRAW_PROCEDURAL;
+		c.mode = mode;
+		c.seed = seed;
+		c.flicker = flicker;
+		c.shadow = this->caster;
+		this->cmds.push_back(c);
+	}
+
+	const std::vector<DrawCmd> &GetCommands() const
+	{
+		return this->cmds;
+	}
+
+private:
+	std::vector<DrawCmd> cmds;
+	ShadowCaster caster = SHADOW_STATIC;
+};
+
+// Splits per-frame CPU work (matrix construction, culling, animation, uniform packing) into jobs that
+// worker threads run into their own DrawList. Finished frames are handed to the GL thread through a
+// small ring of packets whose state is published with atomics, so the GL thread never takes a lock:
+// it replays frame N while the workers prepare frame N+1.
+template <typename Inputs>
+class FramePipeline
+{
+public:
+	typedef std::function<void(const Inputs &, DrawList &)> Job;
+
+	struct Packet
+	{
+		Inputs inputs;
+		std::vector<DrawList> lists;	// One per job, replayed in registration order
+		uint64_t frame;
+	};
+
+	explicit FramePipeline(int workers = 0) : workerCount(workers), submitted(0), replayed(0), stopping(false)
+	{
+		for (Slot &s : this->slots)
+		{
+			s.state.store(SLOT_FREE);
+			s.nextJob.store(0);
+			s.remaining.store(0);
+		}
+	}
+
+	~FramePipeline()
+	{
+		this->Stop();
+	}
+
+	// Jobs must be registered before Start(). Different jobs run concurrently and may only read shared
+	// scene data; the same job never overlaps itself and sees frames in order, so it may keep state
+	// (caches, hierarchies) across frames.
+	void AddJob(Job job)
+	{
+		this->jobs.push_back(job);
+	}
+
+	void Start()
+	{
+		int n = this->workerCount;
+		if (n <= 0)
+		{
+			unsigned int hw = std::thread::hardware_concurrency();
+			n = hw > 1 ? (int)hw - 1 : 1;	// Leave a core for the GL thread
+		}
+		for (Slot &s : this->slots)
+		{
+			s.packet.lists.resize(this->jobs.size());
+		}
+		this->jobFrames.reset(new std::atomic<uint64_t>[this->jobs.size()]);
+		for (size_t j = 0; j < this->jobs.size(); j++)
+		{
+			this->jobFrames[j].store(0);
+		}
+		for (int i = 0; i < n; i++)
+		{
+			this->workers.emplace_back(&FramePipeline::workerLoop, this);
+		}
+	}
+
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(this->wakeMutex);
+			this->stopping = true;
+		}
+		this->wake.notify_all();
+		for (std::thread &t : this->workers)
+		{
+			t.join();
+		}
+		this->workers.clear();
+	}
+
+	// GL thread: hands the inputs of a new frame to the workers. Only waits if every slot is still in flight.
+	void Submit(const Inputs &inputs)
+	{
+		Slot &s = this->slots[this->submitted.load(std::memory_order_relaxed) % SLOT_COUNT];
+		while (s.state.load(std::memory_order_acquire) != SLOT_FREE)
+		{
+			std::this_thread::yield();
+		}
+
+		s.packet.inputs = inputs;
+		s.packet.frame = this->submitted.load(std::memory_order_relaxed);
+		s.remaining.store((int)this->jobs.size(), std::memory_order_relaxed);
+		s.state.store(this->jobs.empty() ? SLOT_READY : SLOT_BUILDING, std::memory_order_relaxed);
+		// Publishing the job counter last: a worker that still holds this slot from an older frame
+		// either sees the exhausted counter or the fresh one together with the new inputs
+		s.nextJob.store(0, std::memory_order_release);
+
+		{
+			std::lock_guard<std::mutex> lock(this->wakeMutex);
+			this->submitted.fetch_add(1, std::memory_order_release);
+		}
+		this->wake.notify_all();
+	}
+
+	// GL thread: returns the oldest prepared frame once more than 'lead' newer frames have been submitted
+	// (lead = 1 pipelines one frame ahead), or nullptr. Waits for the workers if they are still on it.
+	const Packet *Acquire(uint64_t lead = 1)
+	{
+		uint64_t r = this->replayed;
+		if (this->submitted.load(std::memory_order_acquire) <= r + lead)
+		{
+			return nullptr;
+		}
+
+		Slot &s = this->slots[r % SLOT_COUNT];
+		while (s.state.load(std::memory_order_acquire) != SLOT_READY)
+		{
+			std::this_thread::yield();
+		}
+		return &s.packet;
+	}
+
+	// GL thread: gives the packet returned by Acquire() back to the ring
+	void Release()
+	{
+		this->slots[this->replayed % SLOT_COUNT].state.store(SLOT_FREE, std::memory_order_release);
+		this->replayed++;
+	}
+
+private:
+	enum SlotState
+	{
+		SLOT_FREE,
+		SLOT_BUILDING,
+		SLOT_READY
+	};
+
+	struct Slot
+	{
+		Packet packet;
+		std::atomic<int> state;
+		std::atomic<int> nextJob;
+		std::atomic<int> remaining;
+	};
+
+	static const int SLOT_COUNT = 3;
+
+	std::vector<Job> jobs;
+	std::vector<std::thread> workers;
+	int workerCount;
+	Slot slots[SLOT_COUNT];
+	std::atomic<uint64_t> submitted;
+	uint64_t replayed;		// GL thread only
+	std::unique_ptr<std::atomic<uint64_t>[]> jobFrames;	// Frames each job has finished
+
+	// Only used to park idle workers, never on the handoff path
+	std::mutex wakeMutex;
+	std::condition_variable wake;
+	bool stopping;
+
+	void workerLoop()
+	{
+		uint64_t seen = 0;
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(this->wakeMutex);
+				this->wake.wait(lock, [&]() { return this->stopping || this->submitted.load(std::memory_order_acquire) != seen; });
+				if (this->stopping)
+				{
+					return;
+				}
+			}
+
+			uint64_t target = this->submitted.load(std::memory_order_acquire);
+			while (seen < target)
+			{
+				this->runJobs(this->slots[seen % SLOT_COUNT]);
+				seen++;
+			}
+		}
+	}
+
+	void runJobs(Slot &s)
+	{
+		for (;;)
+		{
+			int j = s.nextJob.fetch_add(1, std::memory_order_acq_rel);
+			if (j >= (int)this->jobs.size())
+			{
+				return;
+			}
+
+			// Another worker may still be running this job for the previous frame
+			uint64_t frame = s.packet.frame;
+			while (this->jobFrames[j].load(std::memory_order_acquire) != frame)
+			{
+				std::this_thread::yield();
+			}
+
+			DrawList &list = s.packet.lists[j];
+			list.Clear();
+			this->jobs[j](s.packet.inputs, list);
+			this->jobFrames[j].store(frame + 1, std::memory_order_release);
+
+			// Last job out publishes the packet
+			if (s.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				s.state.store(SLOT_READY, std::memory_order_release);
+			}
+		}
+	}
+};
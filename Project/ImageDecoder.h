@@ -0,0 +1,204 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "SOIL2/image_helper.h"
+#include "SOIL2/stb_image.h"
+
+// Sample type of decoded pixels
+enum class PixelFormat
+{
+	UInt8,
+	UInt16,
+	Float	// Linear; 8-bit files are converted with stb_image's default 2.2 gamma
+};
+
+// Decoded pixels, tightly packed rows of width * channels samples, top row first unless flipped
+struct DecodedImage
+{
+	int width = 0, height = 0, channels = 0;
+	PixelFormat format = PixelFormat::UInt8;
+	std::vector<unsigned char> pixels;
+	std::string error;	// Why the decode failed
+
+	size_t RowBytes() const
+	{
+		return (size_t)this->width * this->channels * SampleBytes(this->format);
+	}
+
+	const uint16_t *Data16() const
+	{
+		return (const uint16_t *)this->pixels.data();
+	}
+
+	const float *DataFloat() const
+	{
+		return (const float *)this->pixels.data();
+	}
+
+	static size_t SampleBytes(PixelFormat format)
+	{
+		return format == PixelFormat::UInt8 ? 1 : (format == PixelFormat::UInt16 ? 2 : 4);
+	}
+};
+
+// The one way images are decoded (TextureCache, terrain heights, material packing): every option is
+// per call and the result, errors included, lives in the DecodedImage, so any number of threads can
+// decode at once. stb_image is compiled once, inside SOIL2, with a per-thread failure reason; its
+// global settings (stbi_set_flip_vertically_on_load and friends) are never touched, flipping is done
+// here instead.
+//
+// 8-bit decodes can be reduced by a power of two on the way in. JPEGs are decoded straight at 1/2,
+// 1/4 or 1/8 size by a reduced IDCT, which skips most of the work and never holds the full-size image;
+// other formats decode at full size and are box-filtered down. A reduced JPEG rounds its size up (a
+// 1001-wide image at 1/2 is 501), a filtered image rounds it down.
+class ImageDecoder
+{
+public:
+	struct Options
+	{
+		int channels = 0;	// 1 to 4, or 0 for what the file has
+		PixelFormat format = PixelFormat::UInt8;
+		bool flipVertically = false;	// Bottom row first, as glTexImage2D expects
+		int reduce = 0;		// log2 of the reduction, 0 to 3; UInt8 only
+		bool srgb = false;	// Filter color channels in linear space when reducing
+	};
+
+	// Size and channel count from the header alone
+	static bool Info(const std::string &path, int &width, int &height, int &channels)
+	{
+		return stbi_info(path.c_str(), &width, &height, &channels) != 0;
+	}
+
+	// Reduction (0 to 3) that brings the file within maxSize texels on its longest side, or 0 when it
+	// already fits, can't be read, or maxSize is 0
+	static int ReductionFor(const std::string &path, int maxSize)
+	{
+		int width = 0, height = 0, channels = 0;
+		if (maxSize <= 0 || !Info(path, width, height, channels))
+		{
+			return 0;
+		}
+		int reduce = 0;
+		while (reduce < 3 && (std::max(width, height) >> reduce) > maxSize)
+		{
+			reduce++;
+		}
+		return reduce;
+	}
+
+	static bool Decode(const std::string &path, const Options &options, DecodedImage &out)
+	{
+		const char *file = path.c_str();
+		return decode(options, out, [&](int *w, int *h, int *c) -> void *
+		{
+			switch (options.format)
+			{
+			case PixelFormat::UInt16:
+				return stbi_load_16(file, w, h, c, options.channels);
+			case PixelFormat::Float:
+				return stbi_loadf(file, w, h, c, options.channels);
+			default:
+				return stbi_load_scaled(file, w, h, c, options.channels, clampReduce(options.reduce));
+			}
+		}, [&](int *w, int *h, int *c)
+		{
+			return stbi_info(file, w, h, c) != 0;
+		});
+	}
+
+	static bool DecodeMemory(const void *data, size_t size, const Options &options, DecodedImage &out)
+	{
+		const stbi_uc *buffer = (const stbi_uc *)data;
+		const int length = (int)size;
+		return decode(options, out, [&](int *w, int *h, int *c) -> void *
+		{
+			switch (options.format)
+			{
+			case PixelFormat::UInt16:
+				return stbi_load_16_from_memory(buffer, length, w, h, c, options.channels);
+			case PixelFormat::Float:
+				return stbi_loadf_from_memory(buffer, length, w, h, c, options.channels);
+			default:
+				return stbi_load_from_memory_scaled(buffer, length, w, h, c, options.channels, clampReduce(options.reduce));
+			}
+		}, [&](int *w, int *h, int *c)
+		{
+			return stbi_info_from_memory(buffer, length, w, h, c) != 0;
+		});
+	}
+
+private:
+	static int clampReduce(int reduce)
+	{
+		return std::min(std::max(reduce, 0), 3);
+	}
+
+	template <typename Load, typename Query>
+	static bool decode(const Options &options, DecodedImage &out, Load load, Query query)
+	{
+		out = DecodedImage();
+		out.format = options.format;
+		const int reduce = options.format == PixelFormat::UInt8 ? clampReduce(options.reduce) : 0;
+
+		// Only JPEGs come back reduced; anything still at the header's size gets filtered
+		int fullWidth = 0, fullHeight = 0, ignored = 0;
+		if (reduce > 0 && !query(&fullWidth, &fullHeight, &ignored))
+		{
+			fullWidth = fullHeight = 0;
+		}
+
+		int width = 0, height = 0, channels = 0;
+		void *data = load(&width, &height, &channels);
+		if (data == nullptr)
+		{
+			const char *reason = stbi_failure_reason();
+			out.error = reason != nullptr ? reason : "unknown error";
+			return false;
+		}
+		out.channels = options.channels > 0 ? options.channels : channels;
+
+		if (reduce > 0 && width == fullWidth && height == fullHeight)
+		{
+			const int block = 1 << reduce;
+			out.width = std::max(1, width / block);
+			out.height = std::max(1, height / block);
+			out.pixels.resize((size_t)out.width * out.height * out.channels);
+			if (options.srgb)
+			{
+				mipmap_image_sRGB((const unsigned char *)data, width, height, out.channels, out.pixels.data(), block, block);
+			}
+			else
+			{
+				mipmap_image((const unsigned char *)data, width, height, out.channels, out.pixels.data(), block, block);
+			}
+		}
+		else
+		{
+			out.width = width;
+			out.height = height;
+			const unsigned char *bytes = (const unsigned char *)data;
+			out.pixels.assign(bytes, bytes + out.RowBytes() * height);
+		}
+		stbi_image_free(data);
+
+		if (options.flipVertically)
+		{
+			const size_t row = out.RowBytes();
+			std::vector<unsigned char> swap(row);
+			for (int y = 0; y < out.height / 2; y++)
+			{
+				unsigned char *a = &out.pixels[(size_t)y * row], *b = &out.pixels[(size_t)(out.height - 1 - y) * row];
+				std::memcpy(swap.data(), a, row);
+				std::memcpy(a, b, row);
+				std::memcpy(b, swap.data(), row);
+			}
+		}
+		return true;
+	}
+};
@@ -0,0 +1,387 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// GL Includes
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define INSTANCE_USE_SSE 1
+#endif
+// Project.vcxproj builds with /arch:AVX2; elsewhere the 8-wide kernels need -mavx or newer
+#if defined(__AVX__)
+#include <immintrin.h>
+#define INSTANCE_USE_AVX 1
+#endif
+
+#include "Parallel.h"
+
+// Per-instance transform parameters stored as parallel arrays (SoA) so the kernels can load
+// 4 or 8 instances per register. Angles are in radians.
+struct InstanceBatch
+{
+	std::vector<float> px, py, pz;
+	std::vector<float> yaw;				// Around Y
+	std::vector<float> tiltX, tiltZ;	// Small lean after the yaw
+	std::vector<float> sx, sy, sz;
+
+	void Add(const glm::vec3 &position, float yawRad, float scale)
+	{
+		this->Add(position, yawRad, 0.0f, 0.0f, glm::vec3(scale));
+	}
+
+	void Add(const glm::vec3 &position, float yawRad, float tiltXRad, float tiltZRad, const glm::vec3 &scale)
+	{
+		this->px.push_back(position.x);
+		this->py.push_back(position.y);
+		this->pz.push_back(position.z);
+		this->yaw.push_back(yawRad);
+		this->tiltX.push_back(tiltXRad);
+		this->tiltZ.push_back(tiltZRad);
+		this->sx.push_back(scale.x);
+		this->sy.push_back(scale.y);
+		this->sz.push_back(scale.z);
+	}
+
+	void Clear()
+	{
+		*this = InstanceBatch();
+	}
+
+	int Size() const
+	{
+		return (int)this->px.size();
+	}
+};
+
+// Every kernel writes out[i] = T(p) * Ry(yaw) * Rx(tiltX) * Rz(tiltZ) * S(s) * fix, where 'fix' is a
+// constant model-space correction (e.g. the -90 degree X rotation of Z-up exports).
+namespace InstanceKernels
+{
+	// Rotation * scale * fix columns for one instance, shared by the scalar path and the SIMD tails
+	template <typename T>
+	inline void composeColumns(T ca, T sa, T cb, T sb, T cc, T sc, T sx, T sy, T sz, const glm::mat3 &fix, T m[9])
+	{
+		// Ry(a) * Rx(b) * Rz(c), columns scaled by S
+		T r0x = (ca * cc + sa * sb * sc) * sx, r0y = (cb * sc) * sx, r0z = (ca * sb * sc - sa * cc) * sx;
+		T r1x = (sa * sb * cc - ca * sc) * sy, r1y = (cb * cc) * sy, r1z = (sa * sc + ca * sb * cc) * sy;
+		T r2x = (sa * cb) * sz, r2y = (T(0) - sb) * sz, r2z = (ca * cb) * sz;
+
+		for (int j = 0; j < 3; j++)
+		{
+			T fx = T(fix[j].x), fy = T(fix[j].y), fz = T(fix[j].z);
+			m[j * 3 + 0] = r0x * fx + r1x * fy + r2x * fz;
+			m[j * 3 + 1] = r0y * fx + r1y * fy + r2y * fz;
+			m[j * 3 + 2] = r0z * fx + r1z * fy + r2z * fz;
+		}
+	}
+
+	inline void buildScalar(const InstanceBatch &in, const glm::mat3 &fix, glm::mat4 *out, int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			float m[9];
+			composeColumns<float>(std::cos(in.yaw[i]), std::sin(in.yaw[i]), std::cos(in.tiltX[i]), std::sin(in.tiltX[i]),
+				std::cos(in.tiltZ[i]), std::sin(in.tiltZ[i]), in.sx[i], in.sy[i], in.sz[i], fix, m);
+
+			float *o = &out[i][0][0];
+			o[0] = m[0]; o[1] = m[1]; o[2] = m[2]; o[3] = 0.0f;
+			o[4] = m[3]; o[5] = m[4]; o[6] = m[5]; o[7] = 0.0f;
+			o[8] = m[6]; o[9] = m[7]; o[10] = m[8]; o[11] = 0.0f;
+			o[12] = in.px[i]; o[13] = in.py[i]; o[14] = in.pz[i]; o[15] = 1.0f;
+		}
+	}
+
+#ifdef INSTANCE_USE_SSE
+	// Thin wrapper so composeColumns and SinCos are written once for 4 and 8 lanes
+	struct F4
+	{
+		__m128 v;
+		F4() {}
+		F4(__m128 x) : v(x) {}
+		explicit F4(float x) : v(_mm_set1_ps(x)) {}
+		static F4 Load(const float *p) { return F4(_mm_loadu_ps(p)); }
+	};
+	inline F4 operator+(F4 a, F4 b) { return F4(_mm_add_ps(a.v, b.v)); }
+	inline F4 operator-(F4 a, F4 b) { return F4(_mm_sub_ps(a.v, b.v)); }
+	inline F4 operator*(F4 a, F4 b) { return F4(_mm_mul_ps(a.v, b.v)); }
+	inline F4 operator/(F4 a, F4 b) { return F4(_mm_div_ps(a.v, b.v)); }
+	inline F4 Abs(F4 a) { return F4(_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)); }
+	inline F4 SignBit(F4 a) { return F4(_mm_and_ps(_mm_set1_ps(-0.0f), a.v)); }
+	inline F4 Xor(F4 a, F4 b) { return F4(_mm_xor_ps(a.v, b.v)); }
+	inline F4 And(F4 a, F4 b) { return F4(_mm_and_ps(a.v, b.v)); }
+	inline F4 Or(F4 a, F4 b) { return F4(_mm_or_ps(a.v, b.v)); }
+	inline F4 Select(F4 mask, F4 a, F4 b) { return F4(_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v))); }
+	inline F4 Equal(F4 a, F4 b) { return F4(_mm_cmpeq_ps(a.v, b.v)); }
+	inline F4 GreaterEqual(F4 a, F4 b) { return F4(_mm_cmpge_ps(a.v, b.v)); }
+	inline F4 Greater(F4 a, F4 b) { return F4(_mm_cmpgt_ps(a.v, b.v)); }
+	inline F4 Min(F4 a, F4 b) { return F4(_mm_min_ps(a.v, b.v)); }
+	inline F4 Max(F4 a, F4 b) { return F4(_mm_max_ps(a.v, b.v)); }
+	inline int MoveMask(F4 a) { return _mm_movemask_ps(a.v); }
+	inline void Store(float *p, F4 a) { _mm_storeu_ps(p, a.v); }
+	// Inputs are non-negative here, so truncation is floor
+	inline F4 Floor(F4 a) { return F4(_mm_cvtepi32_ps(_mm_cvttps_epi32(a.v))); }
+#endif
+
+#ifdef INSTANCE_USE_AVX
+	struct F8
+	{
+		__m256 v;
+		F8() {}
+		F8(__m256 x) : v(x) {}
+		explicit F8(float x) : v(_mm256_set1_ps(x)) {}
+		static F8 Load(const float *p) { return F8(_mm256_loadu_ps(p)); }
+	};
+	inline F8 operator+(F8 a, F8 b) { return F8(_mm256_add_ps(a.v, b.v)); }
+	inline F8 operator-(F8 a, F8 b) { return F8(_mm256_sub_ps(a.v, b.v)); }
+	inline F8 operator*(F8 a, F8 b) { return F8(_mm256_mul_ps(a.v, b.v)); }
+	inline F8 operator/(F8 a, F8 b) { return F8(_mm256_div_ps(a.v, b.v)); }
+	inline F8 Abs(F8 a) { return F8(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)); }
+	inline F8 SignBit(F8 a) { return F8(_mm256_and_ps(_mm256_set1_ps(-0.0f), a.v)); }
+	inline F8 Xor(F8 a, F8 b) { return F8(_mm256_xor_ps(a.v, b.v)); }
+	inline F8 And(F8 a, F8 b) { return F8(_mm256_and_ps(a.v, b.v)); }
+	inline F8 Or(F8 a, F8 b) { return F8(_mm256_or_ps(a.v, b.v)); }
+	inline F8 Select(F8 mask, F8 a, F8 b) { return F8(_mm256_blendv_ps(b.v, a.v, mask.v)); }
+	inline F8 Equal(F8 a, F8 b) { return F8(_mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ)); }
+	inline F8 GreaterEqual(F8 a, F8 b) { return F8(_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)); }
+	inline F8 Greater(F8 a, F8 b) { return F8(_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)); }
+	inline F8 Min(F8 a, F8 b) { return F8(_mm256_min_ps(a.v, b.v)); }
+	inline F8 Max(F8 a, F8 b) { return F8(_mm256_max_ps(a.v, b.v)); }
+	inline int MoveMask(F8 a) { return _mm256_movemask_ps(a.v); }
+	inline void Store(float *p, F8 a) { _mm256_storeu_ps(p, a.v); }
+	inline F8 Floor(F8 a) { return F8(_mm256_floor_ps(a.v)); }
+#endif
+
+#ifdef INSTANCE_USE_SSE
+	// Cephes-style sincos: reduce to [-pi/4, pi/4] by octant, evaluate both minimax polynomials and
+	// swap/negate per quadrant. Max error is about 2 ulp for |x| < 8192, plenty for instance angles.
+	template <typename V>
+	inline void SinCos(V x, V &s, V &c)
+	{
+		V ax = Abs(x);
+		V sign = SignBit(x);
+
+		// Quadrant index h = round-half-up(|x| * 2/pi); reduced angle r = |x| - h * pi/2
+		V h = Floor((ax * V(1.27323954473516f) + V(1.0f)) * V(0.5f));
+		V j = h + h;
+		V r = ((ax - j * V(0.78515625f)) - j * V(2.4187564849853515625e-4f)) - j * V(3.77489497744594108e-8f);
+		V z = r * r;
+
+		V ps = r + r * z * ((V(-1.9515295891e-4f) * z + V(8.3321608736e-3f)) * z - V(1.6666654611e-1f));
+		V pc = V(1.0f) - z * V(0.5f) + z * z * ((V(2.443315711809948e-5f) * z - V(1.388731625493765e-3f)) * z + V(4.166664568298827e-2f));
+
+		V q = h - Floor(h * V(0.25f)) * V(4.0f);		// h mod 4
+		V one = V(1.0f), two = V(2.0f), three = V(3.0f);
+		V swap = Or(Equal(q, one), Equal(q, three));
+		V negS = GreaterEqual(q, two);
+		V negC = Or(Equal(q, one), Equal(q, two));
+		V minusZero = V(-0.0f);
+
+		V sv = Select(swap, pc, ps);
+		V cv = Select(swap, ps, pc);
+		s = Xor(Xor(sv, And(negS, minusZero)), sign);
+		c = Xor(cv, And(negC, minusZero));
+	}
+
+	// 4 instances per iteration; columns are transposed from SoA lanes into packed matrices
+	inline void buildSSE(const InstanceBatch &in, const glm::mat3 &fix, glm::mat4 *out, int begin, int end)
+	{
+		int i = begin;
+		for (; i + 4 <= end; i += 4)
+		{
+			F4 sa, ca, sb, cb, sc, cc;
+			SinCos(F4::Load(&in.yaw[i]), sa, ca);
+			SinCos(F4::Load(&in.tiltX[i]), sb, cb);
+			SinCos(F4::Load(&in.tiltZ[i]), sc, cc);
+
+			F4 m[9];
+			composeColumns<F4>(ca, sa, cb, sb, cc, sc, F4::Load(&in.sx[i]), F4::Load(&in.sy[i]), F4::Load(&in.sz[i]), fix, m);
+
+			__m128 zero = _mm_setzero_ps();
+			__m128 c0x = m[0].v, c0y = m[1].v, c0z = m[2].v, c0w = zero;
+			__m128 c1x = m[3].v, c1y = m[4].v, c1z = m[5].v, c1w = zero;
+			__m128 c2x = m[6].v, c2y = m[7].v, c2z = m[8].v, c2w = zero;
+			__m128 tx = _mm_loadu_ps(&in.px[i]), ty = _mm_loadu_ps(&in.py[i]), tz = _mm_loadu_ps(&in.pz[i]), tw = _mm_set1_ps(1.0f);
+			_MM_TRANSPOSE4_PS(c0x, c0y, c0z, c0w);
+			_MM_TRANSPOSE4_PS(c1x, c1y, c1z, c1w);
+			_MM_TRANSPOSE4_PS(c2x, c2y, c2z, c2w);
+			_MM_TRANSPOSE4_PS(tx, ty, tz, tw);
+
+			// After the transpose register k holds column n of instance i + k
+			__m128 cols[4][4] = { { c0x, c1x, c2x, tx }, { c0y, c1y, c2y, ty }, { c0z, c1z, c2z, tz }, { c0w, c1w, c2w, tw } };
+			for (int k = 0; k < 4; k++)
+			{
+				float *o = &out[i + k][0][0];
+				_mm_storeu_ps(o + 0, cols[k][0]);
+				_mm_storeu_ps(o + 4, cols[k][1]);
+				_mm_storeu_ps(o + 8, cols[k][2]);
+				_mm_storeu_ps(o + 12, cols[k][3]);
+			}
+		}
+		buildScalar(in, fix, out, i, end);
+	}
+#endif
+
+#ifdef INSTANCE_USE_AVX
+	// 4x4 transpose inside each 128-bit half: low half ends up as instances 0-3, high half 4-7
+	inline void transpose8x4(__m256 &r0, __m256 &r1, __m256 &r2, __m256 &r3)
+	{
+		__m256 t0 = _mm256_unpacklo_ps(r0, r1);
+		__m256 t1 = _mm256_unpackhi_ps(r0, r1);
+		__m256 t2 = _mm256_unpacklo_ps(r2, r3);
+		__m256 t3 = _mm256_unpackhi_ps(r2, r3);
+		r0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+		r1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+		r2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+		r3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+	}
+
+	// 8 instances per iteration
+	inline void buildAVX(const InstanceBatch &in, const glm::mat3 &fix, glm::mat4 *out, int begin, int end)
+	{
+		int i = begin;
+		for (; i + 8 <= end; i += 8)
+		{
+			F8 sa, ca, sb, cb, sc, cc;
+			SinCos(F8::Load(&in.yaw[i]), sa, ca);
+			SinCos(F8::Load(&in.tiltX[i]), sb, cb);
+			SinCos(F8::Load(&in.tiltZ[i]), sc, cc);
+
+			F8 m[9];
+			composeColumns<F8>(ca, sa, cb, sb, cc, sc, F8::Load(&in.sx[i]), F8::Load(&in.sy[i]), F8::Load(&in.sz[i]), fix, m);
+
+			__m256 zero = _mm256_setzero_ps();
+			__m256 c[4][4] = {
+				{ m[0].v, m[1].v, m[2].v, zero },
+				{ m[3].v, m[4].v, m[5].v, zero },
+				{ m[6].v, m[7].v, m[8].v, zero },
+				{ _mm256_loadu_ps(&in.px[i]), _mm256_loadu_ps(&in.py[i]), _mm256_loadu_ps(&in.pz[i]), _mm256_set1_ps(1.0f) } };
+			for (int n = 0; n < 4; n++)
+			{
+				transpose8x4(c[n][0], c[n][1], c[n][2], c[n][3]);
+			}
+
+			for (int k = 0; k < 4; k++)
+			{
+				float *lo = &out[i + k][0][0];
+				float *hi = &out[i + 4 + k][0][0];
+				for (int n = 0; n < 4; n++)
+				{
+					_mm_storeu_ps(lo + n * 4, _mm256_castps256_ps128(c[n][k]));
+					_mm_storeu_ps(hi + n * 4, _mm256_extractf128_ps(c[n][k], 1));
+				}
+			}
+		}
+		buildSSE(in, fix, out, i, end);
+	}
+#endif
+
+	// Widest kernel this build was compiled for
+	inline void buildRange(const InstanceBatch &in, const glm::mat3 &fix, glm::mat4 *out, int begin, int end)
+	{
+#if defined(INSTANCE_USE_AVX)
+		buildAVX(in, fix, out, begin, end);
+#elif defined(INSTANCE_USE_SSE)
+		buildSSE(in, fix, out, begin, end);
+#else
+		buildScalar(in, fix, out, begin, end);
+#endif
+	}
+
+	const int PARALLEL_THRESHOLD = 16384;	// Below this a thread spawn costs more than the work
+	const int BLOCK = 2048;
+}
+
+// Writes the packed matrices of every instance in the batch (resizes 'out'). Large batches are split
+// in blocks across all cores.
+inline void BuildInstanceMatrices(const InstanceBatch &in, const glm::mat3 &fix, std::vector<glm::mat4> &out)
+{
+	int n = in.Size();
+	out.resize(n);
+	if (n < InstanceKernels::PARALLEL_THRESHOLD)
+	{
+		InstanceKernels::buildRange(in, fix, out.data(), 0, n);
+		return;
+	}
+
+	int blocks = (n + InstanceKernels::BLOCK - 1) / InstanceKernels::BLOCK;
+	ParallelFor(0, blocks, [&](int b)
+	{
+		int begin = b * InstanceKernels::BLOCK;
+		InstanceKernels::buildRange(in, fix, out.data(), begin, std::min(n, begin + InstanceKernels::BLOCK));
+	});
+}
+
+// Microbenchmark against the chained glm calls the scene used before (--bench-trs on the command line)
+inline void RunInstanceKernelBenchmark(int count)
+{
+	InstanceBatch batch;
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> pos(-150.0f, 150.0f), ang(0.0f, 6.2831853f), tilt(-0.05f, 0.05f), scl(0.5f, 1.5f);
+	for (int i = 0; i < count; i++)
+	{
+		batch.Add(glm::vec3(pos(rng), 0.0f, pos(rng)), ang(rng), tilt(rng), tilt(rng), glm::vec3(scl(rng), scl(rng), scl(rng)));
+	}
+	glm::mat3 fix = glm::mat3(glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(1, 0, 0)));
+	glm::mat4 fix4 = glm::mat4(fix);
+
+	std::vector<glm::mat4> reference(count), result(count);
+
+	typedef std::chrono::high_resolution_clock Clock;
+	auto run = [&](const char *name, int reps, auto body)
+	{
+		double best = 1e30;
+		for (int r = 0; r < reps; r++)
+		{
+			auto t0 = Clock::now();
+			body();
+			double ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+			best = std::min(best, ms);
+		}
+		float err = 0.0f;
+		for (int i = 0; i < count; i++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				for (int k = 0; k < 4; k++)
+				{
+					err = std::max(err, std::fabs(result[i][c][k] - reference[i][c][k]));
+				}
+			}
+		}
+		printf("  %-10s %9.3f ms  %7.2f ns/instance  max err %.2e\n", name, best, best * 1e6 / count, err);
+	};
+
+	printf("TRS batch, %d instances (best of 5)\n", count);
+	auto glmPath = [&](std::vector<glm::mat4> &dst)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			glm::mat4 M(1.0f);
+			M = glm::translate(M, glm::vec3(batch.px[i], batch.py[i], batch.pz[i]));
+			M = glm::rotate(M, batch.yaw[i], glm::vec3(0, 1, 0));
+			M = glm::rotate(M, batch.tiltX[i], glm::vec3(1, 0, 0));
+			M = glm::rotate(M, batch.tiltZ[i], glm::vec3(0, 0, 1));
+			M = glm::scale(M, glm::vec3(batch.sx[i], batch.sy[i], batch.sz[i]));
+			dst[i] = M * fix4;
+		}
+	};
+	glmPath(reference);
+	run("glm", 5, [&]() { glmPath(result); });
+	run("scalar", 5, [&]() { InstanceKernels::buildScalar(batch, fix, result.data(), 0, count); });
+#ifdef INSTANCE_USE_SSE
+	run("sse", 5, [&]() { InstanceKernels::buildSSE(batch, fix, result.data(), 0, count); });
+#endif
+#ifdef INSTANCE_USE_AVX
+	run("avx", 5, [&]() { InstanceKernels::buildAVX(batch, fix, result.data(), 0, count); });
+#endif
+	run("parallel", 5, [&]() { BuildInstanceMatrices(batch, fix, result); });
+}
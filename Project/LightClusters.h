@@ -0,0 +1,326 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "InstanceKernels.h"	// F4/F8 SIMD wrappers
+
+struct PointLight
+{
+	glm::vec3 position;		// World space
+	float radius;			// Contribution is windowed to zero here
+	glm::vec3 color;		// Intensity included
+};
+
+// Clustered forward lighting. The view frustum is split into GRID_X x GRID_Y screen tiles and GRID_Z
+// exponential depth slices (froxels). Every frame the CPU lists, per froxel, the lights whose sphere
+// touches it; a fragment then only loops over the lights of its own froxel. Everything goes to the
+// shaders through texture buffers:
+//   uLightData     RGBA32F, 2 texels per light: position + radius, color
+//   uClusterCells  RG32UI, first index and count per froxel
+//   uLightIndices  R32UI, light indices of all froxels back to back
+class LightClusters
+{
+public:
+	static const int GRID_X = 16;
+	static const int GRID_Y = 9;
+	static const int GRID_Z = 24;
+	static const int CLUSTER_COUNT = GRID_X * GRID_Y * GRID_Z;
+	static const int SLICE_SIZE = GRID_X * GRID_Y;		// Multiple of 8 for the SIMD loop
+
+	LightClusters() : zNear(0.0f), zFar(0.0f), tanHalfX(0.0f), tanHalfY(0.0f), shiftX(0.0f), shiftY(0.0f), created(false)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			this->buffers[i] = this->textures[i] = 0;
+		}
+	}
+
+	~LightClusters()
+	{
+		this->Destroy();
+	}
+
+	// maxDistance: depth where the last slice ends, lights beyond it are not listed
+	void Create(float maxDistance = 200.0f)
+	{
+		this->maxDistance = maxDistance;
+		glGenBuffers(3, this->buffers);
+		glGenTextures(3, this->textures);
+		const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+		for (int i = 0; i < 3; i++)
+		{
+			glBindBuffer(GL_TEXTURE_BUFFER, this->buffers[i]);
+			glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+			glBindTexture(GL_TEXTURE_BUFFER, this->textures[i]);
+			glTexBuffer(GL_TEXTURE_BUFFER, formats[i], this->buffers[i]);
+		}
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		this->cells.assign(CLUSTER_COUNT * 2, 0);
+		this->created = true;
+	}
+
+	void Destroy()
+	{
+		if (this->created)
+		{
+			glDeleteTextures(3, this->textures);
+			glDeleteBuffers(3, this->buffers);
+			this->created = false;
+		}
+	}
+
+	// Assigns the lights to froxels for this view. Pure CPU work, but it fills the lists Upload() reads,
+	// so it runs on the GL thread right before it; calling it from a worker needs a copy per frame in flight.
+	void Build(const std::vector<PointLight> &lights, const glm::mat4 &view, const glm::mat4 &projection)
+	{
+		this->updateFroxels(projection);
+
+		this->lightData.resize(lights.size() * 8);
+		for (size_t i = 0; i < lights.size(); i++)
+		{
+			float *d = &this->lightData[i * 8];
+			d[0] = lights[i].position.x; d[1] = lights[i].position.y; d[2] = lights[i].position.z; d[3] = lights[i].radius;
+			d[4] = lights[i].color.r; d[5] = lights[i].color.g; d[6] = lights[i].color.b; d[7] = 0.0f;
+		}
+
+		// (froxel, light) pairs, then a counting sort by froxel
+		this->pairs.clear();
+		std::fill(this->counts.begin(), this->counts.end(), 0u);
+		for (size_t l = 0; l < lights.size(); l++)
+		{
+			glm::vec3 c = glm::vec3(view * glm::vec4(lights[l].position, 1.0f));
+			float r = lights[l].radius;
+			float depth = -c.z;
+			if (depth + r < this->zNear || depth - r > this->zFar)
+			{
+				continue;
+			}
+			int z0 = this->sliceOf(std::max(depth - r, this->zNear));
+			int z1 = this->sliceOf(std::min(depth + r, this->zFar));
+			for (int z = z0; z <= z1; z++)
+			{
+				this->testSlice(z, c, r, (uint32_t)l);
+			}
+		}
+
+		uint32_t offset = 0;
+		for (int i = 0; i < CLUSTER_COUNT; i++)
+		{
+			this->cells[i * 2] = offset;
+			this->cells[i * 2 + 1] = this->counts[i];
+			offset += this->counts[i];
+		}
+		this->indices.resize(std::max<size_t>(offset, 1));
+		for (const Pair &p : this->pairs)
+		{
+			uint32_t &cursor = this->cells[p.cluster * 2];
+			this->indices[cursor++] = p.light;
+		}
+		// The loop above advanced every start by its count; step back
+		for (int i = 0; i < CLUSTER_COUNT; i++)
+		{
+			this->cells[i * 2] -= this->cells[i * 2 + 1];
+		}
+	}
+
+	// GL thread: streams the lists built by Build() into the texture buffers
+	void Upload()
+	{
+		upload(this->buffers[0], this->lightData.data(), this->lightData.size() * sizeof(float));
+		upload(this->buffers[1], this->cells.data(), this->cells.size() * sizeof(uint32_t));
+		upload(this->buffers[2], this->indices.data(), this->indices.size() * sizeof(uint32_t));
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+
+	// Sets the lookup uniforms on 'program', which must be in use
+	void Bind(GLuint program, int screenWidth, int screenHeight) const
+	{
+		const char *samplers[3] = { "uLightData", "uClusterCells", "uLightIndices" };
+		for (int i = 0; i < 3; i++)
+		{
+			glActiveTexture(GL_TEXTURE0 + FIRST_UNIT + i);
+			glBindTexture(GL_TEXTURE_BUFFER, this->textures[i]);
+			glUniform1i(glGetUniformLocation(program, samplers[i]), FIRST_UNIT + i);
+		}
+		glActiveTexture(GL_TEXTURE0);
+
+		glUniform3i(glGetUniformLocation(program, "uClusterGrid"), GRID_X, GRID_Y, GRID_Z);
+		glUniform2f(glGetUniformLocation(program, "uClusterTile"), (float)GRID_X / std::max(screenWidth, 1), (float)GRID_Y / std::max(screenHeight, 1));
+		glUniform2f(glGetUniformLocation(program, "uClusterDepth"), GRID_Z / logf(this->zFar / this->zNear), this->zNear);
+	}
+
+	size_t GetIndexCount() const
+	{
+		return this->pairs.size();
+	}
+
+	// Lights uploaded by the last Upload(), in the uLightData layout
+	int GetLightCount() const
+	{
+		return (int)(this->lightData.size() / 8);
+	}
+
+	GLuint GetLightTexture() const
+	{
+		return this->textures[0];
+	}
+
+private:
+	static const int FIRST_UNIT = 8;
+
+	struct Pair
+	{
+		uint32_t cluster;
+		uint32_t light;
+	};
+
+	float maxDistance;
+	float zNear, zFar, tanHalfX, tanHalfY;
+	float shiftX, shiftY;	// NDC offset of an off-center projection (a poster tile), 0 otherwise
+	GLuint buffers[3], textures[3];
+	bool created;
+
+	// View-space froxel bounds (SoA, slice-major)
+	std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+
+	std::vector<float> lightData;
+	std::vector<uint32_t> cells;
+	std::vector<uint32_t> indices;
+	std::vector<uint32_t> counts;
+	std::vector<Pair> pairs;
+
+	int sliceOf(float depth) const
+	{
+		int z = (int)floorf(logf(depth / this->zNear) / logf(this->zFar / this->zNear) * GRID_Z);
+		return std::max(0, std::min(z, GRID_Z - 1));
+	}
+
+	// Froxel AABBs only depend on the projection, so they're rebuilt when it changes. An off-center
+	// frustum maps NDC x to the view-space slope (x + shiftX) * tanHalfX instead of x * tanHalfX.
+	void updateFroxels(const glm::mat4 &projection)
+	{
+		float tx = 1.0f / projection[0][0];
+		float ty = 1.0f / projection[1][1];
+		float sx = projection[2][0];
+		float sy = projection[2][1];
+		float n = projection[3][2] / (projection[2][2] - 1.0f);
+		float f = std::min(this->maxDistance, projection[3][2] / (projection[2][2] + 1.0f));
+		if (tx == this->tanHalfX && ty == this->tanHalfY && sx == this->shiftX && sy == this->shiftY && n == this->zNear && f == this->zFar)
+		{
+			return;
+		}
+		this->tanHalfX = tx;
+		this->tanHalfY = ty;
+		this->shiftX = sx;
+		this->shiftY = sy;
+		this->zNear = n;
+		this->zFar = f;
+
+		for (std::vector<float> *v : { &this->minX, &this->minY, &this->minZ, &this->maxX, &this->maxY, &this->maxZ })
+		{
+			v->resize(CLUSTER_COUNT);
+		}
+		this->counts.assign(CLUSTER_COUNT, 0);
+
+		for (int z = 0; z < GRID_Z; z++)
+		{
+			float d0 = n * powf(f / n, (float)z / GRID_Z);
+			float d1 = n * powf(f / n, (float)(z + 1) / GRID_Z);
+			for (int y = 0; y < GRID_Y; y++)
+			{
+				float ny0 = -1.0f + 2.0f * y / GRID_Y + sy, ny1 = -1.0f + 2.0f * (y + 1) / GRID_Y + sy;
+				for (int x = 0; x < GRID_X; x++)
+				{
+					float nx0 = -1.0f + 2.0f * x / GRID_X + sx, nx1 = -1.0f + 2.0f * (x + 1) / GRID_X + sx;
+					int i = (z * GRID_Y + y) * GRID_X + x;
+					// The tile's side planes pass through the eye, so the extremes are at the near or far depth
+					this->minX[i] = std::min(nx0 * tx * d0, nx0 * tx * d1);
+					this->maxX[i] = std::max(nx1 * tx * d0, nx1 * tx * d1);
+					this->minY[i] = std::min(ny0 * ty * d0, ny0 * ty * d1);
+					this->maxY[i] = std::max(ny1 * ty * d0, ny1 * ty * d1);
+					this->minZ[i] = -d1;
+					this->maxZ[i] = -d0;
+				}
+			}
+		}
+	}
+
+	// Sphere vs. every froxel AABB of one slice: squared distance from the center to the box <= r^2
+	void testSlice(int z, const glm::vec3 &c, float r, uint32_t light)
+	{
+		const int base = z * SLICE_SIZE;
+		int i = 0;
+#if defined(INSTANCE_USE_AVX)
+		i = this->testLanes<InstanceKernels::F8, 8>(base, i, c, r, light);
+#elif defined(INSTANCE_USE_SSE)
+		i = this->testLanes<InstanceKernels::F4, 4>(base, i, c, r, light);
+#endif
+		for (; i < SLICE_SIZE; i++)
+		{
+			int k = base + i;
+			float dx = std::max(std::max(this->minX[k] - c.x, c.x - this->maxX[k]), 0.0f);
+			float dy = std::max(std::max(this->minY[k] - c.y, c.y - this->maxY[k]), 0.0f);
+			float dz = std::max(std::max(this->minZ[k] - c.z, c.z - this->maxZ[k]), 0.0f);
+			if (dx * dx + dy * dy + dz * dz <= r * r)
+			{
+				this->add(k, light);
+			}
+		}
+	}
+
+#if defined(INSTANCE_USE_SSE) || defined(INSTANCE_USE_AVX)
+	template <typename V, int LANES>
+	int testLanes(int base, int i, const glm::vec3 &c, float r, uint32_t light)
+	{
+		using namespace InstanceKernels;
+		const V cx(c.x), cy(c.y), cz(c.z), r2(r * r), zero(0.0f);
+		for (; i + LANES <= SLICE_SIZE; i += LANES)
+		{
+			int k = base + i;
+			V dx = Max(Max(V::Load(&this->minX[k]) - cx, cx - V::Load(&this->maxX[k])), zero);
+			V dy = Max(Max(V::Load(&this->minY[k]) - cy, cy - V::Load(&this->maxY[k])), zero);
+			V dz = Max(Max(V::Load(&this->minZ[k]) - cz, cz - V::Load(&this->maxZ[k])), zero);
+			int hits = MoveMask(GreaterEqual(r2, dx * dx + dy * dy + dz * dz));
+			while (hits)
+			{
+				int lane = 0;
+				while (!(hits & (1 << lane)))
+				{
+					lane++;
+				}
+				hits &= ~(1 << lane);
+				this->add(k + lane, light);
+			}
+		}
+		return i;
+	}
+#endif
+
+	void add(int cluster, uint32_t light)
+	{
+		Pair p;
+		p.cluster = (uint32_t)cluster;
+		p.light = light;
+		this->pairs.push_back(p);
+		this->counts[cluster]++;
+	}
+
+	static void upload(GLuint buffer, const void *data, size_t bytes)
+	{
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(bytes, 16), nullptr, GL_STREAM_DRAW);	// Orphan
+		if (bytes > 0)
+		{
+			glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+		}
+	}
+};
@@ -43,6 +43,7 @@ public:
 	vector<Vertex> vertices;
 	vector<GLuint> indices;
 	vector<Texture> textures;
+	vector<glm::vec2> baked;	// Set by SetBakedLighting, kept for passes that merge meshes
 
 	/*  Functions  */
 	// Constructor
@@ -56,8 +57,29 @@ public:
 		this->setupMesh();
 	}
 
+	// Per-vertex baked ambient occlusion and sky visibility (StaticBake.h), shader attribute 3.
+	// Meshes without it read the generic value of attribute 3, set to (1, 1) by the baker.
+	void SetBakedLighting(const vector<glm::vec2> &baked)
+	{
+		if (baked.size() != this->vertices.size())
+		{
+			return;
+		}
+		this->baked = baked;
+		if (this->bakedVBO == 0)
+		{
+			glGenBuffers(1, &this->bakedVBO);
+		}
+		glBindVertexArray(this->VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->bakedVBO);
+		glBufferData(GL_ARRAY_BUFFER, baked.size() * sizeof(glm::vec2), &baked[0], GL_STATIC_DRAW);
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (GLvoid *)0);
+		glBindVertexArray(0);
+	}
+
 	// Render the mesh
-	void Draw(Shader shader)
+	void Draw(Shader &shader)
 	{
 		// Bind appropriate textures
 		GLuint diffuseNr = 1;
@@ -106,6 +128,7 @@ public:
 private:
 	/*  Render data  */
 	GLuint VAO, VBO, EBO;
+	GLuint bakedVBO = 0;
 
 	/*  Functions    */
 	// Initializes all the buffer objects/arrays
@@ -17,6 +17,7 @@
 
 #include "Mesh.h"
 #include  "Shader.h"
+#include "TextureCache.h"
 
 using namespace std;
 
@@ -33,7 +34,7 @@ public:
 	}
 
 	// Draws the model, and thus all its meshes
-	void Draw(Shader shader)
+	void Draw(Shader &shader)
 	{
 		for (GLuint i = 0; i < this->meshes.size(); i++)
 		{
@@ -41,6 +42,28 @@ public:
 		}
 	}
 
+	// Geometry access for CPU-side passes (baking, ray queries)
+	vector<Mesh> &GetMeshes()
+	{
+		return this->meshes;
+	}
+
+	// Draw calls and triangles issued by one Draw(), for the benchmark statistics
+	GLuint GetMeshCount() const
+	{
+		return (GLuint)this->meshes.size();
+	}
+
+	GLuint GetTriangleCount() const
+	{
+		GLuint triangles = 0;
+		for (const Mesh &mesh : this->meshes)
+		{
+			triangles += (GLuint)mesh.indices.size() / 3;
+		}
+		return triangles;
+	}
+
 private:
 	/*  Model Data  */
 	vector<Mesh> meshes;
@@ -213,32 +236,21 @@ private:
 
 GLint TextureFromFile(const char *path, string directory)
 {
-	//Generate texture ID and load texture data
+	//Generate texture ID and load texture data (DXT-compressed through the DDS cache)
 	string filename = string(path);
 	filename = directory + '/' + filename;
-	GLuint textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height;
-
-	unsigned char *image = SOIL_load_image(filename.c_str(), &width, &height, 0, SOIL_LOAD_RGB);
-	if (!image) {
-	    std::cerr << "Failed to load texture: " << filename << std::endl;
+	GLuint textureID = TextureCache::Get().Load(filename);
+	if (textureID == 0) {
 	    return 0;
 	}
 
-	// Assign texture to ID
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D);
-
 	// Parameters
+	glBindTexture(GL_TEXTURE_2D, textureID);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glBindTexture(GL_TEXTURE_2D, 0);
-	SOIL_free_image_data(image);
 
 	return textureID;
 }
\ No newline at end of file
@@ -0,0 +1,217 @@
+#pragma once
+
+// Std. Includes
+#include <iostream>
+#include <string>
+#include <vector>
+
+// GL Includes
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+// Headless GL 3.3 core context for the benchmark mode. Tried in order:
+//   1. EGL on the surfaceless platform (Mesa llvmpipe / GPU drivers without a display server)
+//   2. OSMesa
+//   3. A hidden GLFW window (Windows, or Linux builds without EGL headers)
+#if defined(__has_include)
+#if !defined(_WIN32) && __has_include(<EGL/egl.h>)
+#define EGL_NO_X11 1
+#define MESA_EGL_NO_X11_HEADERS 1
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define OFFSCREEN_HAS_EGL 1
+#endif
+#if __has_include(<GL/osmesa.h>)
+#include <GL/osmesa.h>
+#define OFFSCREEN_HAS_OSMESA 1
+#endif
+#endif
+
+class OffscreenContext
+{
+public:
+	OffscreenContext() : window(nullptr), backend("none")
+	{
+#ifdef OFFSCREEN_HAS_EGL
+		this->display = EGL_NO_DISPLAY;
+		this->context = EGL_NO_CONTEXT;
+#endif
+#ifdef OFFSCREEN_HAS_OSMESA
+		this->osmesa = nullptr;
+#endif
+	}
+
+	~OffscreenContext()
+	{
+		this->Destroy();
+	}
+
+	// Makes a context current on the calling thread. The default framebuffer may not exist (EGL) or
+	// be tiny, so callers must render into their own FBO.
+	bool Create(int width, int height)
+	{
+#ifdef OFFSCREEN_HAS_EGL
+		if (this->createEGL())
+		{
+			this->backend = "egl-surfaceless";
+			return true;
+		}
+#endif
+#ifdef OFFSCREEN_HAS_OSMESA
+		if (this->createOSMesa(width, height))
+		{
+			this->backend = "osmesa";
+			return true;
+		}
+#endif
+		if (this->createHiddenWindow(width, height))
+		{
+			this->backend = "glfw-hidden";
+			return true;
+		}
+		return false;
+	}
+
+	void Destroy()
+	{
+#ifdef OFFSCREEN_HAS_EGL
+		if (this->context != EGL_NO_CONTEXT)
+		{
+			eglMakeCurrent(this->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			eglDestroyContext(this->display, this->context);
+			this->context = EGL_NO_CONTEXT;
+		}
+		if (this->display != EGL_NO_DISPLAY)
+		{
+			eglTerminate(this->display);
+			this->display = EGL_NO_DISPLAY;
+		}
+#endif
+#ifdef OFFSCREEN_HAS_OSMESA
+		if (this->osmesa)
+		{
+			OSMesaDestroyContext(this->osmesa);
+			this->osmesa = nullptr;
+		}
+#endif
+		if (this->window)
+		{
+			glfwDestroyWindow(this->window);
+			glfwTerminate();
+			this->window = nullptr;
+		}
+	}
+
+	// Which path succeeded, reported in the benchmark JSON
+	const char *GetBackend() const
+	{
+		return this->backend;
+	}
+
+private:
+	GLFWwindow *window;
+	const char *backend;
+
+	bool createHiddenWindow(int width, int height)
+	{
+		if (!glfwInit())
+		{
+			return false;
+		}
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+		glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+		this->window = glfwCreateWindow(width, height, "benchmark", nullptr, nullptr);
+		if (!this->window)
+		{
+			glfwTerminate();
+			return false;
+		}
+		glfwMakeContextCurrent(this->window);
+		glfwSwapInterval(0);
+		return true;
+	}
+
+#ifdef OFFSCREEN_HAS_EGL
+	EGLDisplay display;
+	EGLContext context;
+
+	bool createEGL()
+	{
+		// Prefer the surfaceless platform so no X/Wayland connection is needed
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		const char *clientExts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+		if (getPlatformDisplay && clientExts && std::string(clientExts).find("EGL_MESA_platform_surfaceless") != std::string::npos)
+		{
+			this->display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		}
+		if (this->display == EGL_NO_DISPLAY)
+		{
+			this->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		}
+		if (this->display == EGL_NO_DISPLAY || !eglInitialize(this->display, nullptr, nullptr))
+		{
+			this->display = EGL_NO_DISPLAY;
+			return false;
+		}
+
+		const char *exts = eglQueryString(this->display, EGL_EXTENSIONS);
+		if (!exts || std::string(exts).find("EGL_KHR_surfaceless_context") == std::string::npos || !eglBindAPI(EGL_OPENGL_API))
+		{
+			std::cerr << "EGL: no surfaceless desktop GL support" << std::endl;
+			this->Destroy();
+			return false;
+		}
+
+		const EGLint configAttribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+		EGLConfig config = nullptr;
+		EGLint numConfigs = 0;
+		eglChooseConfig(this->display, configAttribs, &config, 1, &numConfigs);
+
+		const EGLint contextAttribs[] = {
+			EGL_CONTEXT_MAJOR_VERSION, 3,
+			EGL_CONTEXT_MINOR_VERSION, 3,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE };
+		this->context = eglCreateContext(this->display, numConfigs > 0 ? config : nullptr, EGL_NO_CONTEXT, contextAttribs);
+		if (this->context == EGL_NO_CONTEXT || !eglMakeCurrent(this->display, EGL_NO_SURFACE, EGL_NO_SURFACE, this->context))
+		{
+			std::cerr << "EGL: failed to create a 3.3 core context (0x" << std::hex << eglGetError() << std::dec << ")" << std::endl;
+			this->Destroy();
+			return false;
+		}
+		return true;
+	}
+#endif
+
+#ifdef OFFSCREEN_HAS_OSMESA
+	OSMesaContext osmesa;
+	std::vector<unsigned char> osmesaBuffer;
+
+	bool createOSMesa(int width, int height)
+	{
+		const int attribs[] = {
+			OSMESA_FORMAT, OSMESA_RGBA,
+			OSMESA_DEPTH_BITS, 24,
+			OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+			OSMESA_CONTEXT_MAJOR_VERSION, 3,
+			OSMESA_CONTEXT_MINOR_VERSION, 3,
+			0 };
+		this->osmesa = OSMesaCreateContextAttribs(attribs, nullptr);
+		if (!this->osmesa)
+		{
+			return false;
+		}
+		this->osmesaBuffer.resize((size_t)width * height * 4);
+		if (!OSMesaMakeCurrent(this->osmesa, this->osmesaBuffer.data(), GL_UNSIGNED_BYTE, width, height))
+		{
+			OSMesaDestroyContext(this->osmesa);
+			this->osmesa = nullptr;
+			return false;
+		}
+		return true;
+	}
+#endif
+};
@@ -0,0 +1,633 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "ExrImage.h"
+#include "ImageDecoder.h"
+#include "Parallel.h"
+
+// A PBR texture set (albedo, normal, roughness, displacement, AO) packed into three textures:
+//   albedo  - sRGB RGB8, mipmapped by the driver
+//   normal  - tangent-space XY as BC5 (RGTC2), Z rebuilt in the shader
+//   surface - RGB8: R = roughness, G = displacement, B = ambient occlusion
+// The import reads the source files once (<name>_diff_*, _nor_gl_*, _rough_*, _disp_*, _ao_*, the
+// Poly Haven naming) and writes the packed levels to the cache; later runs just upload them.
+class PackedMaterial
+{
+public:
+	PackedMaterial()
+	{
+		this->textures[0] = this->textures[1] = this->textures[2] = 0;
+	}
+
+	bool Load(const std::string &directory, const std::string &name, const std::string &cacheDirectory = "Cache/materials")
+	{
+		this->name = name;
+		std::string sources[SOURCE_COUNT];
+		for (int s = 0; s < SOURCE_COUNT; s++)
+		{
+			sources[s] = findSource(directory, name, SOURCE_SUFFIX[s]);
+		}
+		if (sources[DIFFUSE].empty())
+		{
+			std::cerr << "ERROR::PACKEDMATERIAL::NO_DIFFUSE_MAP " << name << " in " << directory << std::endl;
+			return false;
+		}
+
+		const std::string cachePath = cacheDirectory + "/" + name + ".pbr";
+		const uint64_t key = sourceKey(sources);
+		if (!this->loadCache(cachePath, key))
+		{
+			if (!this->import(sources))
+			{
+				return false;
+			}
+			this->saveCache(cachePath, key);
+		}
+		this->upload();
+		std::cerr << "Material " << name << ": " << this->GetBytes() / (1024 * 1024) << " MB in 3 textures ("
+			<< this->GetUnpackedBytes() / (1024 * 1024) << " MB as 4 unpacked RGBA8)" << std::endl;
+		return true;
+	}
+
+	// Samplers uPbrAlbedo, uPbrNormal and uPbrSurface on texture units firstUnit .. firstUnit + 2
+	void Bind(GLuint program, int firstUnit) const
+	{
+		const char *names[3] = { "uPbrAlbedo", "uPbrNormal", "uPbrSurface" };
+		for (int t = 0; t < 3; t++)
+		{
+			glActiveTexture(GL_TEXTURE0 + firstUnit + t);
+			glBindTexture(GL_TEXTURE_2D, this->textures[t]);
+			glUniform1i(glGetUniformLocation(program, names[t]), firstUnit + t);
+		}
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	void Destroy()
+	{
+		glDeleteTextures(3, this->textures);
+		this->textures[0] = this->textures[1] = this->textures[2] = 0;
+	}
+
+	bool IsLoaded() const
+	{
+		return this->textures[0] != 0;
+	}
+
+	// Video memory of the packed textures (RGB8 counted as 4 bytes, as drivers store it)
+	size_t GetBytes() const
+	{
+		size_t bytes = 0;
+		for (const Texture &t : this->packed)
+		{
+			size_t texture = 0;
+			for (const std::vector<unsigned char> &data : t.levels)
+			{
+				texture += t.format == GL_COMPRESSED_RG_RGTC2 ? data.size() : data.size() / 3 * 4;
+			}
+			if (t.levels.size() == 1)
+			{
+				texture += texture / 3;	// Mips made by the driver
+			}
+			bytes += texture;
+		}
+		return bytes;
+	}
+
+	// The same maps as four mipmapped RGBA8 textures
+	size_t GetUnpackedBytes() const
+	{
+		return (size_t)this->packed[ALBEDO].width * this->packed[ALBEDO].height * 4 * 4 * 4 / 3;
+	}
+
+private:
+	static const uint32_t CACHE_VERSION = 2;
+	// Height range of the displacement map relative to the texture width, for normals rebuilt from it
+	static constexpr float HEIGHT_SCALE = 0.15f;
+
+	enum Source { DIFFUSE, NORMAL_GL, ROUGHNESS, DISPLACEMENT, OCCLUSION, SOURCE_COUNT };
+	static constexpr const char *SOURCE_SUFFIX[SOURCE_COUNT] = { "diff", "nor_gl", "rough", "disp", "ao" };
+	enum Packed { ALBEDO, NORMAL, SURFACE };
+
+	struct Texture
+	{
+		uint32_t format = 0;	// GL internal format
+		int width = 0, height = 0;
+		std::vector<std::vector<unsigned char>> levels;
+	};
+
+	std::string name;
+	Texture packed[3];
+	GLuint textures[3];
+
+	static std::string findSource(const std::string &directory, const std::string &name, const std::string &suffix)
+	{
+		const std::string prefix = name + "_" + suffix + "_";
+		std::error_code ec;
+		for (const auto &entry : std::filesystem::directory_iterator(directory, ec))
+		{
+			std::string file = entry.path().filename().string();
+			if (file.compare(0, prefix.size(), prefix) == 0)
+			{
+				return entry.path().string();
+			}
+		}
+		return "";
+	}
+
+	static uint64_t sourceKey(const std::string sources[SOURCE_COUNT])
+	{
+		uint64_t h = 14695981039346656037ull;
+		auto mix = [&h](const void *data, size_t size)
+		{
+			const unsigned char *p = (const unsigned char *)data;
+			for (size_t i = 0; i < size; i++)
+			{
+				h ^= p[i];
+				h *= 1099511628211ull;
+			}
+		};
+		const uint32_t version = CACHE_VERSION;
+		const float heightScale = HEIGHT_SCALE;
+		mix(&version, sizeof(version));
+		mix(&heightScale, sizeof(heightScale));
+		for (int s = 0; s < SOURCE_COUNT; s++)
+		{
+			std::error_code ec;
+			uint64_t size = sources[s].empty() ? 0 : (uint64_t)std::filesystem::file_size(sources[s], ec);
+			int64_t time = sources[s].empty() ? 0 : (int64_t)std::filesystem::last_write_time(sources[s], ec).time_since_epoch().count();
+			mix(sources[s].data(), sources[s].size());
+			mix(&size, sizeof(size));
+			mix(&time, sizeof(time));
+		}
+		return h;
+	}
+
+	// One channel in [0, 1] at w x h (resampled bilinearly when the map has another size)
+	static bool loadGray(const std::string &path, int w, int h, std::vector<float> &out)
+	{
+		std::vector<float> src;
+		int sw = 0, sh = 0;
+		if (path.size() > 4 && path.compare(path.size() - 4, 4, ".exr") == 0)
+		{
+			ExrImage exr;
+			std::string error;
+			if (!LoadExr(path, exr, &error))
+			{
+				std::cerr << "ERROR::PACKEDMATERIAL::CANNOT_LOAD " << path << ": " << error << std::endl;
+				return false;
+			}
+			// LoadExr fails on files without channels, so there is always a planes[0]
+			const float *plane = exr.Channel("Y") ? exr.Channel("Y") : (exr.Channel("R") ? exr.Channel("R") : exr.planes[0].data());
+			src.assign(plane, plane + (size_t)exr.width * exr.height);
+			sw = exr.width;
+			sh = exr.height;
+		}
+		else
+		{
+			ImageDecoder::Options options;
+			options.channels = 1;
+			options.format = PixelFormat::UInt16;
+			DecodedImage image;
+			if (!ImageDecoder::Decode(path, options, image))
+			{
+				std::cerr << "ERROR::PACKEDMATERIAL::CANNOT_LOAD " << path << ": " << image.error << std::endl;
+				return false;
+			}
+			sw = image.width;
+			sh = image.height;
+			src.resize((size_t)sw * sh);
+			const uint16_t *data = image.Data16();
+			for (size_t i = 0; i < src.size(); i++)
+			{
+				src[i] = data[i] / 65535.0f;
+			}
+		}
+
+		out.resize((size_t)w * h);
+		for (int y = 0; y < h; y++)
+		{
+			float fy = std::max(0.0f, (y + 0.5f) * sh / h - 0.5f);
+			int y0 = std::min((int)fy, sh - 1), y1 = std::min(y0 + 1, sh - 1);
+			for (int x = 0; x < w; x++)
+			{
+				float fx = std::max(0.0f, (x + 0.5f) * sw / w - 0.5f);
+				int x0 = std::min((int)fx, sw - 1), x1 = std::min(x0 + 1, sw - 1);
+				float ax = fx - x0, ay = fy - y0;
+				float top = src[(size_t)y0 * sw + x0] * (1 - ax) + src[(size_t)y0 * sw + x1] * ax;
+				float bottom = src[(size_t)y1 * sw + x0] * (1 - ax) + src[(size_t)y1 * sw + x1] * ax;
+				out[(size_t)y * w + x] = glm::clamp(top * (1 - ay) + bottom * ay, 0.0f, 1.0f);
+			}
+		}
+		return true;
+	}
+
+	// Tangent-space normals from an OpenGL-convention normal map (EXR channels R, G, B or 8-bit RGB)
+	static bool loadNormals(const std::string &path, int w, int h, std::vector<glm::vec3> &out)
+	{
+		std::vector<float> c[3];
+		const char *names[3] = { "R", "G", "B" };
+		if (path.size() > 4 && path.compare(path.size() - 4, 4, ".exr") == 0)
+		{
+			ExrImage exr;
+			std::string error;
+			if (!LoadExr(path, exr, &error))
+			{
+				std::cerr << "ERROR::PACKEDMATERIAL::CANNOT_LOAD " << path << ": " << error << std::endl;
+				return false;
+			}
+			if (exr.width != w || exr.height != h || !exr.Channel("R") || !exr.Channel("G") || !exr.Channel("B"))
+			{
+				std::cerr << "ERROR::PACKEDMATERIAL::SIZE_MISMATCH " << path << ": size or channels differ from the albedo" << std::endl;
+				return false;
+			}
+			for (int k = 0; k < 3; k++)
+			{
+				c[k].assign(exr.Channel(names[k]), exr.Channel(names[k]) + (size_t)w * h);
+			}
+		}
+		else
+		{
+			ImageDecoder::Options options;
+			options.channels = 3;
+			DecodedImage image;
+			if (!ImageDecoder::Decode(path, options, image) || image.width != w || image.height != h)
+			{
+				std::cerr << "ERROR::PACKEDMATERIAL::CANNOT_USE " << path << ": unreadable or not the size of the albedo" << std::endl;
+				return false;
+			}
+			const unsigned char *data = image.pixels.data();
+			for (int k = 0; k < 3; k++)
+			{
+				c[k].resize((size_t)w * h);
+				for (size_t i = 0; i < c[k].size(); i++)
+				{
+					c[k][i] = data[i * 3 + k] / 255.0f;
+				}
+			}
+		}
+		out.resize((size_t)w * h);
+		for (size_t i = 0; i < out.size(); i++)
+		{
+			out[i] = glm::normalize(glm::vec3(c[0][i], c[1][i], c[2][i]) * 2.0f - 1.0f + glm::vec3(0.0f, 0.0f, 1e-4f));
+		}
+		return true;
+	}
+
+	// Central differences of the (tiling) height field, in texture space: +X along u, +Y along v
+	static void normalsFromHeight(const std::vector<float> &height, int w, int h, std::vector<glm::vec3> &out)
+	{
+		out.resize((size_t)w * h);
+		const float scale = HEIGHT_SCALE * w * 0.5f;
+		ParallelFor(0, h, [&](int y)
+		{
+			const float *up = &height[(size_t)((y + h - 1) % h) * w], *row = &height[(size_t)y * w], *down = &height[(size_t)((y + 1) % h) * w];
+			for (int x = 0; x < w; x++)
+			{
+				float dx = row[(x + 1) % w] - row[(x + w - 1) % w];
+				float dy = down[x] - up[x];
+				out[(size_t)y * w + x] = glm::normalize(glm::vec3(-dx * scale, -dy * scale, 1.0f));
+			}
+		}, 16);
+	}
+
+	bool import(const std::string sources[SOURCE_COUNT])
+	{
+		std::cerr << "Packing material " << this->name << "..." << std::endl;
+		ImageDecoder::Options options;
+		options.channels = 3;
+		DecodedImage albedo;
+		if (!ImageDecoder::Decode(sources[DIFFUSE], options, albedo))
+		{
+			std::cerr << "ERROR::PACKEDMATERIAL::CANNOT_LOAD " << sources[DIFFUSE] << ": " << albedo.error << std::endl;
+			return false;
+		}
+		const int w = albedo.width, h = albedo.height;
+		Texture &a = this->packed[ALBEDO];
+		a.format = GL_SRGB8;
+		a.width = w;
+		a.height = h;
+		a.levels.assign(1, std::move(albedo.pixels));
+
+		// The other four maps decode in parallel, each on its own thread. Missing maps fall back to a
+		// flat, fairly rough, unoccluded surface
+		std::vector<float> rough, disp, ao;
+		std::vector<glm::vec3> normals;
+		bool loaded[4] = { false, false, false, false };
+		ParallelFor(0, 4, [&](int i)
+		{
+			switch (i)
+			{
+			case 0:
+				loaded[i] = !sources[DISPLACEMENT].empty() && loadGray(sources[DISPLACEMENT], w, h, disp);
+				break;
+			case 1:
+				loaded[i] = !sources[ROUGHNESS].empty() && loadGray(sources[ROUGHNESS], w, h, rough);
+				break;
+			case 2:
+				loaded[i] = !sources[OCCLUSION].empty() && loadGray(sources[OCCLUSION], w, h, ao);
+				break;
+			default:
+				loaded[i] = !sources[NORMAL_GL].empty() && loadNormals(sources[NORMAL_GL], w, h, normals);
+				break;
+			}
+		});
+		const bool hasDisp = loaded[0];
+		if (!hasDisp)
+		{
+			disp.assign((size_t)w * h, 0.5f);
+		}
+		if (!loaded[1])
+		{
+			rough.assign((size_t)w * h, 0.8f);
+		}
+		if (!loaded[2])
+		{
+			ao.assign((size_t)w * h, 1.0f);
+		}
+		if (!loaded[3])
+		{
+			if (hasDisp)
+			{
+				std::cerr << "  Normals derived from the displacement map" << std::endl;
+				normalsFromHeight(disp, w, h, normals);
+			}
+			else
+			{
+				normals.assign((size_t)w * h, glm::vec3(0.0f, 0.0f, 1.0f));
+			}
+		}
+
+		Texture &s = this->packed[SURFACE];
+		s.format = GL_RGB8;
+		s.width = w;
+		s.height = h;
+		s.levels.assign(1, std::vector<unsigned char>((size_t)w * h * 3));
+		for (size_t i = 0; i < (size_t)w * h; i++)
+		{
+			s.levels[0][i * 3 + 0] = (unsigned char)(rough[i] * 255.0f + 0.5f);
+			s.levels[0][i * 3 + 1] = (unsigned char)(disp[i] * 255.0f + 0.5f);
+			s.levels[0][i * 3 + 2] = (unsigned char)(ao[i] * 255.0f + 0.5f);
+		}
+		// Linear data, so a plain box filter is right
+		for (int lw = w, lh = h; lw > 1 || lh > 1;)
+		{
+			int nw = std::max(1, lw / 2), nh = std::max(1, lh / 2);
+			const std::vector<unsigned char> &src = s.levels.back();
+			std::vector<unsigned char> dst((size_t)nw * nh * 3);
+			for (int y = 0; y < nh; y++)
+			{
+				for (int x = 0; x < nw; x++)
+				{
+					int x0 = std::min(2 * x, lw - 1), x1 = std::min(2 * x + 1, lw - 1);
+					int y0 = std::min(2 * y, lh - 1), y1 = std::min(2 * y + 1, lh - 1);
+					for (int k = 0; k < 3; k++)
+					{
+						int sum = src[((size_t)y0 * lw + x0) * 3 + k] + src[((size_t)y0 * lw + x1) * 3 + k]
+							+ src[((size_t)y1 * lw + x0) * 3 + k] + src[((size_t)y1 * lw + x1) * 3 + k];
+						dst[((size_t)y * nw + x) * 3 + k] = (unsigned char)((sum + 2) / 4);
+					}
+				}
+			}
+			s.levels.push_back(dst);
+			lw = nw;
+			lh = nh;
+		}
+
+		// Normals: averaged and renormalized per level, then block-compressed
+		Texture &n = this->packed[NORMAL];
+		n.format = GL_COMPRESSED_RG_RGTC2;
+		n.width = w;
+		n.height = h;
+		n.levels.clear();
+		for (int lw = w, lh = h;;)
+		{
+			n.levels.push_back(encodeBC5(normals, lw, lh));
+			if (lw == 1 && lh == 1)
+			{
+				break;
+			}
+			int nw = std::max(1, lw / 2), nh = std::max(1, lh / 2);
+			std::vector<glm::vec3> next((size_t)nw * nh);
+			for (int y = 0; y < nh; y++)
+			{
+				for (int x = 0; x < nw; x++)
+				{
+					int x0 = std::min(2 * x, lw - 1), x1 = std::min(2 * x + 1, lw - 1);
+					int y0 = std::min(2 * y, lh - 1), y1 = std::min(2 * y + 1, lh - 1);
+					glm::vec3 sum = normals[(size_t)y0 * lw + x0] + normals[(size_t)y0 * lw + x1]
+						+ normals[(size_t)y1 * lw + x0] + normals[(size_t)y1 * lw + x1];
+					next[(size_t)y * nw + x] = glm::length(sum) > 1e-6f ? glm::normalize(sum) : glm::vec3(0.0f, 0.0f, 1.0f);
+				}
+			}
+			normals.swap(next);
+			lw = nw;
+			lh = nh;
+		}
+		return true;
+	}
+
+	// BC4 block: the two extremes as endpoints (red0 > red1: 6 interpolated steps), 3-bit index per texel
+	static void encodeBC4(const unsigned char texels[16], unsigned char out[8])
+	{
+		unsigned char lo = 255, hi = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			lo = std::min(lo, texels[i]);
+			hi = std::max(hi, texels[i]);
+		}
+		out[0] = hi;
+		out[1] = lo;
+		uint64_t bits = 0;
+		if (hi > lo)
+		{
+			for (int i = 0; i < 16; i++)
+			{
+				// Step 0 = lo ... 7 = hi; the palette stores hi at index 0, lo at 1, then 8 - step
+				int step = (int)((texels[i] - lo) * 7.0f / (hi - lo) + 0.5f);
+				uint64_t index = step == 7 ? 0 : (step == 0 ? 1 : 8 - step);
+				bits |= index << (3 * i);
+			}
+		}
+		for (int b = 0; b < 6; b++)
+		{
+			out[2 + b] = (unsigned char)(bits >> (8 * b));
+		}
+	}
+
+	static std::vector<unsigned char> encodeBC5(const std::vector<glm::vec3> &normals, int w, int h)
+	{
+		const int bw = (w + 3) / 4, bh = (h + 3) / 4;
+		std::vector<unsigned char> blocks((size_t)bw * bh * 16);
+		ParallelFor(0, bh, [&](int by)
+		{
+			for (int bx = 0; bx < bw; bx++)
+			{
+				unsigned char r[16], g[16];
+				for (int i = 0; i < 16; i++)
+				{
+					int x = std::min(bx * 4 + (i & 3), w - 1), y = std::min(by * 4 + (i >> 2), h - 1);
+					const glm::vec3 &n = normals[(size_t)y * w + x];
+					r[i] = (unsigned char)glm::clamp(n.x * 127.5f + 128.0f, 0.0f, 255.0f);
+					g[i] = (unsigned char)glm::clamp(n.y * 127.5f + 128.0f, 0.0f, 255.0f);
+				}
+				unsigned char *block = &blocks[((size_t)by * bw + bx) * 16];
+				encodeBC4(r, block);
+				encodeBC4(g, block + 8);
+			}
+		}, 8);
+		return blocks;
+	}
+
+	void upload()
+	{
+		this->Destroy();
+		glGenTextures(3, this->textures);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (int t = 0; t < 3; t++)
+		{
+			const Texture &tex = this->packed[t];
+			glBindTexture(GL_TEXTURE_2D, this->textures[t]);
+			for (size_t l = 0; l < tex.levels.size(); l++)
+			{
+				int lw = std::max(1, tex.width >> l), lh = std::max(1, tex.height >> l);
+				if (tex.format == GL_COMPRESSED_RG_RGTC2)
+				{
+					glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)l, tex.format, lw, lh, 0, (GLsizei)tex.levels[l].size(), tex.levels[l].data());
+				}
+				else
+				{
+					glTexImage2D(GL_TEXTURE_2D, (GLint)l, tex.format, lw, lh, 0, GL_RGB, GL_UNSIGNED_BYTE, tex.levels[l].data());
+				}
+			}
+			if (tex.levels.size() == 1)
+			{
+				glGenerateMipmap(GL_TEXTURE_2D);
+			}
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			if (GLEW_EXT_texture_filter_anisotropic)
+			{
+				GLfloat aniso = 0.0f;
+				glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &aniso);
+				glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, std::min(8.0f, aniso));
+			}
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	struct CacheHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+	};
+
+	struct TextureHeader
+	{
+		uint32_t format;
+		int32_t width, height;
+		uint32_t levels;
+	};
+
+	bool loadCache(const std::string &path, uint64_t key)
+	{
+		std::ifstream in(path, std::ios::binary);
+		if (!in)
+		{
+			return false;
+		}
+		CacheHeader h;
+		in.read((char *)&h, sizeof(h));
+		if (!in || std::memcmp(h.magic, "PBRM", 4) != 0 || h.version != CACHE_VERSION || h.key != key)
+		{
+			return false;
+		}
+		// Anything the upload can't take as is sends the material back to import()
+		const uint32_t formats[3] = { GL_SRGB8, GL_COMPRESSED_RG_RGTC2, GL_RGB8 };
+		for (int p = 0; p < 3; p++)
+		{
+			Texture &t = this->packed[p];
+			TextureHeader th;
+			in.read((char *)&th, sizeof(th));
+			if (!in || th.format != formats[p] || th.width <= 0 || th.height <= 0 || th.levels == 0 || th.levels > 16)
+			{
+				return false;
+			}
+			t.format = th.format;
+			t.width = th.width;
+			t.height = th.height;
+			t.levels.resize(th.levels);
+			for (uint32_t l = 0; l < th.levels; l++)
+			{
+				uint32_t size = 0;
+				in.read((char *)&size, sizeof(size));
+				if (!in || size != levelSize(t.format, std::max(1, t.width >> l), std::max(1, t.height >> l)))
+				{
+					return false;
+				}
+				t.levels[l].resize(size);
+				in.read((char *)t.levels[l].data(), size);
+			}
+		}
+		return (bool)in;
+	}
+
+	// Bytes of one level as import() builds it: 4x4 blocks of 16 bytes for BC5, else tightly packed RGB8
+	static size_t levelSize(uint32_t format, int w, int h)
+	{
+		if (format == GL_COMPRESSED_RG_RGTC2)
+		{
+			return (size_t)((w + 3) / 4) * ((h + 3) / 4) * 16;
+		}
+		return (size_t)w * h * 3;
+	}
+
+	void saveCache(const std::string &path, uint64_t key) const
+	{
+		std::error_code ec;
+		std::filesystem::path dir = std::filesystem::path(path).parent_path();
+		if (!dir.empty())
+		{
+			std::filesystem::create_directories(dir, ec);
+		}
+		std::ofstream out(path, std::ios::binary);
+		if (!out)
+		{
+			std::cerr << "ERROR::PACKEDMATERIAL::CANNOT_WRITE " << path << std::endl;
+			return;
+		}
+		CacheHeader h;
+		std::memcpy(h.magic, "PBRM", 4);
+		h.version = CACHE_VERSION;
+		h.key = key;
+		out.write((const char *)&h, sizeof(h));
+		for (const Texture &t : this->packed)
+		{
+			TextureHeader th = { t.format, t.width, t.height, (uint32_t)t.levels.size() };
+			out.write((const char *)&th, sizeof(th));
+			for (const std::vector<unsigned char> &level : t.levels)
+			{
+				uint32_t size = (uint32_t)level.size();
+				out.write((const char *)&size, sizeof(size));
+				out.write((const char *)level.data(), size);
+			}
+		}
+	}
+};
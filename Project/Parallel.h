@@ -0,0 +1,67 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// Number of worker threads used by the CPU-side precomputation passes
+inline unsigned int WorkerCount()
+{
+	unsigned int n = std::thread::hardware_concurrency();
+	return n == 0 ? 1 : n;
+}
+
+// Splits [begin, end) in contiguous chunks and runs func(i) for every index on all cores.
+// Ranges smaller than minGrain run on the calling thread.
+template <typename Func>
+void ParallelFor(int begin, int end, Func func, int minGrain = 1)
+{
+	int count = end - begin;
+	if (count <= 0)
+	{
+		return;
+	}
+
+	int threads = (int)std::min<unsigned int>(WorkerCount(), (unsigned int)std::max(1, count / std::max(1, minGrain)));
+	if (threads <= 1)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			func(i);
+		}
+		return;
+	}
+
+	std::vector<std::thread> pool;
+	pool.reserve(threads - 1);
+	int chunk = (count + threads - 1) / threads;
+
+	for (int t = 1; t < threads; t++)
+	{
+		int b = begin + t * chunk;
+		int e = std::min(end, b + chunk);
+		if (b >= e)
+		{
+			break;
+		}
+		pool.emplace_back([=, &func]()
+		{
+			for (int i = b; i < e; i++)
+			{
+				func(i);
+			}
+		});
+	}
+
+	// The calling thread takes the first chunk
+	for (int i = begin; i < std::min(end, begin + chunk); i++)
+	{
+		func(i);
+	}
+
+	for (std::thread &th : pool)
+	{
+		th.join();
+	}
+}
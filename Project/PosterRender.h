@@ -0,0 +1,191 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+
+// GL Includes
+#include <GL/glew.h>
+
+// GLM Mathematics
+#include <glm/glm.hpp>
+
+#include "StripImageWriter.h"
+
+// Command line of the poster mode (runs headless, see Benchmark.h for --warmup/--replay/--flyover):
+//   --poster WxH file.png|file.jpg   one still of W x H pixels, rendered tile by tile
+//   --poster-tile N                  tile side in pixels (2048 by default, capped by the GL limits)
+//   --poster-quality N               JPEG quality, 1 to 100
+struct PosterOptions
+{
+	int width = 0;
+	int height = 0;
+	std::string path;
+	int tile = 2048;
+	int quality = 95;
+};
+
+inline bool ParsePosterOptions(int argc, char **argv, PosterOptions &options)
+{
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--poster" && i + 2 < argc)
+		{
+			int w = 0, h = 0;
+			if (sscanf(argv[i + 1], "%dx%d", &w, &h) == 2 && w > 0 && h > 0)
+			{
+				options.width = w;
+				options.height = h;
+				options.path = argv[i + 2];
+			}
+			i += 2;
+		}
+		else if (arg == "--poster-tile")
+		{
+			options.tile = std::max(16, std::atoi(argv[++i]));
+		}
+		else if (arg == "--poster-quality")
+		{
+			options.quality = std::min(std::max(std::atoi(argv[++i]), 1), 100);
+		}
+	}
+	return !options.path.empty();
+}
+
+// Projection that shows only pixels [x, x + w) x [y, y + h) (GL convention, y up) of a width x height
+// image seen through 'projection'. Clip-space x and y are scaled and shifted after the projection, so
+// depth, the near and far planes and everything evaluated per world position or view direction (sky,
+// procedural noise, fog) come out exactly as in the whole image, and the tiles meet without seams.
+inline glm::mat4 TileProjection(const glm::mat4 &projection, int x, int y, int w, int h, int width, int height)
+{
+	const float x0 = 2.0f * x / width - 1.0f, x1 = 2.0f * (x + w) / width - 1.0f;
+	const float y0 = 2.0f * y / height - 1.0f, y1 = 2.0f * (y + h) / height - 1.0f;
+	glm::mat4 crop(1.0f);
+	crop[0][0] = 2.0f / (x1 - x0);
+	crop[1][1] = 2.0f / (y1 - y0);
+	crop[3][0] = -(x1 + x0) / (x1 - x0);
+	crop[3][1] = -(y1 + y0) / (y1 - y0);
+	return crop * projection;
+}
+
+// Largest square tile up to 'requested' the GL can render into, a multiple of 16 so JPEG strips stay
+// aligned to the 8x8 blocks
+inline int MaxPosterTile(int requested)
+{
+	GLint renderbuffer = 0, viewport[2] = { 0, 0 };
+	glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &renderbuffer);
+	glGetIntegerv(GL_MAX_VIEWPORT_DIMS, viewport);
+	int tile = std::min(requested, (int)std::min(renderbuffer, std::min(viewport[0], viewport[1])));
+	return std::max(16, tile / 16 * 16);
+}
+
+// Renders a still far larger than the window or any framebuffer as a grid of tile x tile renders,
+// each through its own slice of the projection (TileProjection). A row of tiles is read straight into
+// a strip of the StripImageWriter, whose encoder compresses it in parallel while the next row renders,
+// so at most two rows of tiles are ever in memory, never the whole image. Tiles on the right and
+// bottom edges are rendered whole and cropped.
+class PosterRenderer
+{
+public:
+	// Draws the scene through the given projection into the framebuffer already bound
+	typedef std::function<void(const glm::mat4 &tileProjection)> DrawTile;
+
+	PosterRenderer() : tiles(0), renderMs(0.0), encodeMs(0.0), totalMs(0.0), bytes(0)
+	{
+	}
+
+	// 'framebuffer' is at least tile x tile pixels (0 for the default one); 'projection' is the one
+	// the whole image would be rendered with
+	bool Render(const PosterOptions &options, int tile, const glm::mat4 &projection, GLuint framebuffer, DrawTile draw)
+	{
+		typedef std::chrono::steady_clock Clock;
+		const Clock::time_point start = Clock::now();
+		this->tiles = 0;
+		this->renderMs = 0.0;
+		StripImageWriter writer;
+		if (!writer.Open(options.path, options.width, options.height, options.quality))
+		{
+			this->error = writer.GetError();
+			return false;
+		}
+
+		const int W = options.width, H = options.height;
+		const int columns = (W + tile - 1) / tile, rows = (H + tile - 1) / tile;
+		for (int r = 0; r < rows; r++)
+		{
+			// Image rows [r * tile, r * tile + stripRows) from the top; the tile's GL origin may fall
+			// below the image on the last row
+			const int stripRows = std::min(tile, H - r * tile);
+			const int glY = H - r * tile - tile;
+			unsigned char *strip = writer.BeginStrip(stripRows);
+			for (int c = 0; c < columns; c++)
+			{
+				const int x = c * tile;
+				const Clock::time_point tileStart = Clock::now();
+				glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+				glViewport(0, 0, tile, tile);
+				draw(TileProjection(projection, x, glY, tile, tile, W, H));
+
+				// Only the part inside the image, straight into its place in the strip
+				glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+				glReadBuffer(framebuffer ? GL_COLOR_ATTACHMENT0 : GL_BACK);
+				glPixelStorei(GL_PACK_ALIGNMENT, 4);
+				glPixelStorei(GL_PACK_ROW_LENGTH, W);
+				glReadPixels(0, tile - stripRows, std::min(tile, W - x), stripRows, GL_RGBA, GL_UNSIGNED_BYTE, strip + (size_t)x * 4);
+				glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+				this->renderMs += std::chrono::duration<double, std::milli>(Clock::now() - tileStart).count();
+				this->tiles++;
+			}
+			writer.EndStrip();
+		}
+
+		const bool ok = writer.Close();
+		this->error = writer.GetError();
+		this->bytes = writer.GetBytesWritten();
+		this->encodeMs = writer.GetEncodeMs();
+		this->totalMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		return ok;
+	}
+
+	int GetTileCount() const
+	{
+		return this->tiles;
+	}
+
+	// Time spent drawing and reading back the tiles, encoding (overlapped with the drawing) and in total
+	double GetRenderMs() const
+	{
+		return this->renderMs;
+	}
+
+	double GetEncodeMs() const
+	{
+		return this->encodeMs;
+	}
+
+	double GetTotalMs() const
+	{
+		return this->totalMs;
+	}
+
+	long long GetBytes() const
+	{
+		return this->bytes;
+	}
+
+	const std::string &GetError() const
+	{
+		return this->error;
+	}
+
+private:
+	int tiles;
+	double renderMs, encodeMs, totalMs;
+	long long bytes;
+	std::string error;
+};
@@ -0,0 +1,229 @@
+#pragma once
+
+// Std. Includes
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// GL Includes
+#include <GL/glew.h>
+
+// On-disk cache of linked program binaries (glGetProgramBinary). A program is keyed by the hash of its
+// sources, the defines it was built with and the driver (vendor, renderer, version), so a driver update
+// or an edited shader simply misses. A binary the driver rejects is deleted and the caller compiles.
+class ProgramCache
+{
+public:
+	static ProgramCache &Get()
+	{
+		static ProgramCache cache;
+		return cache;
+	}
+
+	void SetDirectory(const std::string &directory)
+	{
+		this->directory = directory;
+	}
+
+	bool IsSupported()
+	{
+		if (this->supported < 0)
+		{
+			GLint formats = 0;
+			if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)
+			{
+				glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+			}
+			this->supported = formats > 0 ? 1 : 0;
+		}
+		return this->supported == 1;
+	}
+
+	// Key of a program: sources, defines and the driver that will run it
+	std::string MakeKey(const std::string &vertex, const std::string &fragment, const std::string &defines = "")
+	{
+		if (this->driver.empty())
+		{
+			const GLenum names[4] = { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION };
+			for (GLenum name : names)
+			{
+				const char *s = (const char *)glGetString(name);
+				this->driver += s ? s : "";
+				this->driver += '\n';
+			}
+		}
+		uint64_t h = 14695981039346656037ull;
+		const std::string *parts[4] = { &this->driver, &defines, &vertex, &fragment };
+		for (const std::string *part : parts)
+		{
+			h = fnv1a(h, part->data(), part->size());
+			h = fnv1a(h, "\0", 1);		// "ab"+"c" and "a"+"bc" must differ
+		}
+		char hex[17];
+		snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)h);
+		return hex;
+	}
+
+	// Call before glLinkProgram on a program that will be stored
+	void PrepareForRetrieval(GLuint program)
+	{
+		if (this->IsSupported())
+		{
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+	}
+
+	// A linked program from the cache, or 0 when there is none or the driver refused it
+	GLuint Load(const std::string &key)
+	{
+		if (!this->IsSupported())
+		{
+			this->misses++;
+			return 0;
+		}
+		std::ifstream in(this->pathOf(key), std::ios::binary);
+		if (!in)
+		{
+			this->misses++;
+			return 0;
+		}
+
+		Header h;
+		in.read((char *)&h, sizeof(h));
+		std::vector<char> binary;
+		if (in && std::memcmp(h.magic, "GLPB", 4) == 0 && h.version == CACHE_VERSION && key == std::string(h.key, 16))
+		{
+			binary.resize(h.length);
+			in.read(binary.data(), h.length);
+		}
+		in.close();
+		if (binary.empty() || !in)
+		{
+			this->reject(key);
+			return 0;
+		}
+
+		GLuint program = glCreateProgram();
+		glProgramBinary(program, h.format, binary.data(), (GLsizei)binary.size());
+		GLint ok = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &ok);
+		if (!ok)
+		{
+			glDeleteProgram(program);
+			this->reject(key);
+			return 0;
+		}
+		this->hits++;
+		return program;
+	}
+
+	// Saves a successfully linked program
+	void Store(const std::string &key, GLuint program)
+	{
+		GLint ok = 0, length = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &ok);
+		if (!ok || !this->IsSupported())
+		{
+			return;
+		}
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+		{
+			return;
+		}
+
+		Header h;
+		std::memcpy(h.magic, "GLPB", 4);
+		h.version = CACHE_VERSION;
+		std::memcpy(h.key, key.data(), 16);
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		glGetProgramBinary(program, length, &length, &format, binary.data());
+		h.format = format;
+		h.length = (uint32_t)length;
+
+		std::error_code ec;
+		std::filesystem::create_directories(this->directory, ec);
+		std::ofstream out(this->pathOf(key), std::ios::binary);
+		if (!out)
+		{
+			std::cerr << "ERROR::PROGRAMCACHE::CANNOT_WRITE " << this->pathOf(key) << std::endl;
+			return;
+		}
+		out.write((const char *)&h, sizeof(h));
+		out.write(binary.data(), length);
+	}
+
+	int GetHits() const
+	{
+		return this->hits;
+	}
+
+	int GetMisses() const
+	{
+		return this->misses;
+	}
+
+private:
+	static const uint32_t CACHE_VERSION = 1;
+
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		char key[16];
+		uint32_t format;
+		uint32_t length;
+	};
+
+	std::string directory = "Cache/programs";
+	std::string driver;
+	int supported = -1;
+	int hits = 0, misses = 0;
+
+	ProgramCache()
+	{
+	}
+
+	std::string pathOf(const std::string &key) const
+	{
+		return this->directory + "/" + key + ".bin";
+	}
+
+	void reject(const std::string &key)
+	{
+		std::error_code ec;
+		std::filesystem::remove(this->pathOf(key), ec);
+		this->misses++;
+	}
+
+	static uint64_t fnv1a(uint64_t h, const char *data, size_t size)
+	{
+		for (size_t i = 0; i < size; i++)
+		{
+			h ^= (unsigned char)data[i];
+			h *= 1099511628211ull;
+		}
+		return h;
+	}
+};
+
+// Source with 'defines' placed right after the #version line (which must stay first)
+inline std::string InjectDefines(const std::string &source, const std::string &defines)
+{
+	if (defines.empty())
+	{
+		return source;
+	}
+	size_t eol = source.compare(0, 8, "#version") == 0 ? source.find('\n') : std::string::npos;
+	if (eol == std::string::npos)
+	{
+		return defines + "\n" + source;
+	}
+	return source.substr(0, eol + 1) + defines + "\n" + source.substr(eol + 1);
+}
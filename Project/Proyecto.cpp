@@ -7,15 +7,11 @@
 #include <random>
 #include <algorithm>
 #include <cstdlib>
+#include <chrono>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
-#define STB_IMAGE_STATIC
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-
-
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -24,6 +20,24 @@
 #include "Shader.h"
 #include "Camera.h"
 #include "Model.h"
+#include "Atmosphere.h"
+#include "Simulation.h"
+#include "FramePipeline.h"
+#include "SceneGraph.h"
+#include "InstanceKernels.h"
+#include "Offscreen.h"
+#include "Benchmark.h"
+#include "CameraPath.h"
+#include "ShadowCascades.h"
+#include "LightClusters.h"
+#include "DeferredShading.h"
+#include "AsyncProgram.h"
+#include "StaticBake.h"
+#include "PackedMaterial.h"
+#include "TextureArrayBatch.h"
+#include "Terrain.h"
+#include "FrameCapture.h"
+#include "PosterRender.h"
 
 glm::vec3 gAxePos(10.0f, 0.0f, -5.0f);  // posición del hacha
 float gAxeSpeed = 2.5f;                // velocidad de movimiento
@@ -35,7 +49,13 @@ int gSphereVerts = 0;
 // ================== Prototipos ==================
 void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mode);
 void MouseCallback(GLFWwindow* window, double xPos, double yPos);
-void DoMovement();
+void DoMovement(SimState& state, const TickInput& input, GLfloat dt);
+void UpdateSimulation(SimState& state, const TickInput& input, float dt);
+void SimulationTick(SimState& state, float dt);
+void ApplyScriptedPose(SimState& state);
+bool BuildFlyOver(const std::string& name, FlyOver& path);
+void StartCapture();
+void StopCapture();
 
 // ================== Ventana =====================
 const GLuint WIDTH = 800, HEIGHT = 600;
@@ -51,6 +71,20 @@ bool firstMouse = true;
 // ================== Tiempo ======================
 GLfloat deltaTime = 0.0f;
 GLfloat lastFrame = 0.0f;
+FixedStepSimulation gSim(1.0 / 60.0);   // simulación a 60 Hz, independiente del render
+
+// ================== Grabación / repetición de la cámara ==
+// La simulación sólo lee la entrada de un TickInput por paso, así que una grabación
+// repetida con el reloj fijo da exactamente los mismos estados (CameraPath.h)
+enum InputMode { INPUT_LIVE, INPUT_REPLAY, INPUT_FLYOVER };
+InputMode gInputMode = INPUT_LIVE;
+TickInput gLiveInput;          // lo que llega de los callbacks hasta el siguiente paso
+InputRecording gReplay;        // --replay
+size_t gReplayTick = 0;
+float gReplayDrift = 0.0f;     // mayor diferencia entre la pose recalculada y la grabada
+FlyOver gFlyOver;              // --flyover
+bool gRecordInput = false;     // --record
+InputRecording gRecord;
 
 // ================== Posiciones base =============
 glm::vec3 gTablePos = glm::vec3(-1.8f, 0.0f, -6.0f);
@@ -59,16 +93,51 @@ glm::vec3 gCampPos = glm::vec3(0.0f, 0.0f, 0.0f);
 
 // ================== Shader embebido (procedural)
 GLuint gProg = 0;
+AsyncProgram gProcProgram;   // compila en segundo plano mientras cargan los modelos
 
 // ================== VAOs / VBOs =================
 GLuint  gVAOCube = 0, gVBOCube = 0;   GLsizei gCubeVerts = 0;
 GLuint  gVAOSeat = 0, gVBOSeat = 0;   GLsizei gSeatVerts = 0;
 GLuint  gVAOVase = 0, gVBOVase = 0;   GLsizei gVaseVerts = 0;
-GLuint  gVAOGround = 0, gVBOGround = 0;   GLsizei gGroundVerts = 0;
 GLuint  gVAOCone = 0, gVBOCone = 0;   GLsizei gConeVerts = 0;
-bool    gFireOn = false;
 // ================== Texturas ====================
 GLuint  gTexGrass = 0;
+PackedMaterial gGroundMaterial;   // manchas de suelo de bosque sobre el pasto
+Terrain gTerrain;                 // suelo con relieve y LOD continuo
+
+// ================== Cielo (LUTs de dispersión) ==
+Atmosphere gAtmosphere;
+
+// ================== Sombras del sol ==============
+ShadowCascades gShadows;
+
+// ================== Luces puntuales ==============
+LightClusters gLights;
+std::vector<glm::vec3> gBraziers;   // braseros del tianguis, encendidos de noche
+
+// ================== Sombreado diferido (tecla L, --deferred) ==
+DeferredShading gDeferredShading;
+bool gDeferred = false;             // false = luces en el shader de cada objeto (forward)
+
+// ================== Captura de frames (tecla F9, --capture) ==
+FrameCapture gCapture;
+CaptureOptions gCaptureOpts;
+
+// ================== Preparación del frame en hilos ==
+// Lo que los trabajos necesitan del hilo principal para armar un frame
+struct FrameInputs {
+    SimState  sim;
+    glm::mat4 view, projection;
+    glm::mat4 fullProjection;       // la de la imagen entera; en un póster, projection es la de un tile
+    glm::vec3 sunDir;
+    float     sun;
+    bool      fireOn;
+    float     fireFlicker;
+    glm::vec3 fireColor, firePos;
+    float     braziers;             // 0 = apagados (día), 1 = encendidos
+    std::vector<PointLight> lights; // fogata + braseros
+};
+FramePipeline<FrameInputs> gPipeline;
 
 // ================== Instancias árbol/cactus =====
 const int AR_COUNT = 45;
@@ -80,7 +149,7 @@ std::vector<glm::mat4> gcaModels;
 const int CO_COUNT = 45;
 std::vector<glm::mat4> gCoModels;   // <- MAÍZ
 
-glm::vec3 gWheelPos(20.0f, 0.0f, -15.0f);   // NUEVA POSICIÓN LEJOS
+glm::vec3 gWheelPos(20.0f, 0.0f, -15.0f);   // NUEVA POSICIÓN LEJOS (posición inicial, luego vive en SimState)
 float gWheelYaw = 180.0f;                  // mirando hacia -X (para que avance hacia la cámara)
 
 // ===========================================================
@@ -92,15 +161,41 @@ uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 out vec3 vPos;
+out float vViewDepth;
+
+// Terreno CDLOD (Terrain.h): aPos es el vértice en la rejilla del nodo
+uniform bool      uTerrain;
+uniform sampler2D uTerrainHeight;
+uniform vec4      uTerrainRect;    // xy = origen, z = 1/paso del mapa de alturas, w = 1/resolución
+uniform vec4      uTerrainNode;    // xy = esquina del nodo, z = separación de sus vértices
+uniform vec2      uTerrainMorph;   // x = distancia donde empieza a morfar, y = 1/largo del morph
+uniform vec3      uViewPos;
+float TerrainHeight(vec2 xz){
+    return textureLod(uTerrainHeight, ((xz - uTerrainRect.xy) * uTerrainRect.z + 0.5) * uTerrainRect.w, 0.0).r;
+}
 void main(){
-    vPos = (model * vec4(aPos,1.0)).xyz;
-    gl_Position = projection * view * vec4(vPos,1.0);
+    if (uTerrain) {
+        // Los vértices impares se deslizan hacia la rejilla del nivel siguiente al alejarse
+        vec2 xz = uTerrainNode.xy + aPos.xz * uTerrainNode.z;
+        float d = distance(uViewPos, vec3(xz.x, TerrainHeight(xz), xz.y));
+        float k = clamp((d - uTerrainMorph.x) * uTerrainMorph.y, 0.0, 1.0);
+        xz -= fract(aPos.xz * 0.5) * 2.0 * uTerrainNode.z * k;
+        vPos = (model * vec4(xz.x, TerrainHeight(xz), xz.y, 1.0)).xyz;
+    }
+    else
+        vPos = (model * vec4(aPos,1.0)).xyz;
+    vec4 viewPos = view * vec4(vPos,1.0);
+    vViewDepth = -viewPos.z;
+    gl_Position = projection * viewPos;
 })";
 
 // === REEMPLAZAR EL kFS COMPLETO (LÍNEAS 111-372) CON ESTO ===
 static const char* kFS = R"(#version 330 core
-out vec4 FragColor;
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 GAlbedo;   // sólo con el G-buffer (DeferredShading.h)
+layout(location = 2) out vec4 GNormal;
 in vec3 vPos;
+in float vViewDepth;
 
 uniform float uTime;
 uniform float uSun;
@@ -109,12 +204,65 @@ uniform vec3  uCamp;      // reservado
 uniform int   uMode;      // 0=fuego 1=madera 2=cerámica 3/4/6 colores 5=tejido 10=grassProc 11=sky 12=grassTex 13=hojas 14/15/16 flor 17-21=mascara
 uniform sampler2D uTex;   // para pasto texturizado
 uniform float uTexScale;  // tiling base
+uniform vec3  uViewPos;
+
+// Material PBR empacado del suelo (PackedMaterial.h)
+uniform bool      uPbrEnabled;
+uniform sampler2D uPbrAlbedo;
+uniform sampler2D uPbrNormal;    // XY de la normal (BC5); Z se reconstruye
+uniform sampler2D uPbrSurface;   // r = rugosidad, g = desplazamiento, b = oclusión
+uniform float     uPbrScale;
 uniform float uSeed;      // semilla per-flama
 uniform float uFlicker;   // factor de parpadeo externo
 
-// === NUEVO: Uniforms para la luz de la fogata ===
-uniform vec3  uFirePos;   // Posición de la fogata
-uniform vec3  uFireColor; // Color e intensidad (será vec3(0,0,0) si está apagada)
+// Terreno (Terrain.h): la normal sale del mapa de alturas
+uniform bool      uTerrain;
+uniform sampler2D uTerrainHeight;
+uniform vec4      uTerrainRect;
+uniform float     uTerrainStep;
+vec3 TerrainNormal(vec2 xz){
+    vec2 uv = ((xz - uTerrainRect.xy) * uTerrainRect.z + 0.5) * uTerrainRect.w;
+    vec2 e = vec2(uTerrainRect.w, 0.0);
+    float dx = texture(uTerrainHeight, uv - e.xy).r - texture(uTerrainHeight, uv + e.xy).r;
+    float dz = texture(uTerrainHeight, uv - e.yx).r - texture(uTerrainHeight, uv + e.yx).r;
+    return normalize(vec3(dx, 2.0 * uTerrainStep, dz));
+}
+
+// Luces puntuales (fogata y braseros) repartidas en cúmulos de la vista (LightClusters.h)
+uniform samplerBuffer  uLightData;     // 2 texels por luz: posición + radio, color
+uniform usamplerBuffer uClusterCells;  // primer índice y cantidad de luces por cúmulo
+uniform usamplerBuffer uLightIndices;
+uniform ivec3 uClusterGrid;
+uniform vec2  uClusterTile;            // cúmulos por pixel
+uniform vec2  uClusterDepth;           // x = rebanadas / log(far/near), y = near
+uniform bool  uDeferred;               // las luces las suma el pase diferido; aquí sólo se guarda albedo y normal
+
+vec3 gAlbedo = vec3(0.0);
+vec3 gNormal = vec3(0.0);
+
+// Cielo físico precalculado (ver Atmosphere.h)
+uniform sampler3D uSkyLUT;     // x=elevación de la vista, y=elevación del sol, z=azimut relativo
+uniform float     uSkyExposure;
+
+// Sombras del sol en cascadas (ShadowCascades.h), igual que en modelLoading.frag
+uniform sampler2DArrayShadow uShadowMap;
+uniform mat4  uLightVP[3];
+uniform vec3  uCascadeSplits;
+uniform float uShadowStrength;
+uniform float uShadowTexel;
+
+float ShadowVisibility(vec3 worldPos, float viewDepth){
+    if (uShadowStrength <= 0.0 || viewDepth >= uCascadeSplits.z) return 1.0;
+    int c = viewDepth < uCascadeSplits.x ? 0 : (viewDepth < uCascadeSplits.y ? 1 : 2);
+    vec4 p = uLightVP[c] * vec4(worldPos, 1.0);
+    vec3 uvz = p.xyz / p.w * 0.5 + 0.5;
+    if (any(lessThan(uvz, vec3(0.0))) || any(greaterThan(uvz, vec3(1.0)))) return 1.0;
+    float lit = 0.0;
+    for (int y = -1; y <= 1; y++)
+        for (int x = -1; x <= 1; x++)
+            lit += texture(uShadowMap, vec4(uvz.xy + vec2(x, y) * uShadowTexel, float(c), uvz.z - 0.0002));
+    return mix(lit / 9.0, 1.0, smoothstep(0.9, 1.0, viewDepth / uCascadeSplits.z));
+}
 
 float hash(vec2 p){ return fract(sin(dot(p,vec2(127.1,311.7)))*43758.5453123); }
 float noise(vec2 p){
@@ -140,17 +288,32 @@ float fbm_ridged(vec2 p){
     return v;
 }
 
-// === NUEVO: Función de iluminación de la fogata ===
-vec3 CalcFireLight(vec3 pos, vec3 normal, vec3 albedo) {
-    if (uFireColor.r < 0.01) return vec3(0.0); // Luz apagada
-
-    vec3 lightDir = normalize(uFirePos - pos);
-    float diff = max(dot(normal, lightDir), 0.0);
-    
-    float dist = length(uFirePos - pos);
-    float atten = 1.0 / (1.0 + 0.05 * dist + 0.015 * dist * dist); 
-    
-    return albedo * uFireColor * diff * atten; 
+// Suma de las luces puntuales del cúmulo donde cae el fragmento
+vec3 CalcPointLights(vec3 pos, vec3 normal, vec3 albedo) {
+    if (uDeferred) {
+        gAlbedo = albedo;
+        gNormal = normal;
+        return vec3(0.0);
+    }
+    int z = int(log(max(vViewDepth, uClusterDepth.y) / uClusterDepth.y) * uClusterDepth.x);
+    if (z >= uClusterGrid.z) return vec3(0.0);
+    ivec2 xy = clamp(ivec2(gl_FragCoord.xy * uClusterTile), ivec2(0), uClusterGrid.xy - 1);
+    uvec2 cell = texelFetch(uClusterCells, (z * uClusterGrid.y + xy.y) * uClusterGrid.x + xy.x).xy;
+
+    vec3 sum = vec3(0.0);
+    for (uint i = 0u; i < cell.y; i++) {
+        int l = int(texelFetch(uLightIndices, int(cell.x + i)).r);
+        vec4 posRadius = texelFetch(uLightData, 2 * l);
+        vec3 color = texelFetch(uLightData, 2 * l + 1).rgb;
+
+        vec3 toLight = posRadius.xyz - pos;
+        float dist = length(toLight);
+        float diff = max(dot(normal, toLight / max(dist, 1e-4)), 0.0);
+        float atten = 1.0 / (1.0 + 0.05 * dist + 0.015 * dist * dist);
+        float window = clamp(1.0 - pow(dist / posRadius.w, 4.0), 0.0, 1.0); // llega a 0 en el radio del cúmulo
+        sum += color * diff * atten * window * window;
+    }
+    return albedo * sum;
 }
 
 
@@ -159,21 +322,18 @@ vec3 wood(vec3 p){
     return mix(vec3(0.55,0.36,0.18), vec3(0.74,0.54,0.30), rings);
 }
 
-vec3 skyColor(vec3 dir, float dayVis, out float night){
+vec3 skyColor(vec3 dir, vec3 sunDir, float dayVis, out float night){
     night = 1.0 - clamp(dayVis, 0.0, 1.0);
-    float h = clamp(dir.y*0.5+0.5, 0.0, 1.0);
-    vec3 dawnCol = vec3(0.95,0.55,0.35);
-    vec3 dayTop  = vec3(0.12,0.45,0.90);
-    vec3 dayHzn  = vec3(0.70,0.85,1.00);
-    vec3 duskTop = vec3(0.08,0.20,0.45);
-    vec3 duskHzn = vec3(0.20,0.18,0.25);
-    vec3 dayMix  = mix(dayHzn, dayTop, h);
-    vec3 duskMix = mix(duskHzn, duskTop, h);
-    vec3 base    = mix(duskMix, dayMix, clamp(dayVis,0.0,1.0));
-    float dawn   = smoothstep(0.40,0.60, dayVis)*(1.0-smoothstep(0.65,0.80,dayVis))
-                 + smoothstep(0.20,0.35, dayVis)*(1.0-smoothstep(0.35,0.45,dayVis));
-    base = mix(base, mix(dawnCol, base, h*h), clamp(dawn,0.0,1.0));
-    return base;
+    const float PI = 3.14159265359;
+    // Misma parametrización que Atmosphere::precompute (más texels cerca del horizonte)
+    float u = 0.5 + 0.5*sign(dir.y)*sqrt(abs(dir.y));
+    float v = sunDir.y*0.5 + 0.5;
+    float w = acos(clamp(dot(normalize(dir.xz + vec2(1e-5)), normalize(sunDir.xz + vec2(1e-5))), -1.0, 1.0)) / PI;
+    vec3 lutSize = vec3(textureSize(uSkyLUT, 0));
+    vec3 uvw = (vec3(u, v, w) * (lutSize - 1.0) + 0.5) / lutSize;
+    vec3 L = texture(uSkyLUT, uvw).rgb;
+    vec3 base = vec3(1.0) - exp(-L * uSkyExposure);
+    return base + vec3(0.010, 0.014, 0.030) * night; // resplandor nocturno
 }
 
 float diskHalo(float mu, float rCore, float rHalo){
@@ -183,7 +343,7 @@ float diskHalo(float mu, float rCore, float rHalo){
     return core + 0.35*halo;
 }
 
-void main(){
+void shadeSurface(){
     // === NUEVO: Calcular normal plana para objetos procedurales ===
     vec3 flatNormal = normalize(cross(dFdx(vPos), dFdy(vPos)));
     
@@ -191,7 +351,7 @@ void main(){
 
     if(uMode==1){ 
         vec3 col = wood(vPos);
-        col += CalcFireLight(vPos, flatNormal, col);
+        col += CalcPointLights(vPos, flatNormal, col);
         FragColor=vec4(col,1.0); 
         return; 
     } 
@@ -226,7 +386,7 @@ void main(){
         vec3 jute=vec3(0.90,0.86,0.72), navy=vec3(0.05,0.10,0.20);
         vec3 base=mix(navy,jute,kk);
         base+=0.08*noise(uv*2.5);
-        base += CalcFireLight(vPos, flatNormal, base);
+        base += CalcPointLights(vPos, flatNormal, base);
         FragColor=vec4(base,1.0); return;
     }
 
@@ -238,14 +398,14 @@ void main(){
         vec3 col=mix(terracotta,crema,b*0.25);
         if(abs(vPos.y-0.15)<0.06) col=mix(col,vec3(0.14,0.02,0.02),0.85);
         if(abs(vPos.y-0.00)<0.06) col=mix(col,vec3(0.14,0.02,0.02),0.85);
-        col += CalcFireLight(vPos, flatNormal, col);
+        col += CalcPointLights(vPos, flatNormal, col);
         FragColor=vec4(col,1.0); return;
     }
 
     // Colores varios
-    if(uMode==3){ vec3 col=vec3(0.84,0.72,0.54); col+=CalcFireLight(vPos,flatNormal,col); FragColor=vec4(col,1.0); return; }
-    if(uMode==4){ vec3 col=vec3(0.10,0.07,0.06); col+=CalcFireLight(vPos,flatNormal,col); FragColor=vec4(col,1.0); return; }
-    if(uMode==6){ vec3 col=vec3(0.88,0.42,0.55); col+=CalcFireLight(vPos,flatNormal,col); FragColor=vec4(col,1.0); return; }
+    if(uMode==3){ vec3 col=vec3(0.84,0.72,0.54); col+=CalcPointLights(vPos,flatNormal,col); FragColor=vec4(col,1.0); return; }
+    if(uMode==4){ vec3 col=vec3(0.10,0.07,0.06); col+=CalcPointLights(vPos,flatNormal,col); FragColor=vec4(col,1.0); return; }
+    if(uMode==6){ vec3 col=vec3(0.88,0.42,0.55); col+=CalcPointLights(vPos,flatNormal,col); FragColor=vec4(col,1.0); return; }
 
     // Pasto procedural simple
     if(uMode==10){
@@ -261,7 +421,7 @@ void main(){
         float sunVis  = clamp(uSun, 0.0, 1.0);
         float light   = 0.40 + lambert * mix(0.55, 1.00, sunVis);
         
-        vec3 fireLight = CalcFireLight(vPos, vec3(0,1,0), col);
+        vec3 fireLight = CalcPointLights(vPos, vec3(0,1,0), col);
         col = col * light + fireLight; // Sol multiplica, fogata suma
 
         FragColor = vec4(col, 1.0); return;
@@ -270,7 +430,7 @@ void main(){
     // Cielo + horizonte (no se ilumina por fogata)
     if(uMode==11){
         vec3 dir = normalize(vPos);
-        float nightFactor; vec3 base = skyColor(dir, uSun, nightFactor);
+        float nightFactor; vec3 base = skyColor(dir, normalize(uSunDir), uSun, nightFactor);
         vec2 uvCloud = dir.xz * 0.7 + vec2(0.06*uTime, 0.0);
         float c  = fbm(uvCloud*1.1);
         float cloud = smoothstep(0.52, 0.70, c);
@@ -337,27 +497,44 @@ void main(){
         vec3  albedo = mix(texA, texB, mask);
         float micro = fbm(vPos.xz*1.2);
         albedo *= mix(0.96, 1.06, micro);
-        float lambert = clamp(dot(vec3(0,1,0), normalize(uSunDir)), 0.0, 1.0);
+
+        // Manchas de suelo de bosque; entran primero por las partes bajas del desplazamiento
+        vec3 n = uTerrain ? TerrainNormal(vPos.xz) : vec3(0.0, 1.0, 0.0);
+        float gloss = 0.0;
+        if (uPbrEnabled) {
+            vec2 uvP = vPos.xz * uPbrScale;
+            vec3 surf = texture(uPbrSurface, uvP).rgb;
+            float dirt = smoothstep(0.50, 0.70, fbm(vPos.xz*0.045 + 71.0) + (0.4 - surf.g)*0.8);
+            vec2 nxy = texture(uPbrNormal, uvP).rg * 2.0 - 1.0;
+            vec3 nt = vec3(nxy, sqrt(max(1.0 - dot(nxy, nxy), 0.0)));
+            albedo = mix(albedo, texture(uPbrAlbedo, uvP).rgb * surf.b, dirt);
+            n = normalize(mix(n, vec3(nt.x, nt.z, nt.y), dirt));   // u sobre +X, v sobre +Z
+            gloss = dirt * (1.0 - surf.r);
+        }
+
+        float lambert = clamp(dot(n, normalize(uSunDir)), 0.0, 1.0);
         float sunVis  = clamp(uSun, 0.0, 1.0);
         float ambient = mix(0.40, 0.62, sunVis);
         float light   = ambient + lambert * mix(0.55, 1.00, sunVis);
+        vec3 h = normalize(normalize(uSunDir) + normalize(uViewPos - vPos));
+        float spec = gloss * gloss * pow(max(dot(n, h), 0.0), mix(8.0, 64.0, gloss)) * sunVis;
 
-        vec3 fireLight = CalcFireLight(vPos, vec3(0,1,0), albedo);
-        FragColor = vec4(albedo * light + fireLight, 1.0);
+        vec3 fireLight = CalcPointLights(vPos, n, albedo);
+        FragColor = vec4(albedo * light + fireLight + vec3(0.5 * spec), 1.0);
         return;
     }
     
     // Máscara de Jade
-    if(uMode==17){ vec3 col=vec3(0.30, 0.82, 0.70); col+=CalcFireLight(vPos,flatNormal,col); FragColor = vec4(col, 1.0); return; } // jade claro
-    if(uMode==18){ vec3 col=vec3(0.12, 0.40, 0.33); col+=CalcFireLight(vPos,flatNormal,col); FragColor = vec4(col, 1.0); return; } // jade oscuro
-    if(uMode==19){ vec3 col=vec3(0.83, 0.35, 0.25); col+=CalcFireLight(vPos,flatNormal,col); FragColor = vec4(col, 1.0); return; } // rojo coral
-    if(uMode==20){ vec3 col=vec3(0.95, 0.95, 0.90); col+=CalcFireLight(vPos,flatNormal,col); FragColor = vec4(col, 1.0); return; } // blanco ojos
-    if(uMode==21){ vec3 col=vec3(0.05, 0.05, 0.05); col+=CalcFireLight(vPos,flatNormal,col); FragColor = vec4(col, 1.0); return; } // negro detalles
+    if(uMode==17){ vec3 col=vec3(0.30, 0.82, 0.70); col+=CalcPointLights(vPos,flatNormal,col); FragColor = vec4(col, 1.0); return; } // jade claro
+    if(uMode==18){ vec3 col=vec3(0.12, 0.40, 0.33); col+=CalcPointLights(vPos,flatNormal,col); FragColor = vec4(col, 1.0); return; } // jade oscuro
+    if(uMode==19){ vec3 col=vec3(0.83, 0.35, 0.25); col+=CalcPointLights(vPos,flatNormal,col); FragColor = vec4(col, 1.0); return; } // rojo coral
+    if(uMode==20){ vec3 col=vec3(0.95, 0.95, 0.90); col+=CalcPointLights(vPos,flatNormal,col); FragColor = vec4(col, 1.0); return; } // blanco ojos
+    if(uMode==21){ vec3 col=vec3(0.05, 0.05, 0.05); col+=CalcPointLights(vPos,flatNormal,col); FragColor = vec4(col, 1.0); return; } // negro detalles
 
     // Flor (tallo/hojas, pétalos, centro)
-    if(uMode==14){ vec3 col=vec3(0.10, 0.45, 0.14); col+=CalcFireLight(vPos,flatNormal,col); FragColor = vec4(col, 1.0); return; } // tallo/hojas
-    if(uMode==15){ vec3 col=vec3(0.95, 0.60, 0.75); col+=CalcFireLight(vPos,flatNormal,col); FragColor = vec4(col, 1.0); return; } // pétalo rosado
-    if(uMode==16){ vec3 col=vec3(0.98, 0.85, 0.25); col+=CalcFireLight(vPos,flatNormal,col); FragColor = vec4(col, 1.0); return; } // centro amarillo
+    if(uMode==14){ vec3 col=vec3(0.10, 0.45, 0.14); col+=CalcPointLights(vPos,flatNormal,col); FragColor = vec4(col, 1.0); return; } // tallo/hojas
+    if(uMode==15){ vec3 col=vec3(0.95, 0.60, 0.75); col+=CalcPointLights(vPos,flatNormal,col); FragColor = vec4(col, 1.0); return; } // pétalo rosado
+    if(uMode==16){ vec3 col=vec3(0.98, 0.85, 0.25); col+=CalcPointLights(vPos,flatNormal,col); FragColor = vec4(col, 1.0); return; } // centro amarillo
 
     // Hojas de árbol (canopy)
     if(uMode==13){
@@ -370,12 +547,21 @@ void main(){
         float ambient = mix(0.35, 0.55, sunVis);
         float light   = ambient + lambert * mix(0.45, 0.95, sunVis);
         
-        vec3 fireLight = CalcFireLight(vPos, flatNormal, col);
+        vec3 fireLight = CalcPointLights(vPos, flatNormal, col);
         col = col * light * (0.92 + 0.08*noise(vPos.xz*3.7)) + fireLight;
         
         FragColor = vec4(col, 1.0);
         return;
     }
+}
+
+void main(){
+    shadeSurface();
+    // Sombra del sol sobre todo menos el cielo y el fuego
+    if (uMode != 0 && uMode != 11)
+        FragColor.rgb *= 1.0 - uShadowStrength * (1.0 - ShadowVisibility(vPos, vViewDepth));
+    GAlbedo = vec4(gAlbedo, float(uMode) / 255.0);
+    GNormal = vec4(gNormal, 0.0);
 })";
 
 
@@ -385,28 +571,14 @@ void main(){
 // ===========================================================
 // Utilidades
 // ===========================================================
-static GLuint Compile(GLenum type, const char* src) {
-    GLuint s = glCreateShader(type); glShaderSource(s, 1, &src, nullptr); glCompileShader(s);
-    GLint ok; glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
-    if (!ok) { char log[2048]; glGetShaderInfoLog(s, 2048, nullptr, log); std::cout << "Shader error:\n" << log << "\n"; }
-    return s;
-}
-static GLuint Link(GLuint vs, GLuint fs) {
-    GLuint p = glCreateProgram(); glAttachShader(p, vs); glAttachShader(p, fs); glLinkProgram(p);
-    GLint ok; glGetProgramiv(p, GL_LINK_STATUS, &ok);
-    if (!ok) { char log[2048]; glGetProgramInfoLog(p, 2048, nullptr, log); std::cout << "Link error:\n" << log << "\n"; }
-    glDeleteShader(vs); glDeleteShader(fs); return p;
-}
-static void CreateProgram() { gProg = Link(Compile(GL_VERTEX_SHADER, kVS), Compile(GL_FRAGMENT_SHADER, kFS)); }
+// El programa procedural sólo se manda a compilar; se espera en su primer uso (ReplayFrame)
+static void CreateProgram() { gProg = gProcProgram.Submit(kVS, kFS, "", "kVS/kFS"); }
 
+// Color sRGB comprimido en DXT1 a través del cache de DDS (TextureCache)
 static GLuint LoadTexture2D(const char* path, bool repeat = true) {
-    int w = 0, h = 0, nc = 0;
-    stbi_uc* data = stbi_load(path, &w, &h, &nc, 3);
-    if (!data) { std::cout << "No se pudo cargar " << path << "\n"; return 0; }
-    GLuint tex = 0; glGenTextures(1, &tex);
+    GLuint tex = TextureCache::Get().Load(path, TextureCache::SRGB);
+    if (!tex) { std::cerr << "No se pudo cargar " << path << "\n"; return 0; }
     glBindTexture(GL_TEXTURE_2D, tex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, repeat ? GL_REPEAT : GL_CLAMP_TO_EDGE);
@@ -415,7 +587,6 @@ static GLuint LoadTexture2D(const char* path, bool repeat = true) {
         GLfloat aniso = 0.0f; glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &aniso);
         glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, std::min(8.0f, aniso));
     }
-    stbi_image_free(data);
     glBindTexture(GL_TEXTURE_2D, 0);
     return tex;
 }
@@ -517,20 +688,25 @@ static void BuildVase() {
     glBindVertexArray(0);
 }
 
-static void BuildGround(float S = 220.0f) {
-    float v[] = { -S,0.0f,-S,  S,0.0f,-S,  S,0.0f, S,
-                  -S,0.0f,-S,  S,0.0f, S, -S,0.0f, S };
-    gGroundVerts = 6;
-    glGenVertexArrays(1, &gVAOGround);
-    glGenBuffers(1, &gVBOGround);
-    glBindVertexArray(gVAOGround);
-    glBindBuffer(GL_ARRAY_BUFFER, gVBOGround);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(v), v, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glBindVertexArray(0);
+// Braseros en tres anillos alrededor de la fogata, sin tapar la mesa ni la fogata
+static void PlaceBraziers() {
+    const float radius[3] = { 9.0f, 18.0f, 30.0f };
+    const int   count[3] = { 8, 14, 20 };
+    gBraziers.clear();
+    for (int r = 0; r < 3; ++r) {
+        for (int i = 0; i < count[r]; ++i) {
+            float a = (2.0f * 3.14159265f * i) / count[r] + 0.37f * r;
+            glm::vec3 p = gCampPos + glm::vec3(radius[r] * cosf(a), 0.0f, radius[r] * sinf(a));
+            if (glm::distance(p, gTablePos) < 3.0f) continue;
+            gBraziers.push_back(p);
+        }
+    }
 }
 
+// Parpadeo propio de cada brasero, para que no pulsen todos juntos
+static float BrazierFlicker(int i, float t) {
+    return 0.85f + 0.10f * sinf(t * 7.3f + i * 1.7f) + 0.05f * sinf(t * 13.1f + i * 0.9f);
+}
 
 static void BuildCone(int slices = 16) {
     std::vector<glm::vec3> v;
@@ -609,31 +785,388 @@ static void BuildSphere(int segments = 32, int rings = 16) {
     glBindVertexArray(0);
 }
 
+// ===========================================================
+// Reproducción de las listas de dibujo (sólo hilo de GL)
+// ===========================================================
+// Dibuja en la cascada enlazada los comandos de una clase de sombra (estáticos o dinámicos)
+static void DrawShadowCasters(const FramePipeline<FrameInputs>::Packet& pkt, Shader& depthShader, int caster, const glm::mat4& lightVP, RenderStats& stats) {
+    const GLint locModel = glGetUniformLocation(depthShader.Program, "model");
+    const GLint locAlpha = glGetUniformLocation(depthShader.Program, "alphaTest");
+    glUniformMatrix4fv(glGetUniformLocation(depthShader.Program, "lightViewProj"), 1, GL_FALSE, glm::value_ptr(lightVP));
+
+    GLuint vao = 0;
+    for (const DrawList& list : pkt.lists) {
+        for (const DrawCmd& c : list.GetCommands()) {
+            if (c.shadow != caster) continue;
+            glUniformMatrix4fv(locModel, 1, GL_FALSE, glm::value_ptr(c.model));
+
+            if (c.program == DRAW_MODEL) {
+                glUniform1i(locAlpha, 1);   // hojas de árboles y maíz recortadas por alpha
+                if (c.batch) {
+                    c.batch->Draw(depthShader, c.model);
+                    stats.draws += c.batch->GetMeshCount();
+                    stats.triangles += c.batch->GetTriangleCount();
+                }
+                else {
+                    c.mesh->Draw(depthShader);
+                    stats.draws += c.mesh->GetMeshCount();
+                    stats.triangles += c.mesh->GetTriangleCount();
+                }
+                vao = 0;
+                continue;
+            }
+
+            glUniform1i(locAlpha, 0);
+            if (c.vao != vao) {
+                glBindVertexArray(c.vao);
+                vao = c.vao;
+            }
+            glDrawArrays(GL_TRIANGLES, 0, c.count);
+            stats.draws++; stats.triangles += c.count / 3;
+        }
+    }
+    glBindVertexArray(0);
+}
+
+// Sombras del sol: las cascadas estáticas sólo se redibujan cuando el sol giró o la cámara las
+// desplazó; encima se componen los objetos que se mueven (perrito, pelota, hacha, carretilla).
+// Devuelve la intensidad de la sombra para los shaders (0 de noche).
+static float RenderShadows(const FramePipeline<FrameInputs>::Packet& pkt, Shader& depthShader, RenderStats& stats) {
+    const FrameInputs& in = pkt.inputs;
+    const float strength = 0.6f * glm::smoothstep(0.0f, 0.2f, in.sunDir.y);   // se desvanecen en el horizonte
+    if (strength <= 0.0f) return 0.0f;
+
+    gShadows.Update(in.view, in.fullProjection, in.sunDir);   // mismas cascadas en todos los tiles
+    gShadows.BeginPass();
+    depthShader.Use();
+    TextureArrayBatch::BindSampler(depthShader.Program);
+    for (int c = 0; c < ShadowCascades::CASCADES; c++) {
+        if (!gShadows.NeedsStaticRender(c)) continue;
+        gShadows.BeginStatic(c);
+        DrawShadowCasters(pkt, depthShader, SHADOW_STATIC, gShadows.GetLightMatrix(c), stats);
+    }
+    for (int c = 0; c < ShadowCascades::CASCADES; c++) {
+        gShadows.BeginDynamic(c);
+        DrawShadowCasters(pkt, depthShader, SHADOW_DYNAMIC, gShadows.GetLightMatrix(c), stats);
+    }
+    gShadows.EndPass();
+    return strength;
+}
+
+static void ReplayFrame(const FramePipeline<FrameInputs>::Packet& pkt, Shader& shader, Shader& depthShader, Shader& lightShader, Shader& resolveShader, RenderStats& stats) {
+    const FrameInputs& in = pkt.inputs;
+    const GLfloat currentFrame = (GLfloat)in.sim.time;
+
+    // ---------------- Sombras ----------------
+    const float shadowStrength = RenderShadows(pkt, depthShader, stats);
+
+    // ---------------- Luces puntuales por cúmulo ----------------
+    gLights.Build(in.lights, in.view, in.projection);
+    gLights.Upload();
+
+    // Con el camino diferido la escena va al G-buffer y las luces se suman al final
+    const bool deferred = gDeferred;
+    if (deferred) gDeferredShading.BeginGeometry();
+
+    // ---------------- Cielo ----------------
+    {
+        gProcProgram.Use();
+        gShadows.Bind(gProg, shadowStrength);   // queda puesto para el suelo y los procedurales
+        gLights.Bind(gProg, SCREEN_WIDTH, SCREEN_HEIGHT);
+        glUniform1i(glGetUniformLocation(gProg, "uDeferred"), deferred);
+        glm::mat4 viewNoTrans = glm::mat4(glm::mat3(in.view));
+        glUniformMatrix4fv(glGetUniformLocation(gProg, "projection"), 1, GL_FALSE, glm::value_ptr(in.projection));
+        glUniformMatrix4fv(glGetUniformLocation(gProg, "view"), 1, GL_FALSE, glm::value_ptr(viewNoTrans));
+        glUniform1f(glGetUniformLocation(gProg, "uTime"), currentFrame);
+        glUniform1f(glGetUniformLocation(gProg, "uSun"), in.sun);
+        glUniform3fv(glGetUniformLocation(gProg, "uSunDir"), 1, glm::value_ptr(in.sunDir));
+        glUniform1i(glGetUniformLocation(gProg, "uMode"), 11);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_3D, gAtmosphere.GetSkyTexture());
+        glUniform1i(glGetUniformLocation(gProg, "uSkyLUT"), 1);
+        glUniform1f(glGetUniformLocation(gProg, "uSkyExposure"), gAtmosphere.GetExposure());
+
+        glm::mat4 MSky(1.0f); MSky = glm::scale(MSky, glm::vec3(500.0f));
+        glUniformMatrix4fv(glGetUniformLocation(gProg, "model"), 1, GL_FALSE, glm::value_ptr(MSky));
+
+        glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_FALSE);
+        glBindVertexArray(gVAOCube);
+        glDrawArrays(GL_TRIANGLES, 0, gCubeVerts);
+        glBindVertexArray(0);
+        stats.draws++; stats.triangles += gCubeVerts / 3;
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+        glBindTexture(GL_TEXTURE_3D, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glUseProgram(0);
+    }
+
+    // ---------------- Suelo (pasto texturizado) ----------------
+    // Los uniforms por frame de gProg quedan puestos para los dibujos procedurales de abajo
+    glUseProgram(gProg);
+    glUniformMatrix4fv(glGetUniformLocation(gProg, "projection"), 1, GL_FALSE, glm::value_ptr(in.projection));
+    glUniformMatrix4fv(glGetUniformLocation(gProg, "view"), 1, GL_FALSE, glm::value_ptr(in.view));
+    glUniform1f(glGetUniformLocation(gProg, "uTime"), currentFrame);
+    glUniform1f(glGetUniformLocation(gProg, "uSun"), in.sun);
+    glUniform3fv(glGetUniformLocation(gProg, "uSunDir"), 1, glm::value_ptr(in.sunDir));
+    glUniform1i(glGetUniformLocation(gProg, "uMode"), 12);
+    glUniform1f(glGetUniformLocation(gProg, "uTexScale"), 0.28f);
+    glUniform3fv(glGetUniformLocation(gProg, "uViewPos"), 1, glm::value_ptr(in.sim.cameraPos));
+    glUniform1i(glGetUniformLocation(gProg, "uPbrEnabled"), gGroundMaterial.IsLoaded());
+    glUniform1f(glGetUniformLocation(gProg, "uPbrScale"), 0.35f);
+    if (gGroundMaterial.IsLoaded()) gGroundMaterial.Bind(gProg, 2);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, gTexGrass);
+    glUniform1i(glGetUniformLocation(gProg, "uTex"), 0);
+
+    glm::mat4 MG(1.0f);
+    MG = glm::translate(MG, glm::vec3(0.0f, -0.001f, 0.0f));
+    glUniformMatrix4fv(glGetUniformLocation(gProg, "model"), 1, GL_FALSE, glm::value_ptr(MG));
+    gTerrain.Bind(gProg, 6);
+    stats.draws += gTerrain.Draw(gProg, in.projection * in.view, in.sim.cameraPos);
+    stats.triangles += gTerrain.GetLastTriangleCount();
+
+    // =======================================================
+    // Uniforms por frame del shader de modelos
+    // =======================================================
+    shader.Use();
+    gShadows.Bind(shader.Program, shadowStrength);
+    gLights.Bind(shader.Program, SCREEN_WIDTH, SCREEN_HEIGHT);
+    glUniform1i(glGetUniformLocation(shader.Program, "uDeferred"), deferred);
+    TextureArrayBatch::BindSampler(shader.Program);
+
+    // Proyección y vista
+    glUniformMatrix4fv(glGetUniformLocation(shader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(in.projection));
+    glUniformMatrix4fv(glGetUniformLocation(shader.Program, "view"), 1, GL_FALSE, glm::value_ptr(in.view));
+
+    // Luz direccional basada en el sol (nombres compatibles)
+    auto U = [&](const char* n) { return glGetUniformLocation(shader.Program, n); };
+    // Color del sol e irradiancia del cielo salen de las LUTs de Atmosphere (+ piso nocturno de luna)
+    glm::vec3 Ldir = -in.sunDir;
+    glm::vec3 amb = glm::max(gAtmosphere.GetSkyAmbient(in.sunDir), glm::vec3(0.05f));
+    glm::vec3 dif = gAtmosphere.GetSunLight(in.sunDir) + glm::vec3(0.10f) * (1.0f - in.sun);
+    glm::vec3 spe = dif * 0.5f;
+    glUniform3fv(U("viewPos"), 1, glm::value_ptr(in.sim.cameraPos));
+    glUniform3fv(U("dirLight.direction"), 1, glm::value_ptr(Ldir));
+    glUniform3fv(U("dirLight.ambient"), 1, glm::value_ptr(amb));
+    glUniform3fv(U("dirLight.diffuse"), 1, glm::value_ptr(dif));
+    glUniform3fv(U("dirLight.specular"), 1, glm::value_ptr(spe));
+    glUniform3fv(U("light.direction"), 1, glm::value_ptr(Ldir));
+    glUniform3fv(U("light.ambient"), 1, glm::value_ptr(amb));
+    glUniform3fv(U("light.diffuse"), 1, glm::value_ptr(dif));
+    glUniform3fv(U("light.specular"), 1, glm::value_ptr(spe));
+
+    // =======================================================
+    // Listas de dibujo, en el orden en que se registraron los trabajos
+    // =======================================================
+    const GLint locModel = U("model");
+    const GLint locProcModel = glGetUniformLocation(gProg, "model");
+    const GLint locProcMode = glGetUniformLocation(gProg, "uMode");
+    const GLint locProcSeed = glGetUniformLocation(gProg, "uSeed");
+    const GLint locProcFlicker = glGetUniformLocation(gProg, "uFlicker");
+
+    int program = DRAW_MODEL;
+    GLuint vao = 0;
+    for (const DrawList& list : pkt.lists) {
+        for (const DrawCmd& c : list.GetCommands()) {
+            if (c.program != program) {
+                if (c.program == DRAW_MODEL) shader.Use();
+                else glUseProgram(gProg);
+                program = c.program;
+                vao = 0;
+            }
+
+            if (c.program == DRAW_MODEL) {
+                glUniformMatrix4fv(locModel, 1, GL_FALSE, glm::value_ptr(c.model));
+                if (c.batch) {
+                    c.batch->Draw(shader, c.model);
+                    stats.draws += c.batch->GetMeshCount();
+                    stats.triangles += c.batch->GetTriangleCount();
+                }
+                else {
+                    c.mesh->Draw(shader);
+                    stats.draws += c.mesh->GetMeshCount();
+                    stats.triangles += c.mesh->GetTriangleCount();
+                }
+                vao = 0;
+                continue;
+            }
+
+            glUniformMatrix4fv(locProcModel, 1, GL_FALSE, glm::value_ptr(c.model));
+            glUniform1i(locProcMode, c.mode);
+            if (c.mode == 0) {
+                glUniform1f(locProcSeed, c.seed);        // semilla
+                glUniform1f(locProcFlicker, c.flicker);  // parpadeo externo
+            }
+            if (c.vao != vao) {
+                glBindVertexArray(c.vao);
+                vao = c.vao;
+            }
+            glDrawArrays(GL_TRIANGLES, 0, c.count);
+            stats.draws++; stats.triangles += c.count / 3;
+        }
+    }
+    glBindVertexArray(0);
+
+    // ---------------- Pase de luces (camino diferido) ----------------
+    if (deferred) {
+        gDeferredShading.Resolve(resolveShader);
+        gDeferredShading.LightPass(lightShader, gLights.GetLightTexture(), gLights.GetLightCount(),
+            in.view, in.projection, gVAOSphere, gSphereVerts);
+        stats.draws++; stats.triangles += (long long)gLights.GetLightCount() * gSphereVerts / 3;
+    }
+}
+
+// Póster (--poster): el frame 'frame' se vuelve a dibujar tile por tile, cada uno con su pedazo de la
+// proyección, y los renglones de tiles se van comprimiendo mientras se dibujan los siguientes
+static bool RenderPoster(const PosterOptions& poster, const FrameInputs& frame, GLuint framebuffer, Shader& shader, Shader& depthShader, Shader& lightShader, Shader& resolveShader) {
+    // Se termina el frame pendiente para que cada tile se prepare y se dibuje de inmediato
+    while (gPipeline.Acquire(0)) gPipeline.Release();
+    // Las cascadas se ajustan a la imagen completa una sola vez y sirven para todos los tiles
+    gShadows.Invalidate();
+
+    RenderStats stats;
+    PosterRenderer renderer;
+    const bool ok = renderer.Render(poster, poster.tile, frame.fullProjection, framebuffer, [&](const glm::mat4& tileProjection) {
+        FrameInputs in = frame;
+        in.projection = tileProjection;
+        gPipeline.Submit(in);
+        glClearColor(0.05f, 0.05f, 0.06f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if (const FramePipeline<FrameInputs>::Packet* pkt = gPipeline.Acquire(0)) {
+            ReplayFrame(*pkt, shader, depthShader, lightShader, resolveShader, stats);
+            gPipeline.Release();
+        }
+        glUseProgram(0);
+    });
+
+    if (!ok) {
+        std::cerr << "Poster: cannot write " << poster.path << ": " << renderer.GetError() << "\n";
+        return false;
+    }
+    std::cerr << "Poster: " << poster.width << "x" << poster.height << " to " << poster.path << " ("
+        << renderer.GetBytes() / (1024 * 1024) << " MB), " << renderer.GetTileCount() << " tiles of " << poster.tile
+        << "; drawing " << renderer.GetRenderMs() << " ms, compression " << renderer.GetEncodeMs()
+        << " ms, total " << renderer.GetTotalMs() << " ms, " << stats.draws << " draws\n";
+    return true;
+}
+
 // ===========================================================
 // main
 // ===========================================================
-int main() {
-    // GLFW
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
-    glfwWindowHint(GLFW_SAMPLES, 4);
-
-    GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "Nenis", nullptr, nullptr);
-
-    if (!window) { std::cout << "Failed to create GLFW window\n"; glfwTerminate(); return EXIT_FAILURE; }
-
-    glfwMakeContextCurrent(window);
-    glfwGetFramebufferSize(window, &SCREEN_WIDTH, &SCREEN_HEIGHT);
-    glfwSetKeyCallback(window, KeyCallback);
-    glfwSetCursorPosCallback(window, MouseCallback);
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+int main(int argc, char** argv) {
+    // Microbenchmark de las matrices por instancia (sin ventana)
+    if (argc > 1 && std::string(argv[1]) == "--bench-trs") {
+        RunInstanceKernelBenchmark(argc > 2 ? std::atoi(argv[2]) : 100000);
+        return 0;
+    }
+    // Velocidad del compresor DXT (escalar, SIMD e hilos) sobre las texturas de Models/
+    if (argc > 1 && std::string(argv[1]) == "--bench-dxt") {
+        RunDXTBenchmark(argc > 2 ? argv[2] : "Models");
+        return 0;
+    }
+    // Carga de un EXR con uno y con todos los hilos, y conversión a half / 8 bits escalar contra SIMD
+    if (argc > 1 && std::string(argv[1]) == "--bench-exr") {
+        RunExrBenchmark(argc > 2 ? argv[2] : "Models/barro_track_rough_4k.exr");
+        return 0;
+    }
+    // Rayos por segundo del BVH sobre los modelos fijos (necesita cargarlos; combinar con --headless)
+    int benchRays = 0;
+    for (int i = 1; i < argc; i++)
+        if (std::string(argv[i]) == "--bench-rays")
+            benchRays = (i + 1 < argc && std::atoi(argv[i + 1]) > 0) ? std::atoi(argv[i + 1]) : 1000000;
+    // Piezas del tianguis agrupadas en arreglos de texturas; --no-texture-arrays dibuja cada malla aparte
+    bool textureArrays = true;
+    for (int i = 1; i < argc; i++)
+        if (std::string(argv[i]) == "--no-texture-arrays")
+            textureArrays = false;
+    // Texturas comprimidas en DXT con cache de DDS en Cache/textures; --no-texture-compression las sube sin comprimir
+    for (int i = 1; i < argc; i++)
+        if (std::string(argv[i]) == "--no-texture-compression")
+            TextureCache::Get().SetEnabled(false);
+    // --texture-size N: las texturas más grandes se decodifican ya reducidas (JPEG a 1/2, 1/4 o 1/8 con IDCT reducida)
+    for (int i = 1; i + 1 < argc; i++)
+        if (std::string(argv[i]) == "--texture-size")
+            TextureCache::Get().SetMaxSize(std::atoi(argv[i + 1]));
+
+    // Modo benchmark sin ventana: --headless [--frames N] [--warmup N] [--size WxH] [--out f.json] [--deferred]
+    BenchmarkOptions bench;
+    ParseBenchmarkOptions(argc, argv, bench);
+
+    // Recorridos de cámara: --record f.campath | --replay f.campath | --flyover nombre
+    CameraPathOptions pathOpts;
+    ParseCameraPathOptions(argc, argv, pathOpts);
+    bench.scenario = "live";
+    if (!pathOpts.replay.empty()) {
+        if (!gReplay.Load(pathOpts.replay)) return EXIT_FAILURE;
+        if (std::abs(gReplay.GetStep() - gSim.GetStep()) > 1e-9)
+            std::cerr << "Replay: the recording uses a different simulation step (" << gReplay.GetStep() << ")\n";
+        gInputMode = INPUT_REPLAY;
+        bench.scenario = "replay:" + pathOpts.replay;
+    }
+    else if (!pathOpts.flyover.empty()) {
+        if (!BuildFlyOver(pathOpts.flyover, gFlyOver)) {
+            std::cerr << "Unknown fly-over: " << pathOpts.flyover << " (tianguis, piramides, vegetacion, todo)\n";
+            return EXIT_FAILURE;
+        }
+        gInputMode = INPUT_FLYOVER;
+        bench.scenario = "flyover:" + pathOpts.flyover;
+    }
+    // Captura de frames: --capture carpeta|video.raw [--capture-format png|jpg] [--capture-quality N]
+    // [--capture-ring N] [--capture-threads N]; sin --capture, F9 captura PNG en Capturas/
+    ParseCaptureOptions(argc, argv, gCaptureOpts);
+    // Póster: --poster WxH archivo.png|archivo.jpg [--poster-tile N] [--poster-quality N]; corre sin
+    // ventana y, tras el calentamiento, dibuja un solo frame a esa resolución en tiles
+    PosterOptions poster;
+    const bool posterMode = ParsePosterOptions(argc, argv, poster);
+    if (posterMode) {
+        bench.headless = true;
+        bench.width = bench.height = poster.tile;
+    }
+    gRecordInput = !pathOpts.record.empty();
+    gRecord.Clear(gSim.GetStep());
+    OffscreenContext offscreen;
+    GLFWwindow* window = nullptr;
+
+    if (bench.headless) {
+        if (!offscreen.Create(bench.width, bench.height)) { std::cerr << "Failed to create offscreen context\n"; return EXIT_FAILURE; }
+        SCREEN_WIDTH = bench.width;
+        SCREEN_HEIGHT = bench.height;
+    }
+    else {
+        // GLFW
+        glfwInit();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+        glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+        glfwWindowHint(GLFW_SAMPLES, 4);
+
+        window = glfwCreateWindow(WIDTH, HEIGHT, "Nenis", nullptr, nullptr);
+
+        if (!window) { std::cout << "Failed to create GLFW window\n"; glfwTerminate(); return EXIT_FAILURE; }
+
+        glfwMakeContextCurrent(window);
+        glfwGetFramebufferSize(window, &SCREEN_WIDTH, &SCREEN_HEIGHT);
+        glfwSetKeyCallback(window, KeyCallback);
+        glfwSetCursorPosCallback(window, MouseCallback);
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    }
 
     glewExperimental = GL_TRUE;
-    if (glewInit() != GLEW_OK) { std::cout << "Failed to initialize GLEW\n"; return EXIT_FAILURE; }
+    GLenum glewStatus = glewInit();
+    // Sin servidor X, GLEW carga las funciones de GL pero no encuentra display de GLX: eso es normal aquí
+    if (glewStatus != GLEW_OK && !(bench.headless && glewStatus == GLEW_ERROR_NO_GLX_DISPLAY)) { std::cerr << "Failed to initialize GLEW\n"; return EXIT_FAILURE; }
+
+    // El tile no puede pasar del framebuffer más grande que acepta la GL
+    if (posterMode) SCREEN_WIDTH = SCREEN_HEIGHT = poster.tile = MaxPosterTile(poster.tile);
+
+    RenderTarget target;
+    if (bench.headless && !target.Create(SCREEN_WIDTH, SCREEN_HEIGHT)) return EXIT_FAILURE;
+    if (bench.headless) target.Bind();
 
     glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
     glEnable(GL_DEPTH_TEST);
@@ -646,6 +1179,11 @@ int main() {
 
     // Shaders/modelos
     Shader shader("Shader/modelLoading.vs", "Shader/modelLoading.frag");
+    Shader shadowDepth("Shader/shadowDepth.vs", "Shader/shadowDepth.frag");
+    Shader deferredLight("Shader/deferredLight.vs", "Shader/deferredLight.frag");
+    Shader deferredResolve("Shader/deferredResolve.vs", "Shader/deferredResolve.frag");
+    CreateProgram();
+    // Todos los programas quedan compilándose mientras se cargan los modelos
     Model CanastaChiles((char*)"Models/CanastaChiles.obj");
     Model Chiles((char*)"Models/Chiles.obj");
     Model PetatesTianguis((char*)"Models/PetatesTianguis.obj");
@@ -674,21 +1212,118 @@ int main() {
     Model ArbolTianguis((char*)"Models/MaicesCampo.obj");
     Model CasaAmue((char*)"Models/CocinaCasa.obj");
 
-    // Programa procedural + geometrías
-    CreateProgram();
+    // Pirámide (cercana)
+    glm::mat4 model9(1.0f);
+    model9 = glm::translate(model9, glm::vec3(85.0f, 1.0f, -30.0f));
+    model9 = glm::scale(model9, glm::vec3(1.0f));
+
+    // --- PIRÁMIDE DEL SOL ---
+    glm::mat4 model11(1.0f);
+    model11 = glm::translate(model11, glm::vec3(+25.0f, 0.0f, -140.0f)); // nueva posición al fondo derecho
+    model11 = glm::rotate(model11, glm::radians(10.0f), glm::vec3(0.0f, 1.0f, 0.0f)); // ligera orientación
+    model11 = glm::scale(model11, glm::vec3(1.0f));   // escala acorde a la distancia
+
+    // ================== Iluminación horneada ==================
+    // Oclusión ambiental y visibilidad del cielo por vértice de los modelos fijos; se trazan
+    // una vez en CPU y se guardan en Cache/ (sólo se repite si cambia la geometría)
+    {
+        const glm::mat4 I(1.0f);
+        StaticBake bake;
+        bake.Add(&CanastaChiles, I);
+        bake.Add(&Chiles, I);
+        bake.Add(&PetatesTianguis, I);
+        bake.Add(&Aguacates, I);
+        bake.Add(&Jarrones, I);
+        bake.Add(&Tendedero, I);
+        bake.Add(&PielJaguar, I);
+        bake.Add(&PielesPiso, I);
+        bake.Add(&JuegoPelota, I);
+        bake.Add(&ParedesChozas, I);
+        bake.Add(&TechosChozas, I);
+        bake.Add(&VasijasYMolcajete, I);
+        bake.Add(&Tunas, I);
+        bake.Add(&Vasijas, I);
+        bake.Add(&CasaGrande, I);
+        bake.Add(&FuegoCocinaCG, I);
+        bake.Add(&ArbolTianguis, I);
+        bake.Add(&Piramide, model9);
+        bake.Add(&tula, I);
+        bake.Add(&piramidesol, model11);
+        bake.Run("Cache/static_bake.bin");
+
+        if (benchRays > 0) {
+            TriangleBVH scene;
+            bake.AddTriangles(scene);
+            RunRayBenchmark(scene, benchRays);
+            if (bench.headless) offscreen.Destroy(); else glfwTerminate();
+            return 0;
+        }
+    }
+
+    // ================== Arreglos de texturas ==================
+    // Chiles, aguacates, jarrones, tunas, vasijas y petates comparten un arreglo de texturas por
+    // tamaño de capa, así que se dibujan en unas pocas llamadas sin importar cuántos materiales tengan.
+    // Va después del horneado para llevarse también la oclusión por vértice.
+    TextureArrayBatch tianguisBatch;
+    if (textureArrays) {
+        const glm::mat4 I(1.0f);
+        tianguisBatch.Add(&CanastaChiles, I);
+        tianguisBatch.Add(&Chiles, I);
+        tianguisBatch.Add(&PetatesTianguis, I);
+        tianguisBatch.Add(&Aguacates, I);
+        tianguisBatch.Add(&Jarrones, I);
+        tianguisBatch.Add(&VasijasYMolcajete, I);
+        tianguisBatch.Add(&Tunas, I);
+        tianguisBatch.Add(&Vasijas, I);
+        textureArrays = tianguisBatch.Build();
+        if (textureArrays)
+            std::cerr << "Tianguis: " << tianguisBatch.GetSourceMeshCount() << " meshes in " << tianguisBatch.GetMeshCount()
+                << " draws (" << tianguisBatch.GetLayerCount() << " texture layers)\n";
+    }
+
+    // Geometrías
+    gAtmosphere.Load("Cache/atmosphere.lut");
+    std::cerr << "GL programs: " << ProgramCache::Get().GetHits() << " from the cache, "
+        << ProgramCache::Get().GetMisses() << " compiled\n";
+    gShadows.Create();
+    gLights.Create();
+    gDeferred = bench.deferred && gDeferredShading.Create(SCREEN_WIDTH, SCREEN_HEIGHT);
+    bench.deferred = gDeferred;
     BuildCube();
     BuildSeatPlane();
     BuildVase();
-    BuildGround();
     BuildCone(14);
     BuildSphere();
+    PlaceBraziers();
     // Texturas
-    stbi_set_flip_vertically_on_load(0);
     gTexGrass = LoadTexture2D("Models/pasto.jpg", true);
+    {
+        const TextureCache& tc = TextureCache::Get();
+        std::cerr << "Textures: " << tc.GetHits() << " from the cache, " << tc.GetMisses() << " compressed, "
+            << tc.GetBytes() / (1024 * 1024) << " MB on the GPU (" << tc.GetUncompressedBytes() / (1024 * 1024) << " MB uncompressed)\n";
+    }
+    gGroundMaterial.Load("Models", "forest_ground_04");
+
+    // Terreno: colinas y el desplazamiento del suelo de bosque, plano bajo los modelos fijos y en el
+    // área central (fogata, mesa, braseros, carretilla, pelota), donde todo se apoya en y = 0
+    {
+        const glm::mat4 I(1.0f);
+        gTerrain.AddFlatZone(glm::vec2(-55.0f), glm::vec2(55.0f), 12.0f);
+        Model* flat[] = { &CanastaChiles, &Chiles, &PetatesTianguis, &Aguacates, &Jarrones, &Tendedero, &PielJaguar,
+            &PielesPiso, &JuegoPelota, &ParedesChozas, &TechosChozas, &VasijasYMolcajete, &Tunas, &Vasijas,
+            &CasaGrande, &FuegoCocinaCG, &ArbolTianguis, &tula };
+        for (Model* m : flat) gTerrain.AddFlatZone(*m, I, 6.0f);
+        gTerrain.AddFlatZone(Piramide, model9, 6.0f);
+        gTerrain.AddFlatZone(piramidesol, model11, 6.0f);
+        auto t0 = std::chrono::steady_clock::now();
+        gTerrain.Create("Models/forest_ground_04_disp_1k.png");
+        std::cerr << "Terrain: " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count() << " ms\n";
+    }
 
     // Proyección
-    glm::mat4 projection = glm::perspective(camera.GetZoom(),
-        (GLfloat)SCREEN_WIDTH / (GLfloat)SCREEN_HEIGHT, 0.1f, 1000.0f);
+    glm::mat4 projection = glm::perspective(camera.GetZoom(), posterMode
+        ? (GLfloat)poster.width / (GLfloat)poster.height
+        : (GLfloat)SCREEN_WIDTH / (GLfloat)SCREEN_HEIGHT, 0.1f, 1000.0f);
 
     // Dimensiones mesa/silla
     const float topX = 1.6f, topZ = 3.0f, topY = 0.12f;
@@ -721,6 +1356,7 @@ int main() {
         const float Y_ROT_MIN = 0.0f, Y_ROT_MAX = 360.0f;
         const float S_MIN = 0.85f, S_MAX = 1.45f; // alturas más contenidas
 
+        InstanceBatch arBatch;
         std::mt19937 rng(20251108);
         std::uniform_real_distribution<float> distYaw(Y_ROT_MIN, Y_ROT_MAX);
         std::uniform_real_distribution<float> distS(S_MIN, S_MAX);
@@ -741,19 +1377,11 @@ int main() {
                 float yaw = distYaw(rng);
                 float s = distS(rng);
 
-                glm::mat4 M(1.0f);
-                M = glm::translate(M, glm::vec3(p.x, 0.0f, p.y));
-                M = glm::rotate(M, glm::radians(yaw), glm::vec3(0, 1, 0));
-                M = glm::scale(M, glm::vec3(s));
-
-                gArModels.push_back(M);
+                arBatch.Add(glm::vec3(p.x, 0.0f, p.y), glm::radians(yaw), s);
                 ++placed;
             }
             };
 
-        gArModels.clear();
-        gArModels.reserve(AR_COUNT);
-
         // Distribución 50/50 entre ambos cinturones
         int leftCount = AR_COUNT / 2;
         int rightCount = AR_COUNT - leftCount;
@@ -764,17 +1392,16 @@ int main() {
         // Relleno (si faltó alguno) usando el cinturón izquierdo
         std::uniform_real_distribution<float> distX_L(X_RANGE_L.x, X_RANGE_L.y);
         std::uniform_real_distribution<float> distZ_L(Z_RANGE_L.x, Z_RANGE_L.y);
-        while ((int)gArModels.size() < AR_COUNT) {
+        while (arBatch.Size() < AR_COUNT) {
             glm::vec2 p(distX_L(rng), distZ_L(rng));
             if (!OutsideExclusions(p, ex)) continue;
             float yaw = distYaw(rng);
             float s = distS(rng);
-            glm::mat4 M(1.0f);
-            M = glm::translate(M, glm::vec3(p.x, 0.0f, p.y));
-            M = glm::rotate(M, glm::radians(yaw), glm::vec3(0, 1, 0));
-            M = glm::scale(M, glm::vec3(s));
-            gArModels.push_back(M);
+            arBatch.Add(glm::vec3(p.x, 0.0f, p.y), glm::radians(yaw), s);
         }
+
+        BuildInstanceMatrices(arBatch, glm::mat3(1.0f), gArModels);
+        gTerrain.SnapToGround(gArModels);
     }
 
 
@@ -801,6 +1428,7 @@ int main() {
         const float Y_ROT_MIN = 0.0f, Y_ROT_MAX = 360.0f;
         const float S_MIN = 0.05f, S_MAX = 0.12f;
 
+        InstanceBatch caBatch;
         std::mt19937 rng(20251107);
         std::uniform_real_distribution<float> distYaw(Y_ROT_MIN, Y_ROT_MAX);
         std::uniform_real_distribution<float> distS(S_MIN, S_MAX);
@@ -821,19 +1449,11 @@ int main() {
                 float yaw = distYaw(rng);
                 float s = distS(rng);
 
-                glm::mat4 M(1.0f);
-                M = glm::translate(M, glm::vec3(p.x, 0.0f, p.y));
-                M = glm::rotate(M, glm::radians(yaw), glm::vec3(0, 1, 0)); // solo rotación en Y
-                M = glm::scale(M, glm::vec3(s));
-
-                gcaModels.push_back(M);
+                caBatch.Add(glm::vec3(p.x, 0.0f, p.y), glm::radians(yaw), s);
                 ++placed;
             }
             };
 
-        gcaModels.clear();
-        gcaModels.reserve(CA_COUNT);
-
         int leftCount = (int)std::round(CA_COUNT * 0.60f);
         int rightCount = CA_COUNT - leftCount;
 
@@ -843,433 +1463,218 @@ int main() {
         // Relleno (si faltan cactus)
         std::uniform_real_distribution<float> distX_L(X_RANGE_L.x, X_RANGE_L.y);
         std::uniform_real_distribution<float> distZ_L(Z_RANGE_L.x, Z_RANGE_L.y);
-        while ((int)gcaModels.size() < CA_COUNT) {
+        while (caBatch.Size() < CA_COUNT) {
             glm::vec2 p(distX_L(rng), distZ_L(rng));
             if (!OutsideExclusions(p, ex)) continue;
             float yaw = distYaw(rng);
             float s = distS(rng);
 
-            glm::mat4 M(1.0f);
-            M = glm::translate(M, glm::vec3(p.x, 0.0f, p.y));
-            M = glm::rotate(M, glm::radians(yaw), glm::vec3(0, 1, 0)); // sin inclinarlos
-            M = glm::scale(M, glm::vec3(s));
-            gcaModels.push_back(M);
+            caBatch.Add(glm::vec3(p.x, 0.0f, p.y), glm::radians(yaw), s);
         }
-    }
-
-    const float cycleSeconds = 60.0f;
 
-    while (!glfwWindowShouldClose(window)) {
-        GLfloat currentFrame = (GLfloat)glfwGetTime();
-        deltaTime = currentFrame - lastFrame; lastFrame = currentFrame;
+        // Variación por cactus (inclinación, giro y estiramiento); es fija, así que se hornea aquí
+        const float kScaleJitterXY = 0.10f;
+        const float kScaleJitterY = 0.25f;
+        const float kTiltMaxDeg = 2.0f;
+        const float kYawJitterDeg = 8.0f;
+        const float kYOffset = 0.02f;
 
-        glfwPollEvents();
-        DoMovement();
-
-        glClearColor(0.05f, 0.05f, 0.06f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        auto rand01 = [](uint32_t seed) {
+            float s = std::sin(seed * 12.9898f) * 43758.5453f;
+            return s - std::floor(s);
+            };
 
-        glm::mat4 view = camera.GetViewMatrix();
+        for (int idx = 0; idx < caBatch.Size(); ++idx) {
+            float r0 = rand01(idx * 3u + 0u);
+            float r1 = rand01(idx * 3u + 1u);
+            float r2 = rand01(idx * 3u + 2u);
 
-        float t = fmodf(currentFrame / cycleSeconds, 1.0f);
-        float az = t * 6.2831853f;
-        float el = sinf(az) * 0.8f;
-        float ce = cosf(el), se = sinf(el);
-        glm::vec3 sunDir = glm::normalize(glm::vec3(ce * cosf(az), se, ce * sinf(az)));
-        float sun = 0.5f + 0.5f * se;
+            float s = caBatch.sx[idx];
+            caBatch.sx[idx] = s * (1.0f + (r0 - 0.5f) * kScaleJitterXY * 2.0f);
+            caBatch.sy[idx] = s * (1.0f + (r1 - 0.5f) * kScaleJitterY * 2.0f);
+            caBatch.sz[idx] = s * (1.0f + (r2 - 0.5f) * kScaleJitterXY * 2.0f);
 
-        // === para fuego ===
-        glm::vec3 fireColor(0.0f);
-        float fireFlicker = 1.0f;
-        if (gFireOn) {
-            fireFlicker = 0.85f + 0.25f * sinf(currentFrame * 7.0f);
-            fireColor = glm::vec3(1.0f, 0.45f, 0.1f) * fireFlicker * 2.5f; // Intensidad 2.5
+            caBatch.tiltX[idx] = glm::radians((r0 - 0.5f) * kTiltMaxDeg * 2.0f);
+            caBatch.tiltZ[idx] = glm::radians((r1 - 0.5f) * kTiltMaxDeg * 2.0f);
+            caBatch.yaw[idx] += glm::radians((r2 - 0.5f) * kYawJitterDeg * 2.0f);
+            caBatch.py[idx] += kYOffset;
         }
-        glm::vec3 firePos = gCampPos + glm::vec3(0.0f, 0.2f, 0.0f);
-
-        // ---------------- Cielo ----------------
-        {
-            glUseProgram(gProg);
-            glm::mat4 viewNoTrans = glm::mat4(glm::mat3(view));
-            glUniformMatrix4fv(glGetUniformLocation(gProg, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-            glUniformMatrix4fv(glGetUniformLocation(gProg, "view"), 1, GL_FALSE, glm::value_ptr(viewNoTrans));
-            glUniform1f(glGetUniformLocation(gProg, "uTime"), currentFrame);
-            glUniform1f(glGetUniformLocation(gProg, "uSun"), sun);
-            glUniform3fv(glGetUniformLocation(gProg, "uSunDir"), 1, glm::value_ptr(sunDir));
-            glUniform3fv(glGetUniformLocation(gProg, "uFirePos"), 1, glm::value_ptr(firePos));
-            glUniform3fv(glGetUniformLocation(gProg, "uFireColor"), 1, glm::value_ptr(fireColor));
-            glUniform1i(glGetUniformLocation(gProg, "uMode"), 11);
-
-            glm::mat4 MSky(1.0f); MSky = glm::scale(MSky, glm::vec3(500.0f));
-            glUniformMatrix4fv(glGetUniformLocation(gProg, "model"), 1, GL_FALSE, glm::value_ptr(MSky));
-
-            glDepthFunc(GL_LEQUAL);
-            glDepthMask(GL_FALSE);
-            glBindVertexArray(gVAOCube);
-            glDrawArrays(GL_TRIANGLES, 0, gCubeVerts);
-            glBindVertexArray(0);
-            glDepthMask(GL_TRUE);
-            glDepthFunc(GL_LESS);
-            glUseProgram(0);
-        }
-
-        // ---------------- Suelo (pasto texturizado) ----------------
-        glUseProgram(gProg);
-        glUniformMatrix4fv(glGetUniformLocation(gProg, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-        glUniformMatrix4fv(glGetUniformLocation(gProg, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniform1f(glGetUniformLocation(gProg, "uTime"), currentFrame);
-        glUniform1f(glGetUniformLocation(gProg, "uSun"), sun);
-        glUniform3fv(glGetUniformLocation(gProg, "uSunDir"), 1, glm::value_ptr(sunDir));
-        glUniform3fv(glGetUniformLocation(gProg, "uFirePos"), 1, glm::value_ptr(firePos));
-        glUniform3fv(glGetUniformLocation(gProg, "uFireColor"), 1, glm::value_ptr(fireColor));
-        glUniform1i(glGetUniformLocation(gProg, "uMode"), 12);
-        glUniform1f(glGetUniformLocation(gProg, "uTexScale"), 0.28f);
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, gTexGrass);
-        glUniform1i(glGetUniformLocation(gProg, "uTex"), 0);
-
-        glm::mat4 MG(1.0f);
-        MG = glm::translate(MG, glm::vec3(0.0f, -0.001f, 0.0f));
-        glUniformMatrix4fv(glGetUniformLocation(gProg, "model"), 1, GL_FALSE, glm::value_ptr(MG));
-        glBindVertexArray(gVAOGround);
-        glDrawArrays(GL_TRIANGLES, 0, gGroundVerts);
-        glBindVertexArray(0);
-        glUseProgram(0);
-
-        // =======================================================
-        // MODELOS DEL TIANGUIS (shader externo)
-        // =======================================================
-        shader.Use();
-
-        // Proyección y vista
-        glUniformMatrix4fv(glGetUniformLocation(shader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-        glUniformMatrix4fv(glGetUniformLocation(shader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
-
-        // Luz direccional basada en el sol (nombres compatibles)
-        auto U = [&](const char* n) { return glGetUniformLocation(shader.Program, n); };
-        glm::vec3 Ldir = -sunDir;
-        float amb = glm::mix(0.05f, 0.22f, sun);
-        float dif = glm::mix(0.10f, 1.00f, sun);
-        float spe = glm::mix(0.05f, 0.50f, sun);
-        glUniform3fv(U("viewPos"), 1, glm::value_ptr(camera.GetPosition()));
-        glUniform3fv(U("dirLight.direction"), 1, glm::value_ptr(Ldir));
-        glUniform3f(U("dirLight.ambient"), amb, amb, amb);
-        glUniform3f(U("dirLight.diffuse"), dif, dif, dif);
-        glUniform3f(U("dirLight.specular"), spe, spe, spe);
-        glUniform3fv(U("light.direction"), 1, glm::value_ptr(Ldir));
-        glUniform3f(U("light.ambient"), amb, amb, amb);
-        glUniform3f(U("light.diffuse"), dif, dif, dif);
-        glUniform3f(U("light.specular"), spe, spe, spe);
-
-        // --- Luz de Fogata (Punto 0) ---
-        glUniform3fv(U("pointLights[0].position"), 1, glm::value_ptr(firePos));
-        glUniform3fv(U("pointLights[0].diffuse"), 1, glm::value_ptr(fireColor));
-        glUniform3f(U("pointLights[0].ambient"), fireColor.r * 0.05f, fireColor.g * 0.05f, fireColor.b * 0.05f);
-        glUniform3f(U("pointLights[0].specular"), 1.0f, 1.0f, 1.0f);
-        glUniform1f(U("pointLights[0].constant"), 1.0f);
-        glUniform1f(U("pointLights[0].linear"), 0.05f);      // Atenuación para modelos
-        glUniform1f(U("pointLights[0].quadratic"), 0.015f);  // Atenuación para modelos
-
-        // Apagar las otras 3 luces (si el shader las soporta)
-        glUniform3f(U("pointLights[1].diffuse"), 0.0f, 0.0f, 0.0f);
-        glUniform3f(U("pointLights[2].diffuse"), 0.0f, 0.0f, 0.0f);
-        glUniform3f(U("pointLights[3].diffuse"), 0.0f, 0.0f, 0.0f);
-        // === FIN DEL BLOQUE NUEVO ===
-
-        // Dibujo de props del tianguis
-        {
-            glm::mat4 model(1.0f);
-            glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model));
-            CanastaChiles.Draw(shader);
-
-            glm::mat4 model2(1.0f);
-            glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model2));
-            Chiles.Draw(shader);
-
-            glm::mat4 model3(1.0f);
-            glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model3));
-            PetatesTianguis.Draw(shader);
-
-            glm::mat4 model4(1.0f);
-            glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model4));
-            Aguacates.Draw(shader);
-
-            glm::mat4 model5(1.0f);
-            glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model5));
-            Jarrones.Draw(shader);
-
-            glm::mat4 model6(1.0f);
-            glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model6));
-            Tendedero.Draw(shader);
-
-            glm::mat4 model7(1.0f);
-            glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model7));
-            PielJaguar.Draw(shader);
-
-            glm::mat4 model8(1.0f);
-            glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model8));
-            PielesPiso.Draw(shader);
-
-            glm::mat4 model13(1.0f);
-            glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model13));
-            JuegoPelota.Draw(shader);
-
-            glm::mat4 model16(1.0f);
-            glUniformMatrix4fv(U("model"), 1, GL_FALSE, glm::value_ptr(model16));
-            ParedesChozas.Draw(shader);
-            glm::mat4 model17(1.0f);
-            glUniformMatrix4fv(U("model"), 1, GL_FALSE, glm::value_ptr(model17));
-            TechosChozas.Draw(shader);
-
-            glm::mat4 model18(1.0f);
-            glUniformMatrix4fv(U("model"), 1, GL_FALSE, glm::value_ptr(model18));
-            VasijasYMolcajete.Draw(shader);
-
-            glm::mat4 model19(1.0f);
-            glUniformMatrix4fv(U("model"), 1, GL_FALSE, glm::value_ptr(model19));
-            Tunas.Draw(shader);
-
-            glm::mat4 model20(1.0f);
-            glUniformMatrix4fv(U("model"), 1, GL_FALSE, glm::value_ptr(model20));
-            Vasijas.Draw(shader);
-
-            glm::mat4 model23(1.0f);
-            glUniformMatrix4fv(U("model"), 1, GL_FALSE, glm::value_ptr(model23));
-            CasaGrande.Draw(shader);
-
-            glm::mat4 model24(1.0f);
-            glUniformMatrix4fv(U("model"), 1, GL_FALSE, glm::value_ptr(model24));
-            FuegoCocinaCG.Draw(shader);
 
+        // Enderezados con Rfix (el modelo viene con Z hacia arriba)
+        glm::mat3 Rfix = glm::mat3(glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(1, 0, 0)));
+        BuildInstanceMatrices(caBatch, Rfix, gcaModels);
+        gTerrain.SnapToGround(gcaModels);
+    }
 
-            glm::mat4 model25(1.0f);
-            glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model25));
-            ArbolTianguis.Draw(shader);
+    // --------- Instancias aleatorias de maíz ('co') ----------
+    // (siempre salen iguales por la semilla fija, así que se generan una sola vez)
+    {
+        const glm::vec2 X_RANGE_L(-40.0f, 0.0f);
+        const glm::vec2 Z_RANGE_L(-180.0f, -120.0f);
 
+        const glm::vec2 X_RANGE_R(0.0f, 40.0f);
+        const glm::vec2 Z_RANGE_R(-180.0f, -120.0f);
 
+        std::vector<Exclusion> ex = {
+            { glm::vec2(gTablePos.x,  gTablePos.z), 18.0f },
+            { glm::vec2(gCampPos.x,   gCampPos.z), 14.0f },
+            { glm::vec2(-60.0f,       -95.0f),     22.0f }, // Tula
+            { glm::vec2(25.0f,       -145.0f),     28.0f }, // Pirámide del Sol
+            { glm::vec2(0.0f,          0.0f),      40.0f }  // área central
+        };
 
-        }
-        // --------- Instancias aleatorias de maíz ('co') ----------
-        {
-            const glm::vec2 X_RANGE_L(-40.0f, 0.0f);
-            const glm::vec2 Z_RANGE_L(-180.0f, -120.0f);
-
-            const glm::vec2 X_RANGE_R(0.0f, 40.0f);
-            const glm::vec2 Z_RANGE_R(-180.0f, -120.0f);
-
-            std::vector<Exclusion> ex = {
-                { glm::vec2(gTablePos.x,  gTablePos.z), 18.0f },
-                { glm::vec2(gCampPos.x,   gCampPos.z), 14.0f },
-                { glm::vec2(-60.0f,       -95.0f),     22.0f }, // Tula
-                { glm::vec2(25.0f,       -145.0f),     28.0f }, // Pirámide del Sol
-                { glm::vec2(0.0f,          0.0f),      40.0f }  // área central
-            };
+        const float MIN_DIST = 3.5f;
+        const float MIN_DIST2 = MIN_DIST * MIN_DIST;
+        const int   MAX_TRIES = 200;
+        const float Y_ROT_MIN = 0.0f, Y_ROT_MAX = 360.0f;
+        const float S_MIN = 0.06f, S_MAX = 0.10f;
 
-            const float MIN_DIST = 3.5f;
-            const float MIN_DIST2 = MIN_DIST * MIN_DIST;
-            const int   MAX_TRIES = 200;
-            const float Y_ROT_MIN = 0.0f, Y_ROT_MAX = 360.0f;
-            const float S_MIN = 0.06f, S_MAX = 0.10f;
-
-            std::mt19937 rng(20251109);
-            std::uniform_real_distribution<float> distYaw(Y_ROT_MIN, Y_ROT_MAX);
-            std::uniform_real_distribution<float> distS(S_MIN, S_MAX);
-
-            auto fillBeltCorn = [&](glm::vec2 XR, glm::vec2 ZR, int target) {
-                std::uniform_real_distribution<float> distX(XR.x, XR.y);
-                std::uniform_real_distribution<float> distZ(ZR.x, ZR.y);
-
-                std::vector<glm::vec2> usedXZ;
-                usedXZ.reserve(target);
-                int placed = 0, tries = 0;
-
-                while (tries < MAX_TRIES && placed < target) {
-                    ++tries;
-                    glm::vec2 p(distX(rng), distZ(rng));
-                    if (!OutsideExclusions(p, ex)) continue;
-                    if (!IsFarEnough(p, usedXZ, MIN_DIST2)) continue;
-
-                    usedXZ.push_back(p);
-                    float yaw = distYaw(rng);
-                    float s = distS(rng);
-
-                    glm::mat4 M(1.0f);
-                    M = glm::translate(M, glm::vec3(p.x, 0.0f, p.y));
-                    M = glm::rotate(M, glm::radians(yaw), glm::vec3(0, 1, 0));
-                    M = glm::scale(M, glm::vec3(s));
-
-                    gCoModels.push_back(M);
-                    ++placed;
-                }
-                };
-            {
-                // Pirámide (cercana)
-                glm::mat4 model9(1.0f);
-                model9 = glm::translate(model9, glm::vec3(85.0f, 1.0f, -30.0f));
-                model9 = glm::scale(model9, glm::vec3(1.0f));
-                glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model9));
-                Piramide.Draw(shader);
-
-
-                glm::mat4 model10(1.0f);
-                glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model10));
-                tula.Draw(shader);
-
-                // --- PIRÁMIDE DEL SOL ---
-                glm::mat4 model11(1.0f);
-                model11 = glm::translate(model11, glm::vec3(+25.0f, 0.0f, -140.0f)); // nueva posición al fondo derecho
-                model11 = glm::rotate(model11, glm::radians(10.0f), glm::vec3(0.0f, 1.0f, 0.0f)); // ligera orientación
-                model11 = glm::scale(model11, glm::vec3(1.0f));   // escala acorde a la distancia
-                glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model11));
-                piramidesol.Draw(shader);
-            }
-            gCoModels.clear();
-            gCoModels.reserve(CO_COUNT);
+        InstanceBatch coBatch;
+        std::mt19937 rng(20251109);
+        std::uniform_real_distribution<float> distYaw(Y_ROT_MIN, Y_ROT_MAX);
+        std::uniform_real_distribution<float> distS(S_MIN, S_MAX);
 
-            int leftCount = CO_COUNT / 2;
-            int rightCount = CO_COUNT - leftCount;
+        auto fillBeltCorn = [&](glm::vec2 XR, glm::vec2 ZR, int target) {
+            std::uniform_real_distribution<float> distX(XR.x, XR.y);
+            std::uniform_real_distribution<float> distZ(ZR.x, ZR.y);
 
-            fillBeltCorn(X_RANGE_L, Z_RANGE_L, leftCount);
-            fillBeltCorn(X_RANGE_R, Z_RANGE_R, rightCount);
+            std::vector<glm::vec2> usedXZ;
+            usedXZ.reserve(target);
+            int placed = 0, tries = 0;
 
-            // Relleno (por si faltan algunos)
-            std::uniform_real_distribution<float> distX_L(X_RANGE_L.x, X_RANGE_L.y);
-            std::uniform_real_distribution<float> distZ_L(Z_RANGE_L.x, Z_RANGE_L.y);
-            while ((int)gCoModels.size() < CO_COUNT) {
-                glm::vec2 p(distX_L(rng), distZ_L(rng));
+            while (tries < MAX_TRIES && placed < target) {
+                ++tries;
+                glm::vec2 p(distX(rng), distZ(rng));
                 if (!OutsideExclusions(p, ex)) continue;
+                if (!IsFarEnough(p, usedXZ, MIN_DIST2)) continue;
 
+                usedXZ.push_back(p);
                 float yaw = distYaw(rng);
                 float s = distS(rng);
 
-                glm::mat4 M(1.0f);
-                M = glm::translate(M, glm::vec3(p.x, 0.0f, p.y));
-                M = glm::rotate(M, glm::radians(yaw), glm::vec3(0, 1, 0));
-                M = glm::scale(M, glm::vec3(s));
-                gCoModels.push_back(M);
+                coBatch.Add(glm::vec3(p.x, 0.0f, p.y), glm::radians(yaw), s);
+                ++placed;
             }
-        }
-
-        // ---------------- Cactus (enderezados con Rfix) ----------------
-        {
-            const float kScaleJitterXY = 0.10f;
-            const float kScaleJitterY = 0.25f;
-            const float kTiltMaxDeg = 2.0f;
-            const float kYawJitterDeg = 8.0f;
-            const float kYOffset = 0.02f;
-            const float kCullDistance = 220.0f;
-
-            auto rand01 = [](uint32_t seed) {
-                float s = std::sin(seed * 12.9898f) * 43758.5453f;
-                return s - std::floor(s);
-                };
-
-            glm::mat4 Rfix(1.0f);
-
-            Rfix = glm::rotate(Rfix, glm::radians(-90.0f), glm::vec3(1, 0, 0));
-
-            int idx = 0;
-            for (const glm::mat4& M : gcaModels) {
-                glm::vec3 posWorld = glm::vec3(M[3]);
-                if (glm::distance(posWorld, camera.GetPosition()) > kCullDistance) { ++idx; continue; }
-
-                float r0 = rand01(idx * 3u + 0u);
-                float r1 = rand01(idx * 3u + 1u);
-                float r2 = rand01(idx * 3u + 2u);
-
-                float sx = 1.0f + (r0 - 0.5f) * kScaleJitterXY * 2.0f;
-                float sy = 1.0f + (r1 - 0.5f) * kScaleJitterY * 2.0f;
-                float sz = 1.0f + (r2 - 0.5f) * kScaleJitterXY * 2.0f;
+            };
 
-                float rx = (r0 - 0.5f) * kTiltMaxDeg * 2.0f;
-                float rz = (r1 - 0.5f) * kTiltMaxDeg * 2.0f;
-                float ry = (r2 - 0.5f) * kYawJitterDeg * 2.0f;
+        int leftCount = CO_COUNT / 2;
+        int rightCount = CO_COUNT - leftCount;
 
-                glm::mat4 tweak(1.0f);
-                tweak = glm::translate(tweak, glm::vec3(0.0f, kYOffset, 0.0f));
-                tweak = glm::rotate(tweak, glm::radians(rx), glm::vec3(1, 0, 0));
-                tweak = glm::rotate(tweak, glm::radians(ry), glm::vec3(0, 1, 0));
-                tweak = glm::rotate(tweak, glm::radians(rz), glm::vec3(0, 0, 1));
-                tweak = glm::scale(tweak, glm::vec3(sx, sy, sz));
+        fillBeltCorn(X_RANGE_L, Z_RANGE_L, leftCount);
+        fillBeltCorn(X_RANGE_R, Z_RANGE_R, rightCount);
 
-                glm::mat4 M_final = M * Rfix * tweak;
+        // Relleno (por si faltan algunos)
+        std::uniform_real_distribution<float> distX_L(X_RANGE_L.x, X_RANGE_L.y);
+        std::uniform_real_distribution<float> distZ_L(Z_RANGE_L.x, Z_RANGE_L.y);
+        while (coBatch.Size() < CO_COUNT) {
+            glm::vec2 p(distX_L(rng), distZ_L(rng));
+            if (!OutsideExclusions(p, ex)) continue;
 
-                glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(M_final));
-                ca.Draw(shader);
+            float yaw = distYaw(rng);
+            float s = distS(rng);
 
-                ++idx;
-            }
+            coBatch.Add(glm::vec3(p.x, 0.0f, p.y), glm::radians(yaw), s);
         }
 
+        glm::mat3 RfixCorn = glm::mat3(glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(1, 0, 0))); // levantarlo
+        BuildInstanceMatrices(coBatch, RfixCorn, gCoModels);
+        gTerrain.SnapToGround(gCoModels);
+    }
 
+    const float cycleSeconds = 60.0f;
 
+    // Estado inicial de la simulación
+    {
+        SimState init;
+        init.cameraPos = camera.GetPosition();
+        init.cameraYaw = camera.GetYaw();
+        init.cameraPitch = camera.GetPitch();
+        init.wheelPos = gWheelPos;
+        UpdateSimulation(init, TickInput(), 0.0f);
+        ApplyScriptedPose(init);
+        gSim.Reset(init);
+    }
 
+    // =======================================================
+    // Preparación del frame en hilos trabajadores (FramePipeline.h)
+    // Cada trabajo llena su propia lista de dibujo con matrices y uniforms;
+    // el hilo de GL sólo reproduce las listas (ReplayFrame), un frame atrasado.
+    // =======================================================
+
+    // MODELOS DEL TIANGUIS + monumentos
+    gPipeline.AddJob([&](const FrameInputs&, DrawList& out) {
+        const glm::mat4 I(1.0f);
+        if (textureArrays) {
+            out.AddBatch(&tianguisBatch, I);
+        }
+        else {
+            out.AddModel(&CanastaChiles, I);
+            out.AddModel(&Chiles, I);
+            out.AddModel(&PetatesTianguis, I);
+            out.AddModel(&Aguacates, I);
+            out.AddModel(&Jarrones, I);
+            out.AddModel(&VasijasYMolcajete, I);
+            out.AddModel(&Tunas, I);
+            out.AddModel(&Vasijas, I);
+        }
+        out.AddModel(&Tendedero, I);
+        out.AddModel(&PielJaguar, I);
+        out.AddModel(&PielesPiso, I);
+        out.AddModel(&JuegoPelota, I);
+        out.AddModel(&ParedesChozas, I);
+        out.AddModel(&TechosChozas, I);
+        out.AddModel(&CasaGrande, I);
+        out.AddModel(&FuegoCocinaCG, I);
+        out.AddModel(&ArbolTianguis, I);
+
+        // Pirámide (cercana)
+        out.AddModel(&Piramide, model9);
+
+        out.AddModel(&tula, I);
+
+        // --- PIRÁMIDE DEL SOL ---
+        out.AddModel(&piramidesol, model11);
+        });
+
+    // ---------------- Cactus (matrices ya horneadas, sólo se recortan por distancia) ----------------
+    gPipeline.AddJob([&](const FrameInputs& in, DrawList& out) {
+        const float kCullDistance = 220.0f;
+
+        for (const glm::mat4& M : gcaModels) {
+            glm::vec3 posWorld = glm::vec3(M[3]);
+            if (glm::distance(posWorld, in.sim.cameraPos) > kCullDistance) continue;
+            out.AddModel(&ca, M);
+        }
+        });
 
-        // ===== Árboles =====
+    // ===== Árboles =====
+    gPipeline.AddJob([&](const FrameInputs&, DrawList& out) {
         for (const glm::mat4& M : gArModels) {
-            glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(M));
-            ar.Draw(shader);
+            out.AddModel(&ar, M);
         }
+        });
 
-        // ===== Campo de maíz =====
-        {
-            glm::mat4 RfixCorn(1.0f);
-            RfixCorn = glm::rotate(RfixCorn, glm::radians(-90.0f), glm::vec3(1, 0, 0)); // levantarlo
-
-            for (const glm::mat4& M : gCoModels) {
-                glm::mat4 Mfinal = M * RfixCorn;
-                glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"),
-                    1, GL_FALSE, glm::value_ptr(Mfinal));
-                corn.Draw(shader);
-            }
+    // ===== Campo de maíz =====
+    gPipeline.AddJob([&](const FrameInputs&, DrawList& out) {
+        for (const glm::mat4& M : gCoModels) {
+            out.AddModel(&corn, M);
         }
+        });
 
+    // -------- Procedural fijo (mesa, fogata, máscara, platos, silla) con gProg
+    gPipeline.AddJob([&](const FrameInputs& in, DrawList& out) {
+        const SimState& S = in.sim;
 
-
-        // -------- Procedural (mesa, silla, florero + flor) con gProg
-        glUseProgram(gProg);
-        glUniformMatrix4fv(glGetUniformLocation(gProg, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-        glUniformMatrix4fv(glGetUniformLocation(gProg, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniform1f(glGetUniformLocation(gProg, "uTime"), currentFrame);
-        glUniform1f(glGetUniformLocation(gProg, "uSun"), sun);
-        glUniform3fv(glGetUniformLocation(gProg, "uSunDir"), 1, glm::value_ptr(sunDir));
-
-        glUniform3fv(glGetUniformLocation(gProg, "uFirePos"), 1, glm::value_ptr(firePos));
-        glUniform3fv(glGetUniformLocation(gProg, "uFireColor"), 1, glm::value_ptr(fireColor));
         auto drawCubeAt = [&](glm::vec3 pos, glm::vec3 scl, int mode = 1) {
             glm::mat4 MM(1.0f); MM = glm::translate(MM, pos); MM = glm::scale(MM, scl);
-            glUniformMatrix4fv(glGetUniformLocation(gProg, "model"), 1, GL_FALSE, glm::value_ptr(MM));
-            glUniform1i(glGetUniformLocation(gProg, "uMode"), mode);
-            glBindVertexArray(gVAOCube); glDrawArrays(GL_TRIANGLES, 0, gCubeVerts);
-            };
-
-        auto drawCubeAtRP = [&](glm::vec3 pos, glm::vec3 scl, float yawDeg, float pitchDeg, int mode = 1) {
-            glm::mat4 M(1.0f);
-            M = glm::translate(M, pos);
-            M = glm::rotate(M, glm::radians(yawDeg), glm::vec3(0, 1, 0));
-            M = glm::rotate(M, glm::radians(pitchDeg), glm::vec3(1, 0, 0));
-            M = glm::scale(M, scl);
-            glUniformMatrix4fv(glGetUniformLocation(gProg, "model"), 1, GL_FALSE, glm::value_ptr(M));
-            glUniform1i(glGetUniformLocation(gProg, "uMode"), mode);
-            glBindVertexArray(gVAOCube);
-            glDrawArrays(GL_TRIANGLES, 0, gCubeVerts);
-            glBindVertexArray(0);
+            out.AddProcedural(gVAOCube, gCubeVerts, MM, mode);
             };
         auto drawConeAt = [&](glm::vec3 pos, glm::vec3 scl, int mode, float seed, float flicker) {
             glm::mat4 M(1.0f);
             M = glm::translate(M, pos);
             M = glm::scale(M, scl);
-            glUniformMatrix4fv(glGetUniformLocation(gProg, "model"), 1, GL_FALSE, glm::value_ptr(M));
-            glUniform1i(glGetUniformLocation(gProg, "uMode"), mode);       // 0 = fuego
-            glUniform1f(glGetUniformLocation(gProg, "uSeed"), seed);        // semilla
-            glUniform1f(glGetUniformLocation(gProg, "uFlicker"), flicker);  // parpadeo externo
-            glBindVertexArray(gVAOCone);
-            glDrawArrays(GL_TRIANGLES, 0, gConeVerts);
-            glBindVertexArray(0);
+            out.AddProcedural(gVAOCone, gConeVerts, M, mode, seed, flicker);   // 0 = fuego
             };
-        // ===============================
-
 
         // Mesa
         {
@@ -1286,24 +1691,36 @@ int main() {
             drawCubeAt(gTablePos + glm::vec3(-ox, railH, 0.0f), glm::vec3(0.09f, 0.06f, topZ - 0.09f * 1.4f), 1);
         }
         {
-            if (gFireOn) {
+            if (in.fireOn) {
+                out.SetShadowCaster(SHADOW_NONE);   // las flamas son transparentes y emiten luz
                 // 3 flamas (uMode=0) con ligeras variaciones
                 drawConeAt(gCampPos + glm::vec3(-0.18f, 0.00f, 0.00f),
-                    glm::vec3(0.32f, 0.85f + 0.08f * sinf(currentFrame * 3.4f), 0.32f), 0, 11.0f, fireFlicker);
+                    glm::vec3(0.32f, S.flameHeight[0], 0.32f), 0, 11.0f, in.fireFlicker);
 
                 drawConeAt(gCampPos + glm::vec3(0.16f, 0.00f, -0.08f),
-                    glm::vec3(0.26f, 0.70f + 0.07f * sinf(currentFrame * 4.1f + 1.2f), 0.26f), 0, 17.0f, fireFlicker);
+                    glm::vec3(0.26f, S.flameHeight[1], 0.26f), 0, 17.0f, in.fireFlicker);
 
                 drawConeAt(gCampPos + glm::vec3(0.05f, 0.00f, 0.15f),
-                    glm::vec3(0.22f, 0.60f + 0.06f * sinf(currentFrame * 5.0f + 2.1f), 0.22f), 0, 23.0f, fireFlicker);
+                    glm::vec3(0.22f, S.flameHeight[2], 0.22f), 0, 23.0f, in.fireFlicker);
+                out.SetShadowCaster(SHADOW_STATIC);
+            }
+        }
+        // Braseros: poste de madera, cazo y, de noche, su flama
+        for (int i = 0; i < (int)gBraziers.size(); ++i) {
+            const glm::vec3& b = gBraziers[i];
+            drawCubeAt(b + glm::vec3(0.0f, 0.70f, 0.0f), glm::vec3(0.12f, 1.40f, 0.12f), 1);
+            drawCubeAt(b + glm::vec3(0.0f, 1.45f, 0.0f), glm::vec3(0.45f, 0.12f, 0.45f), 4);
+            if (in.braziers > 0.0f) {
+                out.SetShadowCaster(SHADOW_NONE);
+                drawConeAt(b + glm::vec3(0.0f, 1.50f, 0.0f), glm::vec3(0.20f, 0.55f * in.braziers, 0.20f),
+                    0, 31.0f + i, BrazierFlicker(i, (float)S.time));
+                out.SetShadowCaster(SHADOW_STATIC);
             }
         }
         // =======================
  // MÁSCARA DE JADE MOSAICO (colores sólidos, sin sombras)
  // =======================
         {
-            glUseProgram(gProg);
-
             const float yTop = legH + topY;
             const float t = 0.020f;
             const float eps = 0.010f;
@@ -1404,403 +1821,384 @@ int main() {
             glm::mat4 MS(1.0f);
             MS = glm::translate(MS, gChairPos + glm::vec3(0.0f, 0.75f, 0.0f));
             MS = glm::scale(MS, glm::vec3(seat, 1.0f, seat));
-            glUniformMatrix4fv(glGetUniformLocation(gProg, "model"), 1, GL_FALSE, glm::value_ptr(MS));
-            glUniform1i(glGetUniformLocation(gProg, "uMode"), 5);
-            glBindVertexArray(gVAOSeat);
-            glDrawArrays(GL_TRIANGLES, 0, gSeatVerts);
-            glBindVertexArray(0);
+            out.AddProcedural(gVAOSeat, gSeatVerts, MS, 5);
         }
+        });
+
+    // =======================================================
+    // Props articulados como jerarquía (SceneGraph.h)
+    // Las matrices de mundo se guardan; cada frame sólo se recalculan las
+    // ramas cuyo transform local cambió (carretilla, hacha, patas y cola).
+    // =======================================================
+    SceneGraph props;
+    const glm::quat Q0(1.0f, 0.0f, 0.0f, 0.0f);
+    const int ROOT = SceneGraph::NO_PARENT;
+    std::vector<int> staticProps;   // raíces que nunca se mueven (van a las sombras en caché)
+
+    // Carretilla simple con cubos
+    int wheelRoot = props.AddNode(ROOT, gWheelPos);
+    {
+        auto wb = [&](glm::vec3 lp, glm::vec3 sc, int mode = 1)
+            {
+                props.AddPart(wheelRoot, gVAOCube, gCubeVerts, mode, lp, Q0, sc);
+            };
 
-        // Carretilla simple con cubos
-        // ===============================
-        {
-            auto wb = [&](glm::vec3 lp, glm::vec3 sc, int mode = 1)
-                {
-                    drawCubeAt(gWheelPos + lp, sc, mode);
-                };
-
-            float bodyW = 1.6f;   // ancho
-            float bodyH = 0.40f;  // alto caja
-            float bodyL = 2.3f;   // largo
-
-            // ---------------------------
-            // Caja
-            // ---------------------------
-            wb(glm::vec3(0.0f, bodyH * 0.5f + 0.4f, 0.0f),
-                glm::vec3(bodyW, bodyH, bodyL), 1);
-
-            // Bordes laterales
-            float edgeH = 0.25f;
-            wb(glm::vec3(+bodyW * 0.5f, 0.4f + bodyH + edgeH * 0.5f, 0.0f),
-                glm::vec3(0.10f, edgeH, bodyL), 1);
-
-            wb(glm::vec3(-bodyW * 0.5f, 0.4f + bodyH + edgeH * 0.5f, 0.0f),
-                glm::vec3(0.10f, edgeH, bodyL), 1);
-
-            // ---------------------------
-            // Manubrios
-            // ---------------------------
-            wb(glm::vec3(+bodyW * 0.45f, 0.4f + bodyH + 0.25f, bodyL * 0.60f),
-                glm::vec3(0.10f, 0.10f, 1.6f), 1);
-
-            wb(glm::vec3(-bodyW * 0.45f, 0.4f + bodyH + 0.25f, bodyL * 0.60f),
-                glm::vec3(0.10f, 0.10f, 1.6f), 1);
-
-            // ---------------------------
-            // Piernas de soporte
-            // ---------------------------
-            wb(glm::vec3(+0.55f, 0.2f, -0.90f),
-                glm::vec3(0.15f, 0.40f, 0.15f), 1);
-
-            wb(glm::vec3(-0.55f, 0.2f, -0.90f),
-                glm::vec3(0.15f, 0.40f, 0.15f), 1);
-
-            // ---------------------------
-            // Rueda (cilindro simulado con cubo ancho)
-            // ---------------------------
-            wb(glm::vec3(0.0f, 0.35f, -bodyL * 0.5f),
-                glm::vec3(0.80f, 0.80f, 0.20f), 3);
-        }
-
-        // ========================================
-// Hacha pequeña pegando una piedra
-// ========================================
-        {
-            // Pivot: punta del mango en el piso
-            glm::vec3 pivot = gAxePos;   // por ejemplo glm::vec3(10.0f, 0.0f, -5.0f);
-
-            // ---------- Animación del golpe ----------
-            float t = (float)glfwGetTime();
-            float s = (sin(t * 3.0f) + 1.0f) * 0.5f;   // 0..1
-            float angDeg = -20.0f - 30.0f * s;         // de -20° a -50° (menos exagerado)
-            float angRad = glm::radians(angDeg);
-
-            auto part = [&](glm::vec3 local, glm::vec3 scl, int mode)
-                {
-                    glm::mat4 M(1.0f);
-
-                    // pivot en el piso
-                    M = glm::translate(M, pivot);
-                    // rotación hacia adelante alrededor de X
-                    M = glm::rotate(M, angRad, glm::vec3(1.0f, 0.0f, 0.0f));
-                    // posición local de la pieza (desde el pivot)
-                    M = glm::translate(M, local);
-                    M = glm::scale(M, scl);
-
-                    glUniformMatrix4fv(glGetUniformLocation(gProg, "model"), 1, GL_FALSE, glm::value_ptr(M));
-                    glUniform1i(glGetUniformLocation(gProg, "uMode"), mode); // 1=madera, 2=piedra, 3=cuerda
-                    glBindVertexArray(gVAOCube);
-                    glDrawArrays(GL_TRIANGLES, 0, gCubeVerts);
-                };
-
-            // ---------- Tamaños más pequeños ----------
-            float handleLen = 1.6f;          // antes era más largo
-            float zStone = 0.55f;         // posición de la piedra en Z
-            float zBlade = 0.55f;         // donde cae el filo
-
-            // MANGO
-            part(glm::vec3(0.0f, handleLen * 0.5f, 0.0f),
-                glm::vec3(0.10f, handleLen, 0.10f), 1);
-
-            // CABEZA (bloque de piedra)
-            part(glm::vec3(0.0f, handleLen + 0.15f, 0.30f),
-                glm::vec3(0.45f, 0.28f, 0.40f), 2);
+        float bodyW = 1.6f;   // ancho
+        float bodyH = 0.40f;  // alto caja
+        float bodyL = 2.3f;   // largo
+
+        // Caja
+        wb(glm::vec3(0.0f, bodyH * 0.5f + 0.4f, 0.0f),
+            glm::vec3(bodyW, bodyH, bodyL), 1);
+
+        // Bordes laterales
+        float edgeH = 0.25f;
+        wb(glm::vec3(+bodyW * 0.5f, 0.4f + bodyH + edgeH * 0.5f, 0.0f),
+            glm::vec3(0.10f, edgeH, bodyL), 1);
+        wb(glm::vec3(-bodyW * 0.5f, 0.4f + bodyH + edgeH * 0.5f, 0.0f),
+            glm::vec3(0.10f, edgeH, bodyL), 1);
+
+        // Manubrios
+        wb(glm::vec3(+bodyW * 0.45f, 0.4f + bodyH + 0.25f, bodyL * 0.60f),
+            glm::vec3(0.10f, 0.10f, 1.6f), 1);
+        wb(glm::vec3(-bodyW * 0.45f, 0.4f + bodyH + 0.25f, bodyL * 0.60f),
+            glm::vec3(0.10f, 0.10f, 1.6f), 1);
+
+        // Piernas de soporte
+        wb(glm::vec3(+0.55f, 0.2f, -0.90f),
+            glm::vec3(0.15f, 0.40f, 0.15f), 1);
+        wb(glm::vec3(-0.55f, 0.2f, -0.90f),
+            glm::vec3(0.15f, 0.40f, 0.15f), 1);
+
+        // Rueda (cilindro simulado con cubo ancho)
+        wb(glm::vec3(0.0f, 0.35f, -bodyL * 0.5f),
+            glm::vec3(0.80f, 0.80f, 0.20f), 3);
+    }
 
-            // FILO (un poco más salido, alineado con la piedra)
-            part(glm::vec3(0.0f, handleLen + 0.15f, zBlade),
-                glm::vec3(0.55f, 0.24f, 0.12f), 2);
+    // Hacha pequeña pegando una piedra: pivot en la punta del mango (en el piso), gira en X
+    int axeRoot = props.AddNode(ROOT, gAxePos);
+    {
+        auto part = [&](glm::vec3 local, glm::vec3 scl, int mode)   // 1=madera, 2=piedra, 3=cuerda
+            {
+                props.AddPart(axeRoot, gVAOCube, gCubeVerts, mode, local, Q0, scl);
+            };
 
-            // CUERDA alrededor
-            part(glm::vec3(0.0f, handleLen + 0.05f, 0.20f),
-                glm::vec3(0.22f, 0.20f, 0.22f), 3);
-            part(glm::vec3(0.0f, handleLen + 0.10f, 0.10f),
-                glm::vec3(0.26f, 0.18f, 0.26f), 3);
+        float handleLen = 1.6f;
+        float zBlade = 0.55f;         // donde cae el filo
 
-        }
+        // MANGO
+        part(glm::vec3(0.0f, handleLen * 0.5f, 0.0f),
+            glm::vec3(0.10f, handleLen, 0.10f), 1);
 
+        // CABEZA (bloque de piedra)
+        part(glm::vec3(0.0f, handleLen + 0.15f, 0.30f),
+            glm::vec3(0.45f, 0.28f, 0.40f), 2);
 
-        // Florero
-        {
-            float vaseH = 0.60f;
-            glm::mat4 MV(1.0f);
-            MV = glm::translate(MV, gTablePos + glm::vec3(0.0f, 0.75f + 0.12f + vaseH * 0.5f, 0.0f));
-            MV = glm::scale(MV, glm::vec3(vaseH));
-            glUniformMatrix4fv(glGetUniformLocation(gProg, "model"), 1, GL_FALSE, glm::value_ptr(MV));
-            glUniform1i(glGetUniformLocation(gProg, "uMode"), 2);
-            glBindVertexArray(gVAOVase);
-            glDrawArrays(GL_TRIANGLES, 0, gVaseVerts);
-            glBindVertexArray(0);
-        }
+        // FILO (un poco más salido, alineado con la piedra)
+        part(glm::vec3(0.0f, handleLen + 0.15f, zBlade),
+            glm::vec3(0.55f, 0.24f, 0.12f), 2);
 
-        // ====== Flor dentro del florero (alineada al cuello) ======
-        {
-            const float vaseH = 0.60f;      // misma altura que usas al dibujar el florero
-            const float tableH = 0.75f;     // altura de la mesa que usas arriba
-            const float topT = 0.12f;     // grosor de la tapa de la mesa
-
-            // Altura del borde superior del florero (centro + mitad de su altura)
-            const float yMouth = tableH + topT + vaseH;
-
-            // Pequeño hundimiento para que el tallo nazca desde dentro del cuello
-            const float sink = 0.08f;
-
-            // Punto base: centro del cuello del florero
-            glm::vec3 mouth = gTablePos + glm::vec3(0.0f, yMouth, 0.0f);
-
-            // ---- Tallo (uMode=14, verde)
-            float stemH = 0.50f;
-            glm::mat4 MT(1.0f);
-            MT = glm::translate(MT, mouth + glm::vec3(0.0f, -sink + stemH * 0.5f, 0.0f));
-            MT = glm::scale(MT, glm::vec3(0.045f, stemH, 0.045f));
-            glUniformMatrix4fv(glGetUniformLocation(gProg, "model"), 1, GL_FALSE, glm::value_ptr(MT));
-            glUniform1i(glGetUniformLocation(gProg, "uMode"), 14);
-            glBindVertexArray(gVAOCube);
-            glDrawArrays(GL_TRIANGLES, 0, gCubeVerts);
-
-
-
-            // ---- Hojas (uMode=14, verdes) — a media altura del tallo
-            auto leaf = [&](glm::vec3 off, glm::vec3 scl, float yawDeg) {
-                glm::mat4 ML(1.0f);
-                ML = glm::translate(ML, mouth + off);
-                ML = glm::rotate(ML, glm::radians(yawDeg), glm::vec3(0, 1, 0));
-                ML = glm::scale(ML, scl);
-                glUniformMatrix4fv(glGetUniformLocation(gProg, "model"), 1, GL_FALSE, glm::value_ptr(ML));
-                glUniform1i(glGetUniformLocation(gProg, "uMode"), 14);
-                glBindVertexArray(gVAOCube);
-                glDrawArrays(GL_TRIANGLES, 0, gCubeVerts);
-                };
-            leaf(glm::vec3(0.0f, -sink + 0.22f, 0.0f), glm::vec3(0.12f, 0.02f, 0.06f), 35.0f);
-            leaf(glm::vec3(0.0f, -sink + 0.30f, 0.0f), glm::vec3(0.12f, 0.02f, 0.06f), -35.0f);
-
-            // ---- Pétalos (uMode=15, rosa) alrededor del centro
-            const float petalRingY = -sink + stemH + 0.02f; // justo sobre el tallo
-            const float petalR = 0.075f;                // radio del anillo de pétalos
-            for (int i = 0; i < 6; ++i) {
-                float ang = glm::radians(i * 60.0f);
-                glm::mat4 MP(1.0f);
-                MP = glm::translate(MP, mouth + glm::vec3(0.0f, petalRingY, 0.0f));
-                MP = glm::rotate(MP, ang, glm::vec3(0, 1, 0));                 // gira alrededor del tallo
-                MP = glm::rotate(MP, glm::radians(-18.0f), glm::vec3(1, 0, 0)); // ligera inclinación
-                MP = glm::translate(MP, glm::vec3(0.0f, 0.0f, petalR));       // empuja hacia afuera
-                MP = glm::scale(MP, glm::vec3(0.06f, 0.02f, 0.12f));          // “lámina” del pétalo
-                glUniformMatrix4fv(glGetUniformLocation(gProg, "model"), 1, GL_FALSE, glm::value_ptr(MP));
-                glUniform1i(glGetUniformLocation(gProg, "uMode"), 15);
-                glBindVertexArray(gVAOCube);
-                glDrawArrays(GL_TRIANGLES, 0, gCubeVerts);
-            }
+        // CUERDA alrededor
+        part(glm::vec3(0.0f, handleLen + 0.05f, 0.20f),
+            glm::vec3(0.22f, 0.20f, 0.22f), 3);
+        part(glm::vec3(0.0f, handleLen + 0.10f, 0.10f),
+            glm::vec3(0.26f, 0.18f, 0.26f), 3);
+    }
 
+    // Florero
+    {
+        float vaseH = 0.60f;
+        staticProps.push_back(props.AddPart(ROOT, gVAOVase, gVaseVerts, 2,
+            gTablePos + glm::vec3(0.0f, 0.75f + 0.12f + vaseH * 0.5f, 0.0f), Q0, glm::vec3(vaseH)));
+    }
 
+    // ====== Flor dentro del florero (alineada al cuello) ======
+    {
+        const float vaseH = 0.60f;      // misma altura que el florero
+        const float tableH = 0.75f;     // altura de la mesa
+        const float topT = 0.12f;       // grosor de la tapa de la mesa
 
-            // ---- Centro (uMode=16, amarillo)
-            glm::mat4 MC(1.0f);
-            MC = glm::translate(MC, mouth + glm::vec3(0.0f, petalRingY + 0.005f, 0.0f));
-            MC = glm::scale(MC, glm::vec3(0.05f));
-            glUniformMatrix4fv(glGetUniformLocation(gProg, "model"), 1, GL_FALSE, glm::value_ptr(MC));
-            glUniform1i(glGetUniformLocation(gProg, "uMode"), 16);
-            glBindVertexArray(gVAOCube);
-            glDrawArrays(GL_TRIANGLES, 0, gCubeVerts);
-        }
+        // Altura del borde superior del florero (centro + mitad de su altura)
+        const float yMouth = tableH + topT + vaseH;
 
+        // Pequeño hundimiento para que el tallo nazca desde dentro del cuello
+        const float sink = 0.08f;
 
+        // Nodo base: centro del cuello del florero
+        int mouth = props.AddNode(ROOT, gTablePos + glm::vec3(0.0f, yMouth, 0.0f));
+        staticProps.push_back(mouth);
 
+        // ---- Tallo (uMode=14, verde)
+        float stemH = 0.50f;
+        props.AddPart(mouth, gVAOCube, gCubeVerts, 14,
+            glm::vec3(0.0f, -sink + stemH * 0.5f, 0.0f), Q0, glm::vec3(0.045f, stemH, 0.045f));
 
-        // Chihuahua (voxel)
-        auto drawPart = [&](const glm::vec3& base, float yaw, glm::vec3 local, glm::vec3 scl, int mode) {
-            glm::mat4 MD(1.0f);
-            MD = glm::translate(MD, base);
-            MD = glm::rotate(MD, glm::radians(yaw), glm::vec3(0, 1, 0));
-            MD = glm::translate(MD, local);
-            MD = glm::scale(MD, scl);
-            glUniformMatrix4fv(glGetUniformLocation(gProg, "model"), 1, GL_FALSE, glm::value_ptr(MD));
-            glUniform1i(glGetUniformLocation(gProg, "uMode"), mode);
-            glBindVertexArray(gVAOCube);
-            glDrawArrays(GL_TRIANGLES, 0, gCubeVerts);
-            };
-        auto drawDog = [&](glm::vec3 base, float yaw, float s) {
-            drawPart(base, yaw, glm::vec3(+0.10f, 0.18f, 0.0f), glm::vec3(0.38f * s, 0.22f * s, 0.22f * s), 3);
-            drawPart(base, yaw, glm::vec3(-0.18f, 0.19f, 0.0f), glm::vec3(0.30f * s, 0.20f * s, 0.22f * s), 3);
-            drawPart(base, yaw, glm::vec3(+0.30f, 0.28f, 0.0f), glm::vec3(0.10f * s, 0.16f * s, 0.16f * s), 3);
-            drawPart(base, yaw, glm::vec3(+0.43f, 0.34f, 0.0f), glm::vec3(0.18f * s, 0.16f * s, 0.18f * s), 3);
-            drawPart(base, yaw, glm::vec3(+0.55f, 0.30f, 0.0f), glm::vec3(0.12f * s, 0.10f * s, 0.12f * s), 3);
-            drawPart(base, yaw, glm::vec3(+0.62f, 0.30f, 0.0f), glm::vec3(0.06f * s, 0.06f * s, 0.06f * s), 4);
-            drawPart(base, yaw, glm::vec3(+0.58f, 0.22f, 0.0f), glm::vec3(0.06f * s, 0.02f * s, 0.04f * s), 6);
-            drawPart(base, yaw, glm::vec3(+0.46f, 0.48f, +0.07f), glm::vec3(0.06f * s, 0.14f * s, 0.06f * s), 4);
-            drawPart(base, yaw, glm::vec3(+0.46f, 0.48f, -0.07f), glm::vec3(0.06f * s, 0.14f * s, 0.06f * s), 4);
-            drawPart(base, yaw, glm::vec3(+0.52f, 0.36f, +0.08f), glm::vec3(0.03f * s, 0.03f * s, 0.03f * s), 4);
-            drawPart(base, yaw, glm::vec3(+0.52f, 0.36f, -0.08f), glm::vec3(0.03f * s, 0.03f * s, 0.03f * s), 4);
-            drawPart(base, yaw, glm::vec3(+0.20f, 0.09f, +0.09f), glm::vec3(0.07f * s, 0.18f * s, 0.07f * s), 3);
-            drawPart(base, yaw, glm::vec3(+0.20f, 0.09f, -0.09f), glm::vec3(0.07f * s, 0.18f * s, 0.07f * s), 3);
-            drawPart(base, yaw, glm::vec3(-0.22f, 0.09f, +0.09f), glm::vec3(0.07f * s, 0.18f * s, 0.07f * s), 3);
-            drawPart(base, yaw, glm::vec3(-0.22f, 0.09f, -0.09f), glm::vec3(0.07f * s, 0.18f * s, 0.07f * s), 3);
-            drawPart(base, yaw, glm::vec3(-0.32f, 0.32f, 0.0f), glm::vec3(0.05f * s, 0.16f * s, 0.05f * s), 3);
+        // ---- Hojas (uMode=14, verdes) — a media altura del tallo
+        auto leaf = [&](glm::vec3 off, glm::vec3 scl, float yawDeg) {
+            props.AddPart(mouth, gVAOCube, gCubeVerts, 14,
+                off, glm::angleAxis(glm::radians(yawDeg), glm::vec3(0, 1, 0)), scl);
             };
-        {
-            const float zDog = gTablePos.z + 3.0f * 0.5f + 0.55f;
-            const float xDog = gTablePos.x - 0.30f;
-            drawDog(glm::vec3(xDog, 0.0f, zDog), 10.0f, 1.0f);
+        leaf(glm::vec3(0.0f, -sink + 0.22f, 0.0f), glm::vec3(0.12f, 0.02f, 0.06f), 35.0f);
+        leaf(glm::vec3(0.0f, -sink + 0.30f, 0.0f), glm::vec3(0.12f, 0.02f, 0.06f), -35.0f);
+
+        // ---- Pétalos (uMode=15, rosa) alrededor del centro
+        const float petalRingY = -sink + stemH + 0.02f; // justo sobre el tallo
+        const float petalR = 0.075f;                // radio del anillo de pétalos
+        for (int i = 0; i < 6; ++i) {
+            // gira alrededor del tallo + ligera inclinación
+            glm::quat q = glm::angleAxis(glm::radians(i * 60.0f), glm::vec3(0, 1, 0))
+                * glm::angleAxis(glm::radians(-18.0f), glm::vec3(1, 0, 0));
+            int pivot = props.AddNode(mouth, glm::vec3(0.0f, petalRingY, 0.0f), q);
+            // empuja hacia afuera; “lámina” del pétalo
+            props.AddPart(pivot, gVAOCube, gCubeVerts, 15,
+                glm::vec3(0.0f, 0.0f, petalR), Q0, glm::vec3(0.06f, 0.02f, 0.12f));
         }
 
+        // ---- Centro (uMode=16, amarillo)
+        props.AddPart(mouth, gVAOCube, gCubeVerts, 16,
+            glm::vec3(0.0f, petalRingY + 0.005f, 0.0f), Q0, glm::vec3(0.05f));
+    }
 
-        auto dog_drawPartR3 = [&](const glm::vec3& base, float yawDeg,
-            const glm::vec3& local,
-            float rotXDeg, float rotYDeg, float rotZDeg,
-            const glm::vec3& scl, int mode)
-            {
-                glm::mat4 M(1.0f);
-                M = glm::translate(M, base);
-                M = glm::rotate(M, glm::radians(yawDeg), glm::vec3(0, 1, 0));
-                M = glm::translate(M, local);
-                if (rotXDeg != 0.0f) M = glm::rotate(M, glm::radians(rotXDeg), glm::vec3(1, 0, 0));
-                if (rotYDeg != 0.0f) M = glm::rotate(M, glm::radians(rotYDeg), glm::vec3(0, 1, 0)); // cola
-                if (rotZDeg != 0.0f) M = glm::rotate(M, glm::radians(rotZDeg), glm::vec3(0, 0, 1));
-                M = glm::scale(M, scl);
-
-                glUniformMatrix4fv(glGetUniformLocation(gProg, "model"), 1, GL_FALSE, glm::value_ptr(M));
-                glUniform1i(glGetUniformLocation(gProg, "uMode"), mode);
-                glBindVertexArray(gVAOCube);
-                glDrawArrays(GL_TRIANGLES, 0, gCubeVerts);
+    // Chihuahua (voxel) fijo junto a la mesa
+    {
+        const float s = 1.0f;
+        const float zDog = gTablePos.z + 3.0f * 0.5f + 0.55f;
+        const float xDog = gTablePos.x - 0.30f;
+        int dog = props.AddNode(ROOT, glm::vec3(xDog, 0.0f, zDog), glm::angleAxis(glm::radians(10.0f), glm::vec3(0, 1, 0)));
+        staticProps.push_back(dog);
+
+        auto drawPart = [&](glm::vec3 local, glm::vec3 scl, int mode) {
+            props.AddPart(dog, gVAOCube, gCubeVerts, mode, local, Q0, scl);
             };
+        drawPart(glm::vec3(+0.10f, 0.18f, 0.0f), glm::vec3(0.38f * s, 0.22f * s, 0.22f * s), 3);
+        drawPart(glm::vec3(-0.18f, 0.19f, 0.0f), glm::vec3(0.30f * s, 0.20f * s, 0.22f * s), 3);
+        drawPart(glm::vec3(+0.30f, 0.28f, 0.0f), glm::vec3(0.10f * s, 0.16f * s, 0.16f * s), 3);
+        drawPart(glm::vec3(+0.43f, 0.34f, 0.0f), glm::vec3(0.18f * s, 0.16f * s, 0.18f * s), 3);
+        drawPart(glm::vec3(+0.55f, 0.30f, 0.0f), glm::vec3(0.12f * s, 0.10f * s, 0.12f * s), 3);
+        drawPart(glm::vec3(+0.62f, 0.30f, 0.0f), glm::vec3(0.06f * s, 0.06f * s, 0.06f * s), 4);
+        drawPart(glm::vec3(+0.58f, 0.22f, 0.0f), glm::vec3(0.06f * s, 0.02f * s, 0.04f * s), 6);
+        drawPart(glm::vec3(+0.46f, 0.48f, +0.07f), glm::vec3(0.06f * s, 0.14f * s, 0.06f * s), 4);
+        drawPart(glm::vec3(+0.46f, 0.48f, -0.07f), glm::vec3(0.06f * s, 0.14f * s, 0.06f * s), 4);
+        drawPart(glm::vec3(+0.52f, 0.36f, +0.08f), glm::vec3(0.03f * s, 0.03f * s, 0.03f * s), 4);
+        drawPart(glm::vec3(+0.52f, 0.36f, -0.08f), glm::vec3(0.03f * s, 0.03f * s, 0.03f * s), 4);
+        drawPart(glm::vec3(+0.20f, 0.09f, +0.09f), glm::vec3(0.07f * s, 0.18f * s, 0.07f * s), 3);
+        drawPart(glm::vec3(+0.20f, 0.09f, -0.09f), glm::vec3(0.07f * s, 0.18f * s, 0.07f * s), 3);
+        drawPart(glm::vec3(-0.22f, 0.09f, +0.09f), glm::vec3(0.07f * s, 0.18f * s, 0.07f * s), 3);
+        drawPart(glm::vec3(-0.22f, 0.09f, -0.09f), glm::vec3(0.07f * s, 0.18f * s, 0.07f * s), 3);
+        drawPart(glm::vec3(-0.32f, 0.32f, 0.0f), glm::vec3(0.05f * s, 0.16f * s, 0.05f * s), 3);
+    }
 
-        // ---- Dibuja perrito (patas + cola animadas, lengua rosa; ojos/orejas fijos)
-        auto dog_drawAnimated = [&](const glm::vec3& base, float yawDeg, float s, float t)
-            {
-                // Animación
-                const float stepHz = 2.0f;
-                const float phase = t * 2.0f * 3.14159265f * stepHz;
-                const float legSwing = 22.0f * std::sin(phase);
-                const float legOpp = 22.0f * std::sin(phase + 3.14159265f);
-                const float tailYaw = 20.0f * std::sin(phase * 1.5f);
-
-                // Cuerpo (dos bloques)
-                dog_drawPartR3(base, yawDeg, glm::vec3(+0.10f, 0.18f, 0.0f), 0, 0, 0, glm::vec3(0.38f * s, 0.22f * s, 0.22f * s), 3);
-                dog_drawPartR3(base, yawDeg, glm::vec3(-0.18f, 0.19f, 0.0f), 0, 0, 0, glm::vec3(0.30f * s, 0.20f * s, 0.22f * s), 3);
-
-                // Cabeza/hocico
-                dog_drawPartR3(base, yawDeg, glm::vec3(+0.30f, 0.28f, 0.0f), 0, 0, 0, glm::vec3(0.10f * s, 0.16f * s, 0.16f * s), 3);
-                dog_drawPartR3(base, yawDeg, glm::vec3(+0.43f, 0.34f, 0.0f), 0, 0, 0, glm::vec3(0.18f * s, 0.16f * s, 0.18f * s), 3);
-                dog_drawPartR3(base, yawDeg, glm::vec3(+0.55f, 0.30f, 0.0f), 0, 0, 0, glm::vec3(0.12f * s, 0.10f * s, 0.12f * s), 3);
-
-                // Nariz, ojos y orejas (fijos)
-                dog_drawPartR3(base, yawDeg, glm::vec3(+0.62f, 0.30f, 0.0f), 0, 0, 0, glm::vec3(0.06f * s), 4); // nariz
-                // Lengua (rosa)
-                // Lengua (rosa)
-
-
-                dog_drawPartR3(base, yawDeg, glm::vec3(+0.52f, 0.36f, +0.08f), 0, 0, 0, glm::vec3(0.03f * s), 4); // ojo der
-                dog_drawPartR3(base, yawDeg, glm::vec3(+0.52f, 0.36f, -0.08f), 0, 0, 0, glm::vec3(0.03f * s), 4); // ojo izq
-                dog_drawPartR3(base, yawDeg, glm::vec3(+0.46f, 0.48f, +0.07f), 0, 0, 0, glm::vec3(0.06f * s, 0.14f * s, 0.06f * s), 4); // oreja
-                dog_drawPartR3(base, yawDeg, glm::vec3(+0.46f, 0.48f, -0.07f), 0, 0, 0, glm::vec3(0.06f * s, 0.14f * s, 0.06f * s), 4); // oreja
-
-
-                // Cola (visible y con meneo)
-                dog_drawPartR3(base, yawDeg, glm::vec3(+0.64f, 0.24f, 0.0f), 0.0f, tailYaw, 0.0f,
-                    glm::vec3(0.10f * s, 0.035f * s, 0.06f * s), 3);
-
-                // Patas alternadas
-                dog_drawPartR3(base, yawDeg, glm::vec3(+0.20f, 0.09f, +0.09f), legSwing, 0, 0,
-                    glm::vec3(0.07f * s, 0.18f * s, 0.07f * s), 3); // FL
-                dog_drawPartR3(base, yawDeg, glm::vec3(+0.20f, 0.09f, -0.09f), legOpp, 0, 0,
-                    glm::vec3(0.07f * s, 0.18f * s, 0.07f * s), 3); // FR
-                dog_drawPartR3(base, yawDeg, glm::vec3(-0.22f, 0.09f, +0.09f), legOpp, 0, 0,
-                    glm::vec3(0.07f * s, 0.18f * s, 0.07f * s), 3); // BL
-                dog_drawPartR3(base, yawDeg, glm::vec3(-0.22f, 0.09f, -0.09f), legSwing, 0, 0,
-                    glm::vec3(0.07f * s, 0.18f * s, 0.07f * s), 3); // BR
-
-                // Cuello
-                dog_drawPartR3(base, yawDeg, glm::vec3(-0.32f, 0.32f, 0.0f), 0, 0, 0,
-                    glm::vec3(0.05f * s, 0.16f * s, 0.05f * s), 3);
+    // ---- Perrito animado (patas + cola animadas; ojos/orejas fijos)
+    int dogRoot = props.AddNode(ROOT, glm::vec3(0.0f));
+    int dogTail, dogLegs[4];
+    {
+        const float s = 1.0f;
+        auto dog_part = [&](const glm::vec3& local, const glm::vec3& scl, int mode) {
+            return props.AddPart(dogRoot, gVAOCube, gCubeVerts, mode, local, Q0, scl);
             };
 
-        // ---- Movimiento: lejos de la mesa, trayecto circular amplio
-        {
-            // Posición base alejada (ajusta a gusto)
-            const float x0 = gTablePos.x + 12.0f;  // derecha de la mesa
-            const float z0 = gTablePos.z + 8.0f;   // al frente de la mesa
-            const float y0 = 0.0f;
-
-            // Dirección/sentido
-            const float yaw0Deg = 90.0f;            // perro mirando +X
-            const float MODEL_FORWARD_SIGN = +1.0f; // si parece ir en reversa, usa -1.0f
-
-            // Tiempo y giro
-            const float t = currentFrame;        // o currentFrame*deltaTime
-            const float v = 0.9f;                // velocidad lineal
-            const float wDeg = 15.0f;               // °/s -> radio amplio (baja más para círculo mayor)
-            const float w = glm::radians(wDeg);
-
-            // Orientación actual
-            const float yawDeg = yaw0Deg + wDeg * t * MODEL_FORWARD_SIGN;
-
-            // Trayectoria circular (modelo unicycle exacto)
-            const float yaw0 = glm::radians(yaw0Deg);
-            const float R = (w != 0.0f) ? (v / w) : 0.0f;
-
-            float x = x0, z = z0;
-            if (w != 0.0f) {
-                x = x0 + R * (std::sin(yaw0 + w * t) - std::sin(yaw0));
-                z = z0 + R * (-std::cos(yaw0 + w * t) + std::cos(yaw0));
-            }
-            else {
-                x = x0 + v * std::cos(yaw0) * t;
-                z = z0 + v * std::sin(yaw0) * t;
-            }
+        // Cuerpo (dos bloques)
+        dog_part(glm::vec3(+0.10f, 0.18f, 0.0f), glm::vec3(0.38f * s, 0.22f * s, 0.22f * s), 3);
+        dog_part(glm::vec3(-0.18f, 0.19f, 0.0f), glm::vec3(0.30f * s, 0.20f * s, 0.22f * s), 3);
+
+        // Cabeza/hocico
+        dog_part(glm::vec3(+0.30f, 0.28f, 0.0f), glm::vec3(0.10f * s, 0.16f * s, 0.16f * s), 3);
+        dog_part(glm::vec3(+0.43f, 0.34f, 0.0f), glm::vec3(0.18f * s, 0.16f * s, 0.18f * s), 3);
+        dog_part(glm::vec3(+0.55f, 0.30f, 0.0f), glm::vec3(0.12f * s, 0.10f * s, 0.12f * s), 3);
+
+        // Nariz, ojos y orejas (fijos)
+        dog_part(glm::vec3(+0.62f, 0.30f, 0.0f), glm::vec3(0.06f * s), 4); // nariz
+        dog_part(glm::vec3(+0.52f, 0.36f, +0.08f), glm::vec3(0.03f * s), 4); // ojo der
+        dog_part(glm::vec3(+0.52f, 0.36f, -0.08f), glm::vec3(0.03f * s), 4); // ojo izq
+        dog_part(glm::vec3(+0.46f, 0.48f, +0.07f), glm::vec3(0.06f * s, 0.14f * s, 0.06f * s), 4); // oreja
+        dog_part(glm::vec3(+0.46f, 0.48f, -0.07f), glm::vec3(0.06f * s, 0.14f * s, 0.06f * s), 4); // oreja
+
+        // Cola (visible y con meneo)
+        dogTail = dog_part(glm::vec3(+0.64f, 0.24f, 0.0f), glm::vec3(0.10f * s, 0.035f * s, 0.06f * s), 3);
+
+        // Patas alternadas
+        dogLegs[0] = dog_part(glm::vec3(+0.20f, 0.09f, +0.09f), glm::vec3(0.07f * s, 0.18f * s, 0.07f * s), 3); // FL
+        dogLegs[1] = dog_part(glm::vec3(+0.20f, 0.09f, -0.09f), glm::vec3(0.07f * s, 0.18f * s, 0.07f * s), 3); // FR
+        dogLegs[2] = dog_part(glm::vec3(-0.22f, 0.09f, +0.09f), glm::vec3(0.07f * s, 0.18f * s, 0.07f * s), 3); // BL
+        dogLegs[3] = dog_part(glm::vec3(-0.22f, 0.09f, -0.09f), glm::vec3(0.07f * s, 0.18f * s, 0.07f * s), 3); // BR
+
+        // Cuello
+        dog_part(glm::vec3(-0.32f, 0.32f, 0.0f), glm::vec3(0.05f * s, 0.16f * s, 0.05f * s), 3);
+    }
 
-            glm::vec3 base(x, y0, z);
-            base.y += 0.02f * std::sin(t * 6.0f);   // rebote suave
+    // -------- Procedural animado (carretilla, hacha, florero + flor, perritos, pelota)
+    gPipeline.AddJob([&](const FrameInputs& in, DrawList& out) {
+        const SimState& S = in.sim;
 
-            dog_drawAnimated(base, yawDeg, 1.0f, t);
-        }
+        props.SetPosition(wheelRoot, S.wheelPos);
+        props.SetRotation(axeRoot, glm::angleAxis(S.axeAngle, glm::vec3(1.0f, 0.0f, 0.0f)));
 
+        // ---- Movimiento: lejos de la mesa, trayecto circular amplio (ver UpdateSimulation)
+        props.SetPosition(dogRoot, S.dogPos);
+        props.SetRotation(dogRoot, glm::angleAxis(glm::radians(S.dogYaw), glm::vec3(0, 1, 0)));
         {
-            // Usamos gProg (el shader de cubos/procedurales)
-            glUseProgram(gProg);
-            glUniformMatrix4fv(glGetUniformLocation(gProg, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-            glUniformMatrix4fv(glGetUniformLocation(gProg, "view"), 1, GL_FALSE, glm::value_ptr(view));
-            glUniform1f(glGetUniformLocation(gProg, "uTime"), currentFrame);
+            // Animación
+            const float stepHz = 2.0f;
+            const float phase = (float)S.time * 2.0f * 3.14159265f * stepHz;
+            const float legSwing = 22.0f * std::sin(phase);
+            const float legOpp = 22.0f * std::sin(phase + 3.14159265f);
+            const float tailYaw = 20.0f * std::sin(phase * 1.5f);
+
+            const glm::vec3 X(1, 0, 0), Y(0, 1, 0);
+            props.SetRotation(dogTail, glm::angleAxis(glm::radians(tailYaw), Y));
+            props.SetRotation(dogLegs[0], glm::angleAxis(glm::radians(legSwing), X));
+            props.SetRotation(dogLegs[1], glm::angleAxis(glm::radians(legOpp), X));
+            props.SetRotation(dogLegs[2], glm::angleAxis(glm::radians(legOpp), X));
+            props.SetRotation(dogLegs[3], glm::angleAxis(glm::radians(legSwing), X));
+        }
 
+        props.Update();
+        for (int root : staticProps) props.Emit(out, root);
 
+        // Lo que se mueve se compone cada frame sobre las cascadas de sombra en caché
+        out.SetShadowCaster(SHADOW_DYNAMIC);
+        props.Emit(out, wheelRoot);
+        props.Emit(out, axeRoot);
+        props.Emit(out, dogRoot);
 
-            const glm::vec3 basePos(45.0f, 0.0f, 15.0f);
+        // Pelota
+        {
             const float ballScale = 2.0f;
-            const float bounceHeight = 3.8f;       // Altura máxima del rebote (para que alcance el aro)
-            const float bounceFrequency = 3.0f;    // Frecuencia del rebote (más alto = más rápido)
-            const float horizontalSpeed = 0.8f;    // Velocidad de movimiento horizontal
-            const float maxHorizontalOffset = 3.0f; // Máximo desplazamiento horizontal
+            glm::vec3 finalPos = S.ballPos;
 
-            // Cálculo del rebote vertical (va de 0 a 1)
-            float bounceFactor = std::abs(std::sin(currentFrame * bounceFrequency));
+            glm::mat4 MBall(1.0f);
+            MBall = glm::translate(MBall, finalPos);
+            MBall = glm::scale(MBall, glm::vec3(ballScale));
+            out.AddProcedural(gVAOSphere, gSphereVerts, MBall, 3);
+        }
+        });
 
-            // Altura vertical de la pelota: basePos.y + offset por rebote + mitad de la escala (para que su base toque el suelo)
-            float yOffset = bounceFactor * bounceHeight + (ballScale * 0.5f);
+    gPipeline.Start();
 
+    // Estadísticas del benchmark (el pipeline va un frame atrás, de ahí el +1)
+    typedef std::chrono::high_resolution_clock Clock;
+    const int totalFrames = bench.warmup + bench.frames + 1;
+    int frameIndex = 0;
+    std::vector<double> cpuMs;
+    GpuTimer gpuTimer;
+    RenderStats benchStats;
 
-            float xMove = std::sin(currentFrame * horizontalSpeed * 0.7f) * maxHorizontalOffset;
-            float zMove = std::cos(currentFrame * horizontalSpeed * 0.6f) * maxHorizontalOffset * 0.5f; // Un poco menos en Z
+    if (!bench.headless) lastFrame = (GLfloat)glfwGetTime();
+    if (!gCaptureOpts.path.empty()) StartCapture();
 
-            // Posición final
-            glm::vec3 finalPos = basePos + glm::vec3(xMove, yOffset, zMove);
+    // Reloj fijo (un paso por frame) sin ventana y al repetir o seguir un recorrido:
+    // todas las corridas simulan y muestran exactamente lo mismo
+    const bool fixedClock = bench.headless || gInputMode != INPUT_LIVE;
+    bool pathDone = false;
+    bool posterOk = false;
 
+    while (!pathDone && (bench.headless ? frameIndex < totalFrames : !glfwWindowShouldClose(window))) {
+        Clock::time_point cpuStart = Clock::now();
 
-            glm::mat4 MBall(1.0f);
-            MBall = glm::translate(MBall, finalPos);
-            MBall = glm::scale(MBall, glm::vec3(ballScale));
+        if (!bench.headless) glfwPollEvents();
 
-            glUniformMatrix4fv(glGetUniformLocation(gProg, "model"), 1, GL_FALSE, glm::value_ptr(MBall));
+        double frameTime = gSim.GetStep();
+        if (!fixedClock) {
+            GLfloat frameStart = (GLfloat)glfwGetTime();
+            deltaTime = frameStart - lastFrame; lastFrame = frameStart;
+            frameTime = deltaTime;
+        }
 
-            glBindVertexArray(gVAOSphere);
-            glDrawArrays(GL_TRIANGLES, 0, gSphereVerts);
+        // Actualización a paso fijo; el render sólo interpola entre los dos últimos pasos
+        gSim.Advance(frameTime, SimulationTick);
+        if (gInputMode == INPUT_REPLAY) pathDone = gReplayTick >= gReplay.Size();
+        if (gInputMode == INPUT_FLYOVER) pathDone = gSim.GetCurrent().time >= gFlyOver.GetDuration();
 
-            glBindVertexArray(0);
-            glUseProgram(0);
-        }
+        FrameInputs in;
+        in.sim = gSim.Interpolated();
+        in.projection = projection;
+        in.fullProjection = projection;
+        in.view = camera.GetViewMatrix(in.sim.cameraPos, in.sim.cameraYaw, in.sim.cameraPitch);
 
+        float t = fmodf((float)in.sim.time / cycleSeconds, 1.0f);
+        float az = t * 6.2831853f;
+        float el = sinf(az) * 0.8f;
+        float ce = cosf(el), se = sinf(el);
+        in.sunDir = glm::normalize(glm::vec3(ce * cosf(az), se, ce * sinf(az)));
+        in.sun = 0.5f + 0.5f * se;
 
+        // === para fuego ===
+        in.fireOn = in.sim.fireOn;
+        in.fireColor = glm::vec3(0.0f);
+        in.fireFlicker = 1.0f;
+        if (in.fireOn) {
+            in.fireFlicker = in.sim.fireFlicker;
+            in.fireColor = glm::vec3(1.0f, 0.45f, 0.1f) * in.fireFlicker * 2.5f; // Intensidad 2.5
+        }
+        in.firePos = gCampPos + glm::vec3(0.0f, 0.2f, 0.0f);
+
+        // === luces puntuales: fogata y braseros (éstos se prenden al anochecer) ===
+        in.braziers = 1.0f - glm::smoothstep(0.15f, 0.35f, in.sun);
+        in.lights.clear();
+        if (in.fireOn) in.lights.push_back({ in.firePos, 25.0f, in.fireColor });
+        if (in.braziers > 0.0f) {
+            for (int i = 0; i < (int)gBraziers.size(); ++i) {
+                float k = in.braziers * BrazierFlicker(i, (float)in.sim.time) * 1.8f;
+                in.lights.push_back({ gBraziers[i] + glm::vec3(0.0f, 1.7f, 0.0f), 10.0f, glm::vec3(1.0f, 0.5f, 0.15f) * k });
+            }
+        }
+
+        // Los trabajadores preparan este frame mientras aquí se dibuja el anterior
+        gPipeline.Submit(in);
 
+        glClearColor(0.05f, 0.05f, 0.06f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+        // Se mide a partir del primer frame reproducido después del calentamiento
+        const bool measured = bench.headless && frameIndex > bench.warmup;
+        RenderStats frameStats;
+
+        if (const FramePipeline<FrameInputs>::Packet* pkt = gPipeline.Acquire(1)) {
+            if (measured) gpuTimer.Begin();
+            ReplayFrame(*pkt, shader, shadowDepth, deferredLight, deferredResolve, frameStats);
+            if (measured) gpuTimer.End();
+            gPipeline.Release();
+            // Sólo encola la copia; se lee y se codifica unos frames después
+            gCapture.Capture(bench.headless ? target.GetFramebuffer() : 0);
+        }
 
         glUseProgram(0);
-        glfwSwapBuffers(window);
+        if (posterMode && frameIndex == bench.warmup) {
+            posterOk = RenderPoster(poster, in, target.GetFramebuffer(), shader, shadowDepth, deferredLight, deferredResolve);
+            break;
+        }
+        if (bench.headless) {
+            if (measured) {
+                cpuMs.push_back(std::chrono::duration<double, std::milli>(Clock::now() - cpuStart).count());
+                benchStats.draws += frameStats.draws;
+                benchStats.triangles += frameStats.triangles;
+            }
+        }
+        else {
+            glfwSwapBuffers(window);
+        }
+        ++frameIndex;
+    }
+
+    gPipeline.Stop();
+    StopCapture();
+
+    if (gRecordInput && gRecord.Save(pathOpts.record))
+        std::cerr << "Recorded " << gRecord.Size() << " steps to " << pathOpts.record << "\n";
+    if (gInputMode == INPUT_REPLAY)
+        std::cerr << "Replay: " << gReplayTick << " steps, maximum camera drift " << gReplayDrift << "\n";
+
+    if (posterMode) {
+        target.Destroy();
+        offscreen.Destroy();
+        return posterOk ? 0 : EXIT_FAILURE;
+    }
+    if (bench.headless) {
+        gpuTimer.Drain();
+        WriteBenchmarkReport(bench, offscreen.GetBackend(), cpuMs, gpuTimer.GetResults(), benchStats, (int)cpuMs.size());
+        target.Destroy();
+        offscreen.Destroy();
+        return 0;
     }
 
     glfwTerminate();
@@ -1810,28 +2208,239 @@ int main() {
 // ===========================================================
 // Input
 // ===========================================================
-void DoMovement() {
-    // Cámara
-    if (keys[GLFW_KEY_W] || keys[GLFW_KEY_UP])    camera.ProcessKeyboard(FORWARD, deltaTime);
-    if (keys[GLFW_KEY_S] || keys[GLFW_KEY_DOWN])  camera.ProcessKeyboard(BACKWARD, deltaTime);
-    if (keys[GLFW_KEY_A] || keys[GLFW_KEY_LEFT])  camera.ProcessKeyboard(LEFT, deltaTime);
-    if (keys[GLFW_KEY_D] || keys[GLFW_KEY_RIGHT]) camera.ProcessKeyboard(RIGHT, deltaTime);
+// Teclas sostenidas en el momento del paso
+uint32_t SampleButtons() {
+    uint32_t b = 0;
+    if (keys[GLFW_KEY_W] || keys[GLFW_KEY_UP])    b |= INPUT_FORWARD;
+    if (keys[GLFW_KEY_S] || keys[GLFW_KEY_DOWN])  b |= INPUT_BACKWARD;
+    if (keys[GLFW_KEY_A] || keys[GLFW_KEY_LEFT])  b |= INPUT_LEFT;
+    if (keys[GLFW_KEY_D] || keys[GLFW_KEY_RIGHT]) b |= INPUT_RIGHT;
+    if (keys[GLFW_KEY_G])                         b |= INPUT_WHEEL_FORWARD;
+    if (keys[GLFW_KEY_H])                         b |= INPUT_WHEEL_BACKWARD;
+    return b;
+}
 
+void DoMovement(SimState& state, const TickInput& input, GLfloat dt) {
+    // Cámara (la pose vive en el estado; Camera sólo hace las cuentas)
+    camera.SetPosition(state.cameraPos);
+    camera.SetOrientation(state.cameraYaw, state.cameraPitch);
+    if (input.mouseX != 0.0f || input.mouseY != 0.0f) camera.ProcessMouseMovement(input.mouseX, input.mouseY);
+    if (input.buttons & INPUT_FORWARD)  camera.ProcessKeyboard(FORWARD, dt);
+    if (input.buttons & INPUT_BACKWARD) camera.ProcessKeyboard(BACKWARD, dt);
+    if (input.buttons & INPUT_LEFT)     camera.ProcessKeyboard(LEFT, dt);
+    if (input.buttons & INPUT_RIGHT)    camera.ProcessKeyboard(RIGHT, dt);
+    state.cameraPos = camera.GetPosition();
+    state.cameraYaw = camera.GetYaw();
+    state.cameraPitch = camera.GetPitch();
 
+    // Carretilla (G = adelante, H = atrás)
+    if (input.buttons & INPUT_WHEEL_FORWARD) {
+        state.wheelPos.z -= 5.0f * dt;  // hacia adelante en cámara
+    }
 
+    if (input.buttons & INPUT_WHEEL_BACKWARD) {
+        state.wheelPos.z += 5.0f * dt;  // hacia atrás
+    }
 
-    // Carretilla (G = adelante, H = atrás)
-    float vel = 5.0f * deltaTime;
+    // Fogata (F)
+    if (input.fireToggles & 1u) {
+        state.fireOn = !state.fireOn;
+    }
+}
 
-    if (keys[GLFW_KEY_G]) {
-        gWheelPos.z -= 5.0f * deltaTime;  // hacia adelante en cámara
+// ===========================================================
+// Recorridos de cámara
+// ===========================================================
+// Un paso de simulación: toma la entrada (en vivo, grabada o ninguna en un recorrido),
+// avanza el estado y, con --record, guarda la entrada y la pose resultante
+void SimulationTick(SimState& state, float dt) {
+    TickInput input;
+    if (gInputMode == INPUT_LIVE) {
+        input = gLiveInput;
+        input.buttons = SampleButtons();
+    }
+    else if (gInputMode == INPUT_REPLAY && gReplayTick < gReplay.Size()) {
+        input = gReplay.Get(gReplayTick).input;
+    }
+    gLiveInput = TickInput();
+
+    UpdateSimulation(state, input, dt);
+
+    if (gInputMode == INPUT_REPLAY && gReplayTick < gReplay.Size()) {
+        // La pose grabada manda; lo que se aleja de ella la recalculada indica que algo dejó de ser determinista
+        const CameraPose& pose = gReplay.Get(gReplayTick).pose;
+        gReplayDrift = std::max(gReplayDrift, glm::distance(pose.position, state.cameraPos));
+        state.cameraPos = pose.position;
+        state.cameraYaw = pose.yaw;
+        state.cameraPitch = pose.pitch;
+        ++gReplayTick;
     }
+    ApplyScriptedPose(state);
+
+    if (gRecordInput) {
+        RecordedTick tick;
+        tick.time = state.time;
+        tick.input = input;
+        tick.pose.position = state.cameraPos;
+        tick.pose.yaw = state.cameraYaw;
+        tick.pose.pitch = state.cameraPitch;
+        gRecord.Append(tick);
+    }
+}
 
-    if (keys[GLFW_KEY_H]) {
-        gWheelPos.z += 5.0f * deltaTime;  // hacia atrás
+// Con --flyover la cámara sigue el recorrido según el tiempo simulado
+void ApplyScriptedPose(SimState& state) {
+    if (gInputMode != INPUT_FLYOVER) return;
+    CameraPose pose = gFlyOver.Evaluate(state.time);
+    state.cameraPos = pose.position;
+    state.cameraYaw = UnwrapDegrees(pose.yaw, state.cameraYaw);
+    state.cameraPitch = pose.pitch;
+}
+
+// Recorridos predefinidos (ojo, punto al que mira) para benchmarks repetibles
+bool BuildFlyOver(const std::string& name, FlyOver& path) {
+    // Vuelta al tianguis y pasada junto a la mesa y la fogata
+    FlyOver tianguis;
+    tianguis.AddKey(0.0, glm::vec3(0.0f, 1.6f, 6.0f), glm::vec3(0.0f, 1.6f, -1.0f));
+    tianguis.AddKey(4.0, glm::vec3(14.0f, 4.0f, 10.0f), glm::vec3(0.0f, 1.0f, -2.0f));
+    tianguis.AddKey(8.0, glm::vec3(22.0f, 6.0f, -8.0f), glm::vec3(0.0f, 1.0f, -2.0f));
+    tianguis.AddKey(12.0, glm::vec3(6.0f, 6.0f, -24.0f), glm::vec3(0.0f, 1.0f, -2.0f));
+    tianguis.AddKey(16.0, glm::vec3(-16.0f, 5.0f, -18.0f), glm::vec3(0.0f, 1.0f, -2.0f));
+    tianguis.AddKey(20.0, glm::vec3(-20.0f, 4.0f, 4.0f), glm::vec3(0.0f, 1.0f, -2.0f));
+    tianguis.AddKey(24.0, glm::vec3(-5.0f, 2.2f, -1.0f), gTablePos + glm::vec3(0.0f, 0.8f, 0.0f));
+    tianguis.AddKey(28.0, glm::vec3(3.0f, 1.8f, -3.0f), gCampPos + glm::vec3(0.0f, 0.4f, 0.0f));
+
+    // Pirámide cercana, Pirámide del Sol y Tula
+    FlyOver piramides;
+    piramides.AddKey(0.0, glm::vec3(30.0f, 10.0f, 10.0f), glm::vec3(85.0f, 6.0f, -30.0f));
+    piramides.AddKey(5.0, glm::vec3(70.0f, 14.0f, 5.0f), glm::vec3(85.0f, 6.0f, -30.0f));
+    piramides.AddKey(10.0, glm::vec3(115.0f, 16.0f, -40.0f), glm::vec3(85.0f, 6.0f, -30.0f));
+    piramides.AddKey(16.0, glm::vec3(70.0f, 22.0f, -100.0f), glm::vec3(25.0f, 10.0f, -140.0f));
+    piramides.AddKey(22.0, glm::vec3(5.0f, 24.0f, -105.0f), glm::vec3(25.0f, 10.0f, -140.0f));
+    piramides.AddKey(28.0, glm::vec3(-30.0f, 14.0f, -70.0f), glm::vec3(-60.0f, 4.0f, -95.0f));
+    piramides.AddKey(34.0, glm::vec3(-85.0f, 12.0f, -75.0f), glm::vec3(-60.0f, 4.0f, -95.0f));
+
+    // Cinturón izquierdo de árboles/cactus, maizal y cinturón derecho, a baja altura
+    FlyOver vegetacion;
+    vegetacion.AddKey(0.0, glm::vec3(-70.0f, 5.0f, -70.0f), glm::vec3(-115.0f, 2.0f, -115.0f));
+    vegetacion.AddKey(6.0, glm::vec3(-115.0f, 6.0f, -78.0f), glm::vec3(-115.0f, 2.0f, -160.0f));
+    vegetacion.AddKey(12.0, glm::vec3(-118.0f, 6.0f, -150.0f), glm::vec3(-40.0f, 2.0f, -150.0f));
+    vegetacion.AddKey(18.0, glm::vec3(-30.0f, 5.0f, -115.0f), glm::vec3(0.0f, 1.0f, -150.0f));
+    vegetacion.AddKey(24.0, glm::vec3(20.0f, 5.0f, -185.0f), glm::vec3(80.0f, 2.0f, -150.0f));
+    vegetacion.AddKey(30.0, glm::vec3(85.0f, 6.0f, -158.0f), glm::vec3(115.0f, 2.0f, -115.0f));
+    vegetacion.AddKey(36.0, glm::vec3(118.0f, 6.0f, -80.0f), glm::vec3(115.0f, 2.0f, -40.0f));
+
+    path.Clear();
+    if (name == "tianguis") path.Append(tianguis, 0.0);
+    else if (name == "piramides") path.Append(piramides, 0.0);
+    else if (name == "vegetacion") path.Append(vegetacion, 0.0);
+    else if (name == "todo") {
+        path.Append(tianguis, 0.0);
+        path.Append(piramides, 6.0);
+        path.Append(vegetacion, 6.0);
     }
+    return !path.Empty();
 }
 
+// ===========================================================
+// Simulación (paso fijo, ver Simulation.h)
+// ===========================================================
+void UpdateSimulation(SimState& state, const TickInput& input, float dt) {
+    DoMovement(state, input, dt);
+
+    const float t = (float)state.time;
+
+    // ---- Perrito: trayecto circular amplio lejos de la mesa
+    {
+        // Posición base alejada (ajusta a gusto)
+        const float x0 = gTablePos.x + 12.0f;  // derecha de la mesa
+        const float z0 = gTablePos.z + 8.0f;   // al frente de la mesa
+        const float y0 = 0.0f;
+
+        // Dirección/sentido
+        const float yaw0Deg = 90.0f;            // perro mirando +X
+        const float MODEL_FORWARD_SIGN = +1.0f; // si parece ir en reversa, usa -1.0f
+
+        // Giro
+        const float v = 0.9f;                // velocidad lineal
+        const float wDeg = 15.0f;               // °/s -> radio amplio (baja más para círculo mayor)
+        const float w = glm::radians(wDeg);
+
+        // Orientación actual
+        state.dogYaw = yaw0Deg + wDeg * t * MODEL_FORWARD_SIGN;
+
+        // Trayectoria circular (modelo unicycle exacto)
+        const float yaw0 = glm::radians(yaw0Deg);
+        const float R = (w != 0.0f) ? (v / w) : 0.0f;
+
+        float x = x0, z = z0;
+        if (w != 0.0f) {
+            x = x0 + R * (std::sin(yaw0 + w * t) - std::sin(yaw0));
+            z = z0 + R * (-std::cos(yaw0 + w * t) + std::cos(yaw0));
+        }
+        else {
+            x = x0 + v * std::cos(yaw0) * t;
+            z = z0 + v * std::sin(yaw0) * t;
+        }
+
+        state.dogPos = glm::vec3(x, y0 + 0.02f * std::sin(t * 6.0f), z);   // rebote suave
+    }
+
+    // ---- Pelota rebotando
+    {
+        const glm::vec3 basePos(45.0f, 0.0f, 15.0f);
+        const float ballScale = 2.0f;
+        const float bounceHeight = 3.8f;       // Altura máxima del rebote (para que alcance el aro)
+        const float bounceFrequency = 3.0f;    // Frecuencia del rebote (más alto = más rápido)
+        const float horizontalSpeed = 0.8f;    // Velocidad de movimiento horizontal
+        const float maxHorizontalOffset = 3.0f; // Máximo desplazamiento horizontal
+
+        // Cálculo del rebote vertical (va de 0 a 1)
+        float bounceFactor = std::abs(std::sin(t * bounceFrequency));
+
+        // Altura vertical de la pelota: basePos.y + offset por rebote + mitad de la escala (para que su base toque el suelo)
+        float yOffset = bounceFactor * bounceHeight + (ballScale * 0.5f);
+
+        float xMove = std::sin(t * horizontalSpeed * 0.7f) * maxHorizontalOffset;
+        float zMove = std::cos(t * horizontalSpeed * 0.6f) * maxHorizontalOffset * 0.5f; // Un poco menos en Z
+
+        state.ballPos = basePos + glm::vec3(xMove, yOffset, zMove);
+    }
+
+    // ---- Hacha: golpe
+    {
+        float s = (sin(t * 3.0f) + 1.0f) * 0.5f;   // 0..1
+        float angDeg = -20.0f - 30.0f * s;         // de -20° a -50° (menos exagerado)
+        state.axeAngle = glm::radians(angDeg);
+    }
+
+    // ---- Fogata: parpadeo y altura de las 3 flamas
+    state.fireFlicker = 0.85f + 0.25f * sinf(t * 7.0f);
+    state.flameHeight[0] = 0.85f + 0.08f * sinf(t * 3.4f);
+    state.flameHeight[1] = 0.70f + 0.07f * sinf(t * 4.1f + 1.2f);
+    state.flameHeight[2] = 0.60f + 0.06f * sinf(t * 5.0f + 2.1f);
+}
+
+// ===========================================================
+// Captura de frames
+// ===========================================================
+void StartCapture() {
+    if (gCaptureOpts.path.empty()) gCaptureOpts.path = "Capturas";
+    long long first = gCapture.GetFrameCount();
+    if (!gCapture.Start(gCaptureOpts, SCREEN_WIDTH, SCREEN_HEIGHT)) return;
+    std::cerr << "Capture: " << gCaptureOpts.path << " from frame " << first << "\n";
+}
+
+void StopCapture() {
+    if (!gCapture.IsActive()) return;
+    gCapture.Stop();
+    std::cerr << "Capture: " << gCapture.GetWrittenCount() << " frames to " << gCaptureOpts.path
+        << "; rendering waited " << gCapture.GetWaitMs() << " ms (ring full " << gCapture.GetRingWaits()
+        << " times, encoders " << gCapture.GetEncoderWaits() << " times)\n";
+    if (gCaptureOpts.format == CaptureFormat::Raw)
+        std::cerr << "  ffmpeg -f rawvideo -pix_fmt rgb24 -s " << SCREEN_WIDTH << "x" << SCREEN_HEIGHT
+            << " -r " << (int)std::round(1.0 / gSim.GetStep()) << " -i " << gCaptureOpts.path << " video.mp4\n";
+}
 
 void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mode) {
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
@@ -1839,7 +2448,21 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mode
 
 
     if (key == GLFW_KEY_F && action == GLFW_PRESS) {
-        gFireOn = !gFireOn;
+        gLiveInput.fireToggles++;   // se aplica en el siguiente paso de simulación
+    }
+
+    // Alterna entre sombreado forward y diferido para comparar tiempos
+    if (key == GLFW_KEY_L && action == GLFW_PRESS) {
+        if (!gDeferred && !gDeferredShading.IsCreated())
+            gDeferredShading.Create(SCREEN_WIDTH, SCREEN_HEIGHT);
+        gDeferred = !gDeferred && gDeferredShading.IsCreated();
+        std::cerr << "Shading: " << (gDeferred ? "deferred" : "forward") << std::endl;
+    }
+
+    // Empieza o termina la captura de frames
+    if (key == GLFW_KEY_F9 && action == GLFW_PRESS) {
+        if (gCapture.IsActive()) StopCapture();
+        else StartCapture();
     }
 
 
@@ -1864,5 +2487,7 @@ void MouseCallback(GLFWwindow* window, double xPos, double yPos)
     lastX = (GLfloat)xPos;
     lastY = (GLfloat)yPos;
 
-    camera.ProcessMouseMovement(xOffset, yOffset);
+    // Se acumula hasta el siguiente paso de simulación (ver SimulationTick)
+    gLiveInput.mouseX += xOffset;
+    gLiveInput.mouseY += yOffset;
 }
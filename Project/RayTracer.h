@@ -0,0 +1,875 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// GL Includes
+#include <glm/glm.hpp>
+
+#include "InstanceKernels.h"
+#include "Parallel.h"
+
+struct RayHit
+{
+	float t;			// Distance along the (normalized) direction
+	uint32_t triangle;	// Index in the order triangles were added, TriangleBVH::NO_HIT when nothing was hit
+	float u, v;			// Barycentrics of vertices 1 and 2
+};
+
+// Rays traced together, one per SIMD lane. Lanes with tMax < 0 are inactive.
+// Packets pay off when the rays are coherent: a shared origin (AO, soft shadows) or a screen tile.
+struct RayPacket
+{
+#if defined(INSTANCE_USE_AVX)
+	static const int SIZE = 8;
+#else
+	static const int SIZE = 4;
+#endif
+	float ox[SIZE], oy[SIZE], oz[SIZE];
+	float dx[SIZE], dy[SIZE], dz[SIZE];
+	float tMax[SIZE];
+
+	void Set(int lane, const glm::vec3 &origin, const glm::vec3 &direction, float tMax)
+	{
+		this->ox[lane] = origin.x;
+		this->oy[lane] = origin.y;
+		this->oz[lane] = origin.z;
+		this->dx[lane] = direction.x;
+		this->dy[lane] = direction.y;
+		this->dz[lane] = direction.z;
+		this->tMax[lane] = tMax;
+	}
+};
+
+// Bounding volume hierarchy over world-space triangles for CPU ray queries (picking, baking, visibility).
+// Built with binned SAH, the subtrees in parallel, then collapsed to 4 children per node so one SSE
+// slab test covers all of them. Leaves are 4 triangles stored as SoA and intersected in one go.
+class TriangleBVH
+{
+public:
+	static const uint32_t NO_HIT = 0xFFFFFFFFu;
+
+	void Clear()
+	{
+		this->triangles.clear();
+		this->nodes.clear();
+		this->packs.clear();
+	}
+
+	void AddTriangle(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c)
+	{
+		Triangle t;
+		t.v0 = a;
+		t.e1 = b - a;
+		t.e2 = c - a;
+		this->triangles.push_back(t);
+	}
+
+	void Build()
+	{
+		this->nodes.clear();
+		this->packs.clear();
+		const uint32_t n = (uint32_t)this->triangles.size();
+		if (n == 0)
+		{
+			return;
+		}
+
+		std::vector<Prim> prims(n);
+		std::vector<uint32_t> order(n);
+		ParallelFor(0, (int)n, [&](int i)
+		{
+			const Triangle &t = this->triangles[i];
+			glm::vec3 b = t.v0 + t.e1, c = t.v0 + t.e2;
+			prims[i].min = glm::min(t.v0, glm::min(b, c));
+			prims[i].max = glm::max(t.v0, glm::max(b, c));
+			prims[i].centroid = (prims[i].min + prims[i].max) * 0.5f;
+			order[i] = (uint32_t)i;
+		}, 4096);
+
+		// The top of the tree on this thread until the ranges are small enough to hand out
+		std::vector<BuildNode> tree(1);
+		std::vector<Task> tasks;
+		uint32_t grain = std::max<uint32_t>(1024, n / (WorkerCount() * 4));
+		split(prims, order, tree, 0, 0, n, 0, grain, &tasks);
+
+		std::vector<std::vector<BuildNode>> subtrees(tasks.size());
+		ParallelFor(0, (int)tasks.size(), [&](int k)
+		{
+			subtrees[k].resize(1);
+			split(prims, order, subtrees[k], 0, tasks[k].begin, tasks[k].end, tasks[k].depth, 0, nullptr);
+		});
+
+		// Splice the subtrees in: their local node i (> 0) lands at base + i
+		for (size_t k = 0; k < tasks.size(); k++)
+		{
+			uint32_t base = (uint32_t)tree.size() - 1;
+			for (size_t i = 0; i < subtrees[k].size(); i++)
+			{
+				BuildNode node = subtrees[k][i];
+				if (node.count == 0)
+				{
+					node.left += base;
+				}
+				if (i == 0)
+				{
+					tree[tasks[k].node] = node;
+				}
+				else
+				{
+					tree.push_back(node);
+				}
+			}
+		}
+
+		this->nodes.reserve(tree.size() / 2 + 1);
+		this->packs.reserve(n / 2 + 1);
+		this->collapse(tree, order, 0);
+	}
+
+	// Closest hit closer than tMax
+	bool Intersect(const glm::vec3 &origin, const glm::vec3 &direction, float tMax, RayHit &hit) const
+	{
+		return this->traverse<false>(origin, direction, tMax, &hit);
+	}
+
+	// Any hit closer than tMax, for shadow and occlusion rays
+	bool Occluded(const glm::vec3 &origin, const glm::vec3 &direction, float tMax) const
+	{
+		return this->traverse<true>(origin, direction, tMax, nullptr);
+	}
+
+	// Closest hit of every lane. On return packet.tMax holds the hit distances (unchanged on a miss);
+	// the result has a bit set for each lane that hit.
+	int IntersectPacket(RayPacket &packet, RayHit hits[RayPacket::SIZE]) const
+	{
+#if defined(INSTANCE_USE_AVX)
+		return this->traversePacket<InstanceKernels::F8>(packet, hits);
+#elif defined(INSTANCE_USE_SSE)
+		return this->traversePacket<InstanceKernels::F4>(packet, hits);
+#else
+		int mask = 0;
+		for (int l = 0; l < RayPacket::SIZE; l++)
+		{
+			hits[l].triangle = NO_HIT;
+			if (packet.tMax[l] >= 0.0f && this->Intersect(glm::vec3(packet.ox[l], packet.oy[l], packet.oz[l]),
+				glm::vec3(packet.dx[l], packet.dy[l], packet.dz[l]), packet.tMax[l], hits[l]))
+			{
+				packet.tMax[l] = hits[l].t;
+				mask |= 1 << l;
+			}
+		}
+		return mask;
+#endif
+	}
+
+	size_t GetTriangleCount() const
+	{
+		return this->triangles.size();
+	}
+
+	size_t GetNodeCount() const
+	{
+		return this->nodes.size();
+	}
+
+	void GetBounds(glm::vec3 &min, glm::vec3 &max) const
+	{
+		min = glm::vec3(FLT_MAX);
+		max = glm::vec3(-FLT_MAX);
+		if (this->nodes.empty())
+		{
+			return;
+		}
+		const Node &root = this->nodes[0];
+		for (int k = 0; k < 4; k++)
+		{
+			for (int a = 0; a < 3; a++)
+			{
+				min[a] = std::min(min[a], root.bounds[0][a][k]);
+				max[a] = std::max(max[a], root.bounds[1][a][k]);
+			}
+		}
+	}
+
+private:
+	static const uint32_t LEAF_SIZE = 4;	// One triangle pack
+	static const int BINS = 12;
+	static const int MEDIAN_DEPTH = 48;		// Past this the SAH gives up and halves, which bounds the depth
+	static const int STACK_SIZE = 256;		// 3 per level of a 4-wide tree
+
+	struct Triangle
+	{
+		glm::vec3 v0, e1, e2;
+	};
+
+	struct Prim
+	{
+		glm::vec3 min, max, centroid;
+	};
+
+	struct BuildNode
+	{
+		glm::vec3 min, max;
+		uint32_t left;		// Inner node: left child, the right one is next to it
+		uint32_t first;		// Leaf: first entry of the triangle order
+		uint32_t count;		// 0 for inner nodes
+	};
+
+	struct Task
+	{
+		uint32_t node, begin, end;
+		int depth;
+	};
+
+	// Four children as SoA: bounds[0] = min, bounds[1] = max, then axis, then child.
+	// child > 0: inner node; < 0: ~pack index; 0 (the root, never a child): empty slot, whose
+	// inverted bounds miss every ray.
+	struct Node
+	{
+		float bounds[2][3][4];
+		int32_t child[4];
+	};
+
+	// Four triangles as SoA; unused lanes have zero edges, which the determinant test rejects
+	struct Pack
+	{
+		float v0[3][4], e1[3][4], e2[3][4];
+		uint32_t id[4];
+	};
+
+	std::vector<Triangle> triangles;
+	std::vector<Node> nodes;
+	std::vector<Pack> packs;
+
+	static float halfArea(const glm::vec3 &min, const glm::vec3 &max)
+	{
+		glm::vec3 e = glm::max(max - min, glm::vec3(0.0f));
+		return e.x * e.y + e.y * e.z + e.z * e.x;
+	}
+
+	static void split(const std::vector<Prim> &prims, std::vector<uint32_t> &order, std::vector<BuildNode> &tree,
+		uint32_t index, uint32_t begin, uint32_t end, int depth, uint32_t grain, std::vector<Task> *tasks)
+	{
+		glm::vec3 bmin(FLT_MAX), bmax(-FLT_MAX), cmin(FLT_MAX), cmax(-FLT_MAX);
+		for (uint32_t i = begin; i < end; i++)
+		{
+			const Prim &p = prims[order[i]];
+			bmin = glm::min(bmin, p.min);
+			bmax = glm::max(bmax, p.max);
+			cmin = glm::min(cmin, p.centroid);
+			cmax = glm::max(cmax, p.centroid);
+		}
+		tree[index].min = bmin;
+		tree[index].max = bmax;
+
+		const uint32_t count = end - begin;
+		if (count <= LEAF_SIZE)
+		{
+			tree[index].first = begin;
+			tree[index].count = count;
+			return;
+		}
+		if (tasks != nullptr && count <= grain)
+		{
+			Task task = { index, begin, end, depth };
+			tasks->push_back(task);
+			return;
+		}
+
+		// Binned SAH: centroids into BINS slots per axis, cheapest boundary between two slots
+		int bestAxis = -1, bestBin = 0;
+		float bestCost = FLT_MAX;
+		glm::vec3 extent = cmax - cmin;
+		for (int axis = 0; axis < 3 && depth < MEDIAN_DEPTH; axis++)
+		{
+			if (extent[axis] <= 0.0f)
+			{
+				continue;
+			}
+			float scale = BINS / extent[axis];
+			glm::vec3 binMin[BINS], binMax[BINS];
+			uint32_t binCount[BINS] = {};
+			for (int b = 0; b < BINS; b++)
+			{
+				binMin[b] = glm::vec3(FLT_MAX);
+				binMax[b] = glm::vec3(-FLT_MAX);
+			}
+			for (uint32_t i = begin; i < end; i++)
+			{
+				const Prim &p = prims[order[i]];
+				int b = std::min(BINS - 1, (int)((p.centroid[axis] - cmin[axis]) * scale));
+				binMin[b] = glm::min(binMin[b], p.min);
+				binMax[b] = glm::max(binMax[b], p.max);
+				binCount[b]++;
+			}
+
+			float rightArea[BINS];
+			uint32_t rightCount[BINS];
+			glm::vec3 rmin(FLT_MAX), rmax(-FLT_MAX);
+			uint32_t n = 0;
+			for (int b = BINS - 1; b > 0; b--)
+			{
+				rmin = glm::min(rmin, binMin[b]);
+				rmax = glm::max(rmax, binMax[b]);
+				n += binCount[b];
+				rightArea[b] = halfArea(rmin, rmax);
+				rightCount[b] = n;
+			}
+			glm::vec3 lmin(FLT_MAX), lmax(-FLT_MAX);
+			n = 0;
+			for (int b = 0; b < BINS - 1; b++)
+			{
+				lmin = glm::min(lmin, binMin[b]);
+				lmax = glm::max(lmax, binMax[b]);
+				n += binCount[b];
+				if (n == 0 || rightCount[b + 1] == 0)
+				{
+					continue;
+				}
+				float cost = n * halfArea(lmin, lmax) + rightCount[b + 1] * rightArea[b + 1];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = b;
+				}
+			}
+		}
+
+		uint32_t *first = &order[0];
+		uint32_t m = begin;
+		if (bestAxis >= 0)
+		{
+			float scale = BINS / extent[bestAxis];
+			m = (uint32_t)(std::partition(first + begin, first + end, [&](uint32_t i)
+			{
+				return std::min(BINS - 1, (int)((prims[i].centroid[bestAxis] - cmin[bestAxis]) * scale)) <= bestBin;
+			}) - first);
+		}
+		if (m == begin || m == end)
+		{
+			// Too deep, or every centroid in one spot: half the triangles each way
+			int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+			m = begin + count / 2;
+			std::nth_element(first + begin, first + m, first + end,
+				[&](uint32_t a, uint32_t b) { return prims[a].centroid[axis] < prims[b].centroid[axis]; });
+		}
+
+		uint32_t left = (uint32_t)tree.size();
+		tree.resize(tree.size() + 2);
+		tree[index].left = left;
+		tree[index].count = 0;
+		split(prims, order, tree, left, begin, m, depth + 1, grain, tasks);
+		split(prims, order, tree, left + 1, m, end, depth + 1, grain, tasks);
+	}
+
+	// Pulls grandchildren up (largest first) until a node has 4 children or only leaves below
+	int32_t collapse(const std::vector<BuildNode> &tree, const std::vector<uint32_t> &order, uint32_t b)
+	{
+		uint32_t index = (uint32_t)this->nodes.size();
+		Node empty;
+		for (int k = 0; k < 4; k++)
+		{
+			for (int a = 0; a < 3; a++)
+			{
+				empty.bounds[0][a][k] = FLT_MAX;
+				empty.bounds[1][a][k] = -FLT_MAX;
+			}
+			empty.child[k] = 0;
+		}
+		this->nodes.push_back(empty);
+
+		uint32_t kids[4];
+		int n = 0;
+		if (tree[b].count > 0)
+		{
+			kids[n++] = b;		// The whole tree is one leaf
+		}
+		else
+		{
+			kids[n++] = tree[b].left;
+			kids[n++] = tree[b].left + 1;
+			while (n < 4)
+			{
+				int best = -1;
+				float bestArea = -1.0f;
+				for (int k = 0; k < n; k++)
+				{
+					const BuildNode &c = tree[kids[k]];
+					float area = halfArea(c.min, c.max);
+					if (c.count == 0 && area > bestArea)
+					{
+						best = k;
+						bestArea = area;
+					}
+				}
+				if (best < 0)
+				{
+					break;
+				}
+				uint32_t left = tree[kids[best]].left;
+				kids[best] = left;
+				kids[n++] = left + 1;
+			}
+		}
+
+		for (int k = 0; k < n; k++)
+		{
+			const BuildNode &c = tree[kids[k]];
+			int32_t child = c.count > 0 ? ~this->pack(order, c.first, c.count) : this->collapse(tree, order, kids[k]);
+			Node &node = this->nodes[index];
+			for (int a = 0; a < 3; a++)
+			{
+				node.bounds[0][a][k] = c.min[a];
+				node.bounds[1][a][k] = c.max[a];
+			}
+			node.child[k] = child;
+		}
+		return (int32_t)index;
+	}
+
+	int32_t pack(const std::vector<uint32_t> &order, uint32_t first, uint32_t count)
+	{
+		Pack p;
+		std::memset(&p, 0, sizeof(p));
+		for (int k = 0; k < 4; k++)
+		{
+			p.id[k] = NO_HIT;
+		}
+		for (uint32_t k = 0; k < count; k++)
+		{
+			uint32_t id = order[first + k];
+			const Triangle &t = this->triangles[id];
+			for (int a = 0; a < 3; a++)
+			{
+				p.v0[a][k] = t.v0[a];
+				p.e1[a][k] = t.e1[a];
+				p.e2[a][k] = t.e2[a];
+			}
+			p.id[k] = id;
+		}
+		this->packs.push_back(p);
+		return (int32_t)this->packs.size() - 1;
+	}
+
+	// Slab test of one ray against the 4 children. Near planes are picked by the direction's sign,
+	// so an empty slot (min > max) always misses. Returns a bit per child hit, tNear per child.
+	static int hitChildren(const Node &n, const glm::vec3 &origin, const glm::vec3 &invDir, const int sign[3], float tMax, float tNear[4])
+	{
+#ifdef INSTANCE_USE_SSE
+		using InstanceKernels::F4;
+		F4 t0 = F4(0.0f), t1 = F4(tMax);
+		for (int a = 0; a < 3; a++)
+		{
+			F4 o(origin[a]), inv(invDir[a]);
+			t0 = InstanceKernels::Max(t0, (F4::Load(n.bounds[sign[a]][a]) - o) * inv);
+			t1 = InstanceKernels::Min(t1, (F4::Load(n.bounds[1 - sign[a]][a]) - o) * inv);
+		}
+		InstanceKernels::Store(tNear, t0);
+		return InstanceKernels::MoveMask(InstanceKernels::GreaterEqual(t1, t0));
+#else
+		int mask = 0;
+		for (int k = 0; k < 4; k++)
+		{
+			float t0 = 0.0f, t1 = tMax;
+			for (int a = 0; a < 3; a++)
+			{
+				t0 = std::max(t0, (n.bounds[sign[a]][a][k] - origin[a]) * invDir[a]);
+				t1 = std::min(t1, (n.bounds[1 - sign[a]][a][k] - origin[a]) * invDir[a]);
+			}
+			tNear[k] = t0;
+			mask |= (t1 >= t0) << k;
+		}
+		return mask;
+#endif
+	}
+
+	// Möller-Trumbore on the 4 triangles of a pack. Returns a bit per triangle hit in (0, tMax).
+	static int hitPack(const Pack &p, const glm::vec3 &origin, const glm::vec3 &direction, float tMax, float t[4], float u[4], float v[4])
+	{
+#ifdef INSTANCE_USE_SSE
+		using namespace InstanceKernels;
+		F4 e1x = F4::Load(p.e1[0]), e1y = F4::Load(p.e1[1]), e1z = F4::Load(p.e1[2]);
+		F4 e2x = F4::Load(p.e2[0]), e2y = F4::Load(p.e2[1]), e2z = F4::Load(p.e2[2]);
+		F4 dx(direction.x), dy(direction.y), dz(direction.z);
+		F4 px = dy * e2z - dz * e2y, py = dz * e2x - dx * e2z, pz = dx * e2y - dy * e2x;
+		F4 det = e1x * px + e1y * py + e1z * pz;
+		F4 inv = F4(1.0f) / det;
+		F4 sx = F4(origin.x) - F4::Load(p.v0[0]), sy = F4(origin.y) - F4::Load(p.v0[1]), sz = F4(origin.z) - F4::Load(p.v0[2]);
+		F4 U = (sx * px + sy * py + sz * pz) * inv;
+		F4 qx = sy * e1z - sz * e1y, qy = sz * e1x - sx * e1z, qz = sx * e1y - sy * e1x;
+		F4 V = (dx * qx + dy * qy + dz * qz) * inv;
+		F4 T = (e2x * qx + e2y * qy + e2z * qz) * inv;
+		F4 ok = And(And(GreaterEqual(Abs(det), F4(1e-12f)), And(GreaterEqual(U, F4(0.0f)), GreaterEqual(V, F4(0.0f)))),
+			And(GreaterEqual(F4(1.0f), U + V), And(Greater(T, F4(0.0f)), Greater(F4(tMax), T))));
+		Store(t, T);
+		Store(u, U);
+		Store(v, V);
+		return MoveMask(ok);
+#else
+		int mask = 0;
+		for (int k = 0; k < 4; k++)
+		{
+			glm::vec3 e1(p.e1[0][k], p.e1[1][k], p.e1[2][k]), e2(p.e2[0][k], p.e2[1][k], p.e2[2][k]);
+			glm::vec3 q = glm::cross(direction, e2);
+			float det = glm::dot(e1, q);
+			if (std::fabs(det) < 1e-12f)
+			{
+				continue;
+			}
+			float inv = 1.0f / det;
+			glm::vec3 s = origin - glm::vec3(p.v0[0][k], p.v0[1][k], p.v0[2][k]);
+			u[k] = glm::dot(s, q) * inv;
+			glm::vec3 r = glm::cross(s, e1);
+			v[k] = glm::dot(direction, r) * inv;
+			t[k] = glm::dot(e2, r) * inv;
+			mask |= (u[k] >= 0.0f && v[k] >= 0.0f && u[k] + v[k] <= 1.0f && t[k] > 0.0f && t[k] < tMax) << k;
+		}
+		return mask;
+#endif
+	}
+
+	template <bool ANY>
+	bool traverse(const glm::vec3 &origin, const glm::vec3 &direction, float tMax, RayHit *hit) const
+	{
+		if (this->nodes.empty())
+		{
+			return false;
+		}
+		const glm::vec3 invDir = 1.0f / direction;	// Infinities are fine for the slab test
+		const int sign[3] = { direction.x < 0.0f, direction.y < 0.0f, direction.z < 0.0f };
+		struct Entry
+		{
+			int32_t node;
+			float t;
+		};
+		Entry stack[STACK_SIZE];
+		int top = 0;
+		stack[top++] = Entry{ 0, 0.0f };
+		bool found = false;
+
+		while (top > 0)
+		{
+			Entry e = stack[--top];
+			if (e.t > tMax)
+			{
+				continue;	// Something closer was hit after this was pushed
+			}
+			if (e.node < 0)
+			{
+				const Pack &p = this->packs[~e.node];
+				float t[4], u[4], v[4];
+				int mask = hitPack(p, origin, direction, tMax, t, u, v);
+				if (mask == 0)
+				{
+					continue;
+				}
+				if (ANY)
+				{
+					return true;
+				}
+				for (int k = 0; k < 4; k++)
+				{
+					if ((mask >> k & 1) && t[k] < tMax)
+					{
+						found = true;
+						tMax = t[k];
+						hit->t = t[k];
+						hit->triangle = p.id[k];
+						hit->u = u[k];
+						hit->v = v[k];
+					}
+				}
+				continue;
+			}
+
+			const Node &n = this->nodes[e.node];
+			float tNear[4];
+			int mask = hitChildren(n, origin, invDir, sign, tMax, tNear);
+			// Push the far ones first so the nearest child is visited next
+			Entry hits[4];
+			int count = 0;
+			for (int k = 0; k < 4; k++)
+			{
+				if (mask >> k & 1)
+				{
+					Entry c = { n.child[k], tNear[k] };
+					int j = count++;
+					for (; j > 0 && hits[j - 1].t < c.t; j--)
+					{
+						hits[j] = hits[j - 1];
+					}
+					hits[j] = c;
+				}
+			}
+			for (int k = 0; k < count; k++)
+			{
+				stack[top++] = hits[k];
+			}
+		}
+		return found;
+	}
+
+#if defined(INSTANCE_USE_SSE)
+	// One lane per ray; a node is entered when any active lane's slab test passes
+	template <typename V>
+	int traversePacket(RayPacket &packet, RayHit hits[RayPacket::SIZE]) const
+	{
+		using namespace InstanceKernels;
+		for (int l = 0; l < RayPacket::SIZE; l++)
+		{
+			hits[l].triangle = NO_HIT;
+		}
+		if (this->nodes.empty())
+		{
+			return 0;
+		}
+		const V ox = V::Load(packet.ox), oy = V::Load(packet.oy), oz = V::Load(packet.oz);
+		const V dx = V::Load(packet.dx), dy = V::Load(packet.dy), dz = V::Load(packet.dz);
+		const V ix = V(1.0f) / dx, iy = V(1.0f) / dy, iz = V(1.0f) / dz;
+		V tMax = V::Load(packet.tMax);
+		const V zero(0.0f), one(1.0f);
+		int result = 0;
+		float farthest = FLT_MAX;	// Largest tMax of the packet, refreshed on hits
+
+		struct Entry
+		{
+			int32_t node;
+			float t;
+		};
+		Entry stack[STACK_SIZE];
+		int top = 0;
+		stack[top++] = Entry{ 0, 0.0f };
+		while (top > 0)
+		{
+			Entry e = stack[--top];
+			if (e.t > farthest)
+			{
+				continue;	// Every lane has hit something closer
+			}
+			if (e.node < 0)
+			{
+				const Pack &p = this->packs[~e.node];
+				for (int k = 0; k < 4 && p.id[k] != NO_HIT; k++)
+				{
+					V e1x(p.e1[0][k]), e1y(p.e1[1][k]), e1z(p.e1[2][k]);
+					V e2x(p.e2[0][k]), e2y(p.e2[1][k]), e2z(p.e2[2][k]);
+					V px = dy * e2z - dz * e2y, py = dz * e2x - dx * e2z, pz = dx * e2y - dy * e2x;
+					V det = e1x * px + e1y * py + e1z * pz;
+					V inv = one / det;
+					V sx = ox - V(p.v0[0][k]), sy = oy - V(p.v0[1][k]), sz = oz - V(p.v0[2][k]);
+					V U = (sx * px + sy * py + sz * pz) * inv;
+					V qx = sy * e1z - sz * e1y, qy = sz * e1x - sx * e1z, qz = sx * e1y - sy * e1x;
+					V W = (dx * qx + dy * qy + dz * qz) * inv;
+					V T = (e2x * qx + e2y * qy + e2z * qz) * inv;
+					V ok = And(And(GreaterEqual(Abs(det), V(1e-12f)), And(GreaterEqual(U, zero), GreaterEqual(W, zero))),
+						And(GreaterEqual(one, U + W), And(Greater(T, zero), Greater(tMax, T))));
+					int mask = MoveMask(ok);
+					if (mask == 0)
+					{
+						continue;
+					}
+					tMax = Select(ok, T, tMax);
+					float u[RayPacket::SIZE], v[RayPacket::SIZE];
+					Store(u, U);
+					Store(v, W);
+					for (int l = 0; l < RayPacket::SIZE; l++)
+					{
+						if (mask >> l & 1)
+						{
+							hits[l].triangle = p.id[k];
+							hits[l].u = u[l];
+							hits[l].v = v[l];
+						}
+					}
+					result |= mask;
+					float t[RayPacket::SIZE];
+					Store(t, tMax);
+					farthest = *std::max_element(t, t + RayPacket::SIZE);
+				}
+				continue;
+			}
+
+			// Like single rays, nearest child (for the closest lane) on top of the stack
+			const Node &n = this->nodes[e.node];
+			Entry hits[4];
+			int count = 0;
+			for (int k = 0; k < 4; k++)
+			{
+				if (n.child[k] == 0)
+				{
+					continue;
+				}
+				V ax = (V(n.bounds[0][0][k]) - ox) * ix, bx = (V(n.bounds[1][0][k]) - ox) * ix;
+				V ay = (V(n.bounds[0][1][k]) - oy) * iy, by = (V(n.bounds[1][1][k]) - oy) * iy;
+				V az = (V(n.bounds[0][2][k]) - oz) * iz, bz = (V(n.bounds[1][2][k]) - oz) * iz;
+				V t0 = Max(Max(Min(ax, bx), Min(ay, by)), Max(Min(az, bz), zero));
+				V t1 = Min(Min(Max(ax, bx), Max(ay, by)), Min(Max(az, bz), tMax));
+				V inside = GreaterEqual(t1, t0);
+				if (MoveMask(inside) == 0)
+				{
+					continue;
+				}
+				float tNear[RayPacket::SIZE];
+				Store(tNear, Select(inside, t0, V(FLT_MAX)));
+				Entry c = { n.child[k], *std::min_element(tNear, tNear + RayPacket::SIZE) };
+				int j = count++;
+				for (; j > 0 && hits[j - 1].t < c.t; j--)
+				{
+					hits[j] = hits[j - 1];
+				}
+				hits[j] = c;
+			}
+			for (int k = 0; k < count; k++)
+			{
+				stack[top++] = hits[k];
+			}
+		}
+
+		Store(packet.tMax, tMax);
+		for (int l = 0; l < RayPacket::SIZE; l++)
+		{
+			if (result >> l & 1)
+			{
+				hits[l].t = packet.tMax[l];
+			}
+		}
+		return result;
+	}
+#endif
+};
+
+// Ray throughput over a scene (--bench-rays on the command line): build time, then millions of
+// rays per second for single rays, occlusion rays and packets, on one thread and on all of them.
+// Incoherent rays start anywhere in the scene with random directions; coherent ones are a pinhole
+// camera looking at the middle of it, 8 neighbouring pixels per packet.
+inline void RunRayBenchmark(TriangleBVH &bvh, int rays)
+{
+	typedef std::chrono::high_resolution_clock Clock;
+	double buildMs = 1e30;
+	for (int r = 0; r < 3; r++)
+	{
+		auto t0 = Clock::now();
+		bvh.Build();
+		buildMs = std::min(buildMs, std::chrono::duration<double, std::milli>(Clock::now() - t0).count());
+	}
+	glm::vec3 bmin, bmax;
+	bvh.GetBounds(bmin, bmax);
+	printf("BVH: %zu triangles, %zu nodes, built in %.1f ms on %u threads\n",
+		bvh.GetTriangleCount(), bvh.GetNodeCount(), buildMs, WorkerCount());
+	if (bvh.GetNodeCount() == 0)
+	{
+		return;
+	}
+
+	rays = (rays + RayPacket::SIZE - 1) / RayPacket::SIZE * RayPacket::SIZE;
+	std::vector<glm::vec3> origins(rays), directions(rays);
+	std::vector<RayHit> reference(rays), result(rays);
+
+	auto run = [&](const char *name, bool parallel, auto body)
+	{
+		double best = 1e30;
+		for (int r = 0; r < 3; r++)
+		{
+			auto t0 = Clock::now();
+			if (parallel)
+			{
+				ParallelFor(0, rays / RayPacket::SIZE, body, 64);
+			}
+			else
+			{
+				for (int i = 0; i < rays / RayPacket::SIZE; i++)
+				{
+					body(i);
+				}
+			}
+			best = std::min(best, std::chrono::duration<double>(Clock::now() - t0).count());
+		}
+		printf("  %-22s %8.2f Mrays/s\n", name, rays / best * 1e-6);
+	};
+	auto single = [&](int i)
+	{
+		for (int l = i * RayPacket::SIZE; l < (i + 1) * RayPacket::SIZE; l++)
+		{
+			result[l].triangle = TriangleBVH::NO_HIT;
+			bvh.Intersect(origins[l], directions[l], FLT_MAX, result[l]);
+		}
+	};
+	auto occluded = [&](int i)
+	{
+		for (int l = i * RayPacket::SIZE; l < (i + 1) * RayPacket::SIZE; l++)
+		{
+			result[l].triangle = bvh.Occluded(origins[l], directions[l], FLT_MAX) ? 0 : TriangleBVH::NO_HIT;
+		}
+	};
+	auto packet = [&](int i)
+	{
+		RayPacket p;
+		for (int l = 0; l < RayPacket::SIZE; l++)
+		{
+			p.Set(l, origins[i * RayPacket::SIZE + l], directions[i * RayPacket::SIZE + l], FLT_MAX);
+		}
+		bvh.IntersectPacket(p, &result[i * RayPacket::SIZE]);
+	};
+	auto compare = [&](bool anyHit)
+	{
+		int bad = 0;
+		for (int i = 0; i < rays; i++)
+		{
+			bool a = reference[i].triangle != TriangleBVH::NO_HIT, b = result[i].triangle != TriangleBVH::NO_HIT;
+			bad += a != b || (!anyHit && a && std::fabs(reference[i].t - result[i].t) > 1e-4f * reference[i].t);
+		}
+		if (bad > 0)
+		{
+			printf("  (%d rays differ from single-ray traversal)\n", bad);
+		}
+	};
+
+	std::mt19937 rng(4321);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	for (int set = 0; set < 2; set++)
+	{
+		glm::vec3 size = bmax - bmin, center = (bmin + bmax) * 0.5f;
+		if (set == 0)
+		{
+			for (int i = 0; i < rays; i++)
+			{
+				origins[i] = bmin + size * glm::vec3(unit(rng), unit(rng), unit(rng));
+				float z = unit(rng) * 2.0f - 1.0f, phi = 6.2831853f * unit(rng), r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+				directions[i] = glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+			}
+		}
+		else
+		{
+			int width = std::max(RayPacket::SIZE, (int)std::sqrt((float)rays) / RayPacket::SIZE * RayPacket::SIZE);
+			glm::vec3 eye = center + glm::vec3(0.0f, size.y * 0.5f + 2.0f, glm::length(size) * 0.6f);
+			glm::vec3 forward = glm::normalize(center - eye);
+			glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f))), up = glm::cross(right, forward);
+			for (int i = 0; i < rays; i++)
+			{
+				float x = ((i % width) + 0.5f) / width * 2.0f - 1.0f, y = 1.0f - ((i / width) + 0.5f) / (rays / width + 1) * 2.0f;
+				origins[i] = eye;
+				directions[i] = glm::normalize(forward + right * (x * 0.7f) + up * (y * 0.7f));
+			}
+		}
+
+		printf("%s, %d rays (best of 3)\n", set == 0 ? "Incoherent" : "Coherent (camera)", rays);
+		run("single, 1 thread", false, single);
+		reference = result;
+		run("single", true, single);
+		run("occlusion", true, occluded);
+		compare(true);
+		run("packet, 1 thread", false, packet);
+		compare(false);
+		run("packet", true, packet);
+	}
+}
@@ -118,8 +118,8 @@
 #include <stdlib.h>
 #include <string.h>
 
-/*	error reporting	*/
-const char *result_string_pointer = "SOIL initialized";
+/*	error reporting, one per thread like stb_image's failure reason	*/
+static STBI_THREAD_LOCAL const char *result_string_pointer = "SOIL initialized";
 
 /*	for loading cube maps	*/
 enum{
@@ -1373,11 +1373,20 @@ static void createMipmaps(const unsigned char *const img,
 
 		while( ((1<<MIPlevel) <= width) || ((1<<MIPlevel) <= height) )
 		{
-			/*	do this MIPmap level	*/
-			mipmap_image(
-					img, width, height, channels,
-					resampled,
-					(1 << MIPlevel), (1 << MIPlevel) );
+			/*	do this MIPmap level (sRGB colors are averaged in linear space)	*/
+			if( flags & SOIL_FLAG_SRGB_COLOR_SPACE )
+			{
+				mipmap_image_sRGB(
+						img, width, height, channels,
+						resampled,
+						(1 << MIPlevel), (1 << MIPlevel) );
+			} else
+			{
+				mipmap_image(
+						img, width, height, channels,
+						resampled,
+						(1 << MIPlevel), (1 << MIPlevel) );
+			}
 
 			/*  upload the MIPmaps	*/
 			if( DXT_mode == SOIL_CAPABILITY_PRESENT )
@@ -1619,8 +1628,15 @@ unsigned int
 		new_height = iheight / reduce_block_y;
 		resampled = (unsigned char*)malloc( channels*new_width*new_height );
 		/*	perform the actual reduction	*/
-		mipmap_image( NULL != img ? img : data, iwidth, iheight, channels,
-						resampled, reduce_block_x, reduce_block_y );
+		if( flags & SOIL_FLAG_SRGB_COLOR_SPACE )
+		{
+			mipmap_image_sRGB( NULL != img ? img : data, iwidth, iheight, channels,
+							resampled, reduce_block_x, reduce_block_y );
+		} else
+		{
+			mipmap_image( NULL != img ? img : data, iwidth, iheight, channels,
+							resampled, reduce_block_x, reduce_block_y );
+		}
 		/*	nuke the old guy, then point it at the new guy	*/
 		SOIL_free_image_data( img );
 		img = resampled;
@@ -1900,6 +1916,43 @@ unsigned char*
 	return result;
 }
 
+int
+	SOIL_get_image_info
+	(
+		const char *filename,
+		int *width, int *height, int *channels
+	)
+{
+	if( !stbi_info( filename, width, height, channels ) )
+	{
+		result_string_pointer = stbi_failure_reason();
+		return 0;
+	}
+	result_string_pointer = "Image info read";
+	return 1;
+}
+
+unsigned char*
+	SOIL_load_image_scaled
+	(
+		const char *filename,
+		int *width, int *height, int *channels,
+		int force_channels,
+		int scale_shift
+	)
+{
+	unsigned char *result = stbi_load_scaled( filename,
+			width, height, channels, force_channels, scale_shift );
+	if( result == NULL )
+	{
+		result_string_pointer = stbi_failure_reason();
+	} else
+	{
+		result_string_pointer = "Image loaded";
+	}
+	return result;
+}
+
 unsigned char*
 	SOIL_load_image_from_memory
 	(
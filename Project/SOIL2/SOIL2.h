@@ -385,6 +385,35 @@ unsigned char*
 		int force_channels
 	);
 
+/**
+	Reads only the header of an image file for its size and
+	channel count, without decoding it.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+	SOIL_get_image_info
+	(
+		const char *filename,
+		int *width, int *height, int *channels
+	);
+
+/**
+	Same as SOIL_load_image, but JPEGs are decoded straight at
+	1/2, 1/4 or 1/8 of their size (scale_shift 1, 2 or 3, the
+	size rounded up) with a reduced-size IDCT, in a fraction of
+	the time and memory. Other formats load at full size, so
+	check *width and *height.
+	\return 0 if failed, otherwise returns 1
+**/
+unsigned char*
+	SOIL_load_image_scaled
+	(
+		const char *filename,
+		int *width, int *height, int *channels,
+		int force_channels,
+		int scale_shift
+	);
+
 /**
 	Loads an image from memory into an array of unsigned chars.
 	Note that *channels return the original channel count of the
@@ -441,7 +470,7 @@ void
 /**
 	This function resturn a pointer to a string describing the last thing
 	that happened inside SOIL.  It can be used to determine why an image
-	failed to load.
+	failed to load.  Each thread sees the result of its own last call.
 **/
 const char*
 	SOIL_last_result
@@ -8,11 +8,33 @@
 */
 
 #include "image_DXT.h"
+#include "image_helper.h"
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+/*	SSE2 kernels wherever the compiler targets it (always on x64);
+	the AVX2 ones are compiled alongside and picked at run time	*/
+#if defined( _M_X64 ) || defined( __SSE2__ ) || (defined( _M_IX86_FP ) && (_M_IX86_FP >= 2))
+	#define DXT_SSE2	1
+	#include <emmintrin.h>
+	#if defined( _MSC_VER ) || defined( __GNUC__ )
+		#define DXT_AVX2	1
+		#include <immintrin.h>
+	#endif
+#endif
+#if defined( _MSC_VER )
+	#define DXT_ALIGN16	__declspec(align(16))
+	#define DXT_TARGET_AVX2
+#else
+	#define DXT_ALIGN16	__attribute__((aligned(16)))
+	#define DXT_TARGET_AVX2	__attribute__((target("avx2")))
+#endif
+
+/*	images are split in rows of blocks, at least this many blocks per thread	*/
+#define DXT_MIN_BLOCKS_PER_THREAD	1024
+
 /*	set this =1 if you want to use the covarince matrix method...
 	which is better than my method of using standard deviations
 	overall, except on the infintesimal chance that the power
@@ -38,6 +60,34 @@ void compress_DDS_alpha_block(
 				const unsigned char *const uncompressed,
 				unsigned char compressed[8] );
 
+/*
+	The parts of compress_DDS_color_block that don't loop over
+	pixels, shared by the scalar and the SIMD versions so they
+	all produce the same bits.
+*/
+static void color_line_from_sums(
+				const float sums[9],
+				float point[3], float direction[3] );
+static void master_colors_from_range(
+				const float point[3], const float direction[3],
+				float dot_min, float dot_max,
+				int *cmax, int *cmin );
+static void color_block_line(
+				int enc_c0, int enc_c1,
+				unsigned char compressed[8],
+				float color_line[3], float *dot_offset );
+/*
+	Compresses whole rows of 4x4 blocks, possibly on several threads.
+*/
+static void compress_DXT_image(
+				const unsigned char *const uncompressed,
+				int width, int height, int channels,
+				int dxt5, unsigned char *compressed );
+
+/*	set_DXT_compression_options: the best SIMD kernels, all cores	*/
+static int DXT_use_simd = 2;
+static int DXT_thread_count = 0;
+
 /********* Actual Exposed Functions *********/
 int
 	save_image_as_DDS
@@ -104,11 +154,6 @@ unsigned char* convert_image_to_DXT1(
 		int *out_size )
 {
 	unsigned char *compressed;
-	int i, j, x, y;
-	unsigned char ublock[16*3];
-	unsigned char cblock[8];
-	int index = 0, chan_step = 1;
-	int block_count = 0;
 	/*	error check	*/
 	*out_size = 0;
 	if( (width < 1) || (height < 1) ||
@@ -117,65 +162,16 @@ unsigned char* convert_image_to_DXT1(
 	{
 		return NULL;
 	}
-	/*	for channels == 1 or 2, I do not step forward for R,G,B values	*/
-	if( channels < 3 )
-	{
-		chan_step = 0;
-	}
 	/*	get the RAM for the compressed image
 		(8 bytes per 4x4 pixel block)	*/
 	*out_size = ((width+3) >> 2) * ((height+3) >> 2) * 8;
 	compressed = (unsigned char*)malloc( *out_size );
-	/*	go through each block	*/
-	for( j = 0; j < height; j += 4 )
+	if( NULL == compressed )
 	{
-		for( i = 0; i < width; i += 4 )
-		{
-			/*	copy this block into a new one	*/
-			int idx = 0;
-			int mx = 4, my = 4;
-			if( j+4 >= height )
-			{
-				my = height - j;
-			}
-			if( i+4 >= width )
-			{
-				mx = width - i;
-			}
-			for( y = 0; y < my; ++y )
-			{
-				for( x = 0; x < mx; ++x )
-				{
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels];
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels+chan_step];
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels+chan_step+chan_step];
-				}
-				for( x = mx; x < 4; ++x )
-				{
-					ublock[idx++] = ublock[0];
-					ublock[idx++] = ublock[1];
-					ublock[idx++] = ublock[2];
-				}
-			}
-			for( y = my; y < 4; ++y )
-			{
-				for( x = 0; x < 4; ++x )
-				{
-					ublock[idx++] = ublock[0];
-					ublock[idx++] = ublock[1];
-					ublock[idx++] = ublock[2];
-				}
-			}
-			/*	compress the block	*/
-			++block_count;
-			compress_DDS_color_block( 3, ublock, cblock );
-			/*	copy the data from the block into the main block	*/
-			for( x = 0; x < 8; ++x )
-			{
-				compressed[index++] = cblock[x];
-			}
-		}
+		*out_size = 0;
+		return NULL;
 	}
+	compress_DXT_image( uncompressed, width, height, channels, 0, compressed );
 	return compressed;
 }
 
@@ -185,11 +181,6 @@ unsigned char* convert_image_to_DXT5(
 		int *out_size )
 {
 	unsigned char *compressed;
-	int i, j, x, y;
-	unsigned char ublock[16*4];
-	unsigned char cblock[8];
-	int index = 0, chan_step = 1;
-	int block_count = 0, has_alpha;
 	/*	error check	*/
 	*out_size = 0;
 	if( (width < 1) || (height < 1) ||
@@ -198,82 +189,30 @@ unsigned char* convert_image_to_DXT5(
 	{
 		return NULL;
 	}
-	/*	for channels == 1 or 2, I do not step forward for R,G,B vales	*/
-	if( channels < 3 )
-	{
-		chan_step = 0;
-	}
-	/*	# channels = 1 or 3 have no alpha, 2 & 4 do have alpha	*/
-	has_alpha = 1 - (channels & 1);
 	/*	get the RAM for the compressed image
 		(16 bytes per 4x4 pixel block)	*/
 	*out_size = ((width+3) >> 2) * ((height+3) >> 2) * 16;
 	compressed = (unsigned char*)malloc( *out_size );
-	/*	go through each block	*/
-	for( j = 0; j < height; j += 4 )
+	if( NULL == compressed )
 	{
-		for( i = 0; i < width; i += 4 )
-		{
-			/*	local variables, and my block counter	*/
-			int idx = 0;
-			int mx = 4, my = 4;
-			if( j+4 >= height )
-			{
-				my = height - j;
-			}
-			if( i+4 >= width )
-			{
-				mx = width - i;
-			}
-			for( y = 0; y < my; ++y )
-			{
-				for( x = 0; x < mx; ++x )
-				{
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels];
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels+chan_step];
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels+chan_step+chan_step];
-					ublock[idx++] =
-						has_alpha * uncompressed[(j+y)*width*channels+(i+x)*channels+channels-1]
-						+ (1-has_alpha)*255;
-				}
-				for( x = mx; x < 4; ++x )
-				{
-					ublock[idx++] = ublock[0];
-					ublock[idx++] = ublock[1];
-					ublock[idx++] = ublock[2];
-					ublock[idx++] = ublock[3];
-				}
-			}
-			for( y = my; y < 4; ++y )
-			{
-				for( x = 0; x < 4; ++x )
-				{
-					ublock[idx++] = ublock[0];
-					ublock[idx++] = ublock[1];
-					ublock[idx++] = ublock[2];
-					ublock[idx++] = ublock[3];
-				}
-			}
-			/*	now compress the alpha block	*/
-			compress_DDS_alpha_block( ublock, cblock );
-			/*	copy the data from the compressed alpha block into the main buffer	*/
-			for( x = 0; x < 8; ++x )
-			{
-				compressed[index++] = cblock[x];
-			}
-			/*	then compress the color block	*/
-			++block_count;
-			compress_DDS_color_block( 4, ublock, cblock );
-			/*	copy the data from the compressed color block into the main buffer	*/
-			for( x = 0; x < 8; ++x )
-			{
-				compressed[index++] = cblock[x];
-			}
-		}
+		*out_size = 0;
+		return NULL;
 	}
+	compress_DXT_image( uncompressed, width, height, channels, 1, compressed );
 	return compressed;
 }
 
+void set_DXT_compression_options( int use_simd, int thread_count )
+{
+	DXT_use_simd = use_simd;
+	DXT_thread_count = thread_count;
+}
+
+int get_DXT_simd_level( void )
+{
+	return get_CPU_SIMD_level();
+}
+
 /********* Helper Functions *********/
 int convert_bit_range( int c, int from_bits, int to_bits )
 {
@@ -301,25 +240,38 @@ void compute_color_line_STDEV(
 		int channels,
 		float point[3], float direction[3] )
 {
-	const float inv_16 = 1.0f / 16.0f;
 	int i;
-	float sum_r = 0.0f, sum_g = 0.0f, sum_b = 0.0f;
-	float sum_rr = 0.0f, sum_gg = 0.0f, sum_bb = 0.0f;
-	float sum_rg = 0.0f, sum_rb = 0.0f, sum_gb = 0.0f;
+	float sums[9] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
 	/*	calculate all data needed for the covariance matrix
 		( to compare with _rygdxt code)	*/
 	for( i = 0; i < 16*channels; i += channels )
 	{
-		sum_r += uncompressed[i+0];
-		sum_rr += uncompressed[i+0] * uncompressed[i+0];
-		sum_g += uncompressed[i+1];
-		sum_gg += uncompressed[i+1] * uncompressed[i+1];
-		sum_b += uncompressed[i+2];
-		sum_bb += uncompressed[i+2] * uncompressed[i+2];
-		sum_rg += uncompressed[i+0] * uncompressed[i+1];
-		sum_rb += uncompressed[i+0] * uncompressed[i+2];
-		sum_gb += uncompressed[i+1] * uncompressed[i+2];
+		sums[0] += uncompressed[i+0];
+		sums[3] += uncompressed[i+0] * uncompressed[i+0];
+		sums[1] += uncompressed[i+1];
+		sums[4] += uncompressed[i+1] * uncompressed[i+1];
+		sums[2] += uncompressed[i+2];
+		sums[5] += uncompressed[i+2] * uncompressed[i+2];
+		sums[6] += uncompressed[i+0] * uncompressed[i+1];
+		sums[7] += uncompressed[i+0] * uncompressed[i+2];
+		sums[8] += uncompressed[i+1] * uncompressed[i+2];
 	}
+	color_line_from_sums( sums, point, direction );
+}
+
+/*
+	sums: r, g, b, rr, gg, bb, rg, rb, gb over the 16 pixels.
+	Every term is a whole number below 2^24, so the float sums
+	are exact and don't depend on the order they were added in.
+*/
+static void color_line_from_sums(
+		const float sums[9],
+		float point[3], float direction[3] )
+{
+	const float inv_16 = 1.0f / 16.0f;
+	float sum_r = sums[0], sum_g = sums[1], sum_b = sums[2];
+	float sum_rr = sums[3], sum_gg = sums[4], sum_bb = sums[5];
+	float sum_rg = sums[6], sum_rb = sums[7], sum_gb = sums[8];
 	/*	convert the sums to averages	*/
 	sum_r *= inv_16;
 	sum_g *= inv_16;
@@ -413,14 +365,11 @@ void LSE_master_colors_max_min(
 		int channels,
 		const unsigned char *const uncompressed )
 {
-	int i, j;
-	/*	the master colors	*/
-	int c0[3], c1[3];
+	int i;
 	/*	used for fitting the line	*/
 	float sum_x[] = { 0.0f, 0.0f, 0.0f };
 	float sum_x2[] = { 0.0f, 0.0f, 0.0f };
 	float dot_max = 1.0f, dot_min = -1.0f;
-	float vec_len2 = 0.0f;
 	float dot;
 	/*	error check	*/
 	if( (channels < 3) || (channels > 4) )
@@ -428,8 +377,6 @@ void LSE_master_colors_max_min(
 		return;
 	}
 	compute_color_line_STDEV( uncompressed, channels, sum_x, sum_x2 );
-	vec_len2 = 1.0f / ( 0.00001f +
-			sum_x2[0]*sum_x2[0] + sum_x2[1]*sum_x2[1] + sum_x2[2]*sum_x2[2] );
 	/*	finding the max and min vector values	*/
 	dot_max =
 			(
@@ -454,8 +401,25 @@ void LSE_master_colors_max_min(
 			dot_max = dot;
 		}
 	}
+	master_colors_from_range( sum_x, sum_x2, dot_min, dot_max, cmax, cmin );
+}
+
+/*
+	dot_min and dot_max: the extent of the block's pixels
+	along the color line (not yet offset or scaled)
+*/
+static void master_colors_from_range(
+		const float point[3], const float direction[3],
+		float dot_min, float dot_max,
+		int *cmax, int *cmin )
+{
+	int i, j;
+	/*	the master colors	*/
+	int c0[3], c1[3];
+	float vec_len2 = 1.0f / ( 0.00001f +
+			direction[0]*direction[0] + direction[1]*direction[1] + direction[2]*direction[2] );
 	/*	and the offset (from the average location)	*/
-	dot = sum_x2[0]*sum_x[0] + sum_x2[1]*sum_x[1] + sum_x2[2]*sum_x[2];
+	float dot = direction[0]*point[0] + direction[1]*point[1] + direction[2]*point[2];
 	dot_min -= dot;
 	dot_max -= dot;
 	/*	post multiply by the scaling factor	*/
@@ -465,7 +429,7 @@ void LSE_master_colors_max_min(
 	for( i = 0; i < 3; ++i )
 	{
 		/*	color 0	*/
-		c0[i] = (int)(0.5f + sum_x[i] + dot_max * sum_x2[i]);
+		c0[i] = (int)(0.5f + point[i] + dot_max * direction[i]);
 		if( c0[i] < 0 )
 		{
 			c0[i] = 0;
@@ -474,7 +438,7 @@ void LSE_master_colors_max_min(
 			c0[i] = 255;
 		}
 		/*	color 1	*/
-		c1[i] = (int)(0.5f + sum_x[i] + dot_min * sum_x2[i]);
+		c1[i] = (int)(0.5f + point[i] + dot_min * direction[i]);
 		if( c1[i] < 0 )
 		{
 			c1[i] = 0;
@@ -509,13 +473,53 @@ void
 	int i;
 	int next_bit;
 	int enc_c0, enc_c1;
-	int c0[4], c1[4];
 	float color_line[] = { 0.0f, 0.0f, 0.0f, 0.0f };
-	float vec_len2 = 0.0f, dot_offset = 0.0f;
+	float dot_offset = 0.0f;
 	/*	stupid order	*/
 	int swizzle4[] = { 0, 2, 3, 1 };
 	/*	get the master colors	*/
 	LSE_master_colors_max_min( &enc_c0, &enc_c1, channels, uncompressed );
+	color_block_line( enc_c0, enc_c1, compressed, color_line, &dot_offset );
+	/*	store the rest of the bits	*/
+	next_bit = 8*4;
+	for( i = 0; i < 16; ++i )
+	{
+		/*	find the dot product of this color, to place it on the line
+			(should be [-1,1])	*/
+		int next_value = 0;
+		float dot_product =
+			color_line[0] * uncompressed[i*channels+0] +
+			color_line[1] * uncompressed[i*channels+1] +
+			color_line[2] * uncompressed[i*channels+2] -
+			dot_offset;
+		/*	map to [0,3]	*/
+		next_value = (int)( dot_product * 3.0f + 0.5f );
+		if( next_value > 3 )
+		{
+			next_value = 3;
+		} else if( next_value < 0 )
+		{
+			next_value = 0;
+		}
+		/*	OK, store this value	*/
+		compressed[next_bit >> 3] |= swizzle4[ next_value ] << (next_bit & 7);
+		next_bit += 2;
+	}
+	/*	done compressing to DXT1	*/
+}
+
+/*
+	Stores the 565 master colors and clears the index bits,
+	then gives the scaled line the indices are measured along
+*/
+static void color_block_line(
+		int enc_c0, int enc_c1,
+		unsigned char compressed[8],
+		float color_line[3], float *dot_offset )
+{
+	int i;
+	int c0[4], c1[4];
+	float vec_len2 = 0.0f;
 	/*	store the 565 color 0 and color 1	*/
 	compressed[0] = (enc_c0 >> 0) & 255;
 	compressed[1] = (enc_c0 >> 8) & 255;
@@ -530,7 +534,6 @@ void
 	rgb_888_from_565( enc_c0, &c0[0], &c0[1], &c0[2] );
 	rgb_888_from_565( enc_c1, &c1[0], &c1[1], &c1[2] );
 	/*	the new vector	*/
-	vec_len2 = 0.0f;
 	for( i = 0; i < 3; ++i )
 	{
 		color_line[i] = (float)(c1[i] - c0[i]);
@@ -545,33 +548,7 @@ void
 	color_line[1] *= vec_len2;
 	color_line[2] *= vec_len2;
 	/*	compute the offset (constant) portion of the dot product	*/
-	dot_offset = color_line[0]*c0[0] + color_line[1]*c0[1] + color_line[2]*c0[2];
-	/*	store the rest of the bits	*/
-	next_bit = 8*4;
-	for( i = 0; i < 16; ++i )
-	{
-		/*	find the dot product of this color, to place it on the line
-			(should be [-1,1])	*/
-		int next_value = 0;
-		float dot_product =
-			color_line[0] * uncompressed[i*channels+0] +
-			color_line[1] * uncompressed[i*channels+1] +
-			color_line[2] * uncompressed[i*channels+2] -
-			dot_offset;
-		/*	map to [0,3]	*/
-		next_value = (int)( dot_product * 3.0f + 0.5f );
-		if( next_value > 3 )
-		{
-			next_value = 3;
-		} else if( next_value < 0 )
-		{
-			next_value = 0;
-		}
-		/*	OK, store this value	*/
-		compressed[next_bit >> 3] |= swizzle4[ next_value ] << (next_bit & 7);
-		next_bit += 2;
-	}
-	/*	done compressing to DXT1	*/
+	*dot_offset = color_line[0]*c0[0] + color_line[1]*c0[1] + color_line[2]*c0[2];
 }
 
 void
@@ -630,3 +607,324 @@ void
 	}
 	/*	done compressing to DXT1	*/
 }
+
+/********* Block Rows, SIMD Kernels and Threads *********/
+typedef struct
+{
+	const unsigned char *uncompressed;
+	unsigned char *compressed;
+	int width, height, channels;
+	int dxt5, simd;
+}
+DXT_job;
+
+/*
+	Copies the 4x4 block at (i,j) as RGB (3) or RGBA (4),
+	padding a partial block with its first pixel
+*/
+static void gather_DXT_block(
+		const unsigned char *const uncompressed,
+		int width, int height, int channels,
+		int i, int j, int block_channels,
+		unsigned char *ublock )
+{
+	int x, y, c, idx = 0;
+	int mx = 4, my = 4;
+	/*	for channels == 1 or 2, I do not step forward for R,G,B values	*/
+	int chan_step = (channels < 3) ? 0 : 1;
+	/*	# channels = 1 or 3 have no alpha, 2 & 4 do have alpha	*/
+	int has_alpha = 1 - (channels & 1);
+	if( j+4 >= height )
+	{
+		my = height - j;
+	}
+	if( i+4 >= width )
+	{
+		mx = width - i;
+	}
+	for( y = 0; y < my; ++y )
+	{
+		const unsigned char *row = uncompressed + ((size_t)(j+y)*width + i)*channels;
+		for( x = 0; x < mx; ++x )
+		{
+			ublock[idx++] = row[x*channels];
+			ublock[idx++] = row[x*channels+chan_step];
+			ublock[idx++] = row[x*channels+chan_step+chan_step];
+			if( block_channels == 4 )
+			{
+				ublock[idx++] = has_alpha * row[x*channels+channels-1] + (1-has_alpha)*255;
+			}
+		}
+		for( x = mx; x < 4; ++x )
+		{
+			for( c = 0; c < block_channels; ++c )
+			{
+				ublock[idx++] = ublock[c];
+			}
+		}
+	}
+	for( y = my; y < 4; ++y )
+	{
+		for( x = 0; x < 4; ++x )
+		{
+			for( c = 0; c < block_channels; ++c )
+			{
+				ublock[idx++] = ublock[c];
+			}
+		}
+	}
+}
+
+#if DXT_SSE2
+/*
+	The SIMD versions of compress_DDS_color_block. The per-pixel
+	dot products are evaluated with the same float operations in
+	the same order as the scalar code (no FMA), so the blocks come
+	out bit-identical; only the loops are vectorized.
+*/
+
+/*	R, G, B of the 16 pixels as 16-bit lanes (8 per register),
+	and the sums color_line_from_sums wants	*/
+static void DXT_block_planes_SSE2(
+		int channels,
+		const unsigned char *const uncompressed,
+		__m128i wide[3][2], float sums[9] )
+{
+	static const int pairs[6][2] = { {0,0}, {1,1}, {2,2}, {0,1}, {0,2}, {1,2} };
+	DXT_ALIGN16 unsigned char planes[3][16];
+	DXT_ALIGN16 int lanes[4];
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi16( 1 );
+	__m128i sum;
+	int i, c;
+	for( i = 0; i < 16; ++i )
+	{
+		planes[0][i] = uncompressed[i*channels+0];
+		planes[1][i] = uncompressed[i*channels+1];
+		planes[2][i] = uncompressed[i*channels+2];
+	}
+	for( c = 0; c < 3; ++c )
+	{
+		__m128i p = _mm_load_si128( (const __m128i*)planes[c] );
+		wide[c][0] = _mm_unpacklo_epi8( p, zero );
+		wide[c][1] = _mm_unpackhi_epi8( p, zero );
+		sum = _mm_add_epi32( _mm_madd_epi16( wide[c][0], ones ), _mm_madd_epi16( wide[c][1], ones ) );
+		_mm_store_si128( (__m128i*)lanes, sum );
+		sums[c] = (float)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+	}
+	for( i = 0; i < 6; ++i )
+	{
+		const int a = pairs[i][0], b = pairs[i][1];
+		sum = _mm_add_epi32(
+				_mm_madd_epi16( wide[a][0], wide[b][0] ),
+				_mm_madd_epi16( wide[a][1], wide[b][1] ) );
+		_mm_store_si128( (__m128i*)lanes, sum );
+		sums[3+i] = (float)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+	}
+}
+
+/*	16 indices in [0,3] into the last 4 bytes of the block	*/
+static void DXT_store_indices( const int values[16], unsigned char compressed[8] )
+{
+	/*	stupid order	*/
+	static const unsigned int swizzle4[] = { 0, 2, 3, 1 };
+	unsigned int bits = 0;
+	int i;
+	for( i = 0; i < 16; ++i )
+	{
+		bits |= swizzle4[ values[i] ] << (2*i);
+	}
+	compressed[4] = (bits >> 0) & 255;
+	compressed[5] = (bits >> 8) & 255;
+	compressed[6] = (bits >> 16) & 255;
+	compressed[7] = (bits >> 24) & 255;
+}
+
+static void compress_DDS_color_block_SSE2(
+		int channels,
+		const unsigned char *const uncompressed,
+		unsigned char compressed[8] )
+{
+	__m128i wide[3][2];
+	__m128 f[3][4];
+	__m128 lo, hi, d0, d1, d2, off;
+	DXT_ALIGN16 int values[16];
+	float sums[9], point[3], direction[3], color_line[4], dot_offset;
+	int enc_c0, enc_c1, c, k;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i three = _mm_set1_epi16( 3 );
+	DXT_block_planes_SSE2( channels, uncompressed, wide, sums );
+	color_line_from_sums( sums, point, direction );
+	for( c = 0; c < 3; ++c )
+	{
+		f[c][0] = _mm_cvtepi32_ps( _mm_unpacklo_epi16( wide[c][0], zero ) );
+		f[c][1] = _mm_cvtepi32_ps( _mm_unpackhi_epi16( wide[c][0], zero ) );
+		f[c][2] = _mm_cvtepi32_ps( _mm_unpacklo_epi16( wide[c][1], zero ) );
+		f[c][3] = _mm_cvtepi32_ps( _mm_unpackhi_epi16( wide[c][1], zero ) );
+	}
+	/*	extent of the block along the color line	*/
+	d0 = _mm_set1_ps( direction[0] );
+	d1 = _mm_set1_ps( direction[1] );
+	d2 = _mm_set1_ps( direction[2] );
+	for( k = 0; k < 4; ++k )
+	{
+		__m128 dot = _mm_add_ps( _mm_add_ps( _mm_mul_ps( d0, f[0][k] ), _mm_mul_ps( d1, f[1][k] ) ), _mm_mul_ps( d2, f[2][k] ) );
+		lo = k ? _mm_min_ps( lo, dot ) : dot;
+		hi = k ? _mm_max_ps( hi, dot ) : dot;
+	}
+	lo = _mm_min_ps( lo, _mm_shuffle_ps( lo, lo, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	lo = _mm_min_ps( lo, _mm_shuffle_ps( lo, lo, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	hi = _mm_max_ps( hi, _mm_shuffle_ps( hi, hi, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	hi = _mm_max_ps( hi, _mm_shuffle_ps( hi, hi, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	master_colors_from_range( point, direction, _mm_cvtss_f32( lo ), _mm_cvtss_f32( hi ), &enc_c0, &enc_c1 );
+	color_block_line( enc_c0, enc_c1, compressed, color_line, &dot_offset );
+	/*	indices: truncate dot*3+0.5, clamp to [0,3]	*/
+	d0 = _mm_set1_ps( color_line[0] );
+	d1 = _mm_set1_ps( color_line[1] );
+	d2 = _mm_set1_ps( color_line[2] );
+	off = _mm_set1_ps( dot_offset );
+	for( k = 0; k < 4; k += 2 )
+	{
+		__m128i q[2];
+		__m128i v;
+		for( c = 0; c < 2; ++c )
+		{
+			__m128 dot = _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( d0, f[0][k+c] ), _mm_mul_ps( d1, f[1][k+c] ) ), _mm_mul_ps( d2, f[2][k+c] ) ), off );
+			q[c] = _mm_cvttps_epi32( _mm_add_ps( _mm_mul_ps( dot, _mm_set1_ps( 3.0f ) ), _mm_set1_ps( 0.5f ) ) );
+		}
+		v = _mm_min_epi16( _mm_max_epi16( _mm_packs_epi32( q[0], q[1] ), zero ), three );
+		_mm_store_si128( (__m128i*)(values + 4*k), _mm_unpacklo_epi16( v, zero ) );
+		_mm_store_si128( (__m128i*)(values + 4*k + 4), _mm_unpackhi_epi16( v, zero ) );
+	}
+	DXT_store_indices( values, compressed );
+}
+
+#if DXT_AVX2
+/*
+	The same with 8 pixels per register. The upper halves are cleared
+	before every call into the (non-VEX) shared code: mixing the two
+	with dirty upper state costs more than the wider registers save.
+*/
+DXT_TARGET_AVX2
+static void DXT_load_planes_AVX2( __m128i wide[3][2], __m256 f[3][2] )
+{
+	int c;
+	for( c = 0; c < 3; ++c )
+	{
+		f[c][0] = _mm256_cvtepi32_ps( _mm256_cvtepu16_epi32( wide[c][0] ) );
+		f[c][1] = _mm256_cvtepi32_ps( _mm256_cvtepu16_epi32( wide[c][1] ) );
+	}
+}
+
+DXT_TARGET_AVX2
+static void compress_DDS_color_block_AVX2(
+		int channels,
+		const unsigned char *const uncompressed,
+		unsigned char compressed[8] )
+{
+	__m128i wide[3][2];
+	__m256 f[3][2];
+	__m256 d0, d1, d2, off, mn, mx;
+	__m128 lo, hi;
+	DXT_ALIGN16 int values[16];
+	float sums[9], point[3], direction[3], color_line[4], dot_offset, dot_min, dot_max;
+	int enc_c0, enc_c1, k;
+	DXT_block_planes_SSE2( channels, uncompressed, wide, sums );
+	color_line_from_sums( sums, point, direction );
+	/*	extent of the block along the color line	*/
+	DXT_load_planes_AVX2( wide, f );
+	d0 = _mm256_set1_ps( direction[0] );
+	d1 = _mm256_set1_ps( direction[1] );
+	d2 = _mm256_set1_ps( direction[2] );
+	mn = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( d0, f[0][0] ), _mm256_mul_ps( d1, f[1][0] ) ), _mm256_mul_ps( d2, f[2][0] ) );
+	mx = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( d0, f[0][1] ), _mm256_mul_ps( d1, f[1][1] ) ), _mm256_mul_ps( d2, f[2][1] ) );
+	lo = _mm256_castps256_ps128( _mm256_min_ps( mn, mx ) );
+	hi = _mm256_castps256_ps128( _mm256_max_ps( mn, mx ) );
+	lo = _mm_min_ps( lo, _mm256_extractf128_ps( _mm256_min_ps( mn, mx ), 1 ) );
+	hi = _mm_max_ps( hi, _mm256_extractf128_ps( _mm256_max_ps( mn, mx ), 1 ) );
+	lo = _mm_min_ps( lo, _mm_shuffle_ps( lo, lo, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	lo = _mm_min_ps( lo, _mm_shuffle_ps( lo, lo, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	hi = _mm_max_ps( hi, _mm_shuffle_ps( hi, hi, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	hi = _mm_max_ps( hi, _mm_shuffle_ps( hi, hi, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	dot_min = _mm_cvtss_f32( lo );
+	dot_max = _mm_cvtss_f32( hi );
+	_mm256_zeroupper();
+	master_colors_from_range( point, direction, dot_min, dot_max, &enc_c0, &enc_c1 );
+	color_block_line( enc_c0, enc_c1, compressed, color_line, &dot_offset );
+	/*	indices: truncate dot*3+0.5, clamp to [0,3]	*/
+	DXT_load_planes_AVX2( wide, f );
+	d0 = _mm256_set1_ps( color_line[0] );
+	d1 = _mm256_set1_ps( color_line[1] );
+	d2 = _mm256_set1_ps( color_line[2] );
+	off = _mm256_set1_ps( dot_offset );
+	for( k = 0; k < 2; ++k )
+	{
+		__m256 d = _mm256_sub_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( d0, f[0][k] ), _mm256_mul_ps( d1, f[1][k] ) ), _mm256_mul_ps( d2, f[2][k] ) ), off );
+		__m256i q = _mm256_cvttps_epi32( _mm256_add_ps( _mm256_mul_ps( d, _mm256_set1_ps( 3.0f ) ), _mm256_set1_ps( 0.5f ) ) );
+		q = _mm256_min_epi32( _mm256_max_epi32( q, _mm256_setzero_si256() ), _mm256_set1_epi32( 3 ) );
+		_mm256_storeu_si256( (__m256i*)(values + 8*k), q );
+	}
+	_mm256_zeroupper();
+	DXT_store_indices( values, compressed );
+}
+#endif
+#endif
+
+/*	rows of 4x4 blocks [first, last)	*/
+static void compress_DXT_rows( void *data, int first, int last )
+{
+	const DXT_job *job = (const DXT_job*)data;
+	const int block_channels = job->dxt5 ? 4 : 3;
+	const size_t row_bytes = (size_t)((job->width + 3) >> 2) * (job->dxt5 ? 16 : 8);
+	unsigned char ublock[16*4];
+	int i, j;
+	for( j = first; j < last; ++j )
+	{
+		unsigned char *out = job->compressed + j * row_bytes;
+		for( i = 0; i < job->width; i += 4 )
+		{
+			gather_DXT_block( job->uncompressed, job->width, job->height, job->channels, i, j*4, block_channels, ublock );
+			if( job->dxt5 )
+			{
+				compress_DDS_alpha_block( ublock, out );
+				out += 8;
+			}
+			#if DXT_AVX2
+			if( job->simd >= 2 )
+			{
+				compress_DDS_color_block_AVX2( block_channels, ublock, out );
+			} else
+			#endif
+			#if DXT_SSE2
+			if( job->simd >= 1 )
+			{
+				compress_DDS_color_block_SSE2( block_channels, ublock, out );
+			} else
+			#endif
+			{
+				compress_DDS_color_block( block_channels, ublock, out );
+			}
+			out += 8;
+		}
+	}
+}
+
+static void compress_DXT_image(
+		const unsigned char *const uncompressed,
+		int width, int height, int channels,
+		int dxt5, unsigned char *compressed )
+{
+	DXT_job job;
+	const int rows = (height + 3) >> 2;
+	const int blocks_x = (width + 3) >> 2;
+	job.uncompressed = uncompressed;
+	job.compressed = compressed;
+	job.width = width;
+	job.height = height;
+	job.channels = channels;
+	job.dxt5 = dxt5;
+	job.simd = DXT_use_simd < get_DXT_simd_level() ? DXT_use_simd : get_DXT_simd_level();
+	/*	small images (and the small mip levels) aren't worth a thread	*/
+	run_parallel_rows( rows, (DXT_MIN_BLOCKS_PER_THREAD + blocks_x - 1) / blocks_x,
+			DXT_thread_count, compress_DXT_rows, &job );
+}
@@ -10,6 +10,10 @@
 #ifndef HEADER_IMAGE_DXT
 #define HEADER_IMAGE_DXT
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
 	Converts an image from an array of unsigned chars (RGB or RGBA) to
 	DXT1 or DXT5, then saves the converted image to disk.
@@ -45,6 +49,28 @@ convert_image_to_DXT5
     int *out_size
 );
 
+/**
+	Chooses how convert_image_to_DXT1/DXT5 run: use_simd is the best
+	block kernel allowed (0 scalar, 1 SSE2, 2 AVX2; the default), capped
+	by what the CPU has; thread_count splits the image in rows of blocks
+	(0 = one thread per core, the default). Every setting produces the
+	same bytes as the scalar single-thread path.
+**/
+void
+set_DXT_compression_options
+(
+    int use_simd, int thread_count
+);
+
+/**
+	The block kernels this CPU runs: 0 scalar, 1 SSE2, 2 AVX2
+**/
+int
+get_DXT_simd_level
+(
+    void
+);
+
 /**	A bunch of DirectDraw Surface structures and flags **/
 typedef struct
 {
@@ -120,4 +146,8 @@ DDS_header ;
 #define DDSCAPS2_CUBEMAP_NEGATIVEZ	0x00008000
 #define DDSCAPS2_VOLUME	0x00200000
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* HEADER_IMAGE_DXT	*/
@@ -9,36 +9,233 @@
 #include "image_helper.h"
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 
-/*	Upscaling the image uses simple bilinear interpolation	*/
-int
-	up_scale_image
-	(
-		const unsigned char* const orig,
-		int width, int height, int channels,
-		unsigned char* resampled,
-		int resampled_width, int resampled_height
-	)
+#if defined( __WIN32__ ) || defined( _WIN32 ) || defined( WIN32 )
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+	#define IMAGE_WIN32_THREADS
+#else
+	#include <pthread.h>
+	#include <unistd.h>
+#endif
+
+/*	SSE2 kernels wherever the compiler targets it (always on x64);
+	the AVX2 ones are compiled alongside and picked at run time	*/
+#if defined( _M_X64 ) || defined( __SSE2__ ) || (defined( _M_IX86_FP ) && (_M_IX86_FP >= 2))
+	#define IMAGE_SSE2	1
+	#include <emmintrin.h>
+	#if defined( _MSC_VER ) || defined( __GNUC__ )
+		#define IMAGE_AVX2	1
+		#include <immintrin.h>
+	#endif
+#endif
+#if defined( _MSC_VER )
+	#include <intrin.h>
+	#define IMAGE_ALIGN32	__declspec(align(32))
+	#define IMAGE_TARGET_AVX2
+#else
+	#define IMAGE_ALIGN32	__attribute__((aligned(32)))
+	#define IMAGE_TARGET_AVX2	__attribute__((target("avx2")))
+#endif
+
+#define IMAGE_MAX_THREADS	64
+/*	rows are split across threads only past this many output bytes per thread	*/
+#define IMAGE_MIN_BYTES_PER_THREAD	(64*1024)
+
+/*	set_image_helper_options: the best SIMD kernels, all cores	*/
+static int image_use_simd = 2;
+static int image_thread_count = 0;
+
+/*	the kernel level the helpers run at	*/
+static int image_simd_level( void )
+{
+	int level = get_CPU_SIMD_level();
+	return image_use_simd < level ? image_use_simd : level;
+}
+
+/*	rows per thread so each gets at least IMAGE_MIN_BYTES_PER_THREAD	*/
+static int image_row_grain( int row_bytes )
+{
+	return row_bytes > 0 ? (IMAGE_MIN_BYTES_PER_THREAD + row_bytes - 1) / row_bytes : 1;
+}
+
+/********* Shared runtime: CPU level and row threads *********/
+int get_CPU_SIMD_level( void )
+{
+	static int level = -1;
+	if( level < 0 )
+	{
+		level = 0;
+		#if IMAGE_SSE2
+		level = 1;
+		#endif
+		#if IMAGE_AVX2
+			#if defined( _MSC_VER )
+			{
+				int info[4];
+				__cpuid( info, 0 );
+				if( info[0] >= 7 )
+				{
+					/*	AVX and OSXSAVE, and the OS saves the YMM registers	*/
+					__cpuid( info, 1 );
+					if( (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv( 0 ) & 6) == 6) )
+					{
+						__cpuidex( info, 7, 0 );
+						if( info[1] & (1 << 5) )
+						{
+							level = 2;
+						}
+					}
+				}
+			}
+			#else
+			__builtin_cpu_init();
+			if( __builtin_cpu_supports( "avx2" ) )
+			{
+				level = 2;
+			}
+			#endif
+		#endif
+	}
+	return level;
+}
+
+void set_image_helper_options( int use_simd, int thread_count )
+{
+	image_use_simd = use_simd;
+	image_thread_count = thread_count;
+}
+
+typedef struct
+{
+	void (*func)( void *data, int first, int last );
+	void *data;
+	int first, last;
+}
+row_range_job;
+
+#ifdef IMAGE_WIN32_THREADS
+static DWORD WINAPI row_range_main( LPVOID arg )
+{
+	const row_range_job *job = (const row_range_job*)arg;
+	job->func( job->data, job->first, job->last );
+	return 0;
+}
+#else
+static void *row_range_main( void *arg )
+{
+	const row_range_job *job = (const row_range_job*)arg;
+	job->func( job->data, job->first, job->last );
+	return NULL;
+}
+#endif
+
+static int image_core_count( void )
 {
+	#ifdef IMAGE_WIN32_THREADS
+	SYSTEM_INFO info;
+	GetSystemInfo( &info );
+	return (int)info.dwNumberOfProcessors;
+	#else
+	long n = sysconf( _SC_NPROCESSORS_ONLN );
+	return n > 0 ? (int)n : 1;
+	#endif
+}
+
+void run_parallel_rows(
+		int count, int min_grain, int threads,
+		void (*func)( void *data, int first, int last ), void *data )
+{
+	row_range_job jobs[IMAGE_MAX_THREADS];
+	#ifdef IMAGE_WIN32_THREADS
+	HANDLE handles[IMAGE_MAX_THREADS];
+	#else
+	pthread_t handles[IMAGE_MAX_THREADS];
+	#endif
+	int started[IMAGE_MAX_THREADS];
+	int n = threads > 0 ? threads : image_core_count();
+	int t;
+	if( count < 1 )
+	{
+		return;
+	}
+	/*	small images (and the small mip levels) aren't worth a thread	*/
+	if( min_grain < 1 )
+	{
+		min_grain = 1;
+	}
+	if( n > count / min_grain )
+	{
+		n = count / min_grain;
+	}
+	if( n > IMAGE_MAX_THREADS )
+	{
+		n = IMAGE_MAX_THREADS;
+	}
+	if( n <= 1 )
+	{
+		func( data, 0, count );
+		return;
+	}
+	for( t = 0; t < n; ++t )
+	{
+		jobs[t].func = func;
+		jobs[t].data = data;
+		jobs[t].first = count * t / n;
+		jobs[t].last = count * (t + 1) / n;
+	}
+	/*	range 0 runs here, and so does any whose thread failed to start	*/
+	for( t = 1; t < n; ++t )
+	{
+		#ifdef IMAGE_WIN32_THREADS
+		handles[t] = CreateThread( NULL, 0, row_range_main, &jobs[t], 0, NULL );
+		started[t] = handles[t] != NULL;
+		#else
+		started[t] = pthread_create( &handles[t], NULL, row_range_main, &jobs[t] ) == 0;
+		#endif
+		if( !started[t] )
+		{
+			func( data, jobs[t].first, jobs[t].last );
+		}
+	}
+	func( data, jobs[0].first, jobs[0].last );
+	for( t = 1; t < n; ++t )
+	{
+		if( started[t] )
+		{
+			#ifdef IMAGE_WIN32_THREADS
+			WaitForSingleObject( handles[t], INFINITE );
+			CloseHandle( handles[t] );
+			#else
+			pthread_join( handles[t], NULL );
+			#endif
+		}
+	}
+}
+
+/********* Resampling *********/
+typedef struct
+{
+	const unsigned char *orig;
+	int width, height, channels;
+	unsigned char *resampled;
+	int resampled_width, resampled_height;
 	float dx, dy;
-	int x, y, c;
+	int simd;
+}
+up_scale_job;
 
-    /* error(s) check	*/
-    if ( 	(width < 1) || (height < 1) ||
-            (resampled_width < 2) || (resampled_height < 2) ||
-            (channels < 1) ||
-            (NULL == orig) || (NULL == resampled) )
-    {
-        /*	signify badness	*/
-        return 0;
-    }
-    /*
-		for each given pixel in the new map, find the exact location
-		from the original map which would contribute to this guy
-	*/
-    dx = (width - 1.0f) / (resampled_width - 1.0f);
-    dy = (height - 1.0f) / (resampled_height - 1.0f);
-    for ( y = 0; y < resampled_height; ++y )
+static void up_scale_rows( void *data, int first, int last )
+{
+	const up_scale_job *job = (const up_scale_job*)data;
+	const unsigned char* const orig = job->orig;
+	unsigned char* resampled = job->resampled;
+	const int width = job->width, height = job->height, channels = job->channels;
+	const int resampled_width = job->resampled_width;
+	const float dx = job->dx, dy = job->dy;
+	int x, y, c;
+    for ( y = first; y < last; ++y )
     {
     	/* find the base y index and fractional offset from that	*/
     	float sampley = y * dy;
@@ -46,6 +243,46 @@ int
     	/*	if( inty < 0 ) { inty = 0; } else	*/
 		if( inty > height - 2 ) { inty = height - 2; }
 		sampley -= inty;
+		#if IMAGE_SSE2
+		if( job->simd >= 1 && channels == 4 )
+		{
+			/*	one RGBA pixel per register, same float operations as below	*/
+			const __m128i zero = _mm_setzero_si128();
+			const __m128 wy0 = _mm_set1_ps( 1.0f-sampley ), wy1 = _mm_set1_ps( sampley );
+			for ( x = 0; x < resampled_width; ++x )
+			{
+				float samplex = x * dx;
+				int intx = (int)samplex;
+				const unsigned char *p;
+				__m128 wx0, wx1, p00, p01, p10, p11, value;
+				__m128i v;
+				int quad[2];
+				if( intx > width - 2 ) { intx = width - 2; }
+				samplex -= intx;
+				wx0 = _mm_set1_ps( 1.0f-samplex );
+				wx1 = _mm_set1_ps( samplex );
+				p = orig + (inty * width + intx) * 4;
+				memcpy( quad, p, 8 );
+				v = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)quad ), zero );
+				p00 = _mm_cvtepi32_ps( _mm_unpacklo_epi16( v, zero ) );
+				p01 = _mm_cvtepi32_ps( _mm_unpackhi_epi16( v, zero ) );
+				memcpy( quad, p + width*4, 8 );
+				v = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)quad ), zero );
+				p10 = _mm_cvtepi32_ps( _mm_unpacklo_epi16( v, zero ) );
+				p11 = _mm_cvtepi32_ps( _mm_unpackhi_epi16( v, zero ) );
+				value = _mm_set1_ps( 0.5f );
+				value = _mm_add_ps( value, _mm_mul_ps( _mm_mul_ps( p00, wx0 ), wy0 ) );
+				value = _mm_add_ps( value, _mm_mul_ps( _mm_mul_ps( p01, wx1 ), wy0 ) );
+				value = _mm_add_ps( value, _mm_mul_ps( _mm_mul_ps( p10, wx0 ), wy1 ) );
+				value = _mm_add_ps( value, _mm_mul_ps( _mm_mul_ps( p11, wx1 ), wy1 ) );
+				v = _mm_cvttps_epi32( value );
+				v = _mm_packus_epi16( _mm_packs_epi32( v, zero ), zero );
+				quad[0] = _mm_cvtsi128_si32( v );
+				memcpy( resampled + (y*resampled_width + x)*4, quad, 4 );
+			}
+			continue;
+		}
+		#endif
         for ( x = 0; x < resampled_width; ++x )
         {
 			float samplex = x * dx;
@@ -77,10 +314,209 @@ int
             }
         }
     }
+}
+
+/*	Upscaling the image uses simple bilinear interpolation	*/
+int
+	up_scale_image
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char* resampled,
+		int resampled_width, int resampled_height
+	)
+{
+	up_scale_job job;
+
+    /* error(s) check	*/
+    if ( 	(width < 1) || (height < 1) ||
+            (resampled_width < 2) || (resampled_height < 2) ||
+            (channels < 1) ||
+            (NULL == orig) || (NULL == resampled) )
+    {
+        /*	signify badness	*/
+        return 0;
+    }
+    /*
+		for each given pixel in the new map, find the exact location
+		from the original map which would contribute to this guy
+	*/
+	job.orig = orig;
+	job.width = width;
+	job.height = height;
+	job.channels = channels;
+	job.resampled = resampled;
+	job.resampled_width = resampled_width;
+	job.resampled_height = resampled_height;
+    job.dx = (width - 1.0f) / (resampled_width - 1.0f);
+    job.dy = (height - 1.0f) / (resampled_height - 1.0f);
+	job.simd = image_simd_level();
+	run_parallel_rows( resampled_height, image_row_grain( resampled_width*channels ),
+			image_thread_count, up_scale_rows, &job );
     /*	done	*/
     return 1;
 }
 
+typedef struct
+{
+	const unsigned char *orig;
+	int width, height, channels;
+	unsigned char *resampled;
+	int block_size_x, block_size_y;
+	int mip_width, mip_height;
+	int simd;
+}
+mipmap_job;
+
+/*	the general block average, for output rows [first, last)	*/
+static void mipmap_rows_scalar( const mipmap_job *job, int first, int last )
+{
+	const unsigned char* const orig = job->orig;
+	unsigned char* resampled = job->resampled;
+	const int width = job->width, height = job->height, channels = job->channels;
+	const int block_size_x = job->block_size_x, block_size_y = job->block_size_y;
+	const int mip_width = job->mip_width;
+	int i, j, c;
+	for( j = first; j < last; ++j )
+	{
+		for( i = 0; i < mip_width; ++i )
+		{
+			for( c = 0; c < channels; ++c )
+			{
+				const int index = (j*block_size_y)*width*channels + (i*block_size_x)*channels + c;
+				int sum_value;
+				int u,v;
+				int u_block = block_size_x;
+				int v_block = block_size_y;
+				int block_area;
+				/*	do a bit of checking so we don't over-run the boundaries
+					(necessary for non-square textures!)	*/
+				if( block_size_x * (i+1) > width )
+				{
+					u_block = width - i*block_size_y;
+				}
+				if( block_size_y * (j+1) > height )
+				{
+					v_block = height - j*block_size_y;
+				}
+				block_area = u_block*v_block;
+				/*	for this pixel, see what the average
+					of all the values in the block are.
+					note: start the sum at the rounding value, not at 0	*/
+				sum_value = block_area >> 1;
+				for( v = 0; v < v_block; ++v )
+				for( u = 0; u < u_block; ++u )
+				{
+					sum_value += orig[index + v*width*channels + u*channels];
+				}
+				resampled[j*mip_width*channels + i*channels + c] = sum_value / block_area;
+			}
+		}
+	}
+}
+
+#if IMAGE_SSE2
+/*
+	One output row of a 2x2 box filter, both source rows present:
+	(a + b + c + d + 2) >> 2 per byte, exactly what the general
+	loop computes for a full 2x2 block
+*/
+static void mipmap_row_2x2_SSE2(
+		const unsigned char *r0, const unsigned char *r1,
+		unsigned char *out, int mip_width, int channels )
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16( 2 );
+	const __m128i ones = _mm_set1_epi16( 1 );
+	const int n = mip_width * channels;
+	int k = 0;
+	/*	16 output bytes from 32 bytes of each row	*/
+	for( ; (channels != 3) && (k + 16 <= n); k += 16 )
+	{
+		__m128i a0 = _mm_loadu_si128( (const __m128i*)(r0 + 2*k) );
+		__m128i a1 = _mm_loadu_si128( (const __m128i*)(r0 + 2*k + 16) );
+		__m128i b0 = _mm_loadu_si128( (const __m128i*)(r1 + 2*k) );
+		__m128i b1 = _mm_loadu_si128( (const __m128i*)(r1 + 2*k + 16) );
+		/*	vertical sums, 8 bytes per register	*/
+		__m128i s0 = _mm_add_epi16( _mm_unpacklo_epi8( a0, zero ), _mm_unpacklo_epi8( b0, zero ) );
+		__m128i s1 = _mm_add_epi16( _mm_unpackhi_epi8( a0, zero ), _mm_unpackhi_epi8( b0, zero ) );
+		__m128i s2 = _mm_add_epi16( _mm_unpacklo_epi8( a1, zero ), _mm_unpacklo_epi8( b1, zero ) );
+		__m128i s3 = _mm_add_epi16( _mm_unpackhi_epi8( a1, zero ), _mm_unpackhi_epi8( b1, zero ) );
+		__m128i h0, h1;
+		/*	horizontal: add each pixel to its right neighbour	*/
+		if( channels == 4 )
+		{
+			h0 = _mm_add_epi16( _mm_unpacklo_epi64( s0, s1 ), _mm_unpackhi_epi64( s0, s1 ) );
+			h1 = _mm_add_epi16( _mm_unpacklo_epi64( s2, s3 ), _mm_unpackhi_epi64( s2, s3 ) );
+		} else if( channels == 2 )
+		{
+			s0 = _mm_shuffle_epi32( _mm_add_epi16( s0, _mm_srli_epi64( s0, 32 ) ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+			s1 = _mm_shuffle_epi32( _mm_add_epi16( s1, _mm_srli_epi64( s1, 32 ) ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+			s2 = _mm_shuffle_epi32( _mm_add_epi16( s2, _mm_srli_epi64( s2, 32 ) ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+			s3 = _mm_shuffle_epi32( _mm_add_epi16( s3, _mm_srli_epi64( s3, 32 ) ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+			h0 = _mm_unpacklo_epi64( s0, s1 );
+			h1 = _mm_unpacklo_epi64( s2, s3 );
+		} else
+		{
+			h0 = _mm_packs_epi32( _mm_madd_epi16( s0, ones ), _mm_madd_epi16( s1, ones ) );
+			h1 = _mm_packs_epi32( _mm_madd_epi16( s2, ones ), _mm_madd_epi16( s3, ones ) );
+		}
+		h0 = _mm_srli_epi16( _mm_add_epi16( h0, two ), 2 );
+		h1 = _mm_srli_epi16( _mm_add_epi16( h1, two ), 2 );
+		_mm_storeu_si128( (__m128i*)(out + k), _mm_packus_epi16( h0, h1 ) );
+	}
+	/*	RGB: vertical sums of 8 pixels, then pairs	*/
+	for( ; (channels == 3) && (k + 12 <= n); k += 12 )
+	{
+		IMAGE_ALIGN32 unsigned short sum[24];
+		__m128i a0 = _mm_loadu_si128( (const __m128i*)(r0 + 2*k) );
+		__m128i b0 = _mm_loadu_si128( (const __m128i*)(r1 + 2*k) );
+		__m128i a1 = _mm_loadl_epi64( (const __m128i*)(r0 + 2*k + 16) );
+		__m128i b1 = _mm_loadl_epi64( (const __m128i*)(r1 + 2*k + 16) );
+		int t;
+		_mm_store_si128( (__m128i*)sum, _mm_add_epi16( _mm_unpacklo_epi8( a0, zero ), _mm_unpacklo_epi8( b0, zero ) ) );
+		_mm_store_si128( (__m128i*)(sum + 8), _mm_add_epi16( _mm_unpackhi_epi8( a0, zero ), _mm_unpackhi_epi8( b0, zero ) ) );
+		_mm_store_si128( (__m128i*)(sum + 16), _mm_add_epi16( _mm_unpacklo_epi8( a1, zero ), _mm_unpacklo_epi8( b1, zero ) ) );
+		for( t = 0; t < 12; ++t )
+		{
+			const int o = (t / 3) * 6 + (t % 3);
+			out[k + t] = (unsigned char)((sum[o] + sum[o + 3] + 2) >> 2);
+		}
+	}
+	for( ; k < n; ++k )
+	{
+		const int o = (k / channels) * 2 * channels + (k % channels);
+		out[k] = (unsigned char)((r0[o] + r0[o + channels] + r1[o] + r1[o + channels] + 2) >> 2);
+	}
+}
+#endif
+
+static void mipmap_rows( void *data, int first, int last )
+{
+	const mipmap_job *job = (const mipmap_job*)data;
+	#if IMAGE_SSE2
+	/*	full 2x2 blocks (every row but an odd height's last one) go through SSE2	*/
+	if( job->simd >= 1 && job->block_size_x == 2 && job->block_size_y == 2 && job->width >= 2 )
+	{
+		const size_t stride = (size_t)job->width * job->channels;
+		int j;
+		for( j = first; j < last; ++j )
+		{
+			if( 2*j + 1 < job->height )
+			{
+				mipmap_row_2x2_SSE2( job->orig + 2*j*stride, job->orig + (2*j + 1)*stride,
+						job->resampled + (size_t)j*job->mip_width*job->channels, job->mip_width, job->channels );
+			} else
+			{
+				mipmap_rows_scalar( job, j, j + 1 );
+			}
+		}
+		return;
+	}
+	#endif
+	mipmap_rows_scalar( job, first, last );
+}
+
 int
 	mipmap_image
 	(
@@ -90,8 +526,7 @@ int
 		int block_size_x, int block_size_y
 	)
 {
-	int mip_width, mip_height;
-	int i, j, c;
+	mipmap_job job;
 
 	/*	error check	*/
 	if( (width < 1) || (height < 1) ||
@@ -102,55 +537,378 @@ int
 		/*	nothing to do	*/
 		return 0;
 	}
-	mip_width = width / block_size_x;
-	mip_height = height / block_size_y;
-	if( mip_width < 1 )
+	job.mip_width = width / block_size_x;
+	job.mip_height = height / block_size_y;
+	if( job.mip_width < 1 )
 	{
-		mip_width = 1;
+		job.mip_width = 1;
 	}
-	if( mip_height < 1 )
+	if( job.mip_height < 1 )
 	{
-		mip_height = 1;
+		job.mip_height = 1;
 	}
-	for( j = 0; j < mip_height; ++j )
+	job.orig = orig;
+	job.width = width;
+	job.height = height;
+	job.channels = channels;
+	job.resampled = resampled;
+	job.block_size_x = block_size_x;
+	job.block_size_y = block_size_y;
+	job.simd = image_simd_level();
+	/*	the work is in the source rows: block_size_y of them per output row	*/
+	run_parallel_rows( job.mip_height, image_row_grain( width*channels*block_size_y ),
+			image_thread_count, mipmap_rows, &job );
+	return 1;
+}
+
+/*
+	sRGB <-> linear in 16-bit fixed point. The 64k entry table
+	maps every linear value back to the nearest sRGB byte, so the
+	scalar and the AVX2 (gather) versions agree to the bit.
+*/
+static unsigned short sRGB_to_linear16[256 + 2];	/*	+2: the gathers read 32 bits	*/
+static unsigned char linear16_to_sRGB[65536 + 4];	/*	+4: the gathers read 32 bits	*/
+
+static void fill_sRGB_tables( void )
+{
+	int i;
+	for( i = 0; i < 256; ++i )
 	{
-		for( i = 0; i < mip_width; ++i )
+		double v = i / 255.0;
+		v = (v <= 0.04045) ? v / 12.92 : pow( (v + 0.055) / 1.055, 2.4 );
+		sRGB_to_linear16[i] = (unsigned short)(v * 65535.0 + 0.5);
+	}
+	for( i = 0; i < 65536; ++i )
+	{
+		double v = i / 65535.0;
+		v = (v <= 0.0031308) ? v * 12.92 : 1.055 * pow( v, 1.0 / 2.4 ) - 0.055;
+		v = v * 255.0 + 0.5;
+		linear16_to_sRGB[i] = (unsigned char)(v < 0.0 ? 0 : (v > 255.0 ? 255 : v));
+	}
+}
+
+/*	built once, by whichever thread gets there first; the others wait for it	*/
+#ifdef IMAGE_WIN32_THREADS
+static INIT_ONCE sRGB_tables_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK fill_sRGB_tables_once( PINIT_ONCE once, PVOID param, PVOID *context )
+{
+	(void)once; (void)param; (void)context;
+	fill_sRGB_tables();
+	return TRUE;
+}
+
+static void build_sRGB_tables( void )
+{
+	InitOnceExecuteOnce( &sRGB_tables_once, fill_sRGB_tables_once, NULL, NULL );
+}
+#else
+static pthread_once_t sRGB_tables_once = PTHREAD_ONCE_INIT;
+
+static void build_sRGB_tables( void )
+{
+	pthread_once( &sRGB_tables_once, fill_sRGB_tables );
+}
+#endif
+
+static void mipmap_sRGB_rows_scalar( const mipmap_job *job, int first, int last )
+{
+	const unsigned char* const orig = job->orig;
+	const int width = job->width, height = job->height, channels = job->channels;
+	const int block_size_x = job->block_size_x, block_size_y = job->block_size_y;
+	/*	for channels = 2 or 4, the last one is alpha, and linear	*/
+	const int color_channels = channels - (1 - (channels & 1));
+	int i, j, c;
+	for( j = first; j < last; ++j )
+	{
+		for( i = 0; i < job->mip_width; ++i )
 		{
 			for( c = 0; c < channels; ++c )
 			{
 				const int index = (j*block_size_y)*width*channels + (i*block_size_x)*channels + c;
-				int sum_value;
-				int u,v;
+				int u, v, sum_value;
 				int u_block = block_size_x;
 				int v_block = block_size_y;
 				int block_area;
-				/*	do a bit of checking so we don't over-run the boundaries
-					(necessary for non-square textures!)	*/
 				if( block_size_x * (i+1) > width )
 				{
-					u_block = width - i*block_size_y;
+					u_block = width - i*block_size_x;
 				}
 				if( block_size_y * (j+1) > height )
 				{
 					v_block = height - j*block_size_y;
 				}
 				block_area = u_block*v_block;
-				/*	for this pixel, see what the average
-					of all the values in the block are.
-					note: start the sum at the rounding value, not at 0	*/
 				sum_value = block_area >> 1;
 				for( v = 0; v < v_block; ++v )
 				for( u = 0; u < u_block; ++u )
 				{
-					sum_value += orig[index + v*width*channels + u*channels];
+					const unsigned char value = orig[index + v*width*channels + u*channels];
+					sum_value += (c < color_channels) ? sRGB_to_linear16[value] : value;
 				}
-				resampled[j*mip_width*channels + i*channels + c] = sum_value / block_area;
+				sum_value /= block_area;
+				job->resampled[j*job->mip_width*channels + i*channels + c] =
+						(c < color_channels) ? linear16_to_sRGB[sum_value] : (unsigned char)sum_value;
 			}
 		}
 	}
+}
+
+/*	output bytes [k, n) of a row of the 2x2 sRGB filter, both source rows present	*/
+static void mipmap_sRGB_row_2x2( const unsigned char *r0, const unsigned char *r1,
+		unsigned char *out, int k, int n, int channels )
+{
+	const int color_channels = channels - (1 - (channels & 1));
+	for( ; k < n; ++k )
+	{
+		const int o = (k / channels) * 2 * channels + (k % channels);
+		if( (k % channels) < color_channels )
+		{
+			out[k] = linear16_to_sRGB[(sRGB_to_linear16[r0[o]] + sRGB_to_linear16[r0[o + channels]] +
+					sRGB_to_linear16[r1[o]] + sRGB_to_linear16[r1[o + channels]] + 2) >> 2];
+		} else
+		{
+			out[k] = (unsigned char)((r0[o] + r0[o + channels] + r1[o] + r1[o + channels] + 2) >> 2);
+		}
+	}
+}
+
+#if IMAGE_AVX2
+/*
+	8 outputs of the 2x2 sRGB filter from the 4 source bytes of each
+	(one per 32-bit lane): the color lanes are averaged through the
+	tables, the alpha lanes directly
+*/
+IMAGE_TARGET_AVX2
+static void mipmap_sRGB_store_AVX2( __m256i a, __m256i b, __m256i c, __m256i d, __m256i alpha, unsigned char *out )
+{
+	const __m256i byte_mask = _mm256_set1_epi32( 0xFF );
+	const __m256i word_mask = _mm256_set1_epi32( 0xFFFF );
+	const __m256i two = _mm256_set1_epi32( 2 );
+	__m256i lin, avg, packed;
+	int value;
+	lin = _mm256_add_epi32(
+			_mm256_add_epi32(
+				_mm256_and_si256( _mm256_i32gather_epi32( (const int*)sRGB_to_linear16, a, 2 ), word_mask ),
+				_mm256_and_si256( _mm256_i32gather_epi32( (const int*)sRGB_to_linear16, b, 2 ), word_mask ) ),
+			_mm256_add_epi32(
+				_mm256_and_si256( _mm256_i32gather_epi32( (const int*)sRGB_to_linear16, c, 2 ), word_mask ),
+				_mm256_and_si256( _mm256_i32gather_epi32( (const int*)sRGB_to_linear16, d, 2 ), word_mask ) ) );
+	lin = _mm256_srli_epi32( _mm256_add_epi32( lin, two ), 2 );
+	lin = _mm256_and_si256( _mm256_i32gather_epi32( (const int*)linear16_to_sRGB, lin, 1 ), byte_mask );
+	avg = _mm256_srli_epi32( _mm256_add_epi32( _mm256_add_epi32( _mm256_add_epi32( a, b ), _mm256_add_epi32( c, d ) ), two ), 2 );
+	/*	8 dwords to 8 bytes: the low 4 of each 128-bit half	*/
+	packed = _mm256_blendv_epi8( lin, avg, alpha );
+	packed = _mm256_packus_epi16( _mm256_packus_epi32( packed, packed ), packed );
+	value = _mm_cvtsi128_si32( _mm256_castsi256_si128( packed ) );
+	memcpy( out, &value, 4 );
+	value = _mm_cvtsi128_si32( _mm256_extracti128_si256( packed, 1 ) );
+	memcpy( out + 4, &value, 4 );
+}
+
+/*
+	One output row of the 2x2 sRGB filter, 8 output bytes per
+	register: the source bytes and both table look-ups are gathers.
+	Returns how many output bytes it wrote.
+*/
+IMAGE_TARGET_AVX2
+static int mipmap_sRGB_row_2x2_AVX2(
+		const unsigned char *r0, const unsigned char *r1, int row_bytes,
+		unsigned char *out, int n, int channels )
+{
+	const int color_channels = channels - (1 - (channels & 1));
+	/*	8 lanes cover whole pixels every 'phases' groups (3 for RGB)	*/
+	const int phases = (channels == 3) ? 3 : 1;
+	const __m256i byte_mask = _mm256_set1_epi32( 0xFF );
+	IMAGE_ALIGN32 int offset[3][8], alpha[3][8];
+	IMAGE_ALIGN32 char left[16], right[16];
+	int k, t, p;
+	for( p = 0; p < phases; ++p )
+	{
+		for( t = 0; t < 8; ++t )
+		{
+			const int o = 8*p + t;
+			offset[p][t] = (o / channels) * 2 * channels + (o % channels);
+			alpha[p][t] = (o % channels) >= color_channels ? -1 : 0;
+		}
+	}
+	/*	1, 2 or 4 channels: a group's source bytes are the 16 at 'src',
+		so they come from a load and a byte shuffle instead of gathers	*/
+	for( t = 0; t < 16; ++t )
+	{
+		left[t] = (char)(t < 8 ? offset[0][t] : 0x80);
+		right[t] = (char)(t < 8 ? offset[0][t] + channels : 0x80);
+	}
+	if( phases == 1 )
+	{
+		const __m128i shuffle_left = _mm_load_si128( (const __m128i*)left );
+		const __m128i shuffle_right = _mm_load_si128( (const __m128i*)right );
+		for( k = 0; k + 8 <= n && 2*k + 16 <= row_bytes; k += 8 )
+		{
+			const __m128i s0 = _mm_loadu_si128( (const __m128i*)(r0 + 2*k) );
+			const __m128i s1 = _mm_loadu_si128( (const __m128i*)(r1 + 2*k) );
+			const __m256i a = _mm256_cvtepu8_epi32( _mm_shuffle_epi8( s0, shuffle_left ) );
+			const __m256i b = _mm256_cvtepu8_epi32( _mm_shuffle_epi8( s0, shuffle_right ) );
+			const __m256i c = _mm256_cvtepu8_epi32( _mm_shuffle_epi8( s1, shuffle_left ) );
+			const __m256i d = _mm256_cvtepu8_epi32( _mm_shuffle_epi8( s1, shuffle_right ) );
+			mipmap_sRGB_store_AVX2( a, b, c, d, _mm256_load_si256( (const __m256i*)alpha[0] ), out + k );
+		}
+		_mm256_zeroupper();
+		return k;
+	}
+	for( k = 0; k + 8 <= n; k += 8 )
+	{
+		/*	source bytes of this group: the phase's offsets plus twice the whole periods before it	*/
+		const int group = k >> 3;
+		const int src = (group / phases) * 16 * phases;
+		const __m256i off = _mm256_load_si256( (const __m256i*)offset[group % phases] );
+		__m256i a, b, c, d;
+		/*	the gathers read 4 bytes: stop where that would leave the row	*/
+		if( src + offset[group % phases][7] + channels + 4 > row_bytes )
+		{
+			break;
+		}
+		a = _mm256_and_si256( _mm256_i32gather_epi32( (const int*)(r0 + src), off, 1 ), byte_mask );
+		b = _mm256_and_si256( _mm256_i32gather_epi32( (const int*)(r0 + src + channels), off, 1 ), byte_mask );
+		c = _mm256_and_si256( _mm256_i32gather_epi32( (const int*)(r1 + src), off, 1 ), byte_mask );
+		d = _mm256_and_si256( _mm256_i32gather_epi32( (const int*)(r1 + src + channels), off, 1 ), byte_mask );
+		mipmap_sRGB_store_AVX2( a, b, c, d, _mm256_load_si256( (const __m256i*)alpha[group % phases] ), out + k );
+	}
+	_mm256_zeroupper();
+	return k;
+}
+#endif
+
+static void mipmap_sRGB_rows( void *data, int first, int last )
+{
+	const mipmap_job *job = (const mipmap_job*)data;
+	if( job->block_size_x == 2 && job->block_size_y == 2 && job->width >= 2 )
+	{
+		const int stride = job->width * job->channels;
+		const int n = job->mip_width * job->channels;
+		int j;
+		for( j = first; j < last; ++j )
+		{
+			if( 2*j + 1 < job->height )
+			{
+				const unsigned char *r0 = job->orig + (size_t)2*j*stride;
+				unsigned char *out = job->resampled + (size_t)j*n;
+				int k = 0;
+				#if IMAGE_AVX2
+				if( job->simd >= 2 )
+				{
+					k = mipmap_sRGB_row_2x2_AVX2( r0, r0 + stride, stride, out, n, job->channels );
+				}
+				#endif
+				mipmap_sRGB_row_2x2( r0, r0 + stride, out, k, n, job->channels );
+			} else
+			{
+				mipmap_sRGB_rows_scalar( job, j, j + 1 );
+			}
+		}
+		return;
+	}
+	mipmap_sRGB_rows_scalar( job, first, last );
+}
+
+int
+	mipmap_image_sRGB
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char* resampled,
+		int block_size_x, int block_size_y
+	)
+{
+	mipmap_job job;
+
+	/*	error check	*/
+	if( (width < 1) || (height < 1) ||
+		(channels < 1) || (orig == NULL) ||
+		(resampled == NULL) ||
+		(block_size_x < 1) || (block_size_y < 1) )
+	{
+		/*	nothing to do	*/
+		return 0;
+	}
+	build_sRGB_tables();
+	job.mip_width = width / block_size_x;
+	job.mip_height = height / block_size_y;
+	if( job.mip_width < 1 )
+	{
+		job.mip_width = 1;
+	}
+	if( job.mip_height < 1 )
+	{
+		job.mip_height = 1;
+	}
+	job.orig = orig;
+	job.width = width;
+	job.height = height;
+	job.channels = channels;
+	job.resampled = resampled;
+	job.block_size_x = block_size_x;
+	job.block_size_y = block_size_y;
+	job.simd = image_simd_level();
+	run_parallel_rows( job.mip_height, image_row_grain( width*channels*block_size_y ),
+			image_thread_count, mipmap_sRGB_rows, &job );
 	return 1;
 }
 
+typedef struct
+{
+	unsigned char *orig;
+	int row_bytes, channels;
+	const unsigned char *scale_LUT;
+	float scale_lo, scale_hi;
+	int simd;
+}
+NTSC_job;
+
+static void NTSC_rows( void *data, int first, int last )
+{
+	const NTSC_job *job = (const NTSC_job*)data;
+	unsigned char* const rows = job->orig + (size_t)first * job->row_bytes;
+	const int n = (last - first) * job->row_bytes;
+	const int channels = job->channels;
+	/*	for channels = 2 or 4, ignore the alpha component	*/
+	const int nc = channels - (1 - (channels & 1));
+	int i = 0, j;
+	#if IMAGE_SSE2
+	if( job->simd >= 1 && (channels == 2 || channels == 4) )
+	{
+		/*	16 bytes at a time, in the LUT's float order: (d*i)/255 + lo	*/
+		const __m128 d = _mm_set1_ps( job->scale_hi - job->scale_lo );
+		const __m128 lo = _mm_set1_ps( job->scale_lo );
+		const __m128 c255 = _mm_set1_ps( 255.0f );
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i alpha = channels == 4 ? _mm_set1_epi32( (int)0xFF000000 ) : _mm_set1_epi16( (short)0xFF00 );
+		for( ; i + 16 <= n; i += 16 )
+		{
+			const __m128i v = _mm_loadu_si128( (const __m128i*)(rows + i) );
+			const __m128i lo16 = _mm_unpacklo_epi8( v, zero );
+			const __m128i hi16 = _mm_unpackhi_epi8( v, zero );
+			__m128i q0 = _mm_cvttps_epi32( _mm_add_ps( _mm_div_ps( _mm_mul_ps( d, _mm_cvtepi32_ps( _mm_unpacklo_epi16( lo16, zero ) ) ), c255 ), lo ) );
+			__m128i q1 = _mm_cvttps_epi32( _mm_add_ps( _mm_div_ps( _mm_mul_ps( d, _mm_cvtepi32_ps( _mm_unpackhi_epi16( lo16, zero ) ) ), c255 ), lo ) );
+			__m128i q2 = _mm_cvttps_epi32( _mm_add_ps( _mm_div_ps( _mm_mul_ps( d, _mm_cvtepi32_ps( _mm_unpacklo_epi16( hi16, zero ) ) ), c255 ), lo ) );
+			__m128i q3 = _mm_cvttps_epi32( _mm_add_ps( _mm_div_ps( _mm_mul_ps( d, _mm_cvtepi32_ps( _mm_unpackhi_epi16( hi16, zero ) ) ), c255 ), lo ) );
+			__m128i q = _mm_packus_epi16( _mm_packs_epi32( q0, q1 ), _mm_packs_epi32( q2, q3 ) );
+			/*	alpha bytes pass through	*/
+			q = _mm_or_si128( _mm_and_si128( v, alpha ), _mm_andnot_si128( alpha, q ) );
+			_mm_storeu_si128( (__m128i*)(rows + i), q );
+		}
+	}
+	#endif
+	/*	OK, go through the image and scale any non-alpha components	*/
+	for( ; i < n; i += channels )
+	{
+		for( j = 0; j < nc; ++j )
+		{
+			rows[i+j] = job->scale_LUT[rows[i+j]];
+		}
+	}
+}
+
 int
 	scale_image_RGB_to_NTSC_safe
 	(
@@ -160,9 +918,9 @@ int
 {
 	const float scale_lo = 16.0f - 0.499f;
 	const float scale_hi = 235.0f + 0.499f;
-	int i, j;
-	int nc = channels;
+	int i;
 	unsigned char scale_LUT[256];
+	NTSC_job job;
 	/*	error check	*/
 	if( (width < 1) || (height < 1) ||
 		(channels < 1) || (orig == NULL) )
@@ -175,21 +933,98 @@ int
 	{
 		scale_LUT[i] = (unsigned char)((scale_hi - scale_lo) * i / 255.0f + scale_lo);
 	}
-	/*	for channels = 2 or 4, ignore the alpha component	*/
-	nc -= 1 - (channels & 1);
-	/*	OK, go through the image and scale any non-alpha components	*/
-	for( i = 0; i < width*height*channels; i += channels )
+	job.orig = orig;
+	job.row_bytes = width*channels;
+	job.channels = channels;
+	job.scale_LUT = scale_LUT;
+	job.scale_lo = scale_lo;
+	job.scale_hi = scale_hi;
+	job.simd = image_simd_level();
+	run_parallel_rows( height, image_row_grain( job.row_bytes ), image_thread_count, NTSC_rows, &job );
+	return 1;
+}
+
+unsigned char clamp_byte( int x ) { return ( (x) < 0 ? (0) : ( (x) > 255 ? 255 : (x) ) ); }
+
+typedef struct
+{
+	unsigned char *orig;
+	int width, channels;
+	int simd;
+}
+YCoCg_job;
+
+static void RGB_to_YCoCg_rows( void *data, int first, int last )
+{
+	const YCoCg_job *job = (const YCoCg_job*)data;
+	unsigned char* const orig = job->orig + (size_t)first * job->width * job->channels;
+	const int n = (last - first) * job->width * job->channels;
+	int i = 0;
+	if( job->channels == 3 )
 	{
-		for( j = 0; j < nc; ++j )
+		for( ; i < n; i += 3 )
+		{
+			int r = orig[i+0];
+			int g = (orig[i+1] + 1) >> 1;
+			int b = orig[i+2];
+			int tmp = (2 + r + b) >> 2;
+			/*	Co	*/
+			orig[i+0] = clamp_byte( 128 + ((r - b + 1) >> 1) );
+			/*	Y	*/
+			orig[i+1] = clamp_byte( g + tmp );
+			/*	Cg	*/
+			orig[i+2] = clamp_byte( 128 + g - tmp );
+		}
+		return;
+	}
+	#if IMAGE_SSE2
+	if( job->simd >= 1 )
+	{
+		/*	4 pixels, one per 32-bit lane; only the top can overflow (to 256)	*/
+		const __m128i byte = _mm_set1_epi32( 0xFF );
+		const __m128i one = _mm_set1_epi32( 1 );
+		const __m128i two = _mm_set1_epi32( 2 );
+		const __m128i c128 = _mm_set1_epi32( 128 );
+		for( ; i + 16 <= n; i += 16 )
 		{
-			orig[i+j] = scale_LUT[orig[i+j]];
+			const __m128i v = _mm_loadu_si128( (const __m128i*)(orig + i) );
+			const __m128i r = _mm_and_si128( v, byte );
+			const __m128i g = _mm_srli_epi32( _mm_add_epi32( _mm_and_si128( _mm_srli_epi32( v, 8 ), byte ), one ), 1 );
+			const __m128i b = _mm_and_si128( _mm_srli_epi32( v, 16 ), byte );
+			const __m128i a = _mm_srli_epi32( v, 24 );
+			const __m128i tmp = _mm_srli_epi32( _mm_add_epi32( _mm_add_epi32( r, b ), two ), 2 );
+			__m128i co = _mm_add_epi32( c128, _mm_srai_epi32( _mm_add_epi32( _mm_sub_epi32( r, b ), one ), 1 ) );
+			__m128i cg = _mm_sub_epi32( _mm_add_epi32( c128, g ), tmp );
+			__m128i y = _mm_add_epi32( g, tmp );
+			/*	min( x, 255 ) for x in [0, 256]	*/
+			co = _mm_sub_epi32( co, _mm_srli_epi32( co, 8 ) );
+			cg = _mm_sub_epi32( cg, _mm_srli_epi32( cg, 8 ) );
+			y = _mm_sub_epi32( y, _mm_srli_epi32( y, 8 ) );
+			/*	CoCgAY	*/
+			_mm_storeu_si128( (__m128i*)(orig + i), _mm_or_si128(
+					_mm_or_si128( co, _mm_slli_epi32( cg, 8 ) ),
+					_mm_or_si128( _mm_slli_epi32( a, 16 ), _mm_slli_epi32( y, 24 ) ) ) );
 		}
 	}
-	return 1;
+	#endif
+	for( ; i < n; i += 4 )
+	{
+		int r = orig[i+0];
+		int g = (orig[i+1] + 1) >> 1;
+		int b = orig[i+2];
+		unsigned char a = orig[i+3];
+		int tmp = (2 + r + b) >> 2;
+		/*	Co	*/
+		orig[i+0] = clamp_byte( 128 + ((r - b + 1) >> 1) );
+		/*	Cg	*/
+		orig[i+1] = clamp_byte( 128 + g - tmp );
+		/*	Alpha	*/
+		orig[i+2] = a;
+		/*	Y	*/
+		orig[i+3] = clamp_byte( g + tmp );
+	}
 }
 
-unsigned char clamp_byte( int x ) { return ( (x) < 0 ? (0) : ( (x) > 255 ? 255 : (x) ) ); }
-
 /*
 	This function takes the RGB components of the image
 	and converts them into YCoCg.  3 components will be
@@ -204,7 +1039,7 @@ int
 		int width, int height, int channels
 	)
 {
-	int i;
+	YCoCg_job job;
 	/*	error check	*/
 	if( (width < 1) || (height < 1) ||
 		(channels < 3) || (channels > 4) ||
@@ -214,40 +1049,11 @@ int
 		return -1;
 	}
 	/*	do the conversion	*/
-	if( channels == 3 )
-	{
-		for( i = 0; i < width*height*3; i += 3 )
-		{
-			int r = orig[i+0];
-			int g = (orig[i+1] + 1) >> 1;
-			int b = orig[i+2];
-			int tmp = (2 + r + b) >> 2;
-			/*	Co	*/
-			orig[i+0] = clamp_byte( 128 + ((r - b + 1) >> 1) );
-			/*	Y	*/
-			orig[i+1] = clamp_byte( g + tmp );
-			/*	Cg	*/
-			orig[i+2] = clamp_byte( 128 + g - tmp );
-		}
-	} else
-	{
-		for( i = 0; i < width*height*4; i += 4 )
-		{
-			int r = orig[i+0];
-			int g = (orig[i+1] + 1) >> 1;
-			int b = orig[i+2];
-			unsigned char a = orig[i+3];
-			int tmp = (2 + r + b) >> 2;
-			/*	Co	*/
-			orig[i+0] = clamp_byte( 128 + ((r - b + 1) >> 1) );
-			/*	Cg	*/
-			orig[i+1] = clamp_byte( 128 + g - tmp );
-			/*	Alpha	*/
-			orig[i+2] = a;
-			/*	Y	*/
-			orig[i+3] = clamp_byte( g + tmp );
-		}
-	}
+	job.orig = orig;
+	job.width = width;
+	job.channels = channels;
+	job.simd = image_simd_level();
+	run_parallel_rows( height, image_row_grain( width*channels ), image_thread_count, RGB_to_YCoCg_rows, &job );
 	/*	done	*/
 	return 0;
 }
@@ -309,6 +1115,16 @@ int
 	return 0;
 }
 
+/*	ldexp( 1/255, e - 128 ) for every exponent byte: the scale of an RGBE pixel	*/
+static void build_RGBE_table( float table[256] )
+{
+	int i;
+	for( i = 0; i < 256; ++i )
+	{
+		table[i] = (float)ldexp( 1.0f / 255.0f, i - 128 );
+	}
+}
+
 float
 find_max_RGBE
 (
@@ -318,11 +1134,13 @@ find_max_RGBE
 {
 	float max_val = 0.0f;
 	unsigned char *img = image;
+	float exponent[256];
 	int i, j;
+	build_RGBE_table( exponent );
 	for( i = width * height; i > 0; --i )
 	{
 		/* float scale = powf( 2.0f, img[3] - 128.0f ) / 255.0f; */
-		float scale = (float)ldexp( 1.0f / 255.0f, (int)(img[3]) - 128 );
+		float scale = exponent[img[3]];
 		for( j = 0; j < 3; ++j )
 		{
 			if( img[j] * scale > max_val )
@@ -336,34 +1154,137 @@ find_max_RGBE
 	return max_val;
 }
 
-int
-RGBE_to_RGBdivA
-(
-    unsigned char *image,
-    int width, int height,
-    int rescale_to_max
-)
+typedef struct
 {
-	/* local variables */
-	int i, iv;
-	unsigned char *img = image;
-	float scale = 1.0f;
-	/* error check */
-	if( (!image) || (width < 1) || (height < 1) )
+	unsigned char *image;
+	int width;
+	float scale;
+	float exponent[256];
+	int simd;
+}
+RGBE_job;
+
+#if IMAGE_SSE2
+/*
+	The RGBdivA encode of 4 pixels (one per lane) given their
+	e * (r,g,b), in the scalar loop's float order
+*/
+static __m128i RGBdivA_encode_SSE2( __m128 r, __m128 g, __m128 b )
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 half = _mm_set1_ps( 0.5f );
+	const __m128i one = _mm_set1_epi32( 1 );
+	const __m128i c255 = _mm_set1_epi32( 255 );
+	const __m128 m = _mm_max_ps( b, _mm_max_ps( r, g ) );
+	/*	iv = (m != 0) ? (int)(255/m) : 1, clamped to [1,255]	*/
+	const __m128 nonzero = _mm_cmpneq_ps( m, zero );
+	__m128i iv = _mm_cvttps_epi32( _mm_div_ps( _mm_set1_ps( 255.0f ), m ) );
+	__m128i a, ir, ig, ib, lt;
+	__m128 fa;
+	iv = _mm_or_si128( _mm_and_si128( _mm_castps_si128( nonzero ), iv ), _mm_andnot_si128( _mm_castps_si128( nonzero ), one ) );
+	lt = _mm_cmplt_epi32( iv, one );
+	a = _mm_or_si128( _mm_and_si128( lt, one ), _mm_andnot_si128( lt, iv ) );
+	lt = _mm_cmpgt_epi32( a, c255 );
+	a = _mm_or_si128( _mm_and_si128( lt, c255 ), _mm_andnot_si128( lt, a ) );
+	fa = _mm_cvtepi32_ps( a );
+	/*	(int)(a * c + 0.5f), at most 255	*/
+	ir = _mm_cvttps_epi32( _mm_add_ps( _mm_mul_ps( fa, r ), half ) );
+	ig = _mm_cvttps_epi32( _mm_add_ps( _mm_mul_ps( fa, g ), half ) );
+	ib = _mm_cvttps_epi32( _mm_add_ps( _mm_mul_ps( fa, b ), half ) );
+	lt = _mm_cmpgt_epi32( ir, c255 );
+	ir = _mm_or_si128( _mm_and_si128( lt, c255 ), _mm_andnot_si128( lt, ir ) );
+	lt = _mm_cmpgt_epi32( ig, c255 );
+	ig = _mm_or_si128( _mm_and_si128( lt, c255 ), _mm_andnot_si128( lt, ig ) );
+	lt = _mm_cmpgt_epi32( ib, c255 );
+	ib = _mm_or_si128( _mm_and_si128( lt, c255 ), _mm_andnot_si128( lt, ib ) );
+	/*	the scalar code stores the low byte of whatever is left	*/
+	ir = _mm_and_si128( ir, c255 );
+	ig = _mm_and_si128( ig, c255 );
+	ib = _mm_and_si128( ib, c255 );
+	return _mm_or_si128( _mm_or_si128( ir, _mm_slli_epi32( ig, 8 ) ),
+			_mm_or_si128( _mm_slli_epi32( ib, 16 ), _mm_slli_epi32( a, 24 ) ) );
+}
+#endif
+
+#if IMAGE_AVX2
+/*	8 pixels: the same encode, with the exponent scales from a gather	*/
+IMAGE_TARGET_AVX2
+static int RGBE_to_RGBdivA_AVX2( unsigned char *img, int n, const float exponent[256], float scale )
+{
+	const __m256i byte = _mm256_set1_epi32( 0xFF );
+	const __m256i one = _mm256_set1_epi32( 1 );
+	const __m256 s = _mm256_set1_ps( scale );
+	const __m256 c255f = _mm256_set1_ps( 255.0f );
+	const __m256 half = _mm256_set1_ps( 0.5f );
+	int i;
+	for( i = 0; i + 8 <= n; i += 8 )
 	{
-		return 0;
+		const __m256i v = _mm256_loadu_si256( (const __m256i*)(img + 4*i) );
+		const __m256 e = _mm256_mul_ps( s, _mm256_i32gather_ps( exponent, _mm256_srli_epi32( v, 24 ), 4 ) );
+		const __m256 r = _mm256_mul_ps( e, _mm256_cvtepi32_ps( _mm256_and_si256( v, byte ) ) );
+		const __m256 g = _mm256_mul_ps( e, _mm256_cvtepi32_ps( _mm256_and_si256( _mm256_srli_epi32( v, 8 ), byte ) ) );
+		const __m256 b = _mm256_mul_ps( e, _mm256_cvtepi32_ps( _mm256_and_si256( _mm256_srli_epi32( v, 16 ), byte ) ) );
+		const __m256 m = _mm256_max_ps( b, _mm256_max_ps( r, g ) );
+		const __m256i nonzero = _mm256_castps_si256( _mm256_cmp_ps( m, _mm256_setzero_ps(), _CMP_NEQ_UQ ) );
+		__m256i a = _mm256_cvttps_epi32( _mm256_div_ps( c255f, m ) );
+		__m256 fa;
+		__m256i ir, ig, ib;
+		/*	(int)(255/m) where m != 0, else 1; then clamped to [1,255]	*/
+		a = _mm256_blendv_epi8( one, a, nonzero );
+		a = _mm256_min_epi32( _mm256_max_epi32( a, one ), byte );
+		fa = _mm256_cvtepi32_ps( a );
+		ir = _mm256_cvttps_epi32( _mm256_add_ps( _mm256_mul_ps( fa, r ), half ) );
+		ig = _mm256_cvttps_epi32( _mm256_add_ps( _mm256_mul_ps( fa, g ), half ) );
+		ib = _mm256_cvttps_epi32( _mm256_add_ps( _mm256_mul_ps( fa, b ), half ) );
+		/*	at most 255, and the scalar code stores the low byte of whatever is left	*/
+		ir = _mm256_and_si256( _mm256_min_epi32( ir, byte ), byte );
+		ig = _mm256_and_si256( _mm256_min_epi32( ig, byte ), byte );
+		ib = _mm256_and_si256( _mm256_min_epi32( ib, byte ), byte );
+		_mm256_storeu_si256( (__m256i*)(img + 4*i), _mm256_or_si256(
+				_mm256_or_si256( ir, _mm256_slli_epi32( ig, 8 ) ),
+				_mm256_or_si256( _mm256_slli_epi32( ib, 16 ), _mm256_slli_epi32( a, 24 ) ) ) );
 	}
-	/* convert (note: no negative numbers, but 0.0 is possible) */
-	if( rescale_to_max )
+	_mm256_zeroupper();
+	return i;
+}
+#endif
+
+static void RGBE_to_RGBdivA_rows( void *data, int first, int last )
+{
+	const RGBE_job *job = (const RGBE_job*)data;
+	unsigned char *img = job->image + (size_t)first * job->width * 4;
+	const float scale = job->scale;
+	int i = 0, iv;
+	const int n = (last - first) * job->width;
+	#if IMAGE_AVX2
+	if( job->simd >= 2 )
+	{
+		i = RGBE_to_RGBdivA_AVX2( img, n, job->exponent, scale );
+	} else
+	#endif
+	#if IMAGE_SSE2
+	if( job->simd >= 1 )
 	{
-		scale = 255.0f / find_max_RGBE( image, width, height );
+		const __m128i byte = _mm_set1_epi32( 0xFF );
+		const __m128 s = _mm_set1_ps( scale );
+		for( ; i + 4 <= n; i += 4 )
+		{
+			const __m128i v = _mm_loadu_si128( (const __m128i*)(img + 4*i) );
+			const __m128 e = _mm_mul_ps( s, _mm_setr_ps( job->exponent[img[4*i + 3]], job->exponent[img[4*i + 7]],
+					job->exponent[img[4*i + 11]], job->exponent[img[4*i + 15]] ) );
+			_mm_storeu_si128( (__m128i*)(img + 4*i), RGBdivA_encode_SSE2(
+					_mm_mul_ps( e, _mm_cvtepi32_ps( _mm_and_si128( v, byte ) ) ),
+					_mm_mul_ps( e, _mm_cvtepi32_ps( _mm_and_si128( _mm_srli_epi32( v, 8 ), byte ) ) ),
+					_mm_mul_ps( e, _mm_cvtepi32_ps( _mm_and_si128( _mm_srli_epi32( v, 16 ), byte ) ) ) ) );
+		}
 	}
-	for( i = width * height; i > 0; --i )
+	#endif
+	for( img += 4*i; i < n; ++i )
 	{
 		/* decode this pixel, and find the max */
 		float r,g,b,e, m;
 		/* e = scale * powf( 2.0f, img[3] - 128.0f ) / 255.0f; */
-		e = scale * (float)ldexp( 1.0f / 255.0f, (int)(img[3]) - 128 );
+		e = scale * job->exponent[img[3]];
 		r = e * img[0];
 		g = e * img[1];
 		b = e * img[2];
@@ -382,37 +1303,48 @@ RGBE_to_RGBdivA
 		/* and on to the next pixel */
 		img += 4;
 	}
-	return 1;
 }
 
 int
-RGBE_to_RGBdivA2
+RGBE_to_RGBdivA
 (
     unsigned char *image,
     int width, int height,
     int rescale_to_max
 )
 {
-	/* local variables */
-	int i, iv;
-	unsigned char *img = image;
-	float scale = 1.0f;
+	RGBE_job job;
 	/* error check */
 	if( (!image) || (width < 1) || (height < 1) )
 	{
 		return 0;
 	}
 	/* convert (note: no negative numbers, but 0.0 is possible) */
+	job.scale = 1.0f;
 	if( rescale_to_max )
 	{
-		scale = 255.0f * 255.0f / find_max_RGBE( image, width, height );
+		job.scale = 255.0f / find_max_RGBE( image, width, height );
 	}
-	for( i = width * height; i > 0; --i )
+	job.image = image;
+	job.width = width;
+	job.simd = image_simd_level();
+	build_RGBE_table( job.exponent );
+	run_parallel_rows( height, image_row_grain( width*4 ), image_thread_count, RGBE_to_RGBdivA_rows, &job );
+	return 1;
+}
+
+static void RGBE_to_RGBdivA2_rows( void *data, int first, int last )
+{
+	const RGBE_job *job = (const RGBE_job*)data;
+	unsigned char *img = job->image + (size_t)first * job->width * 4;
+	const float scale = job->scale;
+	int i, iv;
+	for( i = (last - first) * job->width; i > 0; --i )
 	{
 		/* decode this pixel, and find the max */
 		float r,g,b,e, m;
 		/* e = scale * powf( 2.0f, img[3] - 128.0f ) / 255.0f; */
-		e = scale * (float)ldexp( 1.0f / 255.0f, (int)(img[3]) - 128 );
+		e = scale * job->exponent[img[3]];
 		r = e * img[0];
 		g = e * img[1];
 		b = e * img[2];
@@ -431,5 +1363,32 @@ RGBE_to_RGBdivA2
 		/* and on to the next pixel */
 		img += 4;
 	}
+}
+
+int
+RGBE_to_RGBdivA2
+(
+    unsigned char *image,
+    int width, int height,
+    int rescale_to_max
+)
+{
+	RGBE_job job;
+	/* error check */
+	if( (!image) || (width < 1) || (height < 1) )
+	{
+		return 0;
+	}
+	/* convert (note: no negative numbers, but 0.0 is possible) */
+	job.scale = 1.0f;
+	if( rescale_to_max )
+	{
+		job.scale = 255.0f * 255.0f / find_max_RGBE( image, width, height );
+	}
+	job.image = image;
+	job.width = width;
+	job.simd = image_simd_level();
+	build_RGBE_table( job.exponent );
+	run_parallel_rows( height, image_row_grain( width*4 ), image_thread_count, RGBE_to_RGBdivA2_rows, &job );
 	return 1;
 }
@@ -43,6 +43,20 @@ int
 		int block_size_x, int block_size_y
 	);
 
+/**
+	Same as mipmap_image, but the color channels are averaged
+	in linear space (the alpha of 2 or 4 channel images stays
+	linear), as sRGB textures should be.
+**/
+int
+	mipmap_image_sRGB
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char* resampled,
+		int block_size_x, int block_size_y
+	);
+
 /**
 	This function takes the RGB components of the image
 	and scales each channel from [0,255] to [16,235].
@@ -108,6 +122,40 @@ int
 		int rescale_to_max
 	);
 
+/**
+	Chooses how the functions above run: use_simd is the best
+	kernel allowed (0 scalar, 1 SSE2, 2 AVX2; the default), capped
+	by what the CPU has; thread_count splits the image in rows
+	(0 = one thread per core, the default). Every setting produces
+	the same bytes as the scalar single-thread path.
+**/
+void
+	set_image_helper_options
+	(
+		int use_simd, int thread_count
+	);
+
+/**
+	The SIMD level this CPU runs: 0 scalar, 1 SSE2, 2 AVX2
+**/
+int
+	get_CPU_SIMD_level
+	(
+		void
+	);
+
+/**
+	Calls func( data, first, last ) over disjoint ranges covering
+	[0, count), on up to 'threads' threads (0 = one per core) with
+	at least min_grain rows each, and returns when all are done.
+**/
+void
+	run_parallel_rows
+	(
+		int count, int min_grain, int threads,
+		void (*func)( void *data, int first, int last ), void *data
+	);
+
 #ifdef __cplusplus
 }
 #endif
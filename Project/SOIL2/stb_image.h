@@ -361,16 +361,24 @@ STBIDEF stbi_uc *stbi_load_from_file   (FILE *f, int *x, int *y, int *channels_i
 // for stbi_load_from_file, file pointer is left pointing immediately after image
 #endif
 
+// JPEGs are decoded straight to 1/2, 1/4 or 1/8 of their size (scale_shift 1, 2, 3) with a
+// reduced-size IDCT, rounding the dimensions up; other formats load at full size, so check *x, *y
+STBIDEF stbi_uc *stbi_load_from_memory_scaled(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, int scale_shift);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_scaled            (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, int scale_shift);
+#endif
+
 ////////////////////////////////////
 //
 // 16-bits-per-channel interface
 //
 
 STBIDEF stbi_us *stbi_load_16(char const *filename, int *x, int *y, int *channels_in_file, int desired_channels);
+STBIDEF stbi_us *stbi_load_16_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels);
 #ifndef STBI_NO_STDIO
 STBIDEF stbi_us *stbi_load_from_file_16(FILE *f, int *x, int *y, int *channels_in_file, int desired_channels);
 #endif
-// @TODO the other variants
+// @TODO the callbacks variant
 
 ////////////////////////////////////
 //
@@ -424,6 +432,9 @@ STBIDEF int      stbi_info_from_file  (FILE *f,                  int *x, int *y,
 
 
 
+// the three settings below are shared by every thread: set them once before
+// any decoding starts, or leave them alone and post-process per call instead
+//
 // for image formats that explicitly notate that they have premultiplied alpha,
 // we just return the colors as stored in the file. set this flag to force
 // unpremultiplication. results are undefined if the unpremultiply overflow.
@@ -697,6 +708,8 @@ typedef struct
 
    stbi_uc *img_buffer, *img_buffer_end;
    stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+   int jpeg_scale_shift; // JPEG only: decode at 1/2^shift size
 } stbi__context;
 
 
@@ -707,6 +720,7 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
 {
    s->io.read = NULL;
    s->read_from_callbacks = 0;
+   s->jpeg_scale_shift = 0;
    s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
    s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *) buffer+len;
 }
@@ -718,6 +732,7 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
    s->io_user_data = user;
    s->buflen = sizeof(s->buffer_start);
    s->read_from_callbacks = 1;
+   s->jpeg_scale_shift = 0;
    s->img_buffer_original = s->buffer_start;
    stbi__refill_buffer(s);
    s->img_buffer_original_end = s->img_buffer_end;
@@ -850,8 +865,22 @@ static void    *stbi__pkm_load(stbi__context *s, int *x, int *y, int *comp, int
 static int      stbi__pkm_info(stbi__context *s, int *x, int *y, int *comp);
 #endif
 
-// this is not threadsafe
-static const char *stbi__g_failure_reason;
+// one per thread, so decodes on several threads each report their own failure
+#ifndef STBI_THREAD_LOCAL
+   #if defined(__cplusplus) && __cplusplus >= 201103L
+      #define STBI_THREAD_LOCAL       thread_local
+   #elif defined(_MSC_VER)
+      #define STBI_THREAD_LOCAL       __declspec(thread)
+   #elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+      #define STBI_THREAD_LOCAL       _Thread_local
+   #elif defined(__GNUC__)
+      #define STBI_THREAD_LOCAL       __thread
+   #else
+      #define STBI_THREAD_LOCAL
+   #endif
+#endif
+
+static STBI_THREAD_LOCAL const char *stbi__g_failure_reason;
 
 STBIDEF const char *stbi_failure_reason(void)
 {
@@ -1197,6 +1226,20 @@ STBIDEF stbi_uc *stbi_load_from_file(FILE *f, int *x, int *y, int *comp, int req
    return result;
 }
 
+STBIDEF stbi_uc *stbi_load_scaled(char const *filename, int *x, int *y, int *comp, int req_comp, int scale_shift)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   unsigned char *result;
+   stbi__context s;
+   if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+   if (scale_shift < 0 || scale_shift > 3) { fclose(f); return stbi__errpuc("bad scale", "Internal error"); }
+   stbi__start_file(&s,f);
+   s.jpeg_scale_shift = scale_shift;
+   result = stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+   fclose(f);
+   return result;
+}
+
 STBIDEF stbi__uint16 *stbi_load_from_file_16(FILE *f, int *x, int *y, int *comp, int req_comp)
 {
    stbi__uint16 *result;
@@ -1230,6 +1273,22 @@ STBIDEF stbi_uc *stbi_load_from_memory(stbi_uc const *buffer, int len, int *x, i
    return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
 }
 
+STBIDEF stbi_us *stbi_load_16_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__load_and_postprocess_16bit(&s,x,y,comp,req_comp);
+}
+
+STBIDEF stbi_uc *stbi_load_from_memory_scaled(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int scale_shift)
+{
+   stbi__context s;
+   if (scale_shift < 0 || scale_shift > 3) return stbi__errpuc("bad scale", "Internal error");
+   stbi__start_mem(&s,buffer,len);
+   s.jpeg_scale_shift = scale_shift;
+   return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+}
+
 STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
 {
    stbi__context s;
@@ -1729,6 +1788,8 @@ typedef struct
    int scan_n, order[4];
    int restart_interval, todo;
 
+   int scale_shift; // decoded blocks are (8 >> scale_shift) pixels wide
+
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
    void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
@@ -2666,6 +2727,59 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// reduced-size IDCT: the low-frequency NxN corner of the coefficients through an N-point
+// inverse DCT (N = 8 >> shift, shift 1 or 2) gives the block downscaled by 8/N, with the
+// same 1/8 normalization as the full transform; shift 3 is just the DC term
+static void stbi__idct_scaled(stbi_uc *out, int out_stride, short data[64], int shift)
+{
+   // C(u) * cos((2x+1) u pi / 2N) in 1.11 fixed point, [x][u]
+   static const int k4[4][4] = {
+      { 1448,  1892,  1448,   784 },
+      { 1448,   784, -1448, -1892 },
+      { 1448,  -784, -1448,  1892 },
+      { 1448, -1892,  1448,  -784 }
+   };
+   static const int k2[2][2] = {
+      { 1448,  1448 },
+      { 1448, -1448 }
+   };
+   int tmp[16];
+   int n = 8 >> shift, x, y, u, v;
+   const int *k = shift == 1 ? &k4[0][0] : &k2[0][0];
+   if (shift >= 3) {
+      int dc = ((data[0] + 4) >> 3) + 128;
+      out[0] = stbi__clamp(dc);
+      return;
+   }
+   // columns: tmp[y][u] = sum over v of F(u,v) K(y,v), back to integer scale
+   for (y=0; y < n; ++y)
+      for (u=0; u < n; ++u) {
+         int sum = 0;
+         for (v=0; v < n; ++v)
+            sum += data[v*8+u] * k[y*n+v];
+         tmp[y*n+u] = (sum + 1024) >> 11;
+      }
+   // rows, with the 1/4 of the transform and the +128 level shift
+   for (y=0; y < n; ++y, out += out_stride)
+      for (x=0; x < n; ++x) {
+         int sum = 0;
+         for (u=0; u < n; ++u)
+            sum += tmp[y*n+u] * k[x*n+u];
+         out[x] = stbi__clamp(((sum + (1 << 12)) >> 13) + 128);
+      }
+}
+
+// inverse transform block (bx,by) of component n into its place in the component plane
+static void stbi__jpeg_idct(stbi__jpeg *z, int n, int bx, int by, short data[64])
+{
+   int bs = 8 >> z->scale_shift;
+   stbi_uc *out = z->img_comp[n].data + z->img_comp[n].w2*by*bs + bx*bs;
+   if (z->scale_shift)
+      stbi__idct_scaled(out, z->img_comp[n].w2, data, z->scale_shift);
+   else
+      z->idct_block_kernel(out, z->img_comp[n].w2, data);
+}
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
    stbi__jpeg_reset(z);
@@ -2684,7 +2798,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__jpeg_idct(z, n, i, j, data);
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2708,11 +2822,11 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   // by the basic H and V specified for the component
                   for (y=0; y < z->img_comp[n].v; ++y) {
                      for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
+                        int x2 = (i*z->img_comp[n].h + x);
+                        int y2 = (j*z->img_comp[n].v + y);
                         int ha = z->img_comp[n].ha;
                         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+                        stbi__jpeg_idct(z, n, x2, y2, data);
                      }
                   }
                }
@@ -2809,7 +2923,7 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__jpeg_idct(z, n, i, j, data);
             }
          }
       }
@@ -3039,8 +3153,9 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       //
       // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
       // so these muls can't overflow with 32-bit ints (which we require)
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      // (a scaled decode stores its blocks at 8 >> scale_shift pixels)
+      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * (8 >> z->scale_shift);
+      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * (8 >> z->scale_shift);
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
@@ -3050,10 +3165,10 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // align blocks for idct using mmx/sse
       z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
       if (z->progressive) {
-         // w2, h2 are multiples of 8 (see above)
-         z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-         z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+         // one 8x8 block of coefficients per block, whatever the output scale
+         z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+         z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w * 8, z->img_comp[i].coeff_h * 8, sizeof(short), 15);
          if (z->img_comp[i].raw_coeff == NULL)
             return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
          z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
@@ -3511,6 +3626,7 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
+   j->scale_shift = 0;
    j->idct_block_kernel = stbi__idct_block;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
@@ -3564,6 +3680,17 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    // load a jpeg image from whichever source, but leave in YCbCr format
    if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
 
+   // a scaled decode has its planes at 1/2^shift: resample and convert at that size
+   if (z->scale_shift) {
+      int round = (1 << z->scale_shift) - 1;
+      z->s->img_x = (z->s->img_x + round) >> z->scale_shift;
+      z->s->img_y = (z->s->img_y + round) >> z->scale_shift;
+      for (n=0; n < z->s->img_n; ++n) {
+         z->img_comp[n].x = (z->img_comp[n].x + round) >> z->scale_shift;
+         z->img_comp[n].y = (z->img_comp[n].y + round) >> z->scale_shift;
+      }
+   }
+
    // determine actual number of components to generate
    n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
@@ -3719,6 +3846,7 @@ static void * STBI_FORCE_STACK_ALIGN stbi__jpeg_load(stbi__context *s, int *x, i
    STBI_NOTUSED(ri);
    j->s = s;
    stbi__setup_jpeg(j);
+   j->scale_shift = s->jpeg_scale_shift;
    result = load_jpeg_image(j, x,y,comp,req_comp);
    STBI_FREE(j);
    return result;
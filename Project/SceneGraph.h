@@ -0,0 +1,193 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "FramePipeline.h"
+
+// Transform hierarchy for the articulated props. Node data lives in parallel arrays (SoA) in
+// depth-first order, so every subtree is the contiguous index range [node, subtreeEnd[node]).
+// World matrices are cached: Update() only walks the subtrees below nodes whose local transform
+// changed since the last call, so static nodes cost nothing per frame.
+class SceneGraph
+{
+public:
+	static const int NO_PARENT = -1;
+
+	// Adds a node under 'parent'. Nodes must be added depth-first: the parent has to be the last
+	// added node or one of its ancestors (that keeps subtrees contiguous).
+	int AddNode(int parent, const glm::vec3 &position, const glm::quat &rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f), const glm::vec3 &scale = glm::vec3(1.0f))
+	{
+		int node = (int)this->parents.size();
+		assert(parent < node);
+		assert(parent == NO_PARENT || this->subtreeEnd[parent] == node);
+
+		this->parents.push_back(parent);
+		this->subtreeEnd.push_back(node + 1);
+		this->positions.push_back(position);
+		this->rotations.push_back(rotation);
+		this->scales.push_back(scale);
+		this->local.push_back(glm::mat4(1.0f));
+		this->world.push_back(glm::mat4(1.0f));
+		this->localDirty.push_back(1);
+		this->dirtyNodes.push_back(node);
+
+		// Grow the range of every ancestor
+		for (int p = parent; p != NO_PARENT; p = this->parents[p])
+		{
+			this->subtreeEnd[p] = node + 1;
+		}
+		return node;
+	}
+
+	// Convenience: a node that is drawn as a procedural mesh with the given uMode
+	int AddPart(int parent, GLuint vao, GLsizei count, int mode, const glm::vec3 &position, const glm::quat &rotation, const glm::vec3 &scale)
+	{
+		int node = this->AddNode(parent, position, rotation, scale);
+		this->SetDrawable(node, vao, count, mode);
+		return node;
+	}
+
+	void SetDrawable(int node, GLuint vao, GLsizei count, int mode)
+	{
+		this->drawNodes.push_back(node);
+		this->drawVaos.push_back(vao);
+		this->drawCounts.push_back(count);
+		this->drawModes.push_back(mode);
+	}
+
+	// Setters are no-ops when the value doesn't change, so feeding the same state every frame is free
+	void SetPosition(int node, const glm::vec3 &position)
+	{
+		if (this->positions[node] != position)
+		{
+			this->positions[node] = position;
+			this->markDirty(node);
+		}
+	}
+
+	void SetRotation(int node, const glm::quat &rotation)
+	{
+		if (this->rotations[node] != rotation)
+		{
+			this->rotations[node] = rotation;
+			this->markDirty(node);
+		}
+	}
+
+	void SetScale(int node, const glm::vec3 &scale)
+	{
+		if (this->scales[node] != scale)
+		{
+			this->scales[node] = scale;
+			this->markDirty(node);
+		}
+	}
+
+	// Recomputes the world matrices below every changed node
+	void Update()
+	{
+		if (this->dirtyNodes.empty())
+		{
+			return;
+		}
+
+		// Ascending order visits ancestors first; nodes inside an already updated range are skipped
+		std::sort(this->dirtyNodes.begin(), this->dirtyNodes.end());
+		int covered = 0;
+		for (int d : this->dirtyNodes)
+		{
+			if (d < covered)
+			{
+				continue;
+			}
+			for (int i = d; i < this->subtreeEnd[d]; i++)
+			{
+				if (this->localDirty[i])
+				{
+					this->local[i] = composeTRS(this->positions[i], this->rotations[i], this->scales[i]);
+					this->localDirty[i] = 0;
+				}
+				int p = this->parents[i];
+				this->world[i] = p == NO_PARENT ? this->local[i] : this->world[p] * this->local[i];
+			}
+			covered = this->subtreeEnd[d];
+		}
+		this->dirtyNodes.clear();
+	}
+
+	// Appends every drawable node with its cached world matrix, or only those in the subtree of 'root'
+	void Emit(DrawList &out, int root = NO_PARENT) const
+	{
+		int first = root == NO_PARENT ? 0 : root;
+		int last = root == NO_PARENT ? this->GetNodeCount() : this->subtreeEnd[root];
+		for (size_t i = 0; i < this->drawNodes.size(); i++)
+		{
+			int node = this->drawNodes[i];
+			if (node >= first && node < last)
+			{
+				out.AddProcedural(this->drawVaos[i], this->drawCounts[i], this->world[node], this->drawModes[i]);
+			}
+		}
+	}
+
+	const glm::mat4 &GetWorld(int node) const
+	{
+		return this->world[node];
+	}
+
+	int GetNodeCount() const
+	{
+		return (int)this->parents.size();
+	}
+
+private:
+	// Hierarchy
+	std::vector<int> parents;
+	std::vector<int> subtreeEnd;
+
+	// Local transforms (SoA)
+	std::vector<glm::vec3> positions;
+	std::vector<glm::quat> rotations;
+	std::vector<glm::vec3> scales;
+
+	// Cached matrices
+	std::vector<glm::mat4> local;
+	std::vector<glm::mat4> world;
+	std::vector<unsigned char> localDirty;
+	std::vector<int> dirtyNodes;
+
+	// Draw payload (SoA, only for drawable nodes)
+	std::vector<int> drawNodes;
+	std::vector<GLuint> drawVaos;
+	std::vector<GLsizei> drawCounts;
+	std::vector<int> drawModes;
+
+	void markDirty(int node)
+	{
+		if (!this->localDirty[node])
+		{
+			this->localDirty[node] = 1;
+			this->dirtyNodes.push_back(node);
+		}
+	}
+
+	// Same result as translate(position) * mat4_cast(rotation) * scale(scale), without the matrix products
+	static glm::mat4 composeTRS(const glm::vec3 &position, const glm::quat &rotation, const glm::vec3 &scale)
+	{
+		glm::mat3 r = glm::mat3_cast(rotation);
+		glm::mat4 m;
+		m[0] = glm::vec4(r[0] * scale.x, 0.0f);
+		m[1] = glm::vec4(r[1] * scale.y, 0.0f);
+		m[2] = glm::vec4(r[2] * scale.z, 0.0f);
+		m[3] = glm::vec4(position, 1.0f);
+		return m;
+	}
+};
@@ -8,13 +8,16 @@
 
 #include <GL/glew.h>
 
+#include "AsyncProgram.h"
+
 class Shader
 {
 public:
 	GLuint Program;
 	GLuint uniformColor;
-	// Constructor generates the shader on the fly
-	Shader(const GLchar *vertexPath, const GLchar *fragmentPath)
+	// Constructor submits the shader to the driver (or takes it from the program binary cache);
+	// compile errors are reported on the first Use(). 'defines' go after the #version line.
+	Shader(const GLchar *vertexPath, const GLchar *fragmentPath, const std::string &defines = "")
 	{
 		// 1. Retrieve the vertex/fragment source code from filePath
 		std::string vertexCode;
@@ -44,56 +47,22 @@ public:
 		{
 			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
 		}
-		const GLchar *vShaderCode = vertexCode.c_str();
-		const GLchar *fShaderCode = fragmentCode.c_str();
-		// 2. Compile shaders
-		GLuint vertex, fragment;
-		GLint success;
-		GLchar infoLog[512];
-		// Vertex Shader
-		vertex = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vertex, 1, &vShaderCode, NULL);
-		glCompileShader(vertex);
-		// Print compile errors if any
-		glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-		if (!success)
-		{
-			glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-			std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-		}
-		// Fragment Shader
-		fragment = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fragment, 1, &fShaderCode, NULL);
-		glCompileShader(fragment);
-		// Print compile errors if any
-		glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-		if (!success)
-		{
-			glGetShaderInfoLog(fragment, 512, NULL, infoLog);
-			std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-		}
-		// Shader Program
-		this->Program = glCreateProgram();
-		glAttachShader(this->Program, vertex);
-		glAttachShader(this->Program, fragment);
-		glLinkProgram(this->Program);
-		// Print linking errors if any
-		glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
-		if (!success)
-		{
-			glGetProgramInfoLog(this->Program, 512, NULL, infoLog);
-			std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-		}
-		//le damos la localidad de color
-		uniformColor = glGetUniformLocation(this->Program, "color");
-		// Delete the shaders as they're linked into our program now and no longer necessery
-		glDeleteShader(vertex);
-		glDeleteShader(fragment);
-
+		vertexCode = InjectDefines(vertexCode, defines);
+		fragmentCode = InjectDefines(fragmentCode, defines);
+		// 2. Submit compile and link (or take the binary cache's program); checked on first Use()
+		this->Program = this->build.Submit(vertexCode, fragmentCode, defines, vertexPath);
+		uniformColor = 0;
 	}
 	// Uses the current shader
 	void Use()
 	{
+		if (this->pendingLocations)
+		{
+			this->build.Finish();
+			//le damos la localidad de color
+			uniformColor = glGetUniformLocation(this->Program, "color");
+			this->pendingLocations = false;
+		}
 		glUseProgram(this->Program);
 	}
 
@@ -101,6 +70,10 @@ public:
 	{
 		return uniformColor;
 	}
+
+private:
+	AsyncProgram build;
+	bool pendingLocations = true;
 };
 
 #endif
\ No newline at end of file
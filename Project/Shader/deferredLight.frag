@@ -0,0 +1,38 @@
+#version 330 core
+out vec4 FragColor;
+
+flat in int Light;
+
+uniform sampler2D uGAlbedo;   // rgb = albedo, a = material (uMode / 255)
+uniform sampler2D uGNormal;
+uniform sampler2D uGDepth;
+uniform samplerBuffer uLightData;
+uniform mat4 uInvViewProjection;
+uniform vec2 uInvScreen;
+
+void main()
+{
+    vec2 uv = gl_FragCoord.xy * uInvScreen;
+    vec4 albedo = texture(uGAlbedo, uv);
+    int material = int(albedo.a * 255.0 + 0.5);
+    if (material == 0 || material == 11)   // nada, fuego o cielo
+        discard;
+
+    vec4 ndc = vec4(vec3(uv, texture(uGDepth, uv).r) * 2.0 - 1.0, 1.0);
+    vec4 world = uInvViewProjection * ndc;
+    vec3 pos = world.xyz / world.w;
+
+    vec4 posRadius = texelFetch(uLightData, 2 * Light);
+    vec3 color = texelFetch(uLightData, 2 * Light + 1).rgb;
+    vec3 toLight = posRadius.xyz - pos;
+    float dist = length(toLight);
+    if (dist >= posRadius.w)
+        discard;
+
+    // Misma atenuación que CalcPointLights en el camino forward
+    vec3 normal = texture(uGNormal, uv).xyz;
+    float diff = max(dot(normal, toLight / max(dist, 1e-4)), 0.0);
+    float atten = 1.0 / (1.0 + 0.05 * dist + 0.015 * dist * dist);
+    float window = clamp(1.0 - pow(dist / posRadius.w, 4.0), 0.0, 1.0);
+    FragColor = vec4(albedo.rgb * color * diff * atten * window * window, 1.0);
+}
\ No newline at end of file
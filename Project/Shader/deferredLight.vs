@@ -0,0 +1,16 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+// Volumen de una luz puntual: esfera de diámetro 1 escalada al radio de la luz (DeferredShading.h)
+uniform samplerBuffer uLightData;  // 2 texels por luz: posición + radio, color
+uniform mat4 viewProjection;
+
+flat out int Light;
+
+void main()
+{
+    vec4 posRadius = texelFetch(uLightData, 2 * gl_InstanceID);
+    Light = gl_InstanceID;
+    // 2.1 en lugar de 2: la esfera facetada queda por dentro de la esfera real
+    gl_Position = viewProjection * vec4(posRadius.xyz + aPos * posRadius.w * 2.1, 1.0);
+}
\ No newline at end of file
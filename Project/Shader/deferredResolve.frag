@@ -0,0 +1,10 @@
+#version 330 core
+out vec4 FragColor;
+
+uniform sampler2D uColor;   // adjunto 0 del G-buffer: la escena sin las luces puntuales, lineal
+
+void main()
+{
+    // Texel a pixel; con GL_FRAMEBUFFER_SRGB la escritura codifica igual que el pase forward
+    FragColor = texelFetch(uColor, ivec2(gl_FragCoord.xy), 0);
+}
\ No newline at end of file
@@ -1,15 +1,94 @@
 #version 330 core
-out vec4 FragColor;
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out vec4 GAlbedo;   // G-buffer del camino diferido (DeferredShading.h)
+layout (location = 2) out vec4 GNormal;
 
 in vec2 TexCoords;
+in vec3 FragPos;
+in vec3 Normal;
+in float ViewDepth;
+in vec2 Baked;         // x = oclusión ambiental (1 = abierto), y = fracción de cielo visible
+flat in float Layer;
 
 uniform sampler2D texture_diffuse1;
+// Modelos agrupados en un solo dibujo: la textura es una capa de un arreglo (TextureArrayBatch.h)
+uniform sampler2DArray texture_array;
+uniform bool uLayered;
+
+// Sombras del sol en cascadas (ShadowCascades.h)
+uniform sampler2DArrayShadow uShadowMap;
+uniform mat4  uLightVP[3];
+uniform vec3  uCascadeSplits;   // distancia de vista donde termina cada cascada
+uniform float uShadowStrength;  // 0 = sin sombras (noche)
+uniform float uShadowTexel;
+
+float ShadowVisibility(vec3 worldPos, float viewDepth)
+{
+    if (uShadowStrength <= 0.0 || viewDepth >= uCascadeSplits.z)
+        return 1.0;
+    int c = viewDepth < uCascadeSplits.x ? 0 : (viewDepth < uCascadeSplits.y ? 1 : 2);
+    vec4 p = uLightVP[c] * vec4(worldPos, 1.0);
+    vec3 uvz = p.xyz / p.w * 0.5 + 0.5;
+    if (any(lessThan(uvz, vec3(0.0))) || any(greaterThan(uvz, vec3(1.0))))
+        return 1.0;
+    // PCF 3x3 sobre la comparación por hardware
+    float lit = 0.0;
+    for (int y = -1; y <= 1; y++)
+        for (int x = -1; x <= 1; x++)
+            lit += texture(uShadowMap, vec4(uvz.xy + vec2(x, y) * uShadowTexel, float(c), uvz.z - 0.0002));
+    return mix(lit / 9.0, 1.0, smoothstep(0.9, 1.0, viewDepth / uCascadeSplits.z));
+}
+
+// Luces puntuales por cúmulo (LightClusters.h), igual que en el shader procedural
+uniform samplerBuffer  uLightData;
+uniform usamplerBuffer uClusterCells;
+uniform usamplerBuffer uLightIndices;
+uniform ivec3 uClusterGrid;
+uniform vec2  uClusterTile;
+uniform vec2  uClusterDepth;
+uniform bool  uDeferred;
+
+vec3 CalcPointLights(vec3 pos, vec3 normal, vec3 albedo)
+{
+    int z = int(log(max(ViewDepth, uClusterDepth.y) / uClusterDepth.y) * uClusterDepth.x);
+    if (z >= uClusterGrid.z)
+        return vec3(0.0);
+    ivec2 xy = clamp(ivec2(gl_FragCoord.xy * uClusterTile), ivec2(0), uClusterGrid.xy - 1);
+    uvec2 cell = texelFetch(uClusterCells, (z * uClusterGrid.y + xy.y) * uClusterGrid.x + xy.x).xy;
+
+    vec3 sum = vec3(0.0);
+    for (uint i = 0u; i < cell.y; i++)
+    {
+        int l = int(texelFetch(uLightIndices, int(cell.x + i)).r);
+        vec4 posRadius = texelFetch(uLightData, 2 * l);
+        vec3 color = texelFetch(uLightData, 2 * l + 1).rgb;
+
+        vec3 toLight = posRadius.xyz - pos;
+        float dist = length(toLight);
+        float diff = max(dot(normal, toLight / max(dist, 1e-4)), 0.0);
+        float atten = 1.0 / (1.0 + 0.05 * dist + 0.015 * dist * dist);
+        float window = clamp(1.0 - pow(dist / posRadius.w, 4.0), 0.0, 1.0);
+        sum += color * diff * atten * window * window;
+    }
+    return albedo * sum;
+}
 
 void main()
 {    
     
-  vec4   texColor= texture(texture_diffuse1, TexCoords);
+  vec4   texColor= uLayered ? texture(texture_array, vec3(TexCoords, Layer)) : texture(texture_diffuse1, TexCoords);
     if(texColor.a < 0.1)
         discard;
+    // Iluminación horneada: rincones y el interior de las chozas se oscurecen
+    texColor.rgb *= mix(0.35, 1.0, Baked.x) * mix(0.6, 1.0, Baked.y);
+    texColor.rgb *= 1.0 - uShadowStrength * (1.0 - ShadowVisibility(FragPos, ViewDepth));
+    vec3 normal = normalize(Normal);
+    if (uDeferred)
+    {
+        GAlbedo = vec4(texColor.rgb, 1.0);   // material 255: modelos
+        GNormal = vec4(normal, 0.0);
+    }
+    else
+        texColor.rgb += CalcPointLights(FragPos, normal, texColor.rgb);
     FragColor = texColor;
 }
\ No newline at end of file
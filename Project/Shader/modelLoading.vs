@@ -2,8 +2,15 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in vec2 aBaked;   // oclusión y cielo horneados (StaticBake.h); (1,1) si no hay
+layout (location = 4) in float aLayer;  // capa del arreglo de texturas (TextureArrayBatch.h)
 
 out vec2 TexCoords;
+out vec3 FragPos;
+out vec3 Normal;
+out float ViewDepth;
+out vec2 Baked;
+flat out float Layer;
 
 uniform mat4 model;
 uniform mat4 view;
@@ -12,5 +19,12 @@ uniform mat4 projection;
 void main()
 {
     TexCoords = aTexCoords;    
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    Baked = aBaked;
+    Layer = aLayer;
+    vec4 worldPos = model * vec4(aPos, 1.0);
+    vec4 viewPos = view * worldPos;
+    FragPos = worldPos.xyz;
+    Normal = mat3(transpose(inverse(model))) * aNormal;
+    ViewDepth = -viewPos.z;
+    gl_Position = projection * viewPos;
 }
\ No newline at end of file
@@ -0,0 +1,14 @@
+#version 330 core
+in vec2 TexCoords;
+flat in float Layer;
+
+uniform sampler2D texture_diffuse1;
+uniform bool alphaTest;   // modelos con hojas recortadas (árboles, maíz)
+uniform sampler2DArray texture_array;   // modelos agrupados (TextureArrayBatch.h)
+uniform bool uLayered;
+
+void main()
+{
+    if (alphaTest && (uLayered ? texture(texture_array, vec3(TexCoords, Layer)).a : texture(texture_diffuse1, TexCoords).a) < 0.1)
+        discard;
+}
\ No newline at end of file
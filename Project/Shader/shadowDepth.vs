@@ -0,0 +1,17 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 4) in float aLayer;
+
+out vec2 TexCoords;
+flat out float Layer;
+
+uniform mat4 model;
+uniform mat4 lightViewProj;
+
+void main()
+{
+    TexCoords = aTexCoords;
+    Layer = aLayer;
+    gl_Position = lightViewProj * model * vec4(aPos, 1.0);
+}
\ No newline at end of file
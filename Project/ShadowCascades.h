@@ -0,0 +1,310 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// Cascaded shadow maps for the sun. Every cascade keeps two depth layers:
+//   - static: the scene that never moves, cached and only re-rendered when the sun has rotated past a
+//     threshold or the camera has scrolled the cascade out of its cached region
+//   - frame: a copy of the static layer with the moving objects drawn on top, rebuilt every frame
+// A cascade covers a square a bit larger than the bounding sphere of its slice of the view frustum. The
+// sphere does not change size when the camera turns, so the cached map stays valid until it scrolls.
+class ShadowCascades
+{
+public:
+	static const int CASCADES = 3;
+
+	ShadowCascades() : resolution(0), staticDepth(0), frameDepth(0), previousFbo(0), created(false)
+	{
+		for (int c = 0; c < CASCADES; c++)
+		{
+			this->staticFbo[c] = this->frameFbo[c] = 0;
+			this->cascades[c].valid = false;
+			this->cascades[c].lightViewProj = glm::mat4(1.0f);
+		}
+	}
+
+	~ShadowCascades()
+	{
+		this->Destroy();
+	}
+
+	// maxDistance: view distance where shadows end. lambda blends logarithmic (1) and uniform (0) splits.
+	bool Create(int resolution = 2048, float maxDistance = 160.0f, float lambda = 0.75f)
+	{
+		this->resolution = resolution;
+		this->maxDistance = maxDistance;
+		this->lambda = lambda;
+
+		GLint callerFbo = 0;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &callerFbo);
+
+		this->staticDepth = createDepthArray(resolution);
+		this->frameDepth = createDepthArray(resolution);
+		glGenFramebuffers(CASCADES, this->staticFbo);
+		glGenFramebuffers(CASCADES, this->frameFbo);
+
+		bool complete = true;
+		for (int c = 0; c < CASCADES; c++)
+		{
+			complete &= attachLayer(this->staticFbo[c], this->staticDepth, c);
+			complete &= attachLayer(this->frameFbo[c], this->frameDepth, c);
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, callerFbo);
+		if (!complete)
+		{
+			std::cerr << "ERROR::SHADOWCASCADES::INCOMPLETE_FRAMEBUFFER" << std::endl;
+		}
+		this->created = true;
+		return complete;
+	}
+
+	void Destroy()
+	{
+		if (this->created)
+		{
+			glDeleteFramebuffers(CASCADES, this->staticFbo);
+			glDeleteFramebuffers(CASCADES, this->frameFbo);
+			glDeleteTextures(1, &this->staticDepth);
+			glDeleteTextures(1, &this->frameDepth);
+			this->created = false;
+		}
+	}
+
+	// Fits the cascades to this frame's camera and decides which static layers have to be re-rendered.
+	// A cascade that scrolled out of its cached region is always refreshed; sun rotation refreshes at
+	// most one cascade per frame so the cost of a moving sun is spread out.
+	void Update(const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &sunDir)
+	{
+		// Perspective parameters back from the projection matrix
+		float tanHalfY = 1.0f / projection[1][1];
+		float tanHalfX = 1.0f / projection[0][0];
+		float zNear = projection[3][2] / (projection[2][2] - 1.0f);
+		float zFar = std::min(this->maxDistance, projection[3][2] / (projection[2][2] + 1.0f));
+
+		glm::mat4 invView = glm::inverse(view);
+		glm::vec3 sun = glm::normalize(sunDir);
+		const float cosThreshold = cosf(glm::radians(SUN_THRESHOLD_DEGREES));
+
+		float splitNear = zNear;
+		int sunCandidate = -1;
+		for (int c = 0; c < CASCADES; c++)
+		{
+			Cascade &cc = this->cascades[c];
+			cc.refresh = false;
+
+			// Practical split scheme
+			float f = (c + 1) / (float)CASCADES;
+			float logSplit = zNear * powf(zFar / zNear, f);
+			float uniSplit = zNear + (zFar - zNear) * f;
+			float splitFar = this->lambda * logSplit + (1.0f - this->lambda) * uniSplit;
+			cc.splitFar = splitFar;
+
+			// Bounding sphere of the slice: centered on the view axis, radius from the far corner
+			float centerZ = 0.5f * (splitNear + splitFar);
+			glm::vec3 farCorner(splitFar * tanHalfX, splitFar * tanHalfY, -splitFar);
+			glm::vec3 nearCorner(splitNear * tanHalfX, splitNear * tanHalfY, -splitNear);
+			float radius = std::max(glm::length(farCorner - glm::vec3(0.0f, 0.0f, -centerZ)), glm::length(nearCorner - glm::vec3(0.0f, 0.0f, -centerZ)));
+			radius = ceilf(radius * 16.0f) / 16.0f;		// Stable against float noise
+			glm::vec3 center = glm::vec3(invView * glm::vec4(0.0f, 0.0f, -centerZ, 1.0f));
+			splitNear = splitFar;
+
+			if (!cc.valid || cc.radius != radius)
+			{
+				this->fit(cc, center, radius, sun);
+				continue;
+			}
+
+			// Scrolled: the sphere left the region the cached map covers
+			glm::vec3 ls = glm::vec3(cc.lightView * glm::vec4(center, 1.0f));
+			float margin = cc.halfExtent - cc.radius;
+			if (fabsf(ls.x - cc.centerLS.x) > margin || fabsf(ls.y - cc.centerLS.y) > margin || fabsf(ls.z - cc.centerLS.z) > CASTER_REACH * 0.5f)
+			{
+				this->fit(cc, center, radius, sun);
+				continue;
+			}
+
+			// A large jump (first frame after the night, time skip) can't wait for its turn
+			float cosSun = glm::dot(cc.sunDir, sun);
+			if (cosSun < cosf(glm::radians(SUN_FORCE_DEGREES)))
+			{
+				this->fit(cc, center, radius, sun);
+				continue;
+			}
+			if (cosSun < cosThreshold && sunCandidate < 0)
+			{
+				sunCandidate = c;
+				cc.pendingCenter = center;
+			}
+		}
+
+		if (sunCandidate >= 0)
+		{
+			Cascade &cc = this->cascades[sunCandidate];
+			this->fit(cc, cc.pendingCenter, cc.radius, sun);
+		}
+	}
+
+	// Makes the next Update() refit and re-render every cascade at once instead of spreading a sun
+	// change over several frames, for renders that must all see the same maps (poster tiles)
+	void Invalidate()
+	{
+		for (int c = 0; c < CASCADES; c++)
+		{
+			this->cascades[c].valid = false;
+		}
+	}
+
+	bool NeedsStaticRender(int c) const
+	{
+		return this->cascades[c].refresh;
+	}
+
+	// Light view-projection the cascade was last cached with; casters and receivers must both use it
+	const glm::mat4 &GetLightMatrix(int c) const
+	{
+		return this->cascades[c].lightViewProj;
+	}
+
+	// Remembers the caller's framebuffer and viewport, restored by EndPass()
+	void BeginPass()
+	{
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &this->previousFbo);
+		glGetIntegerv(GL_VIEWPORT, this->previousViewport);
+		glViewport(0, 0, this->resolution, this->resolution);
+		glDisable(GL_BLEND);
+		glPolygonOffset(2.0f, 4.0f);	// Slope-scaled bias against acne
+	}
+
+	void BeginStatic(int c)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, this->staticFbo[c]);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		this->cascades[c].valid = true;
+	}
+
+	// Copies the cached static depth into the frame layer; dynamic casters are drawn after this
+	void BeginDynamic(int c)
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, this->staticFbo[c]);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->frameFbo[c]);
+		glBlitFramebuffer(0, 0, this->resolution, this->resolution, 0, 0, this->resolution, this->resolution, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, this->frameFbo[c]);
+	}
+
+	void EndPass()
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, this->previousFbo);
+		glViewport(this->previousViewport[0], this->previousViewport[1], this->previousViewport[2], this->previousViewport[3]);
+		glEnable(GL_BLEND);
+		glPolygonOffset(1.0f, 1.0f);
+	}
+
+	// Sets the receiver uniforms (uShadowMap, uLightVP[], uCascadeSplits, uShadowStrength, uShadowTexel)
+	// on 'program', which must be in use. strength = 0 disables the lookup (night).
+	void Bind(GLuint program, float strength) const
+	{
+		glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, this->frameDepth);
+		glActiveTexture(GL_TEXTURE0);
+
+		glm::mat4 matrices[CASCADES];
+		float splits[CASCADES];
+		for (int c = 0; c < CASCADES; c++)
+		{
+			matrices[c] = this->cascades[c].lightViewProj;
+			splits[c] = this->cascades[c].valid ? this->cascades[c].splitFar : 0.0f;
+		}
+		glUniform1i(glGetUniformLocation(program, "uShadowMap"), TEXTURE_UNIT);
+		glUniformMatrix4fv(glGetUniformLocation(program, "uLightVP"), CASCADES, GL_FALSE, glm::value_ptr(matrices[0]));
+		glUniform3fv(glGetUniformLocation(program, "uCascadeSplits"), 1, splits);
+		glUniform1f(glGetUniformLocation(program, "uShadowStrength"), strength);
+		glUniform1f(glGetUniformLocation(program, "uShadowTexel"), 1.0f / std::max(this->resolution, 1));
+	}
+
+private:
+	static const int TEXTURE_UNIT = 7;
+	static constexpr float SUN_THRESHOLD_DEGREES = 1.5f;
+	static constexpr float SUN_FORCE_DEGREES = 8.0f;
+	static constexpr float CASTER_REACH = 250.0f;		// How far toward the sun casters are captured
+	static constexpr float EXTENT_MARGIN = 1.25f;		// Cached square vs. needed sphere
+
+	struct Cascade
+	{
+		bool valid;
+		bool refresh;
+		float splitFar;
+		float radius;
+		float halfExtent;
+		glm::vec3 sunDir;
+		glm::vec3 centerLS;			// Center of the cached square, light space
+		glm::vec3 pendingCenter;
+		glm::mat4 lightView;
+		glm::mat4 lightViewProj;
+	};
+
+	Cascade cascades[CASCADES];
+	int resolution;
+	float maxDistance, lambda;
+	GLuint staticDepth, frameDepth;
+	GLuint staticFbo[CASCADES], frameFbo[CASCADES];
+	GLint previousFbo;
+	GLint previousViewport[4];
+	bool created;
+
+	// Re-centers a cascade on 'center' with the current sun and flags its static layer for rendering
+	void fit(Cascade &cc, const glm::vec3 &center, float radius, const glm::vec3 &sun)
+	{
+		glm::vec3 up = fabsf(sun.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		cc.lightView = glm::lookAt(glm::vec3(0.0f), -sun, up);
+		cc.sunDir = sun;
+		cc.radius = radius;
+		cc.halfExtent = radius * EXTENT_MARGIN;
+
+		// Snap to whole texels so re-fits don't make the edges crawl
+		float texel = 2.0f * cc.halfExtent / this->resolution;
+		glm::vec3 ls = glm::vec3(cc.lightView * glm::vec4(center, 1.0f));
+		ls.x = floorf(ls.x / texel) * texel;
+		ls.y = floorf(ls.y / texel) * texel;
+		cc.centerLS = ls;
+
+		float zPad = radius + CASTER_REACH;
+		glm::mat4 ortho = glm::ortho(ls.x - cc.halfExtent, ls.x + cc.halfExtent, ls.y - cc.halfExtent, ls.y + cc.halfExtent, -(ls.z + zPad), -(ls.z - zPad));
+		cc.lightViewProj = ortho * cc.lightView;
+		cc.refresh = true;
+	}
+
+	static GLuint createDepthArray(int resolution)
+	{
+		GLuint tex;
+		glGenTextures(1, &tex);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, resolution, resolution, CASCADES, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		// Hardware comparison: sampler2DArrayShadow returns the filtered pass ratio
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		return tex;
+	}
+
+	static bool attachLayer(GLuint fbo, GLuint tex, int layer)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, tex, 0, layer);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	}
+};
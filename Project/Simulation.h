@@ -0,0 +1,113 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+
+// GL Includes
+#include <glm/glm.hpp>
+
+// Everything the fixed-rate update advances. Rendering never writes to it,
+// it only reads an interpolation between the two most recent steps.
+struct SimState
+{
+	double time = 0.0;			// Simulated seconds since start
+
+	glm::vec3 cameraPos = glm::vec3(0.0f);
+	float cameraYaw = -90.0f;	// Degrees, see Camera
+	float cameraPitch = 0.0f;
+	glm::vec3 wheelPos = glm::vec3(0.0f);
+
+	// Chihuahua on its unicycle path
+	glm::vec3 dogPos = glm::vec3(0.0f);
+	float dogYaw = 0.0f;		// Degrees
+
+	glm::vec3 ballPos = glm::vec3(0.0f);
+	float axeAngle = 0.0f;		// Radians, swing around X
+
+	// Fire
+	bool fireOn = false;
+	float fireFlicker = 1.0f;
+	float flameHeight[3] = { 0.0f, 0.0f, 0.0f };
+};
+
+inline SimState LerpState(const SimState &a, const SimState &b, float alpha)
+{
+	SimState s = b;
+	s.time = a.time + (b.time - a.time) * alpha;
+	s.cameraPos = glm::mix(a.cameraPos, b.cameraPos, alpha);
+	s.cameraYaw = glm::mix(a.cameraYaw, b.cameraYaw, alpha);
+	s.cameraPitch = glm::mix(a.cameraPitch, b.cameraPitch, alpha);
+	s.wheelPos = glm::mix(a.wheelPos, b.wheelPos, alpha);
+	s.dogPos = glm::mix(a.dogPos, b.dogPos, alpha);
+	s.dogYaw = glm::mix(a.dogYaw, b.dogYaw, alpha);
+	s.ballPos = glm::mix(a.ballPos, b.ballPos, alpha);
+	s.axeAngle = glm::mix(a.axeAngle, b.axeAngle, alpha);
+	s.fireFlicker = glm::mix(a.fireFlicker, b.fireFlicker, alpha);
+	for (int i = 0; i < 3; i++)
+	{
+		s.flameHeight[i] = glm::mix(a.flameHeight[i], b.flameHeight[i], alpha);
+	}
+	return s;
+}
+
+// Runs the update at a fixed rate independent of the frame rate and keeps the previous
+// and current state (double buffer) so frames can be rendered in between steps.
+class FixedStepSimulation
+{
+public:
+	FixedStepSimulation(double step = 1.0 / 60.0, int maxStepsPerFrame = 8) : step(step), maxSteps(maxStepsPerFrame), accumulator(0.0)
+	{
+	}
+
+	// Sets both buffers, used once before the first frame
+	void Reset(const SimState &state)
+	{
+		this->previous = state;
+		this->current = state;
+		this->accumulator = 0.0;
+	}
+
+	// Consumes the real frame time in fixed steps. update(SimState &, float dt) must only depend on
+	// the state and the input snapshot so it can later run on its own thread.
+	// Returns the number of steps taken.
+	template <typename UpdateFunc>
+	int Advance(double frameTime, UpdateFunc update)
+	{
+		// Avoid the spiral of death after a long stall (loading, window drag)
+		this->accumulator += std::min(frameTime, this->step * this->maxSteps);
+
+		int steps = 0;
+		while (this->accumulator >= this->step)
+		{
+			this->previous = this->current;
+			this->current.time += this->step;
+			update(this->current, (float)this->step);
+			this->accumulator -= this->step;
+			steps++;
+		}
+		return steps;
+	}
+
+	// State to render this frame: between the last two steps by the leftover fraction of a step
+	SimState Interpolated() const
+	{
+		return LerpState(this->previous, this->current, (float)(this->accumulator / this->step));
+	}
+
+	const SimState &GetCurrent() const
+	{
+		return this->current;
+	}
+
+	double GetStep() const
+	{
+		return this->step;
+	}
+
+private:
+	double step;
+	int maxSteps;
+	double accumulator;
+	SimState previous;
+	SimState current;
+};
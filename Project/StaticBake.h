@@ -0,0 +1,315 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Model.h"
+#include "Parallel.h"
+#include "RayTracer.h"
+
+// Per-vertex ambient occlusion and sky visibility for the static models, traced on the CPU against
+// all of them plus the ground plane (y = 0). The result only depends on the geometry, so it is cached
+// on disk keyed by a hash of every vertex, transform and setting, and traced again when any changes.
+// At runtime it is one extra vertex attribute: x = occlusion (1 = open), y = sky visibility.
+class StaticBake
+{
+public:
+	struct Settings
+	{
+		int rays = 64;				// Cosine-weighted hemisphere samples per vertex
+		float aoDistance = 2.5f;	// Occluders further than this don't darken the AO term
+	};
+
+	void Add(Model *model, const glm::mat4 &transform)
+	{
+		Entry e;
+		e.model = model;
+		e.transform = transform;
+		this->entries.push_back(e);
+	}
+
+	void Run(const std::string &cachePath)
+	{
+		this->Run(cachePath, Settings());
+	}
+
+	// World-space triangles of every added model, for other ray queries over the same static scene
+	void AddTriangles(TriangleBVH &bvh) const
+	{
+		for (const Entry &e : this->entries)
+		{
+			for (const Mesh &mesh : e.model->GetMeshes())
+			{
+				for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+				{
+					bvh.AddTriangle(glm::vec3(e.transform * glm::vec4(mesh.vertices[mesh.indices[i]].Position, 1.0f)),
+						glm::vec3(e.transform * glm::vec4(mesh.vertices[mesh.indices[i + 1]].Position, 1.0f)),
+						glm::vec3(e.transform * glm::vec4(mesh.vertices[mesh.indices[i + 2]].Position, 1.0f)));
+				}
+			}
+		}
+	}
+
+	// Loads the cache when it matches the scene, otherwise bakes and writes it. Then uploads to the meshes.
+	void Run(const std::string &cachePath, const Settings &settings)
+	{
+		this->settings = settings;
+		uint64_t key = this->sceneKey();
+		if (!this->loadCache(cachePath, key))
+		{
+			auto start = std::chrono::steady_clock::now();
+			this->bake();
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			std::cerr << "AO bake: " << this->vertexCount() << " vertices, " << this->bvh.GetTriangleCount()
+				<< " triangles, " << seconds << " s on " << WorkerCount() << " threads" << std::endl;
+			this->saveCache(cachePath, key);
+		}
+
+		// Unbaked meshes (trees, animals...) read the generic attribute: fully open, full sky
+		glVertexAttrib2f(3, 1.0f, 1.0f);
+		size_t slot = 0;
+		for (Entry &e : this->entries)
+		{
+			for (Mesh &mesh : e.model->GetMeshes())
+			{
+				mesh.SetBakedLighting(this->baked[slot++]);
+			}
+		}
+	}
+
+private:
+	static const uint32_t CACHE_VERSION = 1;
+
+	struct Entry
+	{
+		Model *model;
+		glm::mat4 transform;
+	};
+
+	struct Sample
+	{
+		glm::vec3 position, normal;
+	};
+
+	std::vector<Entry> entries;
+	Settings settings;
+	TriangleBVH bvh;
+	std::vector<std::vector<glm::vec2>> baked;	// One array per mesh, in entry order
+
+	size_t vertexCount() const
+	{
+		size_t n = 0;
+		for (const Entry &e : this->entries)
+		{
+			for (const Mesh &mesh : e.model->GetMeshes())
+			{
+				n += mesh.vertices.size();
+			}
+		}
+		return n;
+	}
+
+	uint64_t sceneKey() const
+	{
+		uint64_t h = 14695981039346656037ull;
+		auto mix = [&h](const void *data, size_t size)
+		{
+			const unsigned char *p = (const unsigned char *)data;
+			for (size_t i = 0; i < size; i++)
+			{
+				h ^= p[i];
+				h *= 1099511628211ull;
+			}
+		};
+		const uint32_t version = CACHE_VERSION;
+		mix(&version, sizeof(version));
+		mix(&this->settings.rays, sizeof(int));
+		mix(&this->settings.aoDistance, sizeof(float));
+		for (const Entry &e : this->entries)
+		{
+			mix(&e.transform, sizeof(glm::mat4));
+			for (const Mesh &mesh : e.model->GetMeshes())
+			{
+				mix(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+				mix(mesh.indices.data(), mesh.indices.size() * sizeof(GLuint));
+			}
+		}
+		return h;
+	}
+
+	void bake()
+	{
+		// World-space triangles and sample points
+		std::vector<Sample> samples;
+		for (const Entry &e : this->entries)
+		{
+			glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(e.transform)));
+			for (const Mesh &mesh : e.model->GetMeshes())
+			{
+				for (const Vertex &v : mesh.vertices)
+				{
+					Sample s;
+					s.position = glm::vec3(e.transform * glm::vec4(v.Position, 1.0f));
+					s.normal = normalMatrix * v.Normal;
+					samples.push_back(s);
+				}
+			}
+		}
+		this->bvh.Clear();
+		this->AddTriangles(this->bvh);
+		this->bvh.Build();
+
+		std::vector<glm::vec2> result(samples.size());
+		const int BLOCK = 256;
+		ParallelFor(0, (int)((samples.size() + BLOCK - 1) / BLOCK), [&](int block)
+		{
+			size_t end = std::min(samples.size(), (size_t)(block + 1) * BLOCK);
+			for (size_t i = (size_t)block * BLOCK; i < end; i++)
+			{
+				result[i] = this->traceVertex(samples[i], (uint32_t)i);
+			}
+		});
+
+		this->baked.clear();
+		size_t offset = 0;
+		for (const Entry &e : this->entries)
+		{
+			for (const Mesh &mesh : e.model->GetMeshes())
+			{
+				this->baked.emplace_back(result.begin() + offset, result.begin() + offset + mesh.vertices.size());
+				offset += mesh.vertices.size();
+			}
+		}
+	}
+
+	// Fraction of the cosine-weighted hemisphere free of geometry within aoDistance, and open to the sky
+	glm::vec2 traceVertex(const Sample &s, uint32_t seed) const
+	{
+		float len = glm::length(s.normal);
+		if (len < 1e-6f)
+		{
+			return glm::vec2(1.0f);
+		}
+		glm::vec3 n = s.normal / len;
+		glm::vec3 t = glm::normalize(std::fabs(n.y) < 0.99f ? glm::cross(n, glm::vec3(0.0f, 1.0f, 0.0f)) : glm::cross(n, glm::vec3(1.0f, 0.0f, 0.0f)));
+		glm::vec3 b = glm::cross(n, t);
+		glm::vec3 origin = s.position + n * (1e-3f + 1e-4f * glm::length(s.position));
+
+		// Stratified on a sqrt(rays) grid, jittered per vertex so neighbours don't band
+		const int side = std::max(1, (int)std::sqrt((float)this->settings.rays));
+		const int rays = side * side;
+		uint32_t state = (seed * 9781u + 0x9E3779B9u) | 1u;	// xorshift must not start at 0
+		int open = 0, sky = 0;
+		// All rays share the origin, so they go down the BVH as packets
+		for (int k0 = 0; k0 < rays; k0 += RayPacket::SIZE)
+		{
+			RayPacket packet;
+			for (int l = 0; l < RayPacket::SIZE; l++)
+			{
+				int k = k0 + l;
+				if (k >= rays)
+				{
+					packet.Set(l, origin, n, -1.0f);
+					continue;
+				}
+				float u = ((k % side) + random(state)) / side;
+				float v = ((k / side) + random(state)) / side;
+				float r = std::sqrt(u), phi = 6.2831853f * v;
+				glm::vec3 d = t * (r * std::cos(phi)) + b * (r * std::sin(phi)) + n * std::sqrt(std::max(0.0f, 1.0f - u));
+
+				// The ground plane closes the lower half of the world
+				float tGround = (d.y < 0.0f && origin.y >= 0.0f) ? -origin.y / d.y : FLT_MAX;
+				packet.Set(l, origin, d, tGround);
+			}
+			RayHit hits[RayPacket::SIZE];
+			this->bvh.IntersectPacket(packet, hits);
+			for (int l = 0; l < RayPacket::SIZE && k0 + l < rays; l++)
+			{
+				open += packet.tMax[l] > this->settings.aoDistance;
+				sky += packet.tMax[l] == FLT_MAX;
+			}
+		}
+		return glm::vec2((float)open / rays, (float)sky / rays);
+	}
+
+	static float random(uint32_t &state)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return (state >> 8) * (1.0f / 16777216.0f);
+	}
+
+	struct CacheHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		uint64_t vertices;
+	};
+
+	bool loadCache(const std::string &path, uint64_t key)
+	{
+		std::ifstream in(path, std::ios::binary);
+		if (!in)
+		{
+			return false;
+		}
+		CacheHeader h;
+		in.read((char *)&h, sizeof(h));
+		if (!in || std::memcmp(h.magic, "BAKE", 4) != 0 || h.version != CACHE_VERSION || h.key != key || h.vertices != this->vertexCount())
+		{
+			return false;
+		}
+		this->baked.clear();
+		for (const Entry &e : this->entries)
+		{
+			for (const Mesh &mesh : e.model->GetMeshes())
+			{
+				this->baked.emplace_back(mesh.vertices.size());
+				in.read((char *)this->baked.back().data(), mesh.vertices.size() * sizeof(glm::vec2));
+			}
+		}
+		return (bool)in;
+	}
+
+	void saveCache(const std::string &path, uint64_t key) const
+	{
+		std::error_code ec;
+		std::filesystem::path dir = std::filesystem::path(path).parent_path();
+		if (!dir.empty())
+		{
+			std::filesystem::create_directories(dir, ec);
+		}
+		std::ofstream out(path, std::ios::binary);
+		if (!out)
+		{
+			std::cerr << "ERROR::STATICBAKE::CANNOT_WRITE " << path << std::endl;
+			return;
+		}
+		CacheHeader h;
+		std::memcpy(h.magic, "BAKE", 4);
+		h.version = CACHE_VERSION;
+		h.key = key;
+		h.vertices = this->vertexCount();
+		out.write((const char *)&h, sizeof(h));
+		for (const std::vector<glm::vec2> &mesh : this->baked)
+		{
+			out.write((const char *)mesh.data(), mesh.size() * sizeof(glm::vec2));
+		}
+	}
+};
@@ -0,0 +1,1030 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Parallel.h"
+
+// Pieces of the strip writer: checksums, a deflate encoder whose pieces can be concatenated, PNG row
+// filters and a baseline JPEG encoder with a restart marker after every row of blocks
+namespace StripDetail
+{
+	inline uint32_t Crc32(uint32_t crc, const unsigned char *data, size_t size)
+	{
+		static const struct Table
+		{
+			uint32_t v[256];
+			Table()
+			{
+				for (uint32_t n = 0; n < 256; n++)
+				{
+					uint32_t c = n;
+					for (int k = 0; k < 8; k++)
+					{
+						c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+					}
+					this->v[n] = c;
+				}
+			}
+		} table;
+		crc = ~crc;
+		for (size_t i = 0; i < size; i++)
+		{
+			crc = table.v[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+		}
+		return ~crc;
+	}
+
+	static const uint32_t ADLER_BASE = 65521;
+
+	inline uint32_t Adler32(uint32_t adler, const unsigned char *data, size_t size)
+	{
+		uint32_t a = adler & 0xFFFF, b = adler >> 16;
+		while (size > 0)
+		{
+			// 5552 is the longest run before b can overflow 32 bits
+			size_t n = std::min<size_t>(size, 5552);
+			size -= n;
+			while (n--)
+			{
+				a += *data++;
+				b += a;
+			}
+			a %= ADLER_BASE;
+			b %= ADLER_BASE;
+		}
+		return (b << 16) | a;
+	}
+
+	// Checksum of A followed by B from the checksums of both and the length of B (as zlib does it)
+	inline uint32_t Adler32Combine(uint32_t adlerA, uint32_t adlerB, uint64_t sizeB)
+	{
+		const uint32_t rem = (uint32_t)(sizeB % ADLER_BASE);
+		uint32_t a = adlerA & 0xFFFF;
+		uint32_t b = (uint32_t)(((uint64_t)rem * a) % ADLER_BASE);
+		a += (adlerB & 0xFFFF) + ADLER_BASE - 1;
+		b += (adlerA >> 16) + (adlerB >> 16) + ADLER_BASE - rem;
+		if (a >= ADLER_BASE) a -= ADLER_BASE;
+		if (a >= ADLER_BASE) a -= ADLER_BASE;
+		if (b >= ADLER_BASE * 2) b -= ADLER_BASE * 2;
+		if (b >= ADLER_BASE) b -= ADLER_BASE;
+		return (b << 16) | a;
+	}
+
+	// Deflate bit stream, least significant bit first
+	struct DeflateBits
+	{
+		std::vector<unsigned char> &out;
+		uint64_t acc = 0;
+		int count = 0;
+
+		explicit DeflateBits(std::vector<unsigned char> &out) : out(out)
+		{
+		}
+
+		void Put(uint32_t bits, int n)
+		{
+			this->acc |= (uint64_t)bits << this->count;
+			this->count += n;
+			while (this->count >= 8)
+			{
+				this->out.push_back((unsigned char)this->acc);
+				this->acc >>= 8;
+				this->count -= 8;
+			}
+		}
+
+		void Align()
+		{
+			if (this->count > 0)
+			{
+				this->Put(0, 8 - this->count);
+			}
+		}
+	};
+
+	inline int FloorLog2(uint32_t v)
+	{
+		int l = 0;
+		while (v >>= 1)
+		{
+			l++;
+		}
+		return l;
+	}
+
+	// Fixed Huffman literal/length codes, bit-reversed for the LSB-first stream
+	struct FixedCodes
+	{
+		uint16_t code[288];
+		uint8_t length[288];
+		uint8_t distance[30];
+
+		FixedCodes()
+		{
+			for (int v = 0; v < 288; v++)
+			{
+				int len, c;
+				if (v < 144) { len = 8; c = 0x30 + v; }
+				else if (v < 256) { len = 9; c = 0x190 + v - 144; }
+				else if (v < 280) { len = 7; c = v - 256; }
+				else { len = 8; c = 0xC0 + v - 280; }
+				this->code[v] = (uint16_t)reverse(c, len);
+				this->length[v] = (uint8_t)len;
+			}
+			for (int d = 0; d < 30; d++)
+			{
+				this->distance[d] = (uint8_t)reverse(d, 5);
+			}
+		}
+
+		static int reverse(int c, int n)
+		{
+			int r = 0;
+			for (int i = 0; i < n; i++)
+			{
+				r = (r << 1) | ((c >> i) & 1);
+			}
+			return r;
+		}
+	};
+
+	// Greedy LZ77 with hash chains into one fixed-Huffman block that isn't final, followed by an empty
+	// stored block, so the output ends byte aligned (a zlib sync flush). Pieces compressed on their own
+	// can then be laid end to end, and a final empty stored block closes the stream.
+	inline void DeflatePiece(const unsigned char *data, size_t size, std::vector<unsigned char> &out)
+	{
+		static const FixedCodes codes;
+		static const int WINDOW = 32768;
+		static const int HASH_BITS = 15;
+		static const int MAX_CHAIN = 16;
+		static const int NICE_LENGTH = 128;
+
+		DeflateBits bits(out);
+		bits.Put(2, 3);		// BFINAL = 0, BTYPE = 01 (fixed codes)
+
+		std::vector<int32_t> head((size_t)1 << HASH_BITS, -1);
+		std::vector<int32_t> prev(WINDOW, -1);
+		auto hashAt = [&](size_t i)
+		{
+			uint32_t v = data[i] | (uint32_t)data[i + 1] << 8 | (uint32_t)data[i + 2] << 16;
+			return (v * 0x9E3779B1u) >> (32 - HASH_BITS);
+		};
+		auto insert = [&](size_t i)
+		{
+			uint32_t h = hashAt(i);
+			prev[i & (WINDOW - 1)] = head[h];
+			head[h] = (int32_t)i;
+		};
+		auto literal = [&](int v)
+		{
+			bits.Put(codes.code[v], codes.length[v]);
+		};
+
+		size_t i = 0;
+		while (i + 3 <= size)
+		{
+			const size_t maxLength = std::min<size_t>(258, size - i);
+			size_t best = 0, bestDistance = 0;
+			int32_t candidate = head[hashAt(i)];
+			for (int chain = MAX_CHAIN; candidate >= 0 && i - candidate <= WINDOW && chain > 0; chain--)
+			{
+				const unsigned char *a = data + candidate, *b = data + i;
+				if (a[best] == b[best])
+				{
+					size_t length = 0;
+					while (length < maxLength && a[length] == b[length])
+					{
+						length++;
+					}
+					if (length > best)
+					{
+						best = length;
+						bestDistance = i - candidate;
+						if (length >= NICE_LENGTH || length == maxLength)
+						{
+							break;
+						}
+					}
+				}
+				int32_t next = prev[candidate & (WINDOW - 1)];
+				if (next >= candidate)
+				{
+					break;	// The slot was reused by a newer position
+				}
+				candidate = next;
+			}
+
+			if (best < 3)
+			{
+				insert(i);
+				literal(data[i++]);
+				continue;
+			}
+
+			// Length: 257-264 exact, then 4 codes per power of two, 258 on its own
+			const uint32_t lv = (uint32_t)best - 3;
+			if (best == 258)
+			{
+				literal(285);
+			}
+			else if (lv < 8)
+			{
+				literal(257 + lv);
+			}
+			else
+			{
+				const int l = FloorLog2(lv);
+				literal(257 + 4 * (l - 1) + ((lv >> (l - 2)) & 3));
+				bits.Put(lv & ((1u << (l - 2)) - 1), l - 2);
+			}
+			// Distance: 0-3 exact, then 2 codes per power of two
+			const uint32_t dv = (uint32_t)bestDistance - 1;
+			if (dv < 4)
+			{
+				bits.Put(codes.distance[dv], 5);
+			}
+			else
+			{
+				const int l = FloorLog2(dv);
+				bits.Put(codes.distance[2 * l + ((dv >> (l - 1)) & 1)], 5);
+				bits.Put(dv & ((1u << (l - 1)) - 1), l - 1);
+			}
+
+			const size_t end = i + best;
+			for (; i < end; i++)
+			{
+				if (i + 3 <= size)
+				{
+					insert(i);
+				}
+			}
+		}
+		while (i < size)
+		{
+			literal(data[i++]);
+		}
+		literal(256);	// End of block
+
+		bits.Put(0, 3);	// Empty stored block: BFINAL = 0, BTYPE = 00, then LEN = 0, NLEN = ~0
+		bits.Align();
+		out.insert(out.end(), { 0x00, 0x00, 0xFF, 0xFF });
+	}
+
+	inline int Paeth(int a, int b, int c)
+	{
+		int p = a + b - c;
+		int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+		return (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+	}
+
+	// One PNG scanline of packed RGB: tries the five filters and keeps the one with the smallest sum of
+	// absolute (signed) residuals, the usual heuristic. prev is null for the first row of the image.
+	inline void FilterRow(const unsigned char *row, const unsigned char *prev, int bytes, unsigned char *out, unsigned char *scratch)
+	{
+		static const int BPP = 3;
+		int bestFilter = 0;
+		long long bestSum = -1;
+		for (int filter = 0; filter < 5; filter++)
+		{
+			long long sum = 0;
+			for (int i = 0; i < bytes; i++)
+			{
+				int a = i >= BPP ? row[i - BPP] : 0;
+				int b = prev != nullptr ? prev[i] : 0;
+				int c = (i >= BPP && prev != nullptr) ? prev[i - BPP] : 0;
+				int predicted;
+				switch (filter)
+				{
+				case 0: predicted = 0; break;
+				case 1: predicted = a; break;
+				case 2: predicted = b; break;
+				case 3: predicted = (a + b) >> 1; break;
+				default: predicted = Paeth(a, b, c); break;
+				}
+				unsigned char v = (unsigned char)(row[i] - predicted);
+				scratch[i] = v;
+				sum += std::abs((int)(signed char)v);
+			}
+			if (bestSum < 0 || sum < bestSum)
+			{
+				bestSum = sum;
+				bestFilter = filter;
+				std::memcpy(out + 1, scratch, bytes);
+			}
+		}
+		out[0] = (unsigned char)bestFilter;
+	}
+
+	// Baseline JPEG, 4:4:4, the quantization and Huffman tables of the standard's Annex K
+	struct JpegTables
+	{
+		unsigned char quantY[64], quantC[64];	// Zigzag order, as written to DQT
+		float scaleY[64], scaleC[64];			// Natural order, folds in the AAN DCT output scale
+		uint16_t dcY[12][2], dcC[12][2];		// code, length
+		uint16_t acY[256][2], acC[256][2];
+
+		static const unsigned char *ZigZag()
+		{
+			static const unsigned char z[64] = { 0,1,5,6,14,15,27,28,2,4,7,13,16,26,29,42,3,8,12,17,25,30,41,43,9,11,18,24,31,40,44,53,
+				10,19,23,32,39,45,52,54,20,22,33,38,46,51,55,60,21,34,37,47,50,56,59,61,35,36,48,49,57,58,62,63 };
+			return z;
+		}
+
+		// Code counts per length (1-16) and symbols of the four standard tables
+		static const unsigned char *Bits(int table)
+		{
+			static const unsigned char bits[4][16] = {
+				{ 0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0 },
+				{ 0,2,1,3,3,2,4,3,5,5,4,4,0,0,1,0x7d },
+				{ 0,3,1,1,1,1,1,1,1,1,1,0,0,0,0,0 },
+				{ 0,2,1,2,4,4,3,4,7,5,4,4,0,1,2,0x77 } };
+			return bits[table];
+		}
+
+		static const unsigned char *Values(int table, int &count)
+		{
+			static const unsigned char dc[12] = { 0,1,2,3,4,5,6,7,8,9,10,11 };
+			static const unsigned char acLuma[162] = {
+				0x01,0x02,0x03,0x00,0x04,0x11,0x05,0x12,0x21,0x31,0x41,0x06,0x13,0x51,0x61,0x07,0x22,0x71,0x14,0x32,0x81,0x91,0xa1,0x08,
+				0x23,0x42,0xb1,0xc1,0x15,0x52,0xd1,0xf0,0x24,0x33,0x62,0x72,0x82,0x09,0x0a,0x16,0x17,0x18,0x19,0x1a,0x25,0x26,0x27,0x28,
+				0x29,0x2a,0x34,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,0x59,
+				0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x83,0x84,0x85,0x86,0x87,0x88,0x89,
+				0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,0xb5,0xb6,
+				0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,0xe1,0xe2,
+				0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa };
+			static const unsigned char acChroma[162] = {
+				0x00,0x01,0x02,0x03,0x11,0x04,0x05,0x21,0x31,0x06,0x12,0x41,0x51,0x07,0x61,0x71,0x13,0x22,0x32,0x81,0x08,0x14,0x42,0x91,
+				0xa1,0xb1,0xc1,0x09,0x23,0x33,0x52,0xf0,0x15,0x62,0x72,0xd1,0x0a,0x16,0x24,0x34,0xe1,0x25,0xf1,0x17,0x18,0x19,0x1a,0x26,
+				0x27,0x28,0x29,0x2a,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,
+				0x59,0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x82,0x83,0x84,0x85,0x86,0x87,
+				0x88,0x89,0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,
+				0xb5,0xb6,0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,
+				0xe2,0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa };
+			count = (table & 1) ? 162 : 12;
+			return table == 1 ? acLuma : (table == 3 ? acChroma : dc);
+		}
+
+		explicit JpegTables(int quality)
+		{
+			static const int baseY[64] = { 16,11,10,16,24,40,51,61,12,12,14,19,26,58,60,55,14,13,16,24,40,57,69,56,14,17,22,29,51,87,80,62,
+				18,22,37,56,68,109,103,77,24,35,55,64,81,104,113,92,49,64,78,87,103,121,120,101,72,92,95,98,112,100,103,99 };
+			static const int baseC[64] = { 17,18,24,47,99,99,99,99,18,21,26,66,99,99,99,99,24,26,56,99,99,99,99,99,47,66,99,99,99,99,99,99,
+				99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99 };
+			static const float aan[8] = { 1.0f, 1.387039845f, 1.306562965f, 1.175875602f, 1.0f, 0.785694958f, 0.541196100f, 0.275899379f };
+
+			quality = std::min(std::max(quality, 1), 100);
+			const int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+			const unsigned char *zigzag = ZigZag();
+			for (int i = 0; i < 64; i++)
+			{
+				int qy = std::min(std::max((baseY[i] * scale + 50) / 100, 1), 255);
+				int qc = std::min(std::max((baseC[i] * scale + 50) / 100, 1), 255);
+				this->quantY[zigzag[i]] = (unsigned char)qy;
+				this->quantC[zigzag[i]] = (unsigned char)qc;
+				const float aanScale = aan[i >> 3] * aan[i & 7] * 8.0f;
+				this->scaleY[i] = 1.0f / (qy * aanScale);
+				this->scaleC[i] = 1.0f / (qc * aanScale);
+			}
+			build(0, this->dcY);
+			build(1, this->acY);
+			build(2, this->dcC);
+			build(3, this->acC);
+		}
+
+		// Canonical codes from the code counts
+		void build(int table, uint16_t (*codes)[2]) const
+		{
+			int count = 0;
+			const unsigned char *values = Values(table, count);
+			const unsigned char *bits = Bits(table);
+			int code = 0, k = 0;
+			for (int length = 1; length <= 16; length++)
+			{
+				for (int n = 0; n < bits[length - 1]; n++, k++)
+				{
+					codes[values[k]][0] = (uint16_t)code++;
+					codes[values[k]][1] = (uint16_t)length;
+				}
+				code <<= 1;
+			}
+		}
+	};
+
+	// JPEG entropy-coded bytes, most significant bit first, 0xFF stuffed with 0x00
+	struct JpegBits
+	{
+		std::vector<unsigned char> &out;
+		uint32_t acc = 0;
+		int count = 0;
+
+		explicit JpegBits(std::vector<unsigned char> &out) : out(out)
+		{
+		}
+
+		void Put(uint32_t bits, int n)
+		{
+			this->acc = (this->acc << n) | (bits & ((1u << n) - 1));
+			this->count += n;
+			while (this->count >= 8)
+			{
+				unsigned char c = (unsigned char)(this->acc >> (this->count - 8));
+				this->out.push_back(c);
+				if (c == 0xFF)
+				{
+					this->out.push_back(0);
+				}
+				this->count -= 8;
+			}
+			this->acc &= (1u << this->count) - 1;
+		}
+
+		// Pads the last byte with ones, as required before a marker
+		void Flush()
+		{
+			if (this->count > 0)
+			{
+				this->Put(0x7F, 8 - this->count);
+			}
+		}
+	};
+
+	// AAN forward DCT of 8 values at the given stride; outputs are scaled, the quantizer undoes it
+	inline void Fdct8(float *d, int s)
+	{
+		float t0 = d[0] + d[7 * s], t7 = d[0] - d[7 * s];
+		float t1 = d[s] + d[6 * s], t6 = d[s] - d[6 * s];
+		float t2 = d[2 * s] + d[5 * s], t5 = d[2 * s] - d[5 * s];
+		float t3 = d[3 * s] + d[4 * s], t4 = d[3 * s] - d[4 * s];
+
+		float t10 = t0 + t3, t13 = t0 - t3, t11 = t1 + t2, t12 = t1 - t2;
+		d[0] = t10 + t11;
+		d[4 * s] = t10 - t11;
+		float z1 = (t12 + t13) * 0.707106781f;
+		d[2 * s] = t13 + z1;
+		d[6 * s] = t13 - z1;
+
+		t10 = t4 + t5;
+		t11 = t5 + t6;
+		t12 = t6 + t7;
+		float z5 = (t10 - t12) * 0.382683433f;
+		float z2 = 0.541196100f * t10 + z5;
+		float z4 = 1.306562965f * t12 + z5;
+		float z3 = t11 * 0.707106781f;
+		float z11 = t7 + z3, z13 = t7 - z3;
+		d[5 * s] = z13 + z2;
+		d[3 * s] = z13 - z2;
+		d[s] = z11 + z4;
+		d[7 * s] = z11 - z4;
+	}
+
+	// Transforms, quantizes and codes one 8x8 block; returns its DC for the next prediction
+	inline int EncodeBlock(JpegBits &bits, float *block, const float *scale, int dc, const uint16_t (*dcCodes)[2], const uint16_t (*acCodes)[2])
+	{
+		for (int r = 0; r < 8; r++)
+		{
+			Fdct8(block + r * 8, 1);
+		}
+		for (int c = 0; c < 8; c++)
+		{
+			Fdct8(block + c, 8);
+		}
+		const unsigned char *zigzag = JpegTables::ZigZag();
+		int q[64];
+		for (int i = 0; i < 64; i++)
+		{
+			q[zigzag[i]] = (int)std::lround(block[i] * scale[i]);
+		}
+
+		// Magnitude category and the bits that follow it (one's complement for negatives)
+		auto category = [](int v, uint32_t &extra)
+		{
+			int a = v < 0 ? -v : v;
+			int n = 0;
+			while (a)
+			{
+				n++;
+				a >>= 1;
+			}
+			extra = (uint32_t)(v < 0 ? v - 1 : v);
+			return n;
+		};
+
+		uint32_t extra;
+		int n = category(q[0] - dc, extra);
+		bits.Put(dcCodes[n][0], dcCodes[n][1]);
+		if (n > 0)
+		{
+			bits.Put(extra, n);
+		}
+
+		int last = 63;
+		while (last > 0 && q[last] == 0)
+		{
+			last--;
+		}
+		int run = 0;
+		for (int i = 1; i <= last; i++)
+		{
+			if (q[i] == 0)
+			{
+				run++;
+				continue;
+			}
+			while (run >= 16)
+			{
+				bits.Put(acCodes[0xF0][0], acCodes[0xF0][1]);
+				run -= 16;
+			}
+			n = category(q[i], extra);
+			const int symbol = (run << 4) | n;
+			bits.Put(acCodes[symbol][0], acCodes[symbol][1]);
+			bits.Put(extra, n);
+			run = 0;
+		}
+		if (last < 63)
+		{
+			bits.Put(acCodes[0x00][0], acCodes[0x00][1]);	// End of block
+		}
+		return q[0];
+	}
+}
+
+// Writes a PNG or a JPEG whose rows arrive in strips, top strip first, so an image far larger than
+// memory (a tiled poster) is never held whole: only the strip being filled and the one being encoded
+// exist at a time. A background thread encodes each strip while the caller fills the next one, and
+// splits it into bands that are compressed in parallel:
+//   PNG   every band is filtered and deflated on its own, ending in a sync flush, and becomes one
+//         IDAT chunk; the bands' Adler-32 checksums are combined for the zlib trailer
+//   JPEG  a restart marker after every row of 8x8 blocks resets the DC prediction and the bit buffer,
+//         so bands of block rows are independent; strips must then be a multiple of 8 rows tall
+//         except the last one
+// Strips are RGBA (alpha is dropped) with the bottom row first, the order glReadPixels leaves them in.
+class StripImageWriter
+{
+public:
+	enum Format
+	{
+		PNG,
+		JPEG
+	};
+
+	StripImageWriter() : file(nullptr), format(PNG), width(0), height(0), quality(95), rowsQueued(0), rowsEncoded(0),
+		adler(1), bytesWritten(0), encodeMs(0.0), waitMs(0.0), next(0), stopping(false)
+	{
+	}
+
+	~StripImageWriter()
+	{
+		this->Close();
+	}
+
+	// The format follows the extension (.jpg/.jpeg, anything else is PNG)
+	bool Open(const std::string &path, int width, int height, int quality = 95)
+	{
+		this->Close();
+		this->error.clear();
+		std::string ext = path.size() >= 4 ? path.substr(path.size() - 4) : "";
+		std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return (char)tolower(c); });
+		this->format = (ext == ".jpg" || ext == "jpeg") ? JPEG : PNG;
+		const int limit = this->format == JPEG ? 65535 : 0x7FFFFFFF;
+		if (width <= 0 || height <= 0 || width > limit || height > limit)
+		{
+			this->error = "bad size " + std::to_string(width) + "x" + std::to_string(height);
+			return false;
+		}
+		this->file = fopen(path.c_str(), "wb");
+		if (this->file == nullptr)
+		{
+			this->error = "can't open " + path;
+			return false;
+		}
+		this->path = path;
+		this->width = width;
+		this->height = height;
+		this->quality = quality;
+		this->rowsQueued = this->rowsEncoded = 0;
+		this->adler = 1;
+		this->stripError.clear();
+		this->bytesWritten = 0;
+		this->encodeMs = this->waitMs = 0.0;
+		this->previousRow.clear();
+		this->next = 0;
+		for (Strip &s : this->strips)
+		{
+			s.busy = false;
+		}
+		this->writeHeader();
+		this->stopping = false;
+		this->encoder = std::thread(&StripImageWriter::encoderLoop, this);
+		return true;
+	}
+
+	// Buffer for the next 'rows' rows, width * 4 bytes each, bottom row first. Waits while the encoder
+	// still holds both buffers.
+	unsigned char *BeginStrip(int rows)
+	{
+		Strip &s = this->strips[this->next];
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			if (s.busy)
+			{
+				auto start = std::chrono::steady_clock::now();
+				this->done.wait(lock, [&s] { return !s.busy; });
+				this->waitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			}
+		}
+		s.rows = std::max(0, std::min(rows, this->height - this->rowsQueued));
+		s.y = this->rowsQueued;
+		s.pixels.resize((size_t)this->width * std::max(s.rows, 1) * 4);
+		return s.pixels.data();
+	}
+
+	// Hands the strip from BeginStrip() to the encoder
+	void EndStrip()
+	{
+		Strip &s = this->strips[this->next];
+		if (this->format == JPEG && s.rows % 8 != 0 && s.y + s.rows < this->height)
+		{
+			this->stripError = "JPEG strips must be a multiple of 8 rows";
+		}
+		this->rowsQueued += s.rows;
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			s.busy = true;
+			this->queue.push_back(this->next);
+		}
+		this->wake.notify_one();
+		this->next ^= 1;
+	}
+
+	// Waits for the encoder and finishes the file; false if anything went wrong on the way
+	bool Close()
+	{
+		if (this->file == nullptr)
+		{
+			return this->error.empty();
+		}
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->stopping = true;
+		}
+		this->wake.notify_one();
+		this->encoder.join();
+
+		if (!this->stripError.empty() && this->error.empty())
+		{
+			this->error = this->stripError;
+		}
+		if (this->rowsEncoded != this->height && this->error.empty())
+		{
+			this->error = "only " + std::to_string(this->rowsEncoded) + " of " + std::to_string(this->height) + " rows were written";
+		}
+		this->writeTrailer();
+		if (fclose(this->file) != 0 && this->error.empty())
+		{
+			this->error = "can't write " + this->path;
+		}
+		this->file = nullptr;
+		for (Strip &s : this->strips)
+		{
+			std::vector<unsigned char>().swap(s.pixels);
+		}
+		return this->error.empty();
+	}
+
+	const std::string &GetError() const
+	{
+		return this->error;
+	}
+
+	long long GetBytesWritten() const
+	{
+		return this->bytesWritten;
+	}
+
+	// Time the background encoder spent on the strips, and time the caller waited for a free buffer
+	double GetEncodeMs() const
+	{
+		return this->encodeMs;
+	}
+
+	double GetWaitMs() const
+	{
+		return this->waitMs;
+	}
+
+private:
+	struct Strip
+	{
+		std::vector<unsigned char> pixels;
+		int rows = 0;
+		int y = 0;		// First image row
+		bool busy = false;
+	};
+
+	// One independently encoded run of rows and what the ordered write needs to know about it
+	struct Band
+	{
+		std::vector<unsigned char> bytes;
+		uint32_t adler = 1;
+		uint64_t filtered = 0;
+	};
+
+	FILE *file;
+	std::string path;
+	Format format;
+	int width, height, quality;
+	int rowsQueued;				// Caller thread
+	int rowsEncoded;			// Encoder thread until Close()
+	uint32_t adler;				// PNG: zlib checksum of every filtered row so far
+	std::vector<unsigned char> previousRow;	// PNG: last row of the previous strip, packed RGB
+	long long bytesWritten;
+	double encodeMs, waitMs;
+	std::string error;			// Encoder thread until Close()
+	std::string stripError;		// Caller thread
+
+	Strip strips[2];
+	int next;					// Strip the caller fills next
+	std::deque<int> queue;
+	bool stopping;
+	std::thread encoder;
+	std::mutex mutex;
+	std::condition_variable wake;	// Encoder: a strip or the stop request arrived
+	std::condition_variable done;	// Caller: a strip was encoded
+
+	void put(const void *data, size_t size)
+	{
+		if (size > 0 && fwrite(data, 1, size, this->file) != size && this->error.empty())
+		{
+			this->error = "can't write " + this->path;
+		}
+		this->bytesWritten += (long long)size;
+	}
+
+	static void putBE32(std::vector<unsigned char> &out, uint32_t v)
+	{
+		out.push_back((unsigned char)(v >> 24));
+		out.push_back((unsigned char)(v >> 16));
+		out.push_back((unsigned char)(v >> 8));
+		out.push_back((unsigned char)v);
+	}
+
+	// Length, type, data and CRC; 'chunk' holds 8 placeholder bytes followed by the data
+	static void finishChunk(std::vector<unsigned char> &chunk, const char *type)
+	{
+		const uint32_t length = (uint32_t)(chunk.size() - 8);
+		for (int i = 0; i < 4; i++)
+		{
+			chunk[i] = (unsigned char)(length >> (24 - 8 * i));
+			chunk[4 + i] = (unsigned char)type[i];
+		}
+		putBE32(chunk, StripDetail::Crc32(0, chunk.data() + 4, chunk.size() - 4));
+	}
+
+	void writeHeader()
+	{
+		std::vector<unsigned char> out;
+		if (this->format == PNG)
+		{
+			static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+			out.assign(signature, signature + 8);
+			std::vector<unsigned char> ihdr(8);
+			putBE32(ihdr, (uint32_t)this->width);
+			putBE32(ihdr, (uint32_t)this->height);
+			ihdr.insert(ihdr.end(), { 8, 2, 0, 0, 0 });	// 8 bits, RGB, deflate, adaptive filters, no interlace
+			finishChunk(ihdr, "IHDR");
+			out.insert(out.end(), ihdr.begin(), ihdr.end());
+			std::vector<unsigned char> idat(8);
+			idat.insert(idat.end(), { 0x78, 0x01 });	// zlib header: 32K window, fastest level
+			finishChunk(idat, "IDAT");
+			out.insert(out.end(), idat.begin(), idat.end());
+		}
+		else
+		{
+			const StripDetail::JpegTables tables(this->quality);
+			const int mcus = (this->width + 7) / 8;
+			out.insert(out.end(), { 0xFF, 0xD8, 0xFF, 0xE0, 0, 16, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 });
+			out.insert(out.end(), { 0xFF, 0xDB, 0, 132, 0 });
+			out.insert(out.end(), tables.quantY, tables.quantY + 64);
+			out.push_back(1);
+			out.insert(out.end(), tables.quantC, tables.quantC + 64);
+			out.insert(out.end(), { 0xFF, 0xC0, 0, 17, 8,
+				(unsigned char)(this->height >> 8), (unsigned char)this->height, (unsigned char)(this->width >> 8), (unsigned char)this->width,
+				3, 1, 0x11, 0, 2, 0x11, 1, 3, 0x11, 1 });
+			static const unsigned char classes[4] = { 0x00, 0x10, 0x01, 0x11 };
+			for (int t = 0; t < 4; t++)
+			{
+				int count = 0;
+				const unsigned char *values = StripDetail::JpegTables::Values(t, count);
+				const int length = 2 + 1 + 16 + count;
+				out.insert(out.end(), { 0xFF, 0xC4, (unsigned char)(length >> 8), (unsigned char)length, classes[t] });
+				const unsigned char *bits = StripDetail::JpegTables::Bits(t);
+				out.insert(out.end(), bits, bits + 16);
+				out.insert(out.end(), values, values + count);
+			}
+			out.insert(out.end(), { 0xFF, 0xDD, 0, 4, (unsigned char)(mcus >> 8), (unsigned char)mcus });	// Restart every block row
+			out.insert(out.end(), { 0xFF, 0xDA, 0, 12, 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 });
+		}
+		this->put(out.data(), out.size());
+	}
+
+	void writeTrailer()
+	{
+		std::vector<unsigned char> out;
+		if (this->format == PNG)
+		{
+			std::vector<unsigned char> idat(8);
+			idat.insert(idat.end(), { 0x01, 0x00, 0x00, 0xFF, 0xFF });	// Final empty stored block
+			putBE32(idat, this->adler);
+			finishChunk(idat, "IDAT");
+			std::vector<unsigned char> iend(8);
+			finishChunk(iend, "IEND");
+			out.insert(out.end(), idat.begin(), idat.end());
+			out.insert(out.end(), iend.begin(), iend.end());
+		}
+		else
+		{
+			out.insert(out.end(), { 0xFF, 0xD9 });
+		}
+		this->put(out.data(), out.size());
+	}
+
+	void encoderLoop()
+	{
+		for (;;)
+		{
+			int index;
+			{
+				std::unique_lock<std::mutex> lock(this->mutex);
+				this->wake.wait(lock, [this] { return this->stopping || !this->queue.empty(); });
+				if (this->queue.empty())
+				{
+					return;
+				}
+				index = this->queue.front();
+				this->queue.pop_front();
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			Strip &s = this->strips[index];
+			if (s.rows > 0)
+			{
+				this->encodeStrip(s);
+			}
+			this->encodeMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				s.busy = false;
+			}
+			this->done.notify_one();
+		}
+	}
+
+	// Address of image row y (absolute) inside a bottom-up strip
+	const unsigned char *stripRow(const Strip &s, int y) const
+	{
+		return s.pixels.data() + (size_t)(s.rows - 1 - (y - s.y)) * this->width * 4;
+	}
+
+	void encodeStrip(const Strip &s)
+	{
+		// Bands of about a megabyte of pixels: plenty of them for the workers, each big enough to compress well
+		const int rowBytes = this->width * 3;
+		int bandRows = std::max(1, (1 << 20) / rowBytes);
+		if (this->format == JPEG)
+		{
+			bandRows = std::max(8, bandRows / 8 * 8);
+		}
+		const int bandCount = (s.rows + bandRows - 1) / bandRows;
+		std::vector<Band> bands(bandCount);
+		ParallelFor(0, bandCount, [&](int b)
+		{
+			const int y0 = s.y + b * bandRows;
+			const int rows = std::min(bandRows, s.y + s.rows - y0);
+			if (this->format == PNG)
+			{
+				this->encodePngBand(s, y0, rows, bands[b]);
+			}
+			else
+			{
+				this->encodeJpegBand(s, y0, rows, bands[b]);
+			}
+		}, 1);
+
+		for (const Band &band : bands)
+		{
+			if (this->format == PNG)
+			{
+				this->adler = StripDetail::Adler32Combine(this->adler, band.adler, band.filtered);
+			}
+			this->put(band.bytes.data(), band.bytes.size());
+		}
+		if (this->format == PNG)
+		{
+			const unsigned char *last = this->stripRow(s, s.y + s.rows - 1);
+			this->previousRow.resize(rowBytes);
+			for (int x = 0; x < this->width; x++)
+			{
+				std::memcpy(&this->previousRow[(size_t)x * 3], last + (size_t)x * 4, 3);
+			}
+		}
+		this->rowsEncoded += s.rows;
+	}
+
+	void encodePngBand(const Strip &s, int y0, int rows, Band &band)
+	{
+		const int rowBytes = this->width * 3;
+		std::vector<unsigned char> filtered((size_t)(rowBytes + 1) * rows);
+		std::vector<unsigned char> rgb[2] = { std::vector<unsigned char>(rowBytes), std::vector<unsigned char>(rowBytes) };
+		std::vector<unsigned char> scratch(rowBytes);
+		auto pack = [&](int y, std::vector<unsigned char> &dst)
+		{
+			const unsigned char *src = this->stripRow(s, y);
+			for (int x = 0; x < this->width; x++)
+			{
+				dst[(size_t)x * 3 + 0] = src[(size_t)x * 4 + 0];
+				dst[(size_t)x * 3 + 1] = src[(size_t)x * 4 + 1];
+				dst[(size_t)x * 3 + 2] = src[(size_t)x * 4 + 2];
+			}
+		};
+
+		// The row above the band: inside this strip, the previous strip's last row, or none at the top
+		const unsigned char *prev = nullptr;
+		if (y0 > s.y)
+		{
+			pack(y0 - 1, rgb[1]);
+			prev = rgb[1].data();
+		}
+		else if (y0 > 0)
+		{
+			prev = this->previousRow.data();
+		}
+		for (int r = 0; r < rows; r++)
+		{
+			std::vector<unsigned char> &row = rgb[r & 1];
+			pack(y0 + r, row);
+			StripDetail::FilterRow(row.data(), prev, rowBytes, &filtered[(size_t)r * (rowBytes + 1)], scratch.data());
+			prev = row.data();
+		}
+
+		band.filtered = filtered.size();
+		band.adler = StripDetail::Adler32(1, filtered.data(), filtered.size());
+		band.bytes.assign(8, 0);
+		StripDetail::DeflatePiece(filtered.data(), filtered.size(), band.bytes);
+		finishChunk(band.bytes, "IDAT");
+	}
+
+	void encodeJpegBand(const Strip &s, int y0, int rows, Band &band)
+	{
+		const StripDetail::JpegTables tables(this->quality);
+		const int blockRows = (rows + 7) / 8;
+		const int lastBlockRow = (this->height + 7) / 8 - 1;
+		band.bytes.reserve((size_t)this->width * rows / 2);
+		StripDetail::JpegBits bits(band.bytes);
+		float y[64], cb[64], cr[64];
+		for (int br = 0; br < blockRows; br++)
+		{
+			const int top = y0 + br * 8;
+			int dcY = 0, dcCb = 0, dcCr = 0;
+			for (int x0 = 0; x0 < this->width; x0 += 8)
+			{
+				// Blocks past the right or bottom edge repeat the last column / row
+				for (int r = 0, i = 0; r < 8; r++)
+				{
+					const unsigned char *src = this->stripRow(s, std::min(top + r, std::min(this->height, s.y + s.rows) - 1));
+					for (int c = 0; c < 8; c++, i++)
+					{
+						const unsigned char *p = src + (size_t)std::min(x0 + c, this->width - 1) * 4;
+						const float R = p[0], G = p[1], B = p[2];
+						y[i] = 0.29900f * R + 0.58700f * G + 0.11400f * B - 128.0f;
+						cb[i] = -0.16874f * R - 0.33126f * G + 0.50000f * B;
+						cr[i] = 0.50000f * R - 0.41869f * G - 0.08131f * B;
+					}
+				}
+				dcY = StripDetail::EncodeBlock(bits, y, tables.scaleY, dcY, tables.dcY, tables.acY);
+				dcCb = StripDetail::EncodeBlock(bits, cb, tables.scaleC, dcCb, tables.dcC, tables.acC);
+				dcCr = StripDetail::EncodeBlock(bits, cr, tables.scaleC, dcCr, tables.dcC, tables.acC);
+			}
+			bits.Flush();
+			const int blockRow = top / 8;
+			if (blockRow < lastBlockRow)
+			{
+				band.bytes.push_back(0xFF);
+				band.bytes.push_back((unsigned char)(0xD0 + (blockRow & 7)));
+			}
+		}
+	}
+};
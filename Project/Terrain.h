@@ -0,0 +1,536 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "ImageDecoder.h"
+#include "Model.h"
+#include "Parallel.h"
+
+// Heightmap terrain drawn with CDLOD (continuous distance-dependent LOD). One N x N grid mesh is reused
+// for every quadtree node: each LOD level doubles the node size and vertex spacing and covers twice the
+// distance, so the triangle count stays about the same wherever the camera is. Nodes are frustum culled
+// on the CPU against their min/max height; in the vertex shader the odd vertices of each node slide onto
+// the next coarser grid as they approach the end of their level's range, so levels meet without cracks
+// or popping. Heights come from low hills plus the tiled displacement map, and are forced back to y = 0
+// under the flat zones (everything the scene places on the ground plane).
+class Terrain
+{
+public:
+	struct Settings
+	{
+		float size = 440.0f;			// Side of the square centred on the origin
+		int resolution = 1025;			// Heightmap samples per side
+		int gridSize = 32;				// Quads per node side (even)
+		int levels = 6;					// LOD levels; the root node is the whole terrain
+		float firstRange = 40.0f;		// Distance covered by the finest level; each level doubles it
+		float morphStart = 0.66f;		// Fraction of a level's range where its vertices start to morph
+		float hillHeight = 4.0f;		// Amplitude of the low-frequency hills
+		float hillInner = 50.0f;		// Hills grow from this distance to the origin...
+		float hillOuter = 140.0f;		// ...up to full height at this one
+		float detailHeight = 0.35f;		// Amplitude of the displacement map
+		float detailTile = 12.0f;		// Metres per repetition of the displacement map
+	};
+
+	~Terrain()
+	{
+		this->Destroy();
+	}
+
+	// XZ rectangle kept at height 0; the terrain blends back over `margin` metres
+	void AddFlatZone(const glm::vec2 &min, const glm::vec2 &max, float margin)
+	{
+		FlatZone z;
+		z.min = min;
+		z.max = max;
+		z.margin = margin;
+		this->flatZones.push_back(z);
+	}
+
+	// Flat under the footprint of a model placed with `transform`
+	void AddFlatZone(Model &model, const glm::mat4 &transform, float margin)
+	{
+		glm::vec2 min(1e30f), max(-1e30f);
+		for (const Mesh &mesh : model.GetMeshes())
+		{
+			for (const Vertex &v : mesh.vertices)
+			{
+				glm::vec3 p = glm::vec3(transform * glm::vec4(v.Position, 1.0f));
+				min = glm::min(min, glm::vec2(p.x, p.z));
+				max = glm::max(max, glm::vec2(p.x, p.z));
+			}
+		}
+		if (min.x <= max.x)
+		{
+			this->AddFlatZone(min, max, margin);
+		}
+	}
+
+	bool Create(const std::string &displacementPath)
+	{
+		return this->Create(displacementPath, Settings());
+	}
+
+	// Builds the heightmap (the displacement map is optional), its min/max quadtree and the grid mesh
+	bool Create(const std::string &displacementPath, const Settings &settings)
+	{
+		this->Destroy();
+		this->settings = settings;
+		this->settings.gridSize = std::max(2, settings.gridSize & ~1);
+		this->settings.levels = std::max(1, settings.levels);
+		this->settings.resolution = std::max(2, settings.resolution);
+		this->settings.morphStart = glm::clamp(settings.morphStart, 0.1f, 0.95f);
+		// A node may reach a diagonal past its range; that must stay short of where the next
+		// level starts morphing, or the two grids wouldn't meet
+		float leafDiagonal = 1.7321f * this->nodeSize(0);
+		this->settings.firstRange = std::max(settings.firstRange, 1.05f * leafDiagonal / this->settings.morphStart);
+		this->origin = glm::vec2(-0.5f * settings.size);
+		this->step = settings.size / (this->settings.resolution - 1);
+
+		ImageDecoder::Options options;
+		options.channels = 1;
+		options.format = PixelFormat::UInt16;
+		DecodedImage disp;
+		if (!ImageDecoder::Decode(displacementPath, options, disp))
+		{
+			std::cerr << "ERROR::TERRAIN::NO_DISPLACEMENT_MAP " << displacementPath << ", using the hills only" << std::endl;
+		}
+		this->buildHeights(disp.pixels.empty() ? nullptr : disp.Data16(), disp.width, disp.height);
+		this->buildBounds();
+		this->buildMesh();
+		this->uploadHeights();
+		return true;
+	}
+
+	void Destroy()
+	{
+		if (this->heightTexture != 0)
+		{
+			glDeleteTextures(1, &this->heightTexture);
+			glDeleteBuffers(1, &this->vbo);
+			glDeleteBuffers(1, &this->ebo);
+			glDeleteVertexArrays(1, &this->vao);
+			this->heightTexture = this->vbo = this->ebo = this->vao = 0;
+		}
+	}
+
+	bool IsCreated() const
+	{
+		return this->heightTexture != 0;
+	}
+
+	// Bilinear height at a world position; 0 outside the terrain
+	float GetHeight(float x, float z) const
+	{
+		if (this->heights.empty())
+		{
+			return 0.0f;
+		}
+		const int res = this->settings.resolution;
+		float fx = (x - this->origin.x) / this->step, fz = (z - this->origin.y) / this->step;
+		if (fx < 0.0f || fz < 0.0f || fx > res - 1 || fz > res - 1)
+		{
+			return 0.0f;
+		}
+		int ix = std::min((int)fx, res - 2), iz = std::min((int)fz, res - 2);
+		float tx = fx - ix, tz = fz - iz;
+		const float *row0 = &this->heights[(size_t)iz * res + ix], *row1 = row0 + res;
+		return (row0[0] * (1.0f - tx) + row0[1] * tx) * (1.0f - tz) + (row1[0] * (1.0f - tx) + row1[1] * tx) * tz;
+	}
+
+	// Puts instances (translation in column 3) on the ground
+	void SnapToGround(std::vector<glm::mat4> &instances) const
+	{
+		for (glm::mat4 &m : instances)
+		{
+			m[3].y += this->GetHeight(m[3].x, m[3].z);
+		}
+	}
+
+	// Height sampler and mapping for the procedural shader; uTerrain stays off until Draw
+	void Bind(GLuint program, int unit) const
+	{
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_2D, this->heightTexture);
+		glActiveTexture(GL_TEXTURE0);
+		glUniform1i(glGetUniformLocation(program, "uTerrainHeight"), unit);
+		glUniform4f(glGetUniformLocation(program, "uTerrainRect"), this->origin.x, this->origin.y, 1.0f / this->step, 1.0f / this->settings.resolution);
+		glUniform1f(glGetUniformLocation(program, "uTerrainStep"), this->step);
+	}
+
+	// Selects and draws the nodes for this camera with the program in use (after Bind).
+	// Returns the nodes drawn; GetLastTriangleCount() has their triangles.
+	int Draw(GLuint program, const glm::mat4 &viewProjection, const glm::vec3 &camera)
+	{
+		this->selected.clear();
+		this->extractPlanes(viewProjection);
+		this->camera = camera;
+		const int root = this->settings.levels - 1;
+		if (!this->selectNode(root, 0, 0))
+		{
+			this->selected.push_back({ root, 0, 0, false });	// Camera beyond the coarsest range
+		}
+
+		const GLint locTerrain = glGetUniformLocation(program, "uTerrain");
+		const GLint locNode = glGetUniformLocation(program, "uTerrainNode");
+		const GLint locMorph = glGetUniformLocation(program, "uTerrainMorph");
+		glUniform1i(locTerrain, 1);
+		glBindVertexArray(this->vao);
+		this->lastTriangles = 0;
+		const int grid = this->settings.gridSize;
+		for (const Selected &s : this->selected)
+		{
+			float nodeSize = this->nodeSize(s.level);
+			float spacing = nodeSize / grid;
+			glm::vec2 range = this->morphRange(s.level);
+			glUniform4f(locNode, this->origin.x + s.x * nodeSize * (s.quarter ? 0.5f : 1.0f),
+				this->origin.y + s.z * nodeSize * (s.quarter ? 0.5f : 1.0f), spacing, 0.0f);
+			glUniform2f(locMorph, range.x, 1.0f / std::max(range.y - range.x, 1e-3f));
+			if (s.quarter)
+			{
+				glDrawElements(GL_TRIANGLES, this->quarterCount, GL_UNSIGNED_INT, (GLvoid *)(this->fullCount * sizeof(GLuint)));
+				this->lastTriangles += this->quarterCount / 3;
+			}
+			else
+			{
+				glDrawElements(GL_TRIANGLES, this->fullCount, GL_UNSIGNED_INT, 0);
+				this->lastTriangles += this->fullCount / 3;
+			}
+		}
+		glBindVertexArray(0);
+		glUniform1i(locTerrain, 0);
+		return (int)this->selected.size();
+	}
+
+	long long GetLastTriangleCount() const
+	{
+		return this->lastTriangles;
+	}
+
+private:
+	struct FlatZone
+	{
+		glm::vec2 min, max;
+		float margin;
+	};
+
+	// A node to draw: its index at `level`, or with `quarter` a child-sized quarter (index at level - 1)
+	// drawn with the density of `level` because only part of the parent is out of the finer range
+	struct Selected
+	{
+		int level;
+		int x, z;
+		bool quarter;
+	};
+
+	Settings settings;
+	glm::vec2 origin = glm::vec2(0.0f);
+	float step = 1.0f;
+	std::vector<float> heights;
+	std::vector<std::vector<glm::vec2>> bounds;	// Per level, per node: min/max height
+	std::vector<FlatZone> flatZones;
+	std::vector<Selected> selected;
+	glm::vec4 planes[6];
+	glm::vec3 camera = glm::vec3(0.0f);
+	GLuint heightTexture = 0, vao = 0, vbo = 0, ebo = 0;
+	GLsizei fullCount = 0, quarterCount = 0;
+	long long lastTriangles = 0;
+
+	int nodesPerSide(int level) const
+	{
+		return 1 << (this->settings.levels - 1 - level);
+	}
+
+	float nodeSize(int level) const
+	{
+		return this->settings.size / this->nodesPerSide(level);
+	}
+
+	float range(int level) const
+	{
+		return this->settings.firstRange * (float)(1 << level);
+	}
+
+	// Distance where vertices of `level` start morphing to the next level, and where they finish
+	glm::vec2 morphRange(int level) const
+	{
+		float end = this->range(level);
+		float start = level > 0 ? this->range(level - 1) : 0.0f;
+		return glm::vec2(start + (end - start) * this->settings.morphStart, end);
+	}
+
+	static float hash(int x, int z)
+	{
+		uint32_t h = (uint32_t)x * 374761393u + (uint32_t)z * 668265263u;
+		h = (h ^ (h >> 13)) * 1274126177u;
+		return ((h ^ (h >> 16)) & 0xFFFFFF) * (1.0f / 16777215.0f);
+	}
+
+	static float valueNoise(float x, float z)
+	{
+		int ix = (int)std::floor(x), iz = (int)std::floor(z);
+		float tx = x - ix, tz = z - iz;
+		tx = tx * tx * (3.0f - 2.0f * tx);
+		tz = tz * tz * (3.0f - 2.0f * tz);
+		float a = hash(ix, iz), b = hash(ix + 1, iz), c = hash(ix, iz + 1), d = hash(ix + 1, iz + 1);
+		return (a + (b - a) * tx) * (1.0f - tz) + (c + (d - c) * tx) * tz;
+	}
+
+	// Weight of the terrain's own shape: 0 inside a flat zone, 1 past its margin
+	float relief(float x, float z) const
+	{
+		float w = 1.0f;
+		for (const FlatZone &f : this->flatZones)
+		{
+			float dx = std::max(std::max(f.min.x - x, x - f.max.x), 0.0f);
+			float dz = std::max(std::max(f.min.y - z, z - f.max.y), 0.0f);
+			float d = std::sqrt(dx * dx + dz * dz) / std::max(f.margin, 1e-3f);
+			w *= d >= 1.0f ? 1.0f : d * d * (3.0f - 2.0f * d);
+		}
+		return w;
+	}
+
+	void buildHeights(const unsigned short *disp, int dw, int dh)
+	{
+		const int res = this->settings.resolution;
+		const Settings &s = this->settings;
+		this->heights.assign((size_t)res * res, 0.0f);
+		ParallelFor(0, res, [&](int iz)
+		{
+			for (int ix = 0; ix < res; ix++)
+			{
+				float x = this->origin.x + ix * this->step, z = this->origin.y + iz * this->step;
+				float w = this->relief(x, z);
+				if (w <= 0.0f)
+				{
+					continue;
+				}
+
+				// Three octaves of value noise, centred on 0
+				float hills = 0.0f, amplitude = 0.5f, frequency = 1.0f / 90.0f;
+				for (int o = 0; o < 3; o++)
+				{
+					hills += (valueNoise(x * frequency + 17.0f * o, z * frequency) * 2.0f - 1.0f) * amplitude;
+					amplitude *= 0.5f;
+					frequency *= 2.0f;
+				}
+				float r = std::sqrt(x * x + z * z);
+				float t = glm::clamp((r - s.hillInner) / std::max(s.hillOuter - s.hillInner, 1e-3f), 0.0f, 1.0f);
+				float h = hills * s.hillHeight * t * t * (3.0f - 2.0f * t);
+
+				if (disp != nullptr)
+				{
+					// Bilinear, wrapping like the tiled material
+					float u = x / s.detailTile * dw, v = z / s.detailTile * dh;
+					int u0 = (int)std::floor(u), v0 = (int)std::floor(v);
+					float fu = u - u0, fv = v - v0;
+					auto at = [&](int a, int b)
+					{
+						a = ((a % dw) + dw) % dw;
+						b = ((b % dh) + dh) % dh;
+						return disp[(size_t)b * dw + a] * (1.0f / 65535.0f);
+					};
+					float d = (at(u0, v0) * (1.0f - fu) + at(u0 + 1, v0) * fu) * (1.0f - fv) + (at(u0, v0 + 1) * (1.0f - fu) + at(u0 + 1, v0 + 1) * fu) * fv;
+					h += (d - 0.5f) * s.detailHeight;
+				}
+				this->heights[(size_t)iz * res + ix] = h * w;
+			}
+		});
+	}
+
+	// Min/max height of every node, leaves first
+	void buildBounds()
+	{
+		const int res = this->settings.resolution;
+		this->bounds.assign(this->settings.levels, std::vector<glm::vec2>());
+		int n = this->nodesPerSide(0);
+		this->bounds[0].resize((size_t)n * n);
+		ParallelFor(0, n, [&](int nz)
+		{
+			for (int nx = 0; nx < n; nx++)
+			{
+				int x0 = (int)((size_t)nx * (res - 1) / n), x1 = (int)((size_t)(nx + 1) * (res - 1) / n);
+				int z0 = (int)((size_t)nz * (res - 1) / n), z1 = (int)((size_t)(nz + 1) * (res - 1) / n);
+				glm::vec2 b(1e30f, -1e30f);
+				for (int z = z0; z <= z1; z++)
+				{
+					for (int x = x0; x <= x1; x++)
+					{
+						float h = this->heights[(size_t)z * res + x];
+						b.x = std::min(b.x, h);
+						b.y = std::max(b.y, h);
+					}
+				}
+				this->bounds[0][(size_t)nz * n + nx] = b;
+			}
+		});
+		for (int level = 1; level < this->settings.levels; level++)
+		{
+			int m = this->nodesPerSide(level);
+			const std::vector<glm::vec2> &child = this->bounds[level - 1];
+			std::vector<glm::vec2> &parent = this->bounds[level];
+			parent.resize((size_t)m * m);
+			for (int z = 0; z < m; z++)
+			{
+				for (int x = 0; x < m; x++)
+				{
+					glm::vec2 b(1e30f, -1e30f);
+					for (int k = 0; k < 4; k++)
+					{
+						const glm::vec2 &c = child[(size_t)(2 * z + (k >> 1)) * (2 * m) + 2 * x + (k & 1)];
+						b.x = std::min(b.x, c.x);
+						b.y = std::max(b.y, c.y);
+					}
+					parent[(size_t)z * m + x] = b;
+				}
+			}
+		}
+	}
+
+	// (N+1)^2 grid vertices in grid units; the full grid's indices, then the N/2 x N/2 corner for quarters
+	void buildMesh()
+	{
+		const int n = this->settings.gridSize;
+		std::vector<glm::vec3> vertices;
+		vertices.reserve((size_t)(n + 1) * (n + 1));
+		for (int z = 0; z <= n; z++)
+		{
+			for (int x = 0; x <= n; x++)
+			{
+				vertices.push_back(glm::vec3((float)x, 0.0f, (float)z));
+			}
+		}
+		std::vector<GLuint> indices;
+		auto addQuads = [&](int side)
+		{
+			for (int z = 0; z < side; z++)
+			{
+				for (int x = 0; x < side; x++)
+				{
+					GLuint i = (GLuint)(z * (n + 1) + x);
+					indices.push_back(i);
+					indices.push_back(i + n + 1);
+					indices.push_back(i + 1);
+					indices.push_back(i + 1);
+					indices.push_back(i + n + 1);
+					indices.push_back(i + n + 2);
+				}
+			}
+		};
+		addQuads(n);
+		this->fullCount = (GLsizei)indices.size();
+		addQuads(n / 2);
+		this->quarterCount = (GLsizei)indices.size() - this->fullCount;
+
+		glGenVertexArrays(1, &this->vao);
+		glGenBuffers(1, &this->vbo);
+		glGenBuffers(1, &this->ebo);
+		glBindVertexArray(this->vao);
+		glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), vertices.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ebo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid *)0);
+		glBindVertexArray(0);
+	}
+
+	void uploadHeights()
+	{
+		const int res = this->settings.resolution;
+		glGenTextures(1, &this->heightTexture);
+		glBindTexture(GL_TEXTURE_2D, this->heightTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, res, res, 0, GL_RED, GL_FLOAT, this->heights.data());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	// Frustum planes of a view-projection matrix (Gribb-Hartmann), pointing inwards
+	void extractPlanes(const glm::mat4 &m)
+	{
+		glm::vec4 row[4];
+		for (int i = 0; i < 4; i++)
+		{
+			row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+		}
+		for (int i = 0; i < 3; i++)
+		{
+			this->planes[2 * i] = row[3] + row[i];
+			this->planes[2 * i + 1] = row[3] - row[i];
+		}
+	}
+
+	bool inFrustum(const glm::vec3 &min, const glm::vec3 &max) const
+	{
+		for (const glm::vec4 &p : this->planes)
+		{
+			glm::vec3 v(p.x >= 0.0f ? max.x : min.x, p.y >= 0.0f ? max.y : min.y, p.z >= 0.0f ? max.z : min.z);
+			if (p.x * v.x + p.y * v.y + p.z * v.z + p.w < 0.0f)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool inRange(const glm::vec3 &min, const glm::vec3 &max, float r) const
+	{
+		glm::vec3 d = glm::max(glm::max(min - this->camera, this->camera - max), glm::vec3(0.0f));
+		return glm::dot(d, d) <= r * r;
+	}
+
+	void nodeBox(int level, int x, int z, glm::vec3 &min, glm::vec3 &max) const
+	{
+		float size = this->nodeSize(level);
+		const glm::vec2 &b = this->bounds[level][(size_t)z * this->nodesPerSide(level) + x];
+		min = glm::vec3(this->origin.x + x * size, b.x, this->origin.y + z * size);
+		max = glm::vec3(min.x + size, b.y, min.z + size);
+	}
+
+	// Classic CDLOD selection: false when the node is beyond its level's range (the parent covers it)
+	bool selectNode(int level, int x, int z)
+	{
+		glm::vec3 min, max;
+		this->nodeBox(level, x, z, min, max);
+		if (!this->inRange(min, max, this->range(level)))
+		{
+			return false;
+		}
+		if (!this->inFrustum(min, max))
+		{
+			return true;
+		}
+		if (level == 0 || !this->inRange(min, max, this->range(level - 1)))
+		{
+			this->selected.push_back({ level, x, z, false });
+			return true;
+		}
+		for (int k = 0; k < 4; k++)
+		{
+			int cx = 2 * x + (k & 1), cz = 2 * z + (k >> 1);
+			if (!this->selectNode(level - 1, cx, cz))
+			{
+				glm::vec3 cmin, cmax;
+				this->nodeBox(level - 1, cx, cz, cmin, cmax);
+				if (this->inFrustum(cmin, cmax))
+				{
+					this->selected.push_back({ level, cx, cz, true });
+				}
+			}
+		}
+		return true;
+	}
+};
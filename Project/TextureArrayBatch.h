@@ -0,0 +1,462 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <map>
+#include <vector>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "SOIL2/image_helper.h"
+#include "Model.h"
+#include "Parallel.h"
+#include "Shader.h"
+
+// Merges the meshes of several static models into one draw per texture array. Every diffuse texture is
+// resampled to a square power-of-two layer (SOIL's POT up-scale, then box halving down to maxLayerSize);
+// textures that end up with the same layer size and channel count share a GL_TEXTURE_2D_ARRAY, and the
+// layer index travels as vertex attribute 4, so the merged vertices of all their meshes draw at once.
+// Meshes whose texture can't be read back (sRGB or other formats) keep their own draw.
+class TextureArrayBatch
+{
+public:
+	static const int TEXTURE_UNIT = 5;	// texture_array in the model and shadow depth shaders
+
+	struct Settings
+	{
+		int maxLayerSize = 1024;	// Larger textures are halved down to this
+	};
+
+	~TextureArrayBatch()
+	{
+		this->Destroy();
+	}
+
+	void Add(Model *model, const glm::mat4 &transform)
+	{
+		Entry e;
+		e.model = model;
+		e.transform = transform;
+		this->entries.push_back(e);
+	}
+
+	bool Build()
+	{
+		return this->Build(Settings());
+	}
+
+	// Reads the textures back from GL, so the models must be loaded (and baked, to keep attribute 3)
+	bool Build(const Settings &settings)
+	{
+		this->Destroy();
+
+		// Distinct diffuse textures, read back once each
+		std::vector<Source> sources;
+		std::map<GLuint, int> sourceOf;
+		std::vector<Part> parts;
+		for (const Entry &e : this->entries)
+		{
+			for (Mesh &mesh : e.model->GetMeshes())
+			{
+				GLuint id = diffuseTexture(mesh);
+				std::map<GLuint, int>::iterator it = sourceOf.find(id);
+				int source;
+				if (it != sourceOf.end())
+				{
+					source = it->second;
+				}
+				else
+				{
+					source = (int)sources.size();
+					sourceOf[id] = source;
+					sources.push_back(readBack(id, settings.maxLayerSize));
+				}
+
+				if (sources[source].channels == 0 && !sources[source].missing)
+				{
+					Loose l;
+					l.mesh = &mesh;
+					l.transform = e.transform;
+					this->loose.push_back(l);
+					continue;
+				}
+				Part p;
+				p.mesh = &mesh;
+				p.transform = e.transform;
+				p.source = source;
+				parts.push_back(p);
+			}
+		}
+
+		// A missing texture samples as black; its 1x1 layer joins whichever array is largest
+		std::map<std::pair<int, int>, int> groupSize;
+		for (const Source &s : sources)
+		{
+			if (s.channels != 0 && !s.missing)
+			{
+				groupSize[std::make_pair(s.size, s.channels)]++;
+			}
+		}
+		for (Source &s : sources)
+		{
+			if (!s.missing)
+			{
+				continue;
+			}
+			std::pair<int, int> best(1, 3);
+			int count = -1;
+			for (const auto &g : groupSize)
+			{
+				if (g.second > count)
+				{
+					best = g.first;
+					count = g.second;
+				}
+			}
+			s.width = s.height = s.size = best.first;
+			s.channels = best.second;
+			s.pixels.assign((size_t)s.size * s.size * s.channels, 0);
+			for (size_t i = 3; s.channels == 4 && i < s.pixels.size(); i += 4)
+			{
+				s.pixels[i] = 255;
+			}
+		}
+
+		// Resampling is plain CPU work
+		ParallelFor(0, (int)sources.size(), [&](int i)
+		{
+			resample(sources[i]);
+		});
+
+		// Layers: one array per (size, channels), split at the layer limit
+		GLint maxLayers = 256;
+		glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+		std::map<std::pair<int, int>, std::vector<int>> groups;
+		for (int i = 0; i < (int)sources.size(); i++)
+		{
+			if (sources[i].channels != 0)
+			{
+				groups[std::make_pair(sources[i].size, sources[i].channels)].push_back(i);
+			}
+		}
+		std::vector<int> arrayOf(sources.size(), -1), layerOf(sources.size(), 0);
+		for (const auto &g : groups)
+		{
+			for (size_t first = 0; first < g.second.size(); first += maxLayers)
+			{
+				size_t count = std::min(g.second.size() - first, (size_t)maxLayers);
+				for (size_t k = 0; k < count; k++)
+				{
+					arrayOf[g.second[first + k]] = (int)this->arrays.size();
+					layerOf[g.second[first + k]] = (int)k;
+				}
+				Array a;
+				a.texture = createArray(sources, g.second, first, count);
+				a.layers = (int)count;
+				this->arrays.push_back(a);
+			}
+		}
+
+		// Merged geometry, pre-transformed, one vertex buffer per array
+		std::vector<std::vector<BatchVertex>> vertices(this->arrays.size());
+		std::vector<std::vector<GLuint>> indices(this->arrays.size());
+		for (const Part &p : parts)
+		{
+			int a = arrayOf[p.source];
+			glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(p.transform)));
+			GLuint base = (GLuint)vertices[a].size();
+			for (size_t i = 0; i < p.mesh->vertices.size(); i++)
+			{
+				const Vertex &v = p.mesh->vertices[i];
+				BatchVertex b;
+				b.position = glm::vec3(p.transform * glm::vec4(v.Position, 1.0f));
+				b.normal = normalMatrix * v.Normal;
+				b.texCoords = v.TexCoords;
+				b.baked = p.mesh->baked.size() == p.mesh->vertices.size() ? p.mesh->baked[i] : glm::vec2(1.0f);
+				b.layer = (float)layerOf[p.source];
+				vertices[a].push_back(b);
+			}
+			for (GLuint index : p.mesh->indices)
+			{
+				indices[a].push_back(base + index);
+			}
+		}
+		for (size_t a = 0; a < this->arrays.size(); a++)
+		{
+			this->arrays[a].count = (GLsizei)indices[a].size();
+			this->triangles += (GLuint)indices[a].size() / 3;
+			uploadGeometry(this->arrays[a], vertices[a], indices[a]);
+		}
+		for (const Loose &l : this->loose)
+		{
+			this->triangles += (GLuint)l.mesh->indices.size() / 3;
+		}
+		this->sourceMeshes = (GLuint)(parts.size() + this->loose.size());
+		return !this->arrays.empty();
+	}
+
+	// Draws everything with the model matrix already set to `model`
+	void Draw(Shader &shader, const glm::mat4 &model) const
+	{
+		GLint locLayered = glGetUniformLocation(shader.Program, "uLayered");
+		glUniform1i(locLayered, 1);
+		glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+		for (const Array &a : this->arrays)
+		{
+			glBindTexture(GL_TEXTURE_2D_ARRAY, a.texture);
+			glBindVertexArray(a.vao);
+			glDrawElements(GL_TRIANGLES, a.count, GL_UNSIGNED_INT, 0);
+		}
+		glBindVertexArray(0);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		glActiveTexture(GL_TEXTURE0);
+		glUniform1i(locLayered, 0);
+
+		if (this->loose.empty())
+		{
+			return;
+		}
+		GLint locModel = glGetUniformLocation(shader.Program, "model");
+		for (const Loose &l : this->loose)
+		{
+			glm::mat4 m = model * l.transform;
+			glUniformMatrix4fv(locModel, 1, GL_FALSE, glm::value_ptr(m));
+			l.mesh->Draw(shader);
+		}
+		glUniformMatrix4fv(locModel, 1, GL_FALSE, glm::value_ptr(model));
+	}
+
+	// Keeps texture_array off unit 0, where texture_diffuse1 (a different sampler type) lives
+	static void BindSampler(GLuint program)
+	{
+		glUniform1i(glGetUniformLocation(program, "texture_array"), TEXTURE_UNIT);
+	}
+
+	void Destroy()
+	{
+		for (Array &a : this->arrays)
+		{
+			glDeleteTextures(1, &a.texture);
+			glDeleteBuffers(1, &a.vbo);
+			glDeleteBuffers(1, &a.ebo);
+			glDeleteVertexArrays(1, &a.vao);
+		}
+		this->arrays.clear();
+		this->loose.clear();
+		this->triangles = 0;
+		this->sourceMeshes = 0;
+	}
+
+	// Draw calls and triangles issued by one Draw(), for the benchmark statistics
+	GLuint GetMeshCount() const
+	{
+		return (GLuint)(this->arrays.size() + this->loose.size());
+	}
+
+	GLuint GetTriangleCount() const
+	{
+		return this->triangles;
+	}
+
+	// Meshes that went in, and texture layers they ended up in
+	GLuint GetSourceMeshCount() const
+	{
+		return this->sourceMeshes;
+	}
+
+	GLuint GetLayerCount() const
+	{
+		GLuint layers = 0;
+		for (const Array &a : this->arrays)
+		{
+			layers += a.layers;
+		}
+		return layers;
+	}
+
+private:
+	struct Entry
+	{
+		Model *model;
+		glm::mat4 transform;
+	};
+
+	struct Source
+	{
+		int width = 0, height = 0, channels = 0;	// channels 0: can't be layered
+		int size = 0;								// Layer side after resampling
+		bool missing = false;						// Texture 0 (the file failed to load)
+		std::vector<unsigned char> pixels;
+	};
+
+	struct Part
+	{
+		const Mesh *mesh;
+		glm::mat4 transform;
+		int source;
+	};
+
+	struct Loose
+	{
+		Mesh *mesh;
+		glm::mat4 transform;
+	};
+
+	struct Array
+	{
+		GLuint texture = 0, vao = 0, vbo = 0, ebo = 0;
+		GLsizei count = 0;
+		int layers = 0;
+	};
+
+	struct BatchVertex
+	{
+		glm::vec3 position;
+		glm::vec3 normal;
+		glm::vec2 texCoords;
+		glm::vec2 baked;
+		float layer;
+	};
+
+	std::vector<Entry> entries;
+	std::vector<Array> arrays;
+	std::vector<Loose> loose;
+	GLuint triangles = 0;
+	GLuint sourceMeshes = 0;
+
+	static GLuint diffuseTexture(const Mesh &mesh)
+	{
+		for (const Texture &t : mesh.textures)
+		{
+			if (t.type == "texture_diffuse")
+			{
+				return t.id;
+			}
+		}
+		return 0;
+	}
+
+	static int nextPowerOfTwo(int n)
+	{
+		int p = 1;
+		while (p < n)
+		{
+			p <<= 1;
+		}
+		return p;
+	}
+
+	static Source readBack(GLuint id, int maxLayerSize)
+	{
+		Source s;
+		if (id == 0)
+		{
+			s.missing = true;
+			return s;
+		}
+		GLint w = 0, h = 0, format = 0;
+		glBindTexture(GL_TEXTURE_2D, id);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+		// DXT textures from the TextureCache come back decompressed
+		if (format == GL_RGB || format == GL_RGB8 || format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+		{
+			s.channels = 3;
+		}
+		else if (format == GL_RGBA || format == GL_RGBA8 || format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+		{
+			s.channels = 4;
+		}
+		if (s.channels == 0 || w <= 0 || h <= 0)
+		{
+			s.channels = 0;
+			glBindTexture(GL_TEXTURE_2D, 0);
+			return s;
+		}
+		s.width = w;
+		s.height = h;
+		s.size = std::min(nextPowerOfTwo(std::max(w, h)), nextPowerOfTwo(std::max(1, maxLayerSize)));
+		s.pixels.resize((size_t)w * h * s.channels);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glGetTexImage(GL_TEXTURE_2D, 0, s.channels == 4 ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, s.pixels.data());
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return s;
+	}
+
+	// Up-scale to a square power of two, then halve down to the layer size
+	static void resample(Source &s)
+	{
+		if (s.channels == 0)
+		{
+			return;
+		}
+		int side = nextPowerOfTwo(std::max(s.width, s.height));
+		if (s.width != side || s.height != side)
+		{
+			std::vector<unsigned char> square((size_t)side * side * s.channels);
+			up_scale_image(s.pixels.data(), s.width, s.height, s.channels, square.data(), side, side);
+			s.pixels.swap(square);
+		}
+		while (side > s.size)
+		{
+			std::vector<unsigned char> half((size_t)(side / 2) * (side / 2) * s.channels);
+			mipmap_image(s.pixels.data(), side, side, s.channels, half.data(), 2, 2);
+			s.pixels.swap(half);
+			side /= 2;
+		}
+		s.width = s.height = side;
+	}
+
+	static GLuint createArray(const std::vector<Source> &sources, const std::vector<int> &members, size_t first, size_t count)
+	{
+		const Source &s0 = sources[members[first]];
+		GLenum format = s0.channels == 4 ? GL_RGBA : GL_RGB;
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, s0.channels == 4 ? GL_RGBA8 : GL_RGB8, s0.size, s0.size, (GLsizei)count, 0, format, GL_UNSIGNED_BYTE, nullptr);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (size_t k = 0; k < count; k++)
+		{
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)k, s0.size, s0.size, 1, format, GL_UNSIGNED_BYTE, sources[members[first + k]].pixels.data());
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		return texture;
+	}
+
+	static void uploadGeometry(Array &a, const std::vector<BatchVertex> &vertices, const std::vector<GLuint> &indices)
+	{
+		glGenVertexArrays(1, &a.vao);
+		glGenBuffers(1, &a.vbo);
+		glGenBuffers(1, &a.ebo);
+		glBindVertexArray(a.vao);
+		glBindBuffer(GL_ARRAY_BUFFER, a.vbo);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(BatchVertex), vertices.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, a.ebo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+
+		// Same locations as Mesh (0-2) and the baked lighting (3); 4 is the layer
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(BatchVertex), (GLvoid *)offsetof(BatchVertex, position));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(BatchVertex), (GLvoid *)offsetof(BatchVertex, normal));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(BatchVertex), (GLvoid *)offsetof(BatchVertex, texCoords));
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(BatchVertex), (GLvoid *)offsetof(BatchVertex, baked));
+		glEnableVertexAttribArray(4);
+		glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(BatchVertex), (GLvoid *)offsetof(BatchVertex, layer));
+		glBindVertexArray(0);
+	}
+};
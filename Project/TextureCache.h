@@ -0,0 +1,480 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "ImageDecoder.h"
+#include "SOIL2/SOIL2.h"
+#include "SOIL2/image_DXT.h"
+#include "SOIL2/image_helper.h"
+
+// Loads image files as DXT-compressed textures through an on-disk DDS cache. The first load decodes the
+// image, box-filters a full mip chain (in linear space for sRGB textures), compresses every level with
+// SOIL's DXT1/DXT5 encoder and writes it as a DDS named after the source and a key of its path, size,
+// write time and flags; later runs upload that DDS with glCompressedTexImage2D and skip both the decode
+// and glGenerateMipmap. Without S3TC support, or when disabled, textures go up uncompressed as before.
+// With a size cap, images larger than it are decoded already reduced (see ImageDecoder).
+class TextureCache
+{
+public:
+	enum Flags
+	{
+		SRGB = 1,	// Color data: sRGB storage and linear-space mips
+		ALPHA = 2	// Keep the alpha channel (DXT5 instead of DXT1)
+	};
+
+	static TextureCache &Get()
+	{
+		static TextureCache cache;
+		return cache;
+	}
+
+	void SetDirectory(const std::string &directory)
+	{
+		this->directory = directory;
+	}
+
+	void SetEnabled(bool enabled)
+	{
+		this->enabled = enabled;
+	}
+
+	// Longest side a texture is loaded at, reduced by up to 1/8; 0 loads everything at full size
+	void SetMaxSize(int maxSize)
+	{
+		this->maxSize = maxSize;
+	}
+
+	bool IsSupported(int flags) const
+	{
+		return GLEW_EXT_texture_compression_s3tc && (!(flags & SRGB) || GLEW_EXT_texture_sRGB);
+	}
+
+	// A texture with a complete mip chain, or 0 when the image can't be read. Filtering and wrapping are
+	// left to the caller.
+	GLuint Load(const std::string &path, int flags = 0)
+	{
+		const bool compress = this->enabled && this->IsSupported(flags);
+		const int reduce = ImageDecoder::ReductionFor(path, this->maxSize);
+		std::string cached;
+		if (compress)
+		{
+			cached = this->pathOf(path, flags, reduce);
+			GLuint texture = this->loadDDS(cached, flags);
+			if (texture != 0)
+			{
+				this->hits++;
+				return texture;
+			}
+		}
+
+		const int channels = (flags & ALPHA) ? 4 : 3;
+		ImageDecoder::Options options;
+		options.channels = channels;
+		options.reduce = reduce;
+		options.srgb = (flags & SRGB) != 0;
+		DecodedImage image;
+		if (!ImageDecoder::Decode(path, options, image))
+		{
+			std::cerr << "Failed to load texture: " << path << " (" << image.error << ")" << std::endl;
+			return 0;
+		}
+		const int width = image.width, height = image.height;
+		this->uncompressedBytes += mipChainBytes((size_t)width * height * channels);
+
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		if (!compress)
+		{
+			GLenum format = channels == 4 ? GL_RGBA : GL_RGB;
+			GLenum internal = (flags & SRGB) ? (channels == 4 ? GL_SRGB8_ALPHA8 : GL_SRGB8) : format;
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexImage2D(GL_TEXTURE_2D, 0, internal, width, height, 0, format, GL_UNSIGNED_BYTE, image.pixels.data());
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glGenerateMipmap(GL_TEXTURE_2D);
+			glBindTexture(GL_TEXTURE_2D, 0);
+			this->gpuBytes += mipChainBytes((size_t)width * height * channels);
+			return texture;
+		}
+
+		// Mip chain on the CPU, each level compressed as it is made
+		std::vector<Level> levels;
+		std::vector<unsigned char> pixels = std::move(image.pixels);
+		int w = width, h = height;
+		while (true)
+		{
+			Level level;
+			level.width = w;
+			level.height = h;
+			int size = 0;
+			unsigned char *dxt = channels == 4 ? convert_image_to_DXT5(pixels.data(), w, h, channels, &size)
+			                                   : convert_image_to_DXT1(pixels.data(), w, h, channels, &size);
+			if (dxt == nullptr)
+			{
+				break;
+			}
+			level.data.assign(dxt, dxt + size);
+			free(dxt);
+			levels.push_back(std::move(level));
+			if (w == 1 && h == 1)
+			{
+				break;
+			}
+			pixels = downsample(pixels, w, h, channels, (flags & SRGB) != 0);
+			w = std::max(1, w / 2);
+			h = std::max(1, h / 2);
+		}
+		if (levels.empty())
+		{
+			glDeleteTextures(1, &texture);
+			return 0;
+		}
+
+		this->upload(levels, flags);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		this->misses++;
+		this->store(cached, levels, channels);
+		return texture;
+	}
+
+	int GetHits() const
+	{
+		return this->hits;
+	}
+
+	int GetMisses() const
+	{
+		return this->misses;
+	}
+
+	// Texture memory of everything loaded, and what the same images would take uncompressed
+	size_t GetBytes() const
+	{
+		return this->gpuBytes;
+	}
+
+	size_t GetUncompressedBytes() const
+	{
+		return this->uncompressedBytes;
+	}
+
+private:
+	static const uint32_t CACHE_VERSION = 2;
+
+	struct Level
+	{
+		int width, height;
+		std::vector<unsigned char> data;
+	};
+
+	std::string directory = "Cache/textures";
+	bool enabled = true;
+	int maxSize = 0;
+	int hits = 0, misses = 0;
+	size_t gpuBytes = 0, uncompressedBytes = 0;
+
+	TextureCache()
+	{
+	}
+
+	static uint32_t fourCC(char a, char b, char c, char d)
+	{
+		return (uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16) | ((uint32_t)d << 24);
+	}
+
+	static uint64_t fnv1a(uint64_t h, const void *data, size_t size)
+	{
+		const unsigned char *p = (const unsigned char *)data;
+		for (size_t i = 0; i < size; i++)
+		{
+			h = (h ^ p[i]) * 1099511628211ull;
+		}
+		return h;
+	}
+
+	static size_t mipChainBytes(size_t base)
+	{
+		return base + base / 3;
+	}
+
+	// Cache file of a source: its name plus a key of everything that changes the result
+	std::string pathOf(const std::string &path, int flags, int reduce) const
+	{
+		std::error_code ec;
+		uint64_t size = (uint64_t)std::filesystem::file_size(path, ec);
+		int64_t time = ec ? 0 : (int64_t)std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+		uint32_t version = CACHE_VERSION;
+
+		uint64_t h = 14695981039346656037ull;
+		h = fnv1a(h, path.data(), path.size());
+		h = fnv1a(h, &size, sizeof(size));
+		h = fnv1a(h, &time, sizeof(time));
+		h = fnv1a(h, &flags, sizeof(flags));
+		h = fnv1a(h, &version, sizeof(version));
+		if (reduce > 0)
+		{
+			// Only in the key when set, so full-size entries stay valid
+			h = fnv1a(h, &reduce, sizeof(reduce));
+		}
+		char hex[17];
+		snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)h);
+		return this->directory + "/" + std::filesystem::path(path).stem().string() + "-" + hex + ".dds";
+	}
+
+	static GLenum compressedFormat(int flags)
+	{
+		if (flags & ALPHA)
+		{
+			return (flags & SRGB) ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		}
+		return (flags & SRGB) ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	}
+
+	// Uploads the levels to the bound texture
+	void upload(const std::vector<Level> &levels, int flags)
+	{
+		GLenum format = compressedFormat(flags);
+		for (size_t i = 0; i < levels.size(); i++)
+		{
+			const Level &l = levels[i];
+			glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)i, format, l.width, l.height, 0, (GLsizei)l.data.size(), l.data.data());
+			this->gpuBytes += l.data.size();
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+	}
+
+	// A texture from a cached DDS, or 0 when there is none or it doesn't match what was asked for
+	GLuint loadDDS(const std::string &file, int flags)
+	{
+		std::ifstream in(file, std::ios::binary);
+		if (!in)
+		{
+			return 0;
+		}
+		std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		in.close();
+
+		DDS_header header;
+		const int blockBytes = (flags & ALPHA) ? 16 : 8;
+		const uint32_t expected = (flags & ALPHA) ? fourCC('D', 'X', 'T', '5') : fourCC('D', 'X', 'T', '1');
+		bool valid = bytes.size() >= sizeof(header);
+		if (valid)
+		{
+			std::memcpy(&header, bytes.data(), sizeof(header));
+			valid = header.dwMagic == fourCC('D', 'D', 'S', ' ') && header.dwSize == 124 &&
+				(header.sPixelFormat.dwFlags & DDPF_FOURCC) && header.sPixelFormat.dwFourCC == expected &&
+				header.dwWidth > 0 && header.dwHeight > 0 && header.dwMipMapCount > 0 && header.dwMipMapCount <= 32;
+		}
+
+		std::vector<Level> levels;
+		size_t offset = sizeof(header);
+		int w = valid ? (int)header.dwWidth : 0, h = valid ? (int)header.dwHeight : 0;
+		for (uint32_t i = 0; valid && i < header.dwMipMapCount; i++)
+		{
+			size_t size = (size_t)((w + 3) / 4) * ((h + 3) / 4) * blockBytes;
+			if (offset + size > bytes.size())
+			{
+				valid = false;
+				break;
+			}
+			Level level;
+			level.width = w;
+			level.height = h;
+			level.data.assign(bytes.begin() + offset, bytes.begin() + offset + size);
+			levels.push_back(std::move(level));
+			offset += size;
+			w = std::max(1, w / 2);
+			h = std::max(1, h / 2);
+		}
+		if (!valid)
+		{
+			std::cerr << "ERROR::TEXTURECACHE::INVALID_ENTRY " << file << ", compressing again" << std::endl;
+			std::error_code ec;
+			std::filesystem::remove(file, ec);
+			return 0;
+		}
+
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		this->upload(levels, flags);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		this->uncompressedBytes += mipChainBytes((size_t)header.dwWidth * header.dwHeight * ((flags & ALPHA) ? 4 : 3));
+		return texture;
+	}
+
+	// Standard DDS with a mip chain, so other tools (and SOIL_load_OGL_texture) can read it too
+	void store(const std::string &file, const std::vector<Level> &levels, int channels)
+	{
+		DDS_header header;
+		std::memset(&header, 0, sizeof(header));
+		header.dwMagic = fourCC('D', 'D', 'S', ' ');
+		header.dwSize = 124;
+		header.dwFlags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_LINEARSIZE | DDSD_MIPMAPCOUNT;
+		header.dwWidth = levels[0].width;
+		header.dwHeight = levels[0].height;
+		header.dwPitchOrLinearSize = (unsigned int)levels[0].data.size();
+		header.dwMipMapCount = (unsigned int)levels.size();
+		header.sPixelFormat.dwSize = 32;
+		header.sPixelFormat.dwFlags = DDPF_FOURCC;
+		header.sPixelFormat.dwFourCC = channels == 4 ? fourCC('D', 'X', 'T', '5') : fourCC('D', 'X', 'T', '1');
+		header.sCaps.dwCaps1 = DDSCAPS_TEXTURE | DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+
+		// Written under a temporary name and renamed, so an interrupted run never leaves half a file
+		std::error_code ec;
+		std::filesystem::create_directories(this->directory, ec);
+		std::string temporary = file + ".tmp";
+		{
+			std::ofstream out(temporary, std::ios::binary);
+			if (!out)
+			{
+				std::cerr << "ERROR::TEXTURECACHE::CANNOT_WRITE " << file << std::endl;
+				return;
+			}
+			out.write((const char *)&header, sizeof(header));
+			for (const Level &l : levels)
+			{
+				out.write((const char *)l.data.data(), l.data.size());
+			}
+		}
+		std::filesystem::rename(temporary, file, ec);
+		if (ec)
+		{
+			std::filesystem::remove(temporary, ec);
+		}
+	}
+
+	// Next mip level: 2x2 box filter (a 1-texel edge averages what it has). sRGB color channels are
+	// averaged in linear space so the distant mips don't darken; alpha is always linear.
+	static std::vector<unsigned char> downsample(const std::vector<unsigned char> &src, int w, int h, int channels, bool srgb)
+	{
+		int nw = std::max(1, w / 2), nh = std::max(1, h / 2);
+		std::vector<unsigned char> dst((size_t)nw * nh * channels);
+		if (srgb)
+		{
+			mipmap_image_sRGB(src.data(), w, h, channels, dst.data(), 2, 2);
+		}
+		else
+		{
+			mipmap_image(src.data(), w, h, channels, dst.data(), 2, 2);
+		}
+		return dst;
+	}
+};
+
+// DXT compression speed over the textures of a directory (--bench-dxt on the command line): the scalar
+// single-thread compressor against the SIMD kernels and the threaded one, best of 3 over the whole set.
+// Every configuration must produce the scalar path's bytes; a texture that doesn't is reported.
+inline void RunDXTBenchmark(const std::string &directory)
+{
+	struct Image
+	{
+		std::string name;
+		int width, height, channels;
+		std::vector<unsigned char> pixels;
+		std::vector<unsigned char> reference;
+	};
+	std::vector<Image> images;
+	double pixels = 0.0;
+	std::error_code ec;
+	for (const auto &entry : std::filesystem::directory_iterator(directory, ec))
+	{
+		std::string ext = entry.path().extension().string();
+		std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+		if (ext != ".jpg" && ext != ".jpeg" && ext != ".png" && ext != ".tga" && ext != ".bmp")
+		{
+			continue;
+		}
+		Image image;
+		DecodedImage decoded;
+		if (!ImageDecoder::Decode(entry.path().string(), ImageDecoder::Options(), decoded))
+		{
+			continue;
+		}
+		image.name = entry.path().filename().string();
+		image.width = decoded.width;
+		image.height = decoded.height;
+		image.channels = decoded.channels;
+		image.pixels = std::move(decoded.pixels);
+		pixels += (double)image.width * image.height;
+		images.push_back(std::move(image));
+	}
+	if (images.empty())
+	{
+		printf("No textures in %s\n", directory.c_str());
+		return;
+	}
+
+	// Textures with alpha go to DXT5, like TextureCache::ALPHA
+	auto compress = [](const Image &image, std::vector<unsigned char> &out)
+	{
+		int size = 0;
+		unsigned char *dxt = (image.channels == 2 || image.channels == 4)
+			? convert_image_to_DXT5(image.pixels.data(), image.width, image.height, image.channels, &size)
+			: convert_image_to_DXT1(image.pixels.data(), image.width, image.height, image.channels, &size);
+		out.assign(dxt, dxt + size);
+		free(dxt);
+	};
+
+	typedef std::chrono::high_resolution_clock Clock;
+	const int level = get_DXT_simd_level();
+	const char *kernels[3] = { "scalar", "SSE2", "AVX2" };
+	printf("DXT compression, %zu textures, %.1f Mpixel (best of 3, %u hardware threads)\n",
+		images.size(), pixels * 1e-6, std::thread::hardware_concurrency());
+
+	double scalarMs = 0.0;
+	std::vector<unsigned char> out;
+	for (int simd = 0; simd <= level + 1; simd++)
+	{
+		// One thread per kernel, then the best kernel on every core
+		int kernel = std::min(simd, level), threads = simd <= level ? 1 : 0;
+		set_DXT_compression_options(kernel, threads);
+		double best = 1e30;
+		int mismatches = 0;
+		for (int r = 0; r < 3; r++)
+		{
+			double ms = 0.0;
+			for (Image &image : images)
+			{
+				auto t0 = Clock::now();
+				compress(image, out);
+				ms += std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+				if (simd == 0 && r == 0)
+				{
+					image.reference = out;
+				}
+				else if (r == 0 && out != image.reference)
+				{
+					printf("  (%s differs from the scalar output)\n", image.name.c_str());
+					mismatches++;
+				}
+			}
+			best = std::min(best, ms);
+		}
+		if (simd == 0)
+		{
+			scalarMs = best;
+		}
+		char name[32];
+		snprintf(name, sizeof(name), "%s, %s", kernels[kernel], threads == 1 ? "1 thread" : "all threads");
+		printf("  %-20s %9.1f ms %8.1f Mpix/s  x%.2f%s\n", name, best, pixels * 1e-3 / best, scalarMs / best,
+			simd == 0 ? "" : (mismatches == 0 ? "  identical" : "  DIFFERENT"));
+	}
+	set_DXT_compression_options(2, 0);
+}